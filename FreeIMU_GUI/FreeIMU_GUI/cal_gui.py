@@ -244,10 +244,13 @@ class FreeIMUCal(QMainWindow, Ui_FreeIMUCal):
     # read file and run calibration algorithm
     (self.acc_offset, self.acc_scale) = cal_lib.calibrate_from_file(acc_file_name)
     (self.magn_offset, self.magn_scale) = cal_lib.calibrate_from_file(magn_file_name)
+    # full ellipsoid fit, its offsets replace the ones above
+    (self.acc_offset, self.acc_matrix) = cal_lib.calibrate_ellipsoid_from_file(acc_file_name)
+    (self.magn_offset, self.magn_matrix) = cal_lib.calibrate_ellipsoid_from_file(magn_file_name)
     
-    # map floats into integers
-    self.acc_offset = map(int, self.acc_offset)
-    self.magn_offset = map(int, self.magn_offset)
+    # round floats to the integers calibration.h and the EEPROM hold
+    self.acc_offset = [int(round(v)) for v in self.acc_offset]
+    self.magn_offset = [int(round(v)) for v in self.magn_offset]
     
     # show calibrated tab
     self.tabWidget.setCurrentIndex(1)
@@ -271,8 +274,8 @@ class FreeIMUCal(QMainWindow, Ui_FreeIMUCal):
     self.calRes_magn_SCz.setText(str(self.magn_scale[2]))
     
     # compute calibrated data
-    self.acc_cal_data = cal_lib.compute_calibrate_data(self.acc_data, self.acc_offset, self.acc_scale)
-    self.magn_cal_data = cal_lib.compute_calibrate_data(self.magn_data, self.magn_offset, self.magn_scale)
+    self.acc_cal_data = cal_lib.compute_calibrate_data_matrix(self.acc_data, self.acc_offset, self.acc_matrix)
+    self.magn_cal_data = cal_lib.compute_calibrate_data_matrix(self.magn_data, self.magn_offset, self.magn_matrix)
     
     # populate 2D graphs with calibrated data
     self.accXY_cal.plot(x = self.acc_cal_data[0], y = self.acc_cal_data[1], clear = True, pen='r')
@@ -310,22 +313,30 @@ class FreeIMUCal(QMainWindow, Ui_FreeIMUCal):
 
 
 #define CALIBRATION_H
+#define CALIBRATION_MATRICES
 
 const int acc_off_x = %d;
 const int acc_off_y = %d;
 const int acc_off_z = %d;
-const float acc_scale_x = %f;
-const float acc_scale_y = %f;
-const float acc_scale_z = %f;
+const float acc_scale_x = 1;
+const float acc_scale_y = 1;
+const float acc_scale_z = 1;
 
 const int magn_off_x = %d;
 const int magn_off_y = %d;
 const int magn_off_z = %d;
-const float magn_scale_x = %f;
-const float magn_scale_y = %f;
-const float magn_scale_z = %f;
+const float magn_scale_x = 1;
+const float magn_scale_y = 1;
+const float magn_scale_z = 1;
+
+// calibrated = mat * (raw - off), row major
+const float acc_mat[9] = { %s };
+const float magn_mat[9] = { %s };
+const float gyro_mat[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
 """
-    calibration_h_text = text % (self.acc_offset[0], self.acc_offset[1], self.acc_offset[2], self.acc_scale[0], self.acc_scale[1], self.acc_scale[2], self.magn_offset[0], self.magn_offset[1], self.magn_offset[2], self.magn_scale[0], self.magn_scale[1], self.magn_scale[2])
+    acc_mat = ", ".join(["%.9g" % v for row in self.acc_matrix for v in row])
+    magn_mat = ", ".join(["%.9g" % v for row in self.magn_matrix for v in row])
+    calibration_h_text = text % (self.acc_offset[0], self.acc_offset[1], self.acc_offset[2], self.magn_offset[0], self.magn_offset[1], self.magn_offset[2], acc_mat, magn_mat)
     
     calibration_h_folder = QFileDialog.getExistingDirectory(self, "Select the Folder to which save the calibration.h file")
     calibration_h_file = open(os.path.join(str(calibration_h_folder), calibration_h_file_name), "w")
@@ -335,13 +346,14 @@ const float magn_scale_z = %f;
     self.set_status("Calibration saved to: " + str(calibration_h_folder) + calibration_h_file_name + " .\nRecompile and upload the program using the FreeIMU library to your microcontroller.")
   
   def save_calibration_eeprom(self):
-    self.ser.write("c")
-    # pack data into a string 
+    self.ser.write("m")
+    # pack data into a string, layout of FreeIMU::calStore
     offsets = pack('<hhhhhh', self.acc_offset[0], self.acc_offset[1], self.acc_offset[2], self.magn_offset[0], self.magn_offset[1], self.magn_offset[2])
-    scales = pack('<ffffff', self.acc_scale[0], self.acc_scale[1], self.acc_scale[2], self.magn_scale[0], self.magn_scale[1], self.magn_scale[2])
+    gyro_matrix = [[1, 0, 0], [0, 1, 0], [0, 0, 1]]
+    matrices = pack('<' + 'f' * 27, *[v for m in (self.acc_matrix, self.magn_matrix, gyro_matrix) for row in m for v in row])
     # transmit to microcontroller
     self.ser.write(offsets)
-    self.ser.write(scales)
+    self.ser.write(matrices)
     self.set_status("Calibration saved to microcontroller EEPROM.")
     # debug written values to console
     print "Calibration values read back from EEPROM:"
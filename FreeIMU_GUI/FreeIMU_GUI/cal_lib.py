@@ -56,7 +56,35 @@ def calibrate(x, y, z):
   return (offsets, scale)
 
 
-def calibrate_from_file(file_name):
+def calibrate_ellipsoid(x, y, z):
+  """
+  General ellipsoid fit: offsets and a symmetric 3x3 matrix M with |M (v - offsets)| = 1
+  for the samples v, for soft iron and cross axis sensitivity where calibrate() only
+  fits the axis scales.  FreeIMU applies M in place of the scales (FreeIMU::calFold).
+  """
+  # scale the samples to about 1 so the quadratic terms do not swamp the fit
+  s = float(max(numpy.max(numpy.abs(x)), numpy.max(numpy.abs(y)), numpy.max(numpy.abs(z))))
+  x = x / s
+  y = y / s
+  z = z / s
+  # a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+  H = numpy.array([x**2, y**2, z**2, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z])
+  H = numpy.transpose(H)
+  (X, residues, rank, shape) = linalg.lstsq(H, numpy.ones([len(x)]))
+  
+  A = numpy.array([[X[0], X[3], X[4]], [X[3], X[1], X[5]], [X[4], X[5], X[2]]])
+  center = -linalg.solve(A, X[6:9])
+  # (v - center)' A (v - center) = k, M = sqrt(A / k)
+  k = 1 + numpy.dot(center, numpy.dot(A, center))
+  (w, V) = linalg.eigh(A / k)
+  M = numpy.dot(V, numpy.dot(numpy.diag(numpy.sqrt(w)), V.T)) / s
+  
+  offsets = map(numpy.asscalar, center * s)
+  matrix = [map(numpy.asscalar, row) for row in M]
+  return (offsets, matrix)
+
+
+def read_samples(file_name):
   samples_f = open(file_name, 'r')
   samples_x = []
   samples_y = []
@@ -68,7 +96,15 @@ def calibrate_from_file(file_name):
       samples_y.append(int(reading[1]))
       samples_z.append(int(reading[2]))
 
-  return calibrate(numpy.array(samples_x), numpy.array(samples_y), numpy.array(samples_z))
+  return (numpy.array(samples_x), numpy.array(samples_y), numpy.array(samples_z))
+
+
+def calibrate_from_file(file_name):
+  return calibrate(*read_samples(file_name))
+
+
+def calibrate_ellipsoid_from_file(file_name):
+  return calibrate_ellipsoid(*read_samples(file_name))
 
 
 def compute_calibrate_data(data, offsets, scale):
@@ -80,6 +116,15 @@ def compute_calibrate_data(data, offsets, scale):
   return output
 
 
+def compute_calibrate_data_matrix(data, offsets, matrix):
+  output = [[], [], []]
+  for i in range(len(data[0])):
+    v = [data[0][i] - offsets[0], data[1][i] - offsets[1], data[2][i] - offsets[2]]
+    for r in range(3):
+      output[r].append(matrix[r][0] * v[0] + matrix[r][1] * v[1] + matrix[r][2] * v[2])
+  return output
+
+
 if __name__ == "__main__":
   
   print "Calibrating from acc.txt"
@@ -95,3 +140,17 @@ if __name__ == "__main__":
   print offsets
   print "Scales:"
   print scale
+  
+  print "Ellipsoid fit of acc.txt"
+  (offsets, matrix) = calibrate_ellipsoid_from_file("acc.txt")
+  print "Offsets:"
+  print offsets
+  print "Matrix:"
+  print matrix
+  
+  print "Ellipsoid fit of magn.txt"
+  (offsets, matrix) = calibrate_ellipsoid_from_file("magn.txt")
+  print "Offsets:"
+  print offsets
+  print "Matrix:"
+  print matrix
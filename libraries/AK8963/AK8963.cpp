@@ -40,6 +40,7 @@ THE SOFTWARE.
  */
 AK8963::AK8963() {
     devAddr = AK8963_DEFAULT_ADDRESS;
+    asyncCount = 0;
 }
 
 /** Specific address constructor.
@@ -50,6 +51,7 @@ AK8963::AK8963() {
 AK8963::AK8963(bool useSPI, uint8_t address) {
 	bSPI = useSPI;
     devAddr = address;
+    asyncCount = 0;
 }
 
 /** Power on and prepare for general usage.
@@ -112,6 +114,47 @@ void AK8963::getHeading(int16_t *x, int16_t *y, int16_t *z) {
 	}	
 }
 
+/** Queue the reads of getHeading() (I2Cdev::submitRead): ST1, and if that
+ * shows a new measurement the H* registers and ST2, chained to it by the
+ * completion callback. The reads run in I2Cdev::poll(), pollHeading() returns
+ * the values. Does nothing while a queued read is pending.
+ * @param flags I2CDEV_CHAIN to run in the same poll as the transaction queued before
+ * @return true if the read was queued
+ */
+bool AK8963::requestHeading(uint8_t flags) {
+    if (asyncCount == I2CDEV_PENDING) return false;
+    asyncCount = I2CDEV_PENDING;
+    if (I2Cdev::submitRead(bSPI, devAddr, AK8963_RA_ST1, 1, asyncBuffer, headingStatus, this, flags) < 0) {
+        asyncCount = 0;
+        return false;
+    }
+    return true;
+}
+
+void AK8963::headingStatus(void *ctx, int8_t count) {
+    AK8963 *mag = (AK8963 *) ctx;
+    if (count != 1 || !(mag->asyncBuffer[0] & 0x01)) {
+        mag->asyncCount = count; // no new measurement, or failed
+    } else if (I2Cdev::submitRead(mag->bSPI, mag->devAddr, AK8963_RA_HXL, 7, &mag->asyncBuffer[1], I2Cdev::storeCount, &mag->asyncCount, I2CDEV_CHAIN) < 0) {
+        mag->asyncCount = -1;
+    }
+}
+
+/** Get the values of the reads queued by requestHeading(), as getHeading().
+ * @return true once, when the reads have completed with a new measurement
+ * (ST1 DRDY) without overflow (ST2 HOFL); x, y and z are set only then
+ */
+bool AK8963::pollHeading(int16_t *x, int16_t *y, int16_t *z) {
+    if (asyncCount == I2CDEV_PENDING) return false;
+    bool ready = asyncCount == 7;
+    asyncCount = 0;
+    if (!ready || (asyncBuffer[7] & 0x08)) return false;
+    *x = (((int16_t)asyncBuffer[2]) << 8) | asyncBuffer[1];
+    *y = (((int16_t)asyncBuffer[4]) << 8) | asyncBuffer[3];
+    *z = (((int16_t)asyncBuffer[6]) << 8) | asyncBuffer[5];
+    return true;
+}
+
 void AK8963::getSelfTest(int16_t *x, int16_t *y, int16_t *z) {
  	I2Cdev::writeByte(bSPI, devAddr, AK8963_RA_CNTL1, AK8963_MODE_POWERDOWN); // Power down magnetometer  
 	delay(10);   
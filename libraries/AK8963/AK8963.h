@@ -107,6 +107,8 @@ class AK8963 {
         
         // H* registers
         void getHeading(int16_t *x, int16_t *y, int16_t *z);
+        bool requestHeading(uint8_t flags = 0);
+        bool pollHeading(int16_t *x, int16_t *y, int16_t *z);
         
         // ST2 register
         bool getOverflowStatus();
@@ -132,6 +134,10 @@ class AK8963 {
 		bool	bSPI;	
         uint8_t devAddr;
         uint8_t buffer[14];
+        uint8_t asyncBuffer[8];     // ST1, HXL..HZH, ST2 of requestHeading, filled by I2Cdev::poll
+        int8_t asyncCount;
+
+        static void headingStatus(void *ctx, int8_t count);
         uint8_t mode;
 		uint8_t Mscale;
 };
@@ -180,6 +180,17 @@ uint8_t AP_Baro_MS5611::read()
 	return(result);
 }
 
+// read() already runs the conversions in the background and never waits, one temperature
+// and four pressure readings per cycle.  This starts a new cycle with the temperature if the
+// state machine is between cycles; otherwise the running one carries on.
+void AP_Baro_MS5611::startMeasurement()
+{
+	if (MS5611_State != 0) return;
+	MS5611_SPI_write(CMD_CONVERT_D2_OSR4096);
+	MS5611_timer = millis();
+	MS5611_State = 1;
+}
+
 // Calculate Temperature and compensated Pressure in real units (Celsius degrees*100, mbar*100).
 void AP_Baro_MS5611::calculate()
 {
@@ -19,6 +19,12 @@ class AP_Baro_MS5611
   int32_t get_raw_pressure();
   int32_t get_raw_temp();
 
+  /* start/poll interface of the other FreeIMU barometer drivers, on top of read() */
+  void startMeasurement();
+  bool pollMeasurement() { return read() != 0; }
+  float getMeasuredPressure() { return Press / 100.0f; }     // in mbar
+  float getMeasuredTemperature() { return Temp / 100.0f; }   // in celsius degrees
+
   private:
 
   int16_t Temp;
@@ -1,7 +1,7 @@
 //
 //    FILE: RunningAverage.cpp
 //  AUTHOR: Rob Tillaart
-// VERSION: 0.2.04
+// VERSION: 0.2.05
 // PURPOSE: RunningAverage library for Arduino
 //
 // The library stores the last N individual values in a circular buffer,
@@ -16,6 +16,8 @@
 // 0.2.02 - 2012-12-30 refactored trimValue -> fillValue
 // 0.2.03 - 2013-11-31 getElement
 // 0.2.04 - 2014-07-03 added memory protection
+// 0.2.05 - 2026-10-16 copy constructor and assignment copy the buffer instead of
+//          sharing it (iCompass, and its RunningAverage, is assigned by value)
 //
 // Released to the public domain
 //
@@ -31,11 +33,32 @@ RunningAverage::RunningAverage(int n)
     clear();
 }
 
+RunningAverage::RunningAverage(const RunningAverage & ra)
+{
+    _ar = NULL;
+    _size = 0;
+    *this = ra;
+}
+
 RunningAverage::~RunningAverage()
 {
     if (_ar != NULL) free(_ar);
 }
 
+RunningAverage & RunningAverage::operator=(const RunningAverage & ra)
+{
+    if (this == &ra) return *this;
+    if (_ar != NULL) free(_ar);
+    _size = ra._size;
+    _ar = (float*) malloc(_size * sizeof(float));
+    if (_ar == NULL) _size = 0;
+    _cnt = ra._cnt;
+    _idx = ra._idx;
+    _sum = ra._sum;
+    for (int i = 0; i < _size; i++) _ar[i] = ra._ar[i];
+    return *this;
+}
+
 // resets all counters
 void RunningAverage::clear()
 {
@@ -15,7 +15,7 @@
 // add(x) addValue(x)
 // avg() getAverage()
 
-#define RUNNINGAVERAGE_LIB_VERSION "0.2.04"
+#define RUNNINGAVERAGE_LIB_VERSION "0.2.05"
 
 #include "Arduino.h"
 
@@ -24,7 +24,9 @@ class RunningAverage
 public:
     RunningAverage(void);
     RunningAverage(int);
+    RunningAverage(const RunningAverage &);
     ~RunningAverage();
+    RunningAverage & operator=(const RunningAverage &);
 
     void clear();
     void addValue(float);
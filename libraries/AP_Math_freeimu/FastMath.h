@@ -0,0 +1,124 @@
+//=====================================================================================================
+// FastMath.h
+//=====================================================================================================
+//
+// Polynomial approximations of the trigonometric functions used on every update by the
+// angle getters, the heading computation (iCompass), getQ_simple and the DCM filter.
+//
+// FASTMATH selects the implementation at compile time: 1 = the approximations below, 0 = libm.
+// It defaults to 1 on AVR, where every libm call is a few thousand cycles of soft float, and to
+// 0 elsewhere.  Define it before the first include (or with -DFASTMATH=...) to override; since
+// FreeIMU, DCM and iCompass are compiled separately it has to be the same for all of them,
+// so change the default here rather than in a sketch.
+//
+// Maximum absolute errors against double precision libm, measured on the host over the
+// whole input range (debug/fastmath_bench.cpp in the FreeIMU library):
+//
+//   fastAtan(x), fastAtan2(y, x)   1.2e-5 rad   Abramowitz & Stegun 4.4.49 (1e-5) plus rounding
+//   fastAsin(x)                    6.8e-5 rad   A&S 4.4.45, |x| > 1 is clamped to 1
+//   fastSin(x), fastCos(x)         4.0e-7       Taylor on [-pi/4, pi/4] after quadrant
+//                                               reduction, for |x| < 1000 rad
+//   fastSqrt(x)                    libm         avr-libc's sqrt is hand written assembler and
+//                                               already cheaper than a soft float reciprocal
+//                                               square root with Newton steps
+//
+// 6.8e-5 rad is 0.004 degrees, well below the noise of any of the supported sensors.
+//
+//=====================================================================================================
+
+#ifndef FastMath_h
+#define FastMath_h
+
+#include <inttypes.h>
+#include <math.h>
+
+#ifndef FASTMATH
+	#if defined(__AVR__)
+		#define FASTMATH 1
+	#else
+		#define FASTMATH 0
+	#endif
+#endif
+
+#define FM_PI		3.14159265f
+#define FM_PI_2		1.57079633f
+
+// atan for |x| <= 1
+static inline float fmAtanUnit(float x) {
+	float x2 = x * x;
+	return x * (0.9998660f + x2 * (-0.3302995f + x2 * (0.1801410f + x2 * (-0.0851330f + x2 * 0.0208351f))));
+}
+
+static inline float fmAtan(float x) {
+	if(x > 1.0f) return FM_PI_2 - fmAtanUnit(1.0f / x);
+	if(x < -1.0f) return -FM_PI_2 - fmAtanUnit(1.0f / x);
+	return fmAtanUnit(x);
+}
+
+// one division, the smaller of |x| and |y| over the larger; atan2(0, 0) is 0
+static inline float fmAtan2(float y, float x) {
+	float ax = fabs(x), ay = fabs(y), a;
+	if(ay <= ax) {
+		if(ax == 0.0f) return 0.0f;
+		a = fmAtanUnit(ay / ax);
+	} else {
+		a = FM_PI_2 - fmAtanUnit(ax / ay);
+	}
+	if(x < 0.0f) a = FM_PI - a;
+	return y < 0.0f ? -a : a;
+}
+
+static inline float fmAsin(float x) {
+	float ax = fabs(x), a;
+	if(ax > 1.0f) ax = 1.0f;
+	a = FM_PI_2 - sqrt(1.0f - ax) * (1.5707288f + ax * (-0.2121144f + ax * (0.0742610f + ax * -0.0187293f)));
+	return x < 0.0f ? -a : a;
+}
+
+// sin and cos of x with one range reduction
+static inline void fmSinCos(float x, float * s, float * c) {
+	// x = k * pi/2 + r, |r| <= pi/4, pi/2 split in three parts (as in cephes) so that
+	// k * part is exact and r keeps its precision
+	int16_t k = (int16_t)(x * 0.636619772f + (x >= 0.0f ? 0.5f : -0.5f));
+	float r = ((x - k * 1.5703125f) - k * 4.837512969970703125e-4f) - k * 7.54978995489188216e-8f;
+	float r2 = r * r;
+	float sr = r * (1.0f + r2 * (-1.66666667e-1f + r2 * (8.33333333e-3f + r2 * -1.98412698e-4f)));
+	float cr = 1.0f + r2 * (-0.5f + r2 * (4.16666667e-2f + r2 * (-1.38888889e-3f + r2 * 2.48015873e-5f)));
+	switch(k & 3) {
+		case 0: *s = sr; *c = cr; break;
+		case 1: *s = cr; *c = -sr; break;
+		case 2: *s = -sr; *c = -cr; break;
+		default: *s = -cr; *c = sr; break;
+	}
+}
+
+static inline float fmSin(float x) {
+	float s, c;
+	fmSinCos(x, &s, &c);
+	return s;
+}
+
+static inline float fmCos(float x) {
+	float s, c;
+	fmSinCos(x, &s, &c);
+	return c;
+}
+
+#if FASTMATH
+	static inline float fastAtan(float x) { return fmAtan(x); }
+	static inline float fastAtan2(float y, float x) { return fmAtan2(y, x); }
+	static inline float fastAsin(float x) { return fmAsin(x); }
+	static inline float fastSin(float x) { return fmSin(x); }
+	static inline float fastCos(float x) { return fmCos(x); }
+	static inline void fastSinCos(float x, float * s, float * c) { fmSinCos(x, s, c); }
+#else
+	static inline float fastAtan(float x) { return atan(x); }
+	static inline float fastAtan2(float y, float x) { return atan2(y, x); }
+	static inline float fastAsin(float x) { return asin(x); }
+	static inline float fastSin(float x) { return sin(x); }
+	static inline float fastCos(float x) { return cos(x); }
+	static inline void fastSinCos(float x, float * s, float * c) { *s = sin(x); *c = cos(x); }
+#endif
+static inline float fastSqrt(float x) { return sqrt(x); }
+
+#endif // FastMath_h
@@ -33,6 +33,7 @@
 
 #include "DCM.h"
 #include <Arduino.h>
+#include "FastMath.h"
 
 DCM::DCM(){
 
@@ -214,13 +215,14 @@ void DCM::Normalize(void)
 /**************************************************/
 void DCM::Drift_correction(void)
 {
-  float mag_heading_x;
-  float mag_heading_y;
-  float errorCourse;
-
   //Compensation the Roll, Pitch and Yaw drift. 
-  static float Scaled_Omega_P[3];
-  static float Scaled_Omega_I[3];
+  Drift_correction_RP();
+  Drift_correction_Yaw();
+}
+
+void DCM::Drift_correction_RP(void)
+{
+  float Scaled_Omega_I[3];
   float Accel_magnitude;
   float Accel_weight;
   
@@ -235,21 +237,29 @@ void DCM::Drift_correction(void)
   Accel_weight = constrain(1 - 2*abs(1 - Accel_magnitude),0,1);  //  
 
   Vector_Cross_Product(&errorRollPitch[0],&Accel_Vector[0],&DCM_Matrix[2][0]); //adjust the ground of reference
-  Vector_Scale(&Omega_P[0],&errorRollPitch[0],Kp_ROLLPITCH*Accel_weight);
+  Vector_Scale(&Omega_P_RP[0],&errorRollPitch[0],Kp_ROLLPITCH*Accel_weight);
+  Vector_Add(Omega_P,Omega_P_RP,Omega_P_Yaw);
   
   Vector_Scale(&Scaled_Omega_I[0],&errorRollPitch[0],Ki_ROLLPITCH*Accel_weight);
   Vector_Add(Omega_I,Omega_I,Scaled_Omega_I);     
+}
+
+void DCM::Drift_correction_Yaw(void)
+{
+  float mag_heading_x;
+  float mag_heading_y;
+  float errorCourse;
+  float Scaled_Omega_I[3];
   
   //*****YAW***************
   // We make the gyro YAW drift correction based on compass magnetic heading
   
-  mag_heading_x = cos(MAG_Heading);
-  mag_heading_y = sin(MAG_Heading);
+  fastSinCos(MAG_Heading, &mag_heading_y, &mag_heading_x);
   errorCourse=(DCM_Matrix[0][0]*mag_heading_y) - (DCM_Matrix[1][0]*mag_heading_x);  //Calculating YAW error
   Vector_Scale(errorYaw,&DCM_Matrix[2][0],errorCourse); //Applys the yaw correction to the XYZ rotation of the aircraft, depeding the position.
   
-  Vector_Scale(&Scaled_Omega_P[0],&errorYaw[0],Kp_YAW);//.01proportional of YAW.
-  Vector_Add(Omega_P,Omega_P,Scaled_Omega_P);//Adding  Proportional.
+  Vector_Scale(&Omega_P_Yaw[0],&errorYaw[0],Kp_YAW);//.01proportional of YAW.
+  Vector_Add(Omega_P,Omega_P_RP,Omega_P_Yaw);//Adding  Proportional.
   
   Vector_Scale(&Scaled_Omega_I[0],&errorYaw[0],Ki_YAW);//.00001Integrator
   Vector_Add(Omega_I,Omega_I,Scaled_Omega_I);//adding integrator to the Omega_I
@@ -305,16 +315,16 @@ void DCM::Matrix_update(void)
 
 void DCM::getEulerRad(float * angles)
 {
-  angles[1] = asin(DCM_Matrix[2][0]);  //originally -asin
-  angles[2] = atan2(DCM_Matrix[2][1],DCM_Matrix[2][2]);
-  angles[0] = atan2(DCM_Matrix[1][0],DCM_Matrix[0][0]);
+  angles[1] = fastAsin(DCM_Matrix[2][0]);  //originally -asin
+  angles[2] = fastAtan2(DCM_Matrix[2][1],DCM_Matrix[2][2]);
+  angles[0] = fastAtan2(DCM_Matrix[1][0],DCM_Matrix[0][0]);
 }
 
 void DCM::getEulerDeg(float * angles)
 {
-  angles[1] = TO_DEG(asin(DCM_Matrix[2][0]));
-  angles[2] = TO_DEG(atan2(DCM_Matrix[2][1],DCM_Matrix[2][2]));
-  angles[0] = TO_DEG(atan2(DCM_Matrix[1][0],DCM_Matrix[0][0]));
+  angles[1] = TO_DEG(fastAsin(DCM_Matrix[2][0]));
+  angles[2] = TO_DEG(fastAtan2(DCM_Matrix[2][1],DCM_Matrix[2][2]));
+  angles[0] = TO_DEG(fastAtan2(DCM_Matrix[1][0],DCM_Matrix[0][0]));
 }
 
 //
@@ -351,6 +361,26 @@ void DCM::getDCM2Q(float * q)
 
 }
 
+//
+//Quaternion to DCM, the inverse of getDCM2Q: starts the filter from the
+//orientation q (FreeIMU notation), the gyro drift integrator is kept
+//
+void DCM::setQ2DCM(const float * q)
+{
+  float s = q[0], x = -q[1], y = -q[2], z = -q[3];
+
+  DCM_Matrix[0][0] = s*s + x*x - y*y - z*z;
+  DCM_Matrix[0][1] = 2*(x*y + s*z);
+  DCM_Matrix[0][2] = 2*(x*z - s*y);
+  DCM_Matrix[1][0] = 2*(x*y - s*z);
+  DCM_Matrix[1][1] = s*s - x*x + y*y - z*z;
+  DCM_Matrix[1][2] = 2*(y*z + s*x);
+  DCM_Matrix[2][0] = 2*(x*z + s*y);
+  DCM_Matrix[2][1] = 2*(y*z - s*x);
+  DCM_Matrix[2][2] = s*s - x*x - y*y + z*z;
+  Normalize();
+}
+
 void DCM::calDCM() 
 {
     Matrix_update();
@@ -358,4 +388,21 @@ void DCM::calDCM()
     Drift_correction();
 }
 
+//
+//Multi-rate use: predictDCM integrates the gyro with the drift correction of the
+//last correctDCM, correctDCM updates the roll/pitch (accelerometer) and/or the
+//yaw (MAG_Heading) part of the correction.  calDCM does both on every call.
+//
+void DCM::predictDCM()
+{
+    Matrix_update();
+    Normalize();
+}
+
+void DCM::correctDCM(bool accel, bool heading)
+{
+    if(accel) Drift_correction_RP();
+    if(heading) Drift_correction_Yaw();
+}
+
 
@@ -92,7 +92,10 @@ class DCM
 		void getEulerRad(float * angles);
 		void getEulerDeg(float * angles);
 		void calDCM();
+		void predictDCM();
+		void correctDCM(bool accel, bool heading);
 		void getDCM2Q(float * q);
+		void setQ2DCM(const float * q);
 	
 	  private:
 		// Sensor variables
@@ -104,6 +107,8 @@ class DCM
 		float Gyro_Vector[3]= {0, 0, 0}; // Store the gyros turn rate in a vector
 		float Omega_Vector[3]= {0, 0, 0}; // Corrected Gyro_Vector data
 		float Omega_P[3]= {0, 0, 0}; // Omega Proportional correction
+		float Omega_P_RP[3]= {0, 0, 0}; // roll/pitch and yaw parts of Omega_P
+		float Omega_P_Yaw[3]= {0, 0, 0};
 		float Omega_I[3]= {0, 0, 0}; // Omega Integrator
 		float Omega[3]= {0, 0, 0};
 		float errorRollPitch[3] = {0, 0, 0};
@@ -117,6 +122,8 @@ class DCM
 		int num_magn_errors = 0;
 		int num_gyro_errors = 0;
 	
+		void Drift_correction_RP(void);
+		void Drift_correction_Yaw(void);
 		void init_rotation_matrix(float m[3][3], float yaw, float pitch, float roll);
 		void Matrix_Vector_Multiply( float a[3][3],  float b[3], float out[3]);
 		void Matrix_Multiply( float a[3][3],  float b[3][3], float out[3][3]);
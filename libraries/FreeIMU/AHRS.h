@@ -28,13 +28,47 @@
 // AHRS algorithm update
 
 
-void FreeIMU::AHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
+void MahonyEngine::AHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt) {
+	float halfe[3];
+
+	fieldError(ax, ay, az, mx, my, mz, halfe);
+        
+        //if there is a valid correction vector
+        if( (halfe[0] != 0.0f) || (halfe[1] != 0.0f) || (halfe[2] != 0.0f) ) {
+		// Compute and apply integral feedback if enabled
+		if(twoKi > 0.0f) {
+			integralFBx += twoKi * halfe[0] * dt;	// integral error scaled by Ki
+			integralFBy += twoKi * halfe[1] * dt;
+			integralFBz += twoKi * halfe[2] * dt;
+			gx += integralFBx;	// apply integral feedback
+			gy += integralFBy;
+			gz += integralFBz;
+		}
+		else {
+			integralFBx = 0.0f;	// prevent integral windup
+			integralFBy = 0.0f;
+			integralFBz = 0.0f;
+		}
+
+		// Apply proportional feedback
+		gx += twoKp * halfe[0];
+		gy += twoKp * halfe[1];
+		gz += twoKp * halfe[2];
+	}
+	
+	integrate(gx, gy, gz, dt);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Half the cross product between the estimated and measured directions of the field vectors,
+// zero measurements are skipped
+
+void MahonyEngine::fieldError(float ax, float ay, float az, float mx, float my, float mz, float * halfe) {
 	float recipNorm;
     float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;  
 	float hx, hy, bx, bz;
 	float halfvx, halfvy, halfvz, halfwx, halfwy, halfwz;
-	float halfex, halfey, halfez;
-	float qa, qb, qc;
+	float halfex = 0.0f, halfey = 0.0f, halfez = 0.0f;
 
 	// Auxiliary variables to avoid repeated arithmetic
         q0q0 = q0 * q0;
@@ -91,34 +125,22 @@ void FreeIMU::AHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 		halfey += (az * halfvx - ax * halfvz);
 		halfez += (ax * halfvy - ay * halfvx);
         }
-        
-        //if there is a valid correction vector
-        if( (halfex != 0.0f) || (halfey != 0.0f) || (halfez != 0.0f) ) {
-		// Compute and apply integral feedback if enabled
-		if(twoKi > 0.0f) {
-			integralFBx += twoKi * halfex * (1.0f / sampleFreq);	// integral error scaled by Ki
-			integralFBy += twoKi * halfey * (1.0f / sampleFreq);
-			integralFBz += twoKi * halfez * (1.0f / sampleFreq);
-			gx += integralFBx;	// apply integral feedback
-			gy += integralFBy;
-			gz += integralFBz;
-		}
-		else {
-			integralFBx = 0.0f;	// prevent integral windup
-			integralFBy = 0.0f;
-			integralFBz = 0.0f;
-		}
 
-		// Apply proportional feedback
-		gx += twoKp * halfex;
-		gy += twoKp * halfey;
-		gz += twoKp * halfez;
-	}
-	
-	// Integrate rate of change of quaternion
-	gx *= (0.5f * (1.0f / sampleFreq));		// pre-multiply common factors
-	gy *= (0.5f * (1.0f / sampleFreq));
-	gz *= (0.5f * (1.0f / sampleFreq));
+	halfe[0] = halfex;
+	halfe[1] = halfey;
+	halfe[2] = halfez;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Integrate rate of change of quaternion
+
+void MahonyEngine::integrate(float gx, float gy, float gz, float dt) {
+	float recipNorm;
+	float qa, qb, qc;
+
+	gx *= (0.5f * dt);		// pre-multiply common factors
+	gy *= (0.5f * dt);
+	gz *= (0.5f * dt);
 	qa = q0;
 	qb = q1;
 	qc = q2;
@@ -136,6 +158,35 @@ void FreeIMU::AHRSupdate(float gx, float gy, float gz, float ax, float ay, float
 }
 
 //---------------------------------------------------------------------------------------------------
+// Multi-rate update: the gyro is integrated with the integral feedback of the last correction,
+// a correction applies the proportional feedback at once, as a rotation over its own dt
+
+void MahonyEngine::predictStep(const float * val, float dt) {
+	integrate(val[3] * M_PI/180 + integralFBx, val[4] * M_PI/180 + integralFBy, val[5] * M_PI/180 + integralFBz, dt);
+}
+
+void MahonyEngine::correctStep(const float * val, uint8_t sensors, float dt) {
+	const float acc = (sensors & FUSION_ACC) ? 1.0f : 0.0f;
+	const float mag = (sensors & FUSION_MAG) ? 1.0f : 0.0f;
+	float halfe[3];
+
+	fieldError(acc * val[0], acc * val[1], acc * val[2], mag * val[6], mag * val[7], mag * val[8], halfe);
+	if( (halfe[0] == 0.0f) && (halfe[1] == 0.0f) && (halfe[2] == 0.0f) ) return;
+
+	if(twoKi > 0.0f) {
+		integralFBx += twoKi * halfe[0] * dt;
+		integralFBy += twoKi * halfe[1] * dt;
+		integralFBz += twoKi * halfe[2] * dt;
+	}
+	else {
+		integralFBx = 0.0f;
+		integralFBy = 0.0f;
+		integralFBz = 0.0f;
+	}
+	integrate(twoKp * halfe[0], twoKp * halfe[1], twoKp * halfe[2], dt);
+}
+
+//---------------------------------------------------------------------------------------------------
 
 
 
@@ -0,0 +1,68 @@
+//=====================================================================================================
+// BoardAxes.h
+//=====================================================================================================
+//
+// Axis alignment of the sensors of each board as a type: AxisMap holds, as template parameters,
+// which calibrated sensor axis (accx, accy, accz, gyrox, gyroy, gyroz, magx, magy, magz) goes to
+// each board axis and with which sign.  apply() is nine assignments with constant indices and
+// signs, where the sensor_order/sensor_sign member arrays it replaces were walked on every
+// sample.  A map that is not a permutation, moves an axis to another sensor or has a sign other
+// than -1, 0 (axis not used) or 1 does not compile.
+//
+// FreeIMU does not call apply() on the samples: calFold multiplies the map of the board into the
+// calibration matrices (CalibTransform.h) with order() and sign() when the calibration is loaded.
+//
+// The maps of all boards are defined here whatever the board, FreeIMU.h picks the one of the
+// board as BoardAxes, so a host program can check them all in one build (debug/board_axes_check).
+//
+//=====================================================================================================
+
+#ifndef BoardAxes_h
+#define BoardAxes_h
+
+#include <inttypes.h>
+
+template <int8_t O0, int8_t O1, int8_t O2, int8_t O3, int8_t O4, int8_t O5, int8_t O6, int8_t O7, int8_t O8,
+          int8_t S0, int8_t S1, int8_t S2, int8_t S3, int8_t S4, int8_t S5, int8_t S6, int8_t S7, int8_t S8>
+struct AxisMap
+{
+	static_assert(((1 << O0) | (1 << O1) | (1 << O2) | (1 << O3) | (1 << O4) | (1 << O5)
+	               | (1 << O6) | (1 << O7) | (1 << O8)) == 0x1FF, "axis order is not a permutation of 0..8");
+	static_assert(O0 / 3 == 0 && O1 / 3 == 0 && O2 / 3 == 0 && O3 / 3 == 1 && O4 / 3 == 1 && O5 / 3 == 1
+	              && O6 / 3 == 2 && O7 / 3 == 2 && O8 / 3 == 2, "axis order mixes sensors");
+	static_assert(S0 * S0 <= 1 && S1 * S1 <= 1 && S2 * S2 <= 1 && S3 * S3 <= 1 && S4 * S4 <= 1
+	              && S5 * S5 <= 1 && S6 * S6 <= 1 && S7 * S7 <= 1 && S8 * S8 <= 1, "axis sign is not -1, 0 or 1");
+
+	// for folding, printing and checking the map, not for the sample path
+	static int8_t order(uint8_t i) { const int8_t o[9] = {O0, O1, O2, O3, O4, O5, O6, O7, O8}; return o[i]; }
+	static int8_t sign(uint8_t i) { const int8_t s[9] = {S0, S1, S2, S3, S4, S5, S6, S7, S8}; return s[i]; }
+
+	/**
+	 * Board axes out[0..8] from the calibrated sensor axes in[0..8].
+	*/
+	static inline void apply(const float * in, float * out) {
+		out[0] = flip(S0, in[O0]);
+		out[1] = flip(S1, in[O1]);
+		out[2] = flip(S2, in[O2]);
+		out[3] = flip(S3, in[O3]);
+		out[4] = flip(S4, in[O4]);
+		out[5] = flip(S5, in[O5]);
+		out[6] = flip(S6, in[O6]);
+		out[7] = flip(S7, in[O7]);
+		out[8] = flip(S8, in[O8]);
+	}
+
+  private:
+	// s is a constant, no multiply is left
+	static inline float flip(int8_t s, float v) { return s > 0 ? v : s < 0 ? -v : 0.0f; }
+};
+
+//accx, accy, accz, gyrox, gyroy, gyroz, magx, magy, magz
+typedef AxisMap<0,1,2,3,4,5,6,7,8,  1,1,1,1,1,1, 1, 1,1> AlignedAxes;		// HAS_AXIS_ALIGNED()
+typedef AxisMap<0,1,2,3,4,5,7,6,8,  1,1,1,1,1,1, 1,-1,1> SEN10724Axes;
+typedef AxisMap<0,1,2,3,4,5,6,7,8,  1,1,1,1,1,1,-1,-1,1> ArduIMUv3Axes;
+// the sign table of these boards had 8 entries, magz is 0 as it was
+typedef AxisMap<0,1,2,3,4,5,7,6,8,  1,1,1,1,1,1, 1,-1,0> MPU9x50Axes;		// GEN_MPU9150, MPU9250_5611, GEN_MPU9250
+typedef AxisMap<1,0,2,4,3,5,7,6,8,  1,-1,1,1,-1,1,-1,1,1> APM25Axes;
+
+#endif // BoardAxes_h
@@ -0,0 +1,68 @@
+//=====================================================================================================
+// CalibTransform.h
+//=====================================================================================================
+//
+// Calibration of a 3 axis sensor as one affine transform, board axes = m * raw + b.  The
+// calibration as measured is an offset and a 3x3 matrix, cal = M (raw - offset): soft iron and
+// cross axis sensitivity for the magnetometer, misalignment and scale for accelerometer and gyro.
+// fold() multiplies in the axis map of the board (BoardAxes.h) and a scale factor (the gyro
+// sensitivity) and turns the offset into b, once when the calibration is loaded, so a sample
+// costs nine multiply-adds and no divide.  setOffset() only recomputes b, for the gyro offsets
+// measured at runtime.  bound() is the range of the output for the range of the raw values.
+// Has no Arduino dependencies.
+//
+//=====================================================================================================
+
+#ifndef CalibTransform_h
+#define CalibTransform_h
+
+#include <inttypes.h>
+#include <math.h>
+
+struct CalibTransform {
+	float m[3][3];
+	float b[3];
+
+	/**
+	 * m = A * M * scale with A the rows first..first+2 of the axis map of the board and
+	 * M row major, b from offset.  Axes must map the three axes of a sensor onto themselves.
+	*/
+	template <class Axes>
+	void fold(const float * M, const float * offset, float scale, uint8_t first) {
+		for(uint8_t i = 0; i < 3; i++) {
+			uint8_t r = Axes::order(first + i) - first;
+			float s = Axes::sign(first + i) * scale;
+			for(uint8_t j = 0; j < 3; j++) m[i][j] = s * M[r * 3 + j];
+		}
+		setOffset(offset);
+	}
+
+	/**
+	 * b = -m * offset, m unchanged.
+	*/
+	void setOffset(const float * offset) {
+		for(uint8_t i = 0; i < 3; i++) {
+			b[i] = -(m[i][0] * offset[0] + m[i][1] * offset[1] + m[i][2] * offset[2]);
+		}
+	}
+
+	void apply(const float * in, float * out) const {
+		out[0] = m[0][0] * in[0] + m[0][1] * in[1] + m[0][2] * in[2] + b[0];
+		out[1] = m[1][0] * in[0] + m[1][1] * in[1] + m[1][2] * in[2] + b[1];
+		out[2] = m[2][0] * in[0] + m[2][1] * in[1] + m[2][2] * in[2] + b[2];
+	}
+
+	/**
+	 * The largest magnitude an output axis takes for raw values within +-raw.
+	*/
+	float bound(float raw) const {
+		float r = 0.0f;
+		for(uint8_t i = 0; i < 3; i++) {
+			float s = (fabsf(m[i][0]) + fabsf(m[i][1]) + fabsf(m[i][2])) * raw + fabsf(b[i]);
+			if(s > r) r = s;
+		}
+		return r;
+	}
+};
+
+#endif // CalibTransform_h
@@ -1,6 +1,17 @@
 #include "CommunicationUtils.h"
 
+// sequence number of the next frame, shared by all the frame types
+static uint8_t frame_seq = 0;
+static TelemetryWriter * frame_writer = NULL;
+
+// text and raw bytes go to Serial directly, after the rest of a frame the writer started
+void serialText() {
+  if(frame_writer) frame_writer->finish(Serial);
+}
+
+
 void serialPrintFloatArr(float * arr, int length) {
+  serialText();
   for(int i=0; i<length; i++) {
     serialFloatPrint(arr[i]);
     Serial.print(",");
@@ -9,6 +20,7 @@ void serialPrintFloatArr(float * arr, int length) {
 
 
 void serialFloatPrint(float f) {
+  serialText();
   byte * b = (byte *) &f;
   for(int i=0; i<4; i++) {
     
@@ -35,7 +47,95 @@ void writeArr(void * varr, uint8_t arr_length, uint8_t type_bytes) {
 // thanks to Francesco Ferrara and the Simplo project for the following code!
 void writeVar(void * val, uint8_t type_bytes) {
   byte * addr=(byte *)(val);
+  serialText();
   for(uint8_t i=0; i<type_bytes; i++) { 
     Serial.write(addr[i]);
   }
 }
+
+
+void serialFrameWriter(TelemetryWriter * writer) {
+  frame_writer = writer;
+}
+
+// a frame the writer drops still takes its sequence number, the host counts it lost
+static void serialFrameSend(FrameEncoder &e, uint8_t * buf) {
+  uint8_t n = e.end();
+  if(n > 0) {
+    if(frame_writer) frame_writer->push(buf, n);
+    else Serial.write(buf, n);
+    frame_seq++;
+  }
+}
+
+
+void serialFrameFloatArr(uint8_t type, float * arr, uint8_t length) {
+  uint8_t buf[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  e.begin(type, frame_seq);
+  for(uint8_t i=0; i<length; i++) {
+    e.putFloat(arr[i]);
+  }
+  serialFrameSend(e, buf);
+}
+
+
+// int16 whatever the size of int, the raw sensor values fit
+void serialFrameIntArr(int * arr, uint8_t length) {
+  uint8_t buf[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  e.begin(FRAME_INT16, frame_seq);
+  for(uint8_t i=0; i<length; i++) {
+    e.putInt16(arr[i]);
+  }
+  serialFrameSend(e, buf);
+}
+
+
+void serialFrameQuat16(float * q) {
+  uint8_t buf[4 * 2 + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  e.begin(FRAME_QUAT16, frame_seq);
+  for(uint8_t i=0; i<4; i++) {
+    e.putScaled(q[i], FRAME_Q15);
+  }
+  serialFrameSend(e, buf);
+}
+
+
+void serialFrameAngles16(float * ypr) {
+  uint8_t buf[3 * 2 + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  e.begin(FRAME_ANGLES16, frame_seq);
+  for(uint8_t i=0; i<3; i++) {
+    e.putScaled(ypr[i], FRAME_CDEG);
+  }
+  serialFrameSend(e, buf);
+}
+
+
+// the scales of the packed frames follow with STREAM_PACKED
+void serialFrameStatus(const TelemetryStream &stream, const PackScale * scale) {
+  uint8_t buf[11 + 12 + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  e.begin(FRAME_STATUS, frame_seq);
+  e.putU16(stream.rate);
+  e.putU8(stream.fields);
+  e.putU32(stream.ticks);
+  e.putU32(stream.dropped);
+  if(scale && (stream.fields & STREAM_PACKED)) {
+    e.putFloat(scale->acc);
+    e.putFloat(scale->gyro);
+    e.putFloat(scale->magn);
+  }
+  serialFrameSend(e, buf);
+}
+
+
+// a keyframe or the deltas to it, see TelemetryPack.h
+void serialFramePacked(PackEncoder &pack, const PackSample &s) {
+  uint8_t buf[PACK_MAX_PAYLOAD + FRAME_OVERHEAD];
+  FrameEncoder e(buf, sizeof(buf));
+  pack.encode(e, frame_seq, s);
+  serialFrameSend(e, buf);
+}
@@ -2,11 +2,27 @@
 #define CommunitationUtils_h
 
 #include "Arduino.h"
+#include "TelemetryFrame.h"
+#include "TelemetryStream.h"
+#include "TelemetryPack.h"
+#include "TelemetryWriter.h"
 
 void serialPrintFloatArr(float * arr, int length);
 void serialFloatPrint(float f);
 void writeArr(void * arr, uint8_t arr_length, uint8_t type_bytes);
 void writeVar(void * val, uint8_t type_bytes);
+// before anything else printed or written to Serial while frames go through a writer, the
+// functions above call it
+void serialText();
+
+// binary frames, see TelemetryFrame.h; queued in writer instead of written to Serial if set
+void serialFrameWriter(TelemetryWriter * writer);
+void serialFrameFloatArr(uint8_t type, float * arr, uint8_t length);
+void serialFrameIntArr(int * arr, uint8_t length);
+void serialFrameQuat16(float * q);
+void serialFrameAngles16(float * ypr);
+void serialFrameStatus(const TelemetryStream &stream, const PackScale * scale = NULL);
+void serialFramePacked(PackEncoder &pack, const PackSample &s);
 
 
 #endif // CommunitationUtils_h
\ No newline at end of file
@@ -0,0 +1,374 @@
+//=====================================================================================================
+// EKFEngine.h
+//=====================================================================================================
+//
+// Error-state extended Kalman filter (MARG 5).  Unlike the complementary filters the gains are not
+// fixed: they follow from the sensor noise figures and the state covariance, and the gyro bias is
+// estimated with its own uncertainty.
+//
+// Nominal state: orientation quaternion q0..q3 (same convention as the other engines), gyro bias
+// in rad/s and, with EKF_MAG_DISTURBANCE, a magnetic disturbance in the body frame (normalised
+// field units, first order Gauss-Markov with time constant magDistTau).
+//
+// Error state (6 or 9): attitude error dtheta (body frame, q_true = q x [dtheta/2, 1]), gyro bias
+// error and mag disturbance error.  The covariance is kept as the packed upper triangle of the
+// symmetric matrix (21 or 45 floats).  The prediction is written out block by block using the
+// structure of the transition matrix (I - [w dt]x, -I dt), the corrections are sequential scalar
+// updates (one per accelerometer and magnetometer axis), so no matrix inverse is needed and the
+// rank one covariance update only touches the upper triangle.  Nothing is allocated at run time.
+//
+// The accelerometer and magnetometer are normalised, so their units do not matter.  The magnetic
+// reference is built from the measurement itself (as in AHRS.h) and the mag update is projected
+// on the vertical axis, so a disturbed field only affects the heading.  Innovations larger than
+// gate standard deviations are rejected (linear accelerations, mag spikes).
+//
+// debug/ekf_bench.cpp compares the cost per update with DCM::calDCM and the accuracy with the
+// Mahony engine on a host.
+//
+//=====================================================================================================
+
+#ifndef EKFEngine_h
+#define EKFEngine_h
+
+#include "FusionEngine.h"
+#include "vector_math.h"
+
+// 1 adds three magnetic disturbance states (9 state filter)
+#ifndef EKF_MAG_DISTURBANCE
+	#define EKF_MAG_DISTURBANCE 0
+#endif
+
+#if EKF_MAG_DISTURBANCE
+	#define EKF_STATES 9
+#else
+	#define EKF_STATES 6
+#endif
+#define EKF_P_SIZE (EKF_STATES * (EKF_STATES + 1) / 2)
+
+// index of element (i, j), i <= j, in the packed upper triangle of the covariance
+#define EKF_P(i, j) ((i) * (2 * EKF_STATES - (i) + 1) / 2 + (j) - (i))
+
+// consecutive rejected accelerometer updates after which the attitude covariance is reopened
+#define EKF_REJECT_LIMIT 200
+
+class EKFEngine : public FusionEngine<EKFEngine>
+{
+  public:
+	typedef vmath::quat<float> quatf;
+	typedef vmath::mat3<float> mat3f;
+	typedef vmath::vec3<float> vec3f;
+
+	static const bool MULTI_RATE = true;
+
+	EKFEngine() : gyroNoise(1e-3f), biasNoise(2e-5f), accNoise(0.02f), magNoise(0.05f),
+				  magDistNoise(0.003f), magDistTau(10.0f), gate(5.0f) {
+		resetState();
+	}
+
+	/**
+	 * @param gyro gyro noise density in rad/s/sqrt(Hz)
+	 * @param bias gyro bias random walk in rad/s^2/sqrt(Hz)
+	 * @param acc standard deviation of one axis of the normalised accelerometer
+	 * @param mag standard deviation of one axis of the normalised magnetometer
+	*/
+	void setNoise(float gyro, float bias, float acc, float mag) {
+		gyroNoise = gyro;
+		biasNoise = bias;
+		accNoise = acc;
+		magNoise = mag;
+	}
+
+	void resetState() {
+		for(uint8_t i = 0; i < EKF_P_SIZE; i++) P[i] = 0.0f;
+		openAttitude();
+		// 2 deg/s initial bias uncertainty
+		P[EKF_P(3, 3)] = P[EKF_P(4, 4)] = P[EKF_P(5, 5)] = 1.2e-3f;
+		bias = vec3f(0.0f);
+	  #if EKF_MAG_DISTURBANCE
+		P[EKF_P(6, 6)] = P[EKF_P(7, 7)] = P[EKF_P(8, 8)] = 0.01f;
+		magDist = vec3f(0.0f);
+	  #endif
+		clearError();
+		rejected = 0;
+		rejectRun = 0;
+	}
+
+	void step(const float * val, float dt) {
+		predictStep(val, dt);
+		correctStep(val, FUSION_ALL, dt);
+	}
+
+	// propagates the nominal state and the covariance
+	void predictStep(const float * val, float dt) {
+		const float d2r = M_PI / 180.0f;
+		quatf q(q1, q2, q3, q0);
+		vec3f th((val[3] * d2r - bias.x) * dt, (val[4] * d2r - bias.y) * dt, (val[5] * d2r - bias.z) * dt);
+
+		q *= quatf(th * 0.5f, 1.0f);
+		q *= invSqrt(vmath::dot(q, q));
+		predict(th, dt);
+		setNominal(q);
+	}
+
+	// the covariance already holds the time since the last correction, dt is not needed
+	void correctStep(const float * val, uint8_t sensors, float dt) {
+		quatf q(q1, q2, q3, q0);
+		float norm;
+
+		const mat3f R = vmath::quat_to_mat3(q);
+		// estimated direction of gravity in the body frame, R^T * [0 0 1]
+		const vec3f v(R.elem[2][0], R.elem[2][1], R.elem[2][2]);
+
+		norm = val[0] * val[0] + val[1] * val[1] + val[2] * val[2];
+		if((sensors & FUSION_ACC) && norm > 0.0f) {
+			bool used = false;
+			norm = invSqrt(norm);
+			vec3f a(val[0] * norm, val[1] * norm, val[2] * norm);
+			// rows of H = [v]x
+			const float h0[3] = {0.0f, -v.z, v.y};
+			const float h1[3] = {v.z, 0.0f, -v.x};
+			const float h2[3] = {-v.y, v.x, 0.0f};
+			used |= measure(h0, -1, a.x - v.x, accNoise * accNoise);
+			used |= measure(h1, -1, a.y - v.y, accNoise * accNoise);
+			used |= measure(h2, -1, a.z - v.z, accNoise * accNoise);
+			if(used) {
+				rejectRun = 0;
+			} else if(++rejectRun >= EKF_REJECT_LIMIT) {
+				// the estimate has drifted out of the gate, start over from the measurements
+				openAttitude();
+				rejectRun = 0;
+			}
+		}
+
+		norm = val[6] * val[6] + val[7] * val[7] + val[8] * val[8];
+		if((sensors & FUSION_MAG) && norm > 0.0f) {
+			norm = invSqrt(norm);
+			vec3f m(val[6] * norm, val[7] * norm, val[8] * norm);
+		  #if EKF_MAG_DISTURBANCE
+			vec3f mc = m - magDist;
+		  #else
+			const vec3f &mc = m;
+		  #endif
+			// reference direction of flux in earth frame from the corrected measurement
+			float hx = R.elem[0][0] * mc.x + R.elem[0][1] * mc.y + R.elem[0][2] * mc.z;
+			float hy = R.elem[1][0] * mc.x + R.elem[1][1] * mc.y + R.elem[1][2] * mc.z;
+			float bz = R.elem[2][0] * mc.x + R.elem[2][1] * mc.y + R.elem[2][2] * mc.z;
+			float bx = sqrt(hx * hx + hy * hy);
+			// estimated direction of flux in the body frame, R^T * [bx 0 bz]
+			vec3f mp(bx * R.elem[0][0] + bz * v.x, bx * R.elem[0][1] + bz * v.y, bx * R.elem[0][2] + bz * v.z);
+			// H = [mp]x * v * v^T, only rotations about the vertical change the estimate
+			vec3f u = vmath::cross(mp, v);
+			const float h0[3] = {u.x * v.x, u.x * v.y, u.x * v.z};
+			const float h1[3] = {u.y * v.x, u.y * v.y, u.y * v.z};
+			const float h2[3] = {u.z * v.x, u.z * v.y, u.z * v.z};
+		  #if EKF_MAG_DISTURBANCE
+			mp += magDist;
+		  #endif
+			measure(h0, 0, m.x - mp.x, magNoise * magNoise);
+			measure(h1, 1, m.y - mp.y, magNoise * magNoise);
+			measure(h2, 2, m.z - mp.z, magNoise * magNoise);
+		}
+
+		// fold the error state into the nominal state
+		q *= quatf(vec3f(dx[0], dx[1], dx[2]) * 0.5f, 1.0f);
+		q *= invSqrt(vmath::dot(q, q));
+		bias += vec3f(dx[3], dx[4], dx[5]);
+	  #if EKF_MAG_DISTURBANCE
+		magDist += vec3f(dx[6], dx[7], dx[8]);
+	  #endif
+		clearError();
+		setNominal(q);
+	}
+
+	float gyroNoise;		// rad/s/sqrt(Hz)
+	float biasNoise;		// rad/s^2/sqrt(Hz)
+	float accNoise;			// normalised units
+	float magNoise;			// normalised units
+	float magDistNoise;		// normalised units/sqrt(Hz)
+	float magDistTau;		// s
+	float gate;				// innovation gate in standard deviations
+
+	vec3f bias;				// estimated gyro bias in rad/s
+  #if EKF_MAG_DISTURBANCE
+	vec3f magDist;			// estimated magnetic disturbance, normalised units
+  #endif
+	float P[EKF_P_SIZE];	// error covariance, packed upper triangle
+	uint32_t rejected;		// number of gated measurements
+
+  private:
+	float dx[EKF_STATES];	// error state accumulated by the scalar updates
+	uint16_t rejectRun;
+
+	void setNominal(const quatf &q) {
+		q0 = q.w;
+		q1 = q.v.x;
+		q2 = q.v.y;
+		q3 = q.v.z;
+	}
+
+	void clearError() {
+		for(uint8_t i = 0; i < EKF_STATES; i++) dx[i] = 0.0f;
+	}
+
+	// large attitude uncertainty, uncorrelated with the other states
+	void openAttitude() {
+		for(uint8_t i = 0; i < 3; i++) {
+			for(uint8_t j = i; j < EKF_STATES; j++) P[EKF_P(i, j)] = 0.0f;
+			P[EKF_P(i, i)] = 0.25f;
+		}
+	}
+
+	float sym(uint8_t i, uint8_t j) const {
+		return i <= j ? P[EKF_P(i, j)] : P[EKF_P(j, i)];
+	}
+
+	// out = (I - [th]x) * M
+	static void phiMul(const vec3f &th, const mat3f &M, mat3f &out) {
+	  #define EKF_PHI_COL(c) \
+		out.elem[0][c] = M.elem[0][c] - th.y * M.elem[2][c] + th.z * M.elem[1][c]; \
+		out.elem[1][c] = M.elem[1][c] - th.z * M.elem[0][c] + th.x * M.elem[2][c]; \
+		out.elem[2][c] = M.elem[2][c] - th.x * M.elem[1][c] + th.y * M.elem[0][c];
+		EKF_PHI_COL(0)
+		EKF_PHI_COL(1)
+		EKF_PHI_COL(2)
+	  #undef EKF_PHI_COL
+	}
+
+	/**
+	 * P = F P F^T + Q with F = [[I - [th]x, -I dt, 0], [0, I, 0], [0, 0, a I]].
+	 * With A = Phi Ptt - dt Ptb^T and C = Phi Ptb - dt Pbb the new blocks are
+	 * Ptt = A Phi^T - dt C, Ptb = C, Pbb = Pbb + Qb; only the upper triangle is
+	 * computed.
+	*/
+	void predict(const vec3f &th, float dt) {
+		mat3f T, C, A, N;
+		const float qt = gyroNoise * gyroNoise * dt;
+		const float qb = biasNoise * biasNoise * dt;
+
+		T.elem[0][0] = P[EKF_P(0, 0)];
+		T.elem[0][1] = T.elem[1][0] = P[EKF_P(0, 1)];
+		T.elem[0][2] = T.elem[2][0] = P[EKF_P(0, 2)];
+		T.elem[1][1] = P[EKF_P(1, 1)];
+		T.elem[1][2] = T.elem[2][1] = P[EKF_P(1, 2)];
+		T.elem[2][2] = P[EKF_P(2, 2)];
+
+		C.elem[0][0] = P[EKF_P(0, 3)]; C.elem[0][1] = P[EKF_P(0, 4)]; C.elem[0][2] = P[EKF_P(0, 5)];
+		C.elem[1][0] = P[EKF_P(1, 3)]; C.elem[1][1] = P[EKF_P(1, 4)]; C.elem[1][2] = P[EKF_P(1, 5)];
+		C.elem[2][0] = P[EKF_P(2, 3)]; C.elem[2][1] = P[EKF_P(2, 4)]; C.elem[2][2] = P[EKF_P(2, 5)];
+
+		phiMul(th, T, A);
+		phiMul(th, C, N);
+
+		A.elem[0][0] -= dt * C.elem[0][0]; A.elem[0][1] -= dt * C.elem[1][0]; A.elem[0][2] -= dt * C.elem[2][0];
+		A.elem[1][0] -= dt * C.elem[0][1]; A.elem[1][1] -= dt * C.elem[1][1]; A.elem[1][2] -= dt * C.elem[2][1];
+		A.elem[2][0] -= dt * C.elem[0][2]; A.elem[2][1] -= dt * C.elem[1][2]; A.elem[2][2] -= dt * C.elem[2][2];
+
+		N.elem[0][0] -= dt * P[EKF_P(3, 3)]; N.elem[0][1] -= dt * P[EKF_P(3, 4)]; N.elem[0][2] -= dt * P[EKF_P(3, 5)];
+		N.elem[1][0] -= dt * P[EKF_P(3, 4)]; N.elem[1][1] -= dt * P[EKF_P(4, 4)]; N.elem[1][2] -= dt * P[EKF_P(4, 5)];
+		N.elem[2][0] -= dt * P[EKF_P(3, 5)]; N.elem[2][1] -= dt * P[EKF_P(4, 5)]; N.elem[2][2] -= dt * P[EKF_P(5, 5)];
+
+		// Ptt = A Phi^T - dt N, row i of A Phi^T is a_i + a_i x th
+		P[EKF_P(0, 0)] = A.elem[0][0] + A.elem[0][1] * th.z - A.elem[0][2] * th.y - dt * N.elem[0][0] + qt;
+		P[EKF_P(0, 1)] = A.elem[0][1] + A.elem[0][2] * th.x - A.elem[0][0] * th.z - dt * N.elem[0][1];
+		P[EKF_P(0, 2)] = A.elem[0][2] + A.elem[0][0] * th.y - A.elem[0][1] * th.x - dt * N.elem[0][2];
+		P[EKF_P(1, 1)] = A.elem[1][1] + A.elem[1][2] * th.x - A.elem[1][0] * th.z - dt * N.elem[1][1] + qt;
+		P[EKF_P(1, 2)] = A.elem[1][2] + A.elem[1][0] * th.y - A.elem[1][1] * th.x - dt * N.elem[1][2];
+		P[EKF_P(2, 2)] = A.elem[2][2] + A.elem[2][0] * th.y - A.elem[2][1] * th.x - dt * N.elem[2][2] + qt;
+
+		P[EKF_P(0, 3)] = N.elem[0][0]; P[EKF_P(0, 4)] = N.elem[0][1]; P[EKF_P(0, 5)] = N.elem[0][2];
+		P[EKF_P(1, 3)] = N.elem[1][0]; P[EKF_P(1, 4)] = N.elem[1][1]; P[EKF_P(1, 5)] = N.elem[1][2];
+		P[EKF_P(2, 3)] = N.elem[2][0]; P[EKF_P(2, 4)] = N.elem[2][1]; P[EKF_P(2, 5)] = N.elem[2][2];
+
+		P[EKF_P(3, 3)] += qb;
+		P[EKF_P(4, 4)] += qb;
+		P[EKF_P(5, 5)] += qb;
+
+	  #if EKF_MAG_DISTURBANCE
+		// Ptd = a (Phi Ptd - dt Pbd), Pbd = a Pbd, Pdd = a^2 Pdd + Qd
+		const float a = 1.0f - dt / magDistTau;
+		const float qd = magDistNoise * magDistNoise * dt;
+		mat3f D;
+
+		C.elem[0][0] = P[EKF_P(0, 6)]; C.elem[0][1] = P[EKF_P(0, 7)]; C.elem[0][2] = P[EKF_P(0, 8)];
+		C.elem[1][0] = P[EKF_P(1, 6)]; C.elem[1][1] = P[EKF_P(1, 7)]; C.elem[1][2] = P[EKF_P(1, 8)];
+		C.elem[2][0] = P[EKF_P(2, 6)]; C.elem[2][1] = P[EKF_P(2, 7)]; C.elem[2][2] = P[EKF_P(2, 8)];
+		phiMul(th, C, D);
+
+		P[EKF_P(0, 6)] = a * (D.elem[0][0] - dt * P[EKF_P(3, 6)]);
+		P[EKF_P(0, 7)] = a * (D.elem[0][1] - dt * P[EKF_P(3, 7)]);
+		P[EKF_P(0, 8)] = a * (D.elem[0][2] - dt * P[EKF_P(3, 8)]);
+		P[EKF_P(1, 6)] = a * (D.elem[1][0] - dt * P[EKF_P(4, 6)]);
+		P[EKF_P(1, 7)] = a * (D.elem[1][1] - dt * P[EKF_P(4, 7)]);
+		P[EKF_P(1, 8)] = a * (D.elem[1][2] - dt * P[EKF_P(4, 8)]);
+		P[EKF_P(2, 6)] = a * (D.elem[2][0] - dt * P[EKF_P(5, 6)]);
+		P[EKF_P(2, 7)] = a * (D.elem[2][1] - dt * P[EKF_P(5, 7)]);
+		P[EKF_P(2, 8)] = a * (D.elem[2][2] - dt * P[EKF_P(5, 8)]);
+
+		P[EKF_P(3, 6)] *= a; P[EKF_P(3, 7)] *= a; P[EKF_P(3, 8)] *= a;
+		P[EKF_P(4, 6)] *= a; P[EKF_P(4, 7)] *= a; P[EKF_P(4, 8)] *= a;
+		P[EKF_P(5, 6)] *= a; P[EKF_P(5, 7)] *= a; P[EKF_P(5, 8)] *= a;
+
+		P[EKF_P(6, 6)] = a * a * P[EKF_P(6, 6)] + qd;
+		P[EKF_P(6, 7)] *= a * a;
+		P[EKF_P(6, 8)] *= a * a;
+		P[EKF_P(7, 7)] = a * a * P[EKF_P(7, 7)] + qd;
+		P[EKF_P(7, 8)] *= a * a;
+		P[EKF_P(8, 8)] = a * a * P[EKF_P(8, 8)] + qd;
+	  #endif
+	}
+
+	/**
+	 * Scalar measurement update, y = h . dtheta (+ disturbance[axis]) + noise.
+	 *
+	 * @param h attitude row of the measurement matrix
+	 * @param axis magnetometer axis for the disturbance state, -1 for none
+	 * @param innov measurement minus estimate at the nominal state
+	 * @param r measurement noise variance
+	 * @return false if the innovation was rejected by the gate
+	*/
+	bool measure(const float * h, int8_t axis, float innov, float r) {
+		float pht[EKF_STATES];
+		float s;
+	  #if EKF_MAG_DISTURBANCE
+		const uint8_t d = 6 + axis;
+	  #endif
+
+		// P * h^T, the attitude rows of P are the attitude columns
+		pht[0] = P[EKF_P(0, 0)] * h[0] + P[EKF_P(0, 1)] * h[1] + P[EKF_P(0, 2)] * h[2];
+		pht[1] = P[EKF_P(0, 1)] * h[0] + P[EKF_P(1, 1)] * h[1] + P[EKF_P(1, 2)] * h[2];
+		pht[2] = P[EKF_P(0, 2)] * h[0] + P[EKF_P(1, 2)] * h[1] + P[EKF_P(2, 2)] * h[2];
+		for(uint8_t i = 3; i < EKF_STATES; i++) {
+			pht[i] = P[EKF_P(0, i)] * h[0] + P[EKF_P(1, i)] * h[1] + P[EKF_P(2, i)] * h[2];
+		}
+	  #if EKF_MAG_DISTURBANCE
+		if(axis >= 0) {
+			for(uint8_t i = 0; i < EKF_STATES; i++) pht[i] += sym(i, d);
+		}
+	  #endif
+		// innovation relative to the error state already accumulated
+		innov -= h[0] * dx[0] + h[1] * dx[1] + h[2] * dx[2];
+		s = h[0] * pht[0] + h[1] * pht[1] + h[2] * pht[2] + r;
+	  #if EKF_MAG_DISTURBANCE
+		if(axis >= 0) {
+			innov -= dx[d];
+			s += pht[d];
+		}
+	  #endif
+
+		if(s <= 0.0f || innov * innov > gate * gate * s) {
+			rejected++;
+			return false;
+		}
+
+		s = 1.0f / s;
+		float * p = P;
+		for(uint8_t i = 0; i < EKF_STATES; i++) {
+			const float k = pht[i] * s;
+			dx[i] += k * innov;
+			for(uint8_t j = i; j < EKF_STATES; j++) *p++ -= k * pht[j];
+		}
+		return true;
+	}
+};
+
+#endif // EKFEngine_h
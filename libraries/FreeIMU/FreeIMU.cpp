@@ -253,6 +253,98 @@ GNU General Public License for more details.
 -------- An example file has been created to show the DCM implementation with euler angle output.
 -------- Use existing Serial sketches for use with processing. No other changes are needed.
 --------------------------------------------------------------------------
+10-16-26
+-------- Added FIFO burst acquisition for the MPU60X0 boards (FIFO_BURST in FreeIMU.h).  getQ
+-------- drains every sample buffered in the FIFO and runs the filter once per sample with the
+-------- FIFO sample period as dt, so gyro samples are no longer lost when the loop stalls.
+-------- getValues was split into calibrateAccGyro/applyCalibration and the filter dispatch moved
+-------- into fusionUpdate so both acquisition paths share them.
+-------- Added updateBatch to run the selected filter over arrays of samples (FIFO backlogs,
+-------- log replay) without any sensor reads or micros() calls.
+-------- The filters are now fusion engines (FusionEngine.h) holding their own state.  Every
+-------- engine enabled in FUSION_ENGINES is compiled in, one is active and a second one can
+-------- run in shadow mode on the same samples to compare cost and drift.  The update cost
+-------- of each engine in CPU cycles is kept in fusion_stats.  The filters take dt directly.
+-------- An engine switched to, shadowed or restarted by getQ_simple starts from the current
+-------- orientation, DCM included (DCM::setQ2DCM).  getQ_simple builds that orientation in
+-------- the frame of the engines: up from the accelerometer, north from the horizontal field.
+-------- Added Q1.15/Q2.30 fixed point Mahony and Madgwick engines (FusionFixed.h), selected
+-------- with FUSION_FIXED in FreeIMU.h.  debug/fixed_replay.cpp compares them with the float
+-------- filters on recorded or synthetic data, debug/freeimu_sim_fixed runs FreeIMU on them.
+-------- Added an error-state Kalman filter engine (MARG 5, EKFEngine.h) estimating the gyro bias
+-------- and optionally a magnetic disturbance, tuned with the ekf*Def noise figures in FreeIMU.h.
+-------- debug/ekf_bench.cpp compares its cost per update with the DCM filter.
+-------- Multi-rate fusion: the Mahony, Madgwick, DCM and EKF engines have separate gyro
+-------- integration (predict) and accelerometer/magnetometer correction steps.  The gyro is
+-------- integrated on every sample, the corrections run at FUSION_ACC_RATE/FUSION_MAG_RATE
+-------- and the magnetometer is only read when its correction is due.
+-------- Timestamped fusion: getQ(q, val, t_us) takes the sample time from the caller and
+-------- replayQ runs a logged sample through the same path, the time step is the integer
+-------- difference of the timestamps so a replay reproduces the live run.  dt_jitter keeps a
+-------- histogram of the timestamp jitter.
+-------- The angle getters read an orientation snapshot (OrientationState.h) taken by getQ
+-------- instead of calling getQ themselves, derived values are computed once per update.
+-------- A getter polled twice without a getQ in between still updates the filter.
+-------- FastMath.h (AP_Math_freeimu): polynomial atan/atan2/asin/sin/cos with documented error
+-------- bounds, used by the angle getters, getQ_simple, calcMagHeading, iCompass and DCM.
+-------- FASTMATH selects them (default on AVR) or libm, debug/fastmath_bench.cpp checks them.
+-------- Host build: debug/Makefile builds the libraries on Linux against debug/host (Arduino core,
+-------- Wire with a simulated I2C bus, SPI, EEPROM) and register level models of the MPU-6050/9250,
+-------- AK8963, HMC5883L and MS5611.  debug/freeimu_sim.cpp runs init/getQ against them.
+-------- Data-ready acquisition: with FIFO_INT_PIN the MPU60X0 INT pin interrupt moves the FIFO
+-------- into fifoRing (now a lock-free single producer/consumer ring) and getQ fuses what is
+-------- there.  claimBus/releaseBus keep the interrupt off the bus while the loop uses it,
+-------- getFIFOStats reports ring depth, overruns and interrupts.  debug/fifo_sim.cpp.
+-------- MPU-9150/9250: with MAG_AUX_MASTER the MPU's I2C master reads the AK8975/AK8963 at
+-------- MAG_AUX_RATE and getMotion9 returns accel, temp, gyro and mag in one burst, no more
+-------- delay(10) per sample.  mag_status has the freshness and overflow flags, the filter
+-------- only takes fresh readings.
+-------- Barometers: all five drivers (MS561101BA, AP_Baro_MS5611, BMP085, LPS331, MPL3115A2)
+-------- got a startMeasurement/pollMeasurement/getMeasured* interface that never waits.
+-------- getBaroAlt and getEstAltitude use the latest completed sample (pollBaro), the altitude
+-------- Kalman filter sees each sample once.
+-------- getValues/getRawValues read the temperature with accel and gyro (MPU60X0::getMotion7),
+-------- one transaction per sample.  The temperature correction polynomial is evaluated in
+-------- float and only when DTemp changes.
+-------- Temperature correction table (TempCorrLUT.h): with TEMP_CORR_LUT nodes init tabulates the
+-------- c3..c0 cubics and the correction is interpolated linearly, default on except on AVR.
+-------- debug/tempcorr_bench.cpp reports its error and RAM per size.
+-------- The axis alignment is a compile time AxisMap per board (BoardAxes.h) instead of the
+-------- sensor_order/sensor_sign arrays, the remap is straight line code.
+-------- Calibration with 3x3 matrices (acc_mat, magn_mat, gyro_mat: misalignment, soft iron) after
+-------- the offsets.  calFold folds offsets, scales, matrices, the board axes and the gyro
+-------- sensitivity into one CalibTransform per sensor, a sample costs a matrix-vector product
+-------- and no divide.  calibration.h carries the matrices with CALIBRATION_MATRICES, the EEPROM
+-------- with signature FREEIMU_EEPROM_SIGNATURE_MAT (calStore, serial command 'm'); FreeIMU_GUI
+-------- fits full ellipsoids.  The old calibration.h and EEPROM layout still load.
+-------- Gyro bias estimated in the background (GYRO_BIAS_BACKGROUND, GyroBias.h): getQ averages
+-------- windows of samples while MotionDetect finds the board still, init no longer blocks in
+-------- initGyros and setTempCalib(0) no longer stalls the loop.  The converged bias is stored in
+-------- the EEPROM with its temperature (GYRO_BIAS_STORE), a byte per sample, and the next start
+-------- takes it as converged if the temperature is close.  gyro_off_* are floats.
+-------- The FreeIMU_serial sketches run their loop as tasks of a LoopScheduler (LoopScheduler.h)
+-------- with a period each: acquire (FIFO_BURST), fusion, baro, telemetry, GPS and commands; the
+-------- serial command 'S' reports misses and run times per task.  acquire() reads the FIFO
+-------- without fusing.
+-------- Binary telemetry frames (TelemetryFrame.h): marker, length, type, sequence number and
+-------- CRC-16 around little endian floats or Q15/centidegree int16, sent by the serialFrame*
+-------- functions of CommunicationUtils and the serial commands 'Q' and 'Z'.  A 'z' line of 163
+-------- bytes is a 79 byte frame; debug/frame_dump.cpp decodes them on a PC.
+-------- Push streaming (TelemetryStream.h): the serial command 's' with a rate and a field mask
+-------- subscribes to frames sent by a scheduler task at that rate, with a status frame of ticks
+-------- sent and dropped every second, instead of a command per burst of 'Z'.
+-------- Packed telemetry (TelemetryPack.h): smallest three quaternion in 32 or 48 bits, int16
+-------- sensor values with per stream scales and varint deltas of temperature, pressure and
+-------- altitude to a keyframe, 34 bytes a frame instead of 71; the subscription field
+-------- STREAM_PACKED and the XBee sketch command 'c'.  debug/pack_bench.cpp measures it.
+-------- The scales are fitted to the calibrated range of each sensor (calRange), raw counts
+-------- when uncalibrated, and the status frame of the subscription carries them.
+-------- Non-blocking frame output (TelemetryWriter.h): the FreeIMU_serial sketches queue frames
+-------- in a ring flushed by a writer task as far as Serial.availableForWrite() allows, dropping
+-------- the oldest frames or decimating whole ticks (STREAM_DECIMATE) when the port falls
+-------- behind; 'S' reports dropped frames, skipped ticks and the longest write stall.  Text
+-------- printed to Serial waits for the rest of a started frame (serialText), not inside it.
+--------------------------------------------------------------------------
 */
 
 #include "Arduino.h"
@@ -266,13 +358,16 @@ GNU General Public License for more details.
 #include <Filter.h>             // Filter library
 #include <Butter.h>
 
-#if(MARG == 0)
+#if HAS_ENGINE(FUSION_MAHONY)
 	#include "AHRS.h"
-#elif(MARG == 1)
+#endif
+#if HAS_ENGINE(FUSION_MADGWICK)
 	#include "MadgwickAHRS.h"
-#elif(MARG == 3)
+#endif
+#if HAS_ENGINE(FUSION_MARG)
 	#include "MARGUpdateFilter.h"
-#else
+#endif
+#if HAS_ENGINE(FUSION_DCM)
 	#include "DCM.h"
 	//dcm = DCM(); This has to be defined later otherwise compiler complains
 #endif
@@ -390,22 +485,44 @@ FreeIMU::FreeIMU() {
   #if HAS_PRESS()
     kPress.KalmanInit(0.0000005,0.01,1.0,0);
   #endif
+  #if HAS_BARO()
+    baro_press = baro_press_filt = 1013.25f;
+    baro_temp = 15.0f;
+  #endif
   
-  // initialize quaternion
-  q0 = 1.0f;
-  q1 = 0.0f;
-  q2 = 0.0f;
-  q3 = 0.0f;
-  q3old = 0.0f;
+  // initialize fusion engines
   exInt = 0.0;
   eyInt = 0.0;
   ezInt = 0.0;
-  twoKp = twoKpDef;
-  twoKi = twoKiDef;
-  beta = betaDef;
-  integralFBx = 0.0f,  integralFBy = 0.0f, integralFBz = 0.0f;
+  #if HAS_ENGINE(FUSION_MADGWICK)
+	madgwick.setGains(betaDef);
+  #endif
+  #if HAS_ENGINE(FUSION_MARG)
+	marg.setGains(betaDef);
+  #endif
+  #if HAS_ENGINE(FUSION_DCM)
+	dcmEngine.attach(&dcm);
+  #endif
+  #if HAS_ENGINE(FUSION_EKF)
+	ekf.setNoise(ekfGyroNoiseDef, ekfBiasNoiseDef, ekfAccNoiseDef, ekfMagNoiseDef);
+  #endif
+  resetEngines();
+  fusion_active = MARG;
+  fusion_shadow = FUSION_NONE;
+  fusion_shadow_diff = 0.0f;
+  fusion_rates.setRates(FUSION_ACC_RATE, FUSION_MAG_RATE);
+  mag_raw[0] = mag_raw[1] = mag_raw[2] = 0.0f;
+  mag_heading = 0.0f;
+  #if HAS_MAG_AUX()
+    mag_status = 0;
+  #endif
+  clearFusionStats();
+  dt_jitter.clear();
+  orientation.clear();
   lastUpdate = 0;
   now = 0;
+  sample_time = 0;
+  sample_time_set = false;
 
   //temp_break = -1000;	  //original temp_break = -4300;
   //senTemp_break = 32.;
@@ -417,6 +534,37 @@ FreeIMU::FreeIMU() {
   gyro_off_x = 0.;
   gyro_off_y = 0.;  
   gyro_off_z = 0.;
+  #if GYRO_BIAS_BACKGROUND
+	gyro_bias.begin(0.0f, 0.0f, nsamples);	// thresholds set by init with the sensitivity
+	motion_still = false;
+  #endif
+  #if GYRO_BIAS_STORE
+	gyro_store_pos = -1;
+	gyro_stored = false;
+	gyro_warm_check = false;
+  #endif
+  
+  for(uint8_t i = 0; i < 9; i++) acgyro_corr[i] = 0.0f;
+  corr_valid = false;
+  #if TEMP_CORR_LUT > 0
+	#if HAS_ITG3200()
+		temp_lut.build(c3, c2, c1, c0, senTemp_min, senTemp_break);
+	#else
+		temp_lut.build(c3, c2, c1, c0, TEMP_CORR_MIN, temp_break);
+	#endif
+  #endif
+  
+  #if HAS_MPU_FIFO()
+    fifo_overflows = 0;
+    fifo_dt = (1 + FIFO_RATE_DIV) / 1000.0f;
+    memset(fifo_val, 0, sizeof(fifo_val));
+  #endif
+  #if HAS_FIFO_INT()
+    bus_claims = 0;
+    fifo_int_pending = false;
+    fifo_interrupts = 0;
+    fifo_deferred = 0;
+  #endif
   
   #ifndef CALIBRATION_H
   // initialize scale factors to neutral values
@@ -441,6 +589,18 @@ FreeIMU::FreeIMU() {
 	magn_scale_y = ::magn_scale_y;
 	magn_scale_z = ::magn_scale_z;
   #endif
+	for(uint8_t i = 0; i < 9; i++) {
+		acc_mat[i] = magn_mat[i] = gyro_mat[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+	}
+  #ifdef CALIBRATION_MATRICES
+	for(uint8_t i = 0; i < 9; i++) {
+		acc_mat[i] = ::acc_mat[i];
+		magn_mat[i] = ::magn_mat[i];
+		gyro_mat[i] = ::gyro_mat[i];
+	}
+  #endif
+	gyro_sensitivity = 1.0f;	// set by init with the sensors
+	calFold();
 }
 
 void FreeIMU::init() {
@@ -480,34 +640,22 @@ void FreeIMU::RESET() {
 	
 	delay(50);
 	//reset matrix
-	q0 = 1.0f;
-    q1 = 0.0f;
-    q2 = 0.0f;
-    q3 = 0.0f;
+	resetEngines();
+	orientation.clear();
     exInt = 0.0;
     eyInt = 0.0;
     ezInt = 0.0;
-    twoKp = twoKpDef;
-    twoKi = twoKiDef;
-   // beta = betaDef;
-    integralFBx = 0.0f,  integralFBy = 0.0f, integralFBz = 0.0f;
     //lastUpdate = 0;
     //now = 0;
 }
 
 void FreeIMU::RESET_Q() {
 	//reset matrix
-	q0 = 1.0f;
-    q1 = 0.0f;
-    q2 = 0.0f;
-    q3 = 0.0f;
+	resetEngines();
+	orientation.clear();
     exInt = 0.0;
     eyInt = 0.0;
     ezInt = 0.0;
-    twoKp = twoKpDef;
-    twoKi = twoKiDef;
-   // beta = betaDef;
-    integralFBx = 0.0f,  integralFBy = 0.0f, integralFBz = 0.0f;
     //lastUpdate = 0;
     //now = 0;
 }
@@ -582,8 +730,10 @@ void FreeIMU::RESET_Q() {
 	delay(1000);
 	gyro.setFilterBW(BW020_SR1);
 	delay(1000);
-	// calibrate the ITG3200
-	gyro.zeroCalibrate(128,5);
+	#if !GYRO_BIAS_BACKGROUND
+		// calibrate the ITG3200, otherwise its bias is in gyro_off_*
+		gyro.zeroCalibrate(128,5);
+	#endif
 	gyro_sensitivity = 14.375f;
   #endif
   
@@ -628,6 +778,10 @@ void FreeIMU::RESET_Q() {
 	//initialize magnetometer
 	mag = AK8975(false, AK8975_DEFAULT_ADDRESS);
 	mag.initialize();
+	#if HAS_MAG_AUX()
+		// from here on the MPU reads the magnetometer and starts its next measurement
+		accgyro.setAuxMagnetometer(AK8975_DEFAULT_ADDRESS, true, MAG_AUX_DIV(accgyro.getRate()));
+	#endif
   #elif HAS_MPU9250()
 	//initialize accelerometer and gyroscope
 	accgyro = MPU60X0(false, accgyro_addr);
@@ -643,6 +797,10 @@ void FreeIMU::RESET_Q() {
 	mag = AK8963(false, AK8963_DEFAULT_ADDRESS);
 	mag.initialize();  
 	mag.setModeRes(AK8963_MODE_CONT2, MFS_16BITS);
+	#if HAS_MAG_AUX()
+		// from here on the MPU reads the magnetometer, continuous mode 2 measures at 100Hz
+		accgyro.setAuxMagnetometer(AK8963_DEFAULT_ADDRESS, false, MAG_AUX_DIV(accgyro.getRate()));
+	#endif
   #elif HAS_MPU6000()
 	accgyro = MPU60X0(true, accgyro_addr);
 	accgyro.initialize();
@@ -768,34 +926,77 @@ void FreeIMU::RESET_Q() {
 	baro331.enableDefault();
   #endif
   
+  #if HAS_BARO()
+    startBaro();
+  #endif
+  
   // zero gyro
   //zeroGyro();
   //if(temp_corr_on == 0) {
   //digitalWrite(12,HIGH);
   
-  initGyros(); //}
+  #if GYRO_BIAS_BACKGROUND
+	gyroBiasStart();	// getQ estimates the bias
+  #else
+	initGyros(); //}
+  #endif
 
   //digitalWrite(12,LOW);
 	
   #ifndef CALIBRATION_H
 	// load calibration from eeprom
 	calLoad();
+  #else
+	// with the gyro sensitivity known now
+	calFold();
   #endif
 
   
   RESET_Q();
 
-  float values[11];
-
   //DCM filter implementation set here so we can intit with calibrated values.  All initializations have to be done first.
-  #if(MARG == 4)
+  #if HAS_ENGINE(FUSION_DCM)
+    float values[11];
     dcm = DCM();
     getValues( values);
-    values[9] = maghead.iheading(1, 0, 0, values[0], values[1], values[2], values[6], values[7], values[8]);
+	#if IS_9DOM()
+		values[9] = maghead.iheading(1, 0, 0, values[0], values[1], values[2], values[6], values[7], values[8]);
+	#else
+		values[9] = 0.0f;
+	#endif
     dcm.setSensorVals(values);
     dcm.DCM_init(Kp_ROLLPITCH, Ki_ROLLPITCH, Kp_YAW, Ki_YAW);
   #endif
 
+  //Cycle counter for the fusion engine statistics (Teensy 3.x)
+  #if defined(ARM_DWT_CYCCNT)
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  #endif
+
+  //Start buffering only now so the FIFO does not overflow during gyro calibration.
+  //Sample rate = 1kHz/(1+FIFO_RATE_DIV), the DLPF set above keeps the gyro output rate at 1kHz
+  #if HAS_MPU_FIFO()
+    accgyro.setRate(FIFO_RATE_DIV);
+    #if HAS_MAG_AUX()
+      accgyro.setSlave4MasterDelay(max(MAG_AUX_DIV(FIFO_RATE_DIV), 1) - 1);
+    #endif
+    fifo_dt = (1 + FIFO_RATE_DIV) / 1000.0f;
+    fifoRing.clear();
+    accgyro.setFIFOBurstEnabled(true);
+  #endif
+  
+  //From here on the data-ready interrupt reads the FIFO: INT pin active high, push-pull,
+  //50us pulse for every sample written to the FIFO
+  #if HAS_FIFO_INT()
+    fifo_owner = this;
+    accgyro.setInterruptMode(0);
+    accgyro.setInterruptDrive(0);
+    accgyro.setInterruptLatch(0);
+    accgyro.setIntDataReadyEnabled(true);
+    pinMode(FIFO_INT_PIN, INPUT);
+    attachInterrupt(digitalPinToInterrupt(FIFO_INT_PIN), fifoISR, RISING);
+  #endif
 }
 
 #ifndef CALIBRATION_H
@@ -809,8 +1010,17 @@ void eeprom_read_var(uint8_t size, byte * var) {
   location += size;
 }
 
+/**
+ * Loads the calibration stored in the EEPROM, neutral values if there is none, and folds it
+ * (calFold).  Reads both layouts: FREEIMU_EEPROM_SIGNATURE with per axis scales and
+ * FREEIMU_EEPROM_SIGNATURE_MAT with 3x3 matrices.
+*/
 void FreeIMU::calLoad() {
-  if(EEPROM.read(FREEIMU_EEPROM_BASE) == FREEIMU_EEPROM_SIGNATURE) { // check if signature is ok so we have good data
+  uint8_t signature = EEPROM.read(FREEIMU_EEPROM_BASE);
+  for(uint8_t i = 0; i < 9; i++) {
+    acc_mat[i] = magn_mat[i] = gyro_mat[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+  }
+  if(signature == FREEIMU_EEPROM_SIGNATURE || signature == FREEIMU_EEPROM_SIGNATURE_MAT) { // check if signature is ok so we have good data
     location = FREEIMU_EEPROM_BASE + 1; // reset location
     
     eeprom_read_var(sizeof(acc_off_x), (byte *) &acc_off_x);
@@ -820,7 +1030,15 @@ void FreeIMU::calLoad() {
     eeprom_read_var(sizeof(magn_off_x), (byte *) &magn_off_x);
     eeprom_read_var(sizeof(magn_off_y), (byte *) &magn_off_y);
     eeprom_read_var(sizeof(magn_off_z), (byte *) &magn_off_z);
-    
+  }
+  if(signature == FREEIMU_EEPROM_SIGNATURE_MAT) {
+    eeprom_read_var(sizeof(acc_mat), (byte *) acc_mat);
+    eeprom_read_var(sizeof(magn_mat), (byte *) magn_mat);
+    eeprom_read_var(sizeof(gyro_mat), (byte *) gyro_mat);
+    acc_scale_x = acc_scale_y = acc_scale_z = 1;
+    magn_scale_x = magn_scale_y = magn_scale_z = 1;
+  }
+  else if(signature == FREEIMU_EEPROM_SIGNATURE) {
     eeprom_read_var(sizeof(acc_scale_x), (byte *) &acc_scale_x);
     eeprom_read_var(sizeof(acc_scale_y), (byte *) &acc_scale_y);
     eeprom_read_var(sizeof(acc_scale_z), (byte *) &acc_scale_z);
@@ -844,6 +1062,182 @@ void FreeIMU::calLoad() {
     magn_scale_y = 1;
     magn_scale_z = 1;
   }
+  calFold();
+}
+
+/**
+ * Stores a calibration with matrices in the EEPROM and loads it.  data holds
+ * FREEIMU_EEPROM_MAT_SIZE bytes, little endian as on the AVR and ARM boards: int16 acc and
+ * magn offsets (x, y, z each), then float acc_mat, magn_mat and gyro_mat, row major.
+*/
+void FreeIMU::calStore(const uint8_t * data) {
+  EEPROM.write(FREEIMU_EEPROM_BASE, FREEIMU_EEPROM_SIGNATURE_MAT);
+  for(uint8_t i = 0; i < FREEIMU_EEPROM_MAT_SIZE; i++) {
+    EEPROM.write(FREEIMU_EEPROM_BASE + 1 + i, data[i]);
+  }
+  calLoad();
+}
+#endif
+
+/**
+ * Folds the calibration parameters (offsets, scales, matrices), the board axes (BoardAxes)
+ * and the gyro sensitivity into acc_cal, gyro_cal and magn_cal.  To be called after any of
+ * them changed, calLoad and init do; the gyro offsets alone only need calGyroOffsets.
+*/
+void FreeIMU::calFold() {
+  float M[9];
+  const float acc_off[3] = {(float) acc_off_x, (float) acc_off_y, (float) acc_off_z};
+  const float acc_scale[3] = {acc_scale_x, acc_scale_y, acc_scale_z};
+  for(uint8_t i = 0; i < 9; i++) M[i] = acc_mat[i] / acc_scale[i % 3];
+  acc_cal.fold<BoardAxes>(M, acc_off, 1.0f, 0);
+
+  const float zero[3] = {0.0f, 0.0f, 0.0f};
+  gyro_cal.fold<BoardAxes>(gyro_mat, zero, 1.0f / gyro_sensitivity, 3);
+  calGyroOffsets();
+
+  #if HAS_HMC5883L() || HAS_MPU9150() || HAS_MPU9250() || HAS_LSM303()
+	const float magn_off[3] = {(float) magn_off_x, (float) magn_off_y, (float) magn_off_z};
+	const float magn_scale[3] = {magn_scale_x, magn_scale_y, magn_scale_z};
+	for(uint8_t i = 0; i < 9; i++) M[i] = magn_mat[i] / magn_scale[i % 3];
+	magn_cal.fold<BoardAxes>(M, magn_off, 1.0f, 6);
+  #else
+	for(uint8_t i = 0; i < 9; i++) M[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+	magn_cal.fold<BoardAxes>(M, zero, 1.0f, 6);
+  #endif
+}
+
+/**
+ * Moves the gyro offsets into gyro_cal.  With the temperature correction on the gyro offsets
+ * are not used, acgyro_corr has them.
+*/
+void FreeIMU::calGyroOffsets() {
+  float off[3] = {0.0f, 0.0f, 0.0f};
+  if(temp_corr_on != 1) {
+    off[0] = gyro_off_x;
+    off[1] = gyro_off_y;
+    off[2] = gyro_off_z;
+  }
+  gyro_cal.setOffset(off);
+}
+
+/**
+ * The largest magnitude an axis of sensor (0 acc, 1 gyro, 2 magn) takes in the values of
+ * getValues: the full scale range in g, deg/s or the calibrated field when calibrated, raw
+ * counts when not.  For the scales of packed telemetry (TelemetryPack.h).
+*/
+float FreeIMU::calRange(uint8_t sensor) {
+  if(sensor == 0) return acc_cal.bound(32768.0f);
+  if(sensor == 1) return gyro_cal.bound(32768.0f);
+  return magn_cal.bound(MAGN_RAW_RANGE);
+}
+
+/**
+ * Takes gyro_off_* as the gyro bias, converged or as the estimate to start from.
+*/
+void FreeIMU::gyroBiasSet(bool converged) {
+  #if GYRO_BIAS_BACKGROUND
+	const float off[3] = {gyro_off_x, gyro_off_y, gyro_off_z};
+	gyro_bias.set(off, converged);
+  #endif
+  calGyroOffsets();
+}
+
+/**
+ * True once the gyro bias is known: converged in the background, stored at a close temperature
+ * or measured by zeroGyro/initGyros.
+*/
+bool FreeIMU::gyroBiasConverged() {
+  #if GYRO_BIAS_BACKGROUND
+	return gyro_bias.converged();
+  #else
+	return true;
+  #endif
+}
+
+#if GYRO_BIAS_BACKGROUND
+/**
+ * Starts the background gyro bias estimation, from the bias stored in the EEPROM if there is
+ * one.  Whether it counts as converged is decided on the first sample, which brings the
+ * temperature.  Called by init once gyro_sensitivity is known.
+*/
+void FreeIMU::gyroBiasStart() {
+	// windows agree within 0.1 deg/s, the noise within a window stays under 2 deg/s
+	gyro_bias.begin(0.1f * gyro_sensitivity, 2.0f * gyro_sensitivity, nsamples);
+  #if GYRO_BIAS_STORE
+	if(EEPROM.read(FREEIMU_EEPROM_GYRO_BASE) == FREEIMU_EEPROM_SIGNATURE_GYRO) {
+		for(uint8_t i = 0; i < sizeof(gyro_store); i++) {
+			((uint8_t *) gyro_store)[i] = EEPROM.read(FREEIMU_EEPROM_GYRO_BASE + 1 + i);
+		}
+		gyro_off_x = gyro_store[0];
+		gyro_off_y = gyro_store[1];
+		gyro_off_z = gyro_store[2];
+		gyro_stored = true;
+		gyro_warm_check = true;
+	}
+  #endif
+	gyroBiasSet(false);
+}
+
+/**
+ * One sample of the background gyro bias estimation, values_cal as given to applyCalibration.
+ * Moves a new estimate into the calibration and stores it.  Not while the temperature
+ * correction is on, which has the gyro offsets.
+*/
+void FreeIMU::gyroBiasUpdate(const float * values_cal) {
+  #if GYRO_BIAS_STORE
+	#if HAS_ITG3200()
+		float t = senTemp;
+	#elif HAS_MPU6050() || HAS_MPU6000() || HAS_MPU9150() || HAS_MPU9250()
+		float t = DTemp;
+	#else
+		float t = 0.0f;		// no temperature, the stored bias is always taken
+	#endif
+	if(gyro_warm_check) {
+		gyro_warm_check = false;
+		if(fabs(t - gyro_store[3]) <= GYRO_BIAS_WARM_TEMP) gyroBiasSet(true);
+	}
+	if(gyro_store_pos >= 0) gyroStoreStep();
+  #endif
+	if(temp_corr_on == 1 || !gyro_bias.add(&values_cal[0], &values_cal[3], motion_still)) return;
+	
+	const float * b = gyro_bias.bias();
+	gyro_off_x = b[0];
+	gyro_off_y = b[1];
+	gyro_off_z = b[2];
+	calGyroOffsets();
+	
+  #if GYRO_BIAS_STORE
+	// stored again when it moved by 0.1 deg/s or half the warm start temperature range
+	bool moved = !gyro_stored || fabs(t - gyro_store[3]) > 0.5f * GYRO_BIAS_WARM_TEMP;
+	for(uint8_t k = 0; k < 3; k++) {
+		moved = moved || fabs(b[k] - gyro_store[k]) > 0.1f * gyro_sensitivity;
+	}
+	if(moved && gyro_store_pos < 0) {
+		for(uint8_t k = 0; k < 3; k++) gyro_store[k] = b[k];
+		gyro_store[3] = t;
+		gyro_store_pos = 0;
+	}
+  #endif
+}
+#endif
+
+#if GYRO_BIAS_STORE
+/**
+ * Writes the next byte of gyro_store to the EEPROM, one per sample so the loop never waits
+ * for the EEPROM: the signature is cleared first and written last.
+*/
+void FreeIMU::gyroStoreStep() {
+	if(gyro_store_pos == 0) {
+		EEPROM.write(FREEIMU_EEPROM_GYRO_BASE, 0);
+	} else if(gyro_store_pos <= (int8_t) sizeof(gyro_store)) {
+		EEPROM.write(FREEIMU_EEPROM_GYRO_BASE + gyro_store_pos, ((uint8_t *) gyro_store)[gyro_store_pos - 1]);
+	} else {
+		EEPROM.write(FREEIMU_EEPROM_GYRO_BASE, FREEIMU_EEPROM_SIGNATURE_GYRO);
+		gyro_stored = true;
+		gyro_store_pos = -1;
+		return;
+	}
+	gyro_store_pos++;
 }
 #endif
 
@@ -852,6 +1246,7 @@ void FreeIMU::calLoad() {
  * Populates raw_values with the raw_values from the sensors
 */
 void FreeIMU::getRawValues(int * raw_values) {
+    claimBus();
     //Set raw values for Magnetometer, Press, Temp to 0 in case you are only using
 	//an accelerometer and gyro
 	//raw_values[9] will be set to MPU-6050 temp, see zeroGyro to change raw_values dimension
@@ -865,19 +1260,32 @@ void FreeIMU::getRawValues(int * raw_values) {
     gyro.readGyroRaw(&raw_values[3], &raw_values[4], &raw_values[5]);
 	gyro.readTemp(&senTemp);
 	raw_values[9] = senTemp*100;
+  #elif HAS_MAG_AUX()
+    int16_t ax, ay, az, gx, gy, gz, mx, my, mz, t;
+    mag_status = accgyro.getMotion9(&ax, &ay, &az, &gx, &gy, &gz, &mx, &my, &mz, &t);
+    raw_values[0] = ax;
+    raw_values[1] = ay;
+    raw_values[2] = az;
+    raw_values[3] = gx;
+    raw_values[4] = gy;
+    raw_values[5] = gz;
+    raw_values[6] = mx;
+    raw_values[7] = my;
+    raw_values[8] = mz;
+    raw_values[9] = t;
   #elif HAS_MPU6050() || HAS_MPU6000() || HAS_MPU9150() || HAS_MPU9250()
     #ifdef __AVR__
-     accgyro.getMotion6(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5]);  	  
+     accgyro.getMotion7(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5], &raw_values[9]);
  	  #if HAS_MPU9150() || HAS_MPU9250()
 		mag.getHeading(&raw_values[6], &raw_values[7], &raw_values[8]);			
 		delay(10);
 		#endif
-	 rt = accgyro.getTemperature();	  
-     raw_values[9] = rt;
+     rt = raw_values[9];
 	 #else
-      int16_t ax, ay, az, gx, gy, gz, mx, my, mz, rt;
-      accgyro.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
+      int16_t ax, ay, az, gx, gy, gz, rt;
+      accgyro.getMotion7(&ax, &ay, &az, &gx, &gy, &gz, &rt);
 	  #if HAS_MPU9150() || HAS_MPU9250() 
+		int16_t mx, my, mz;
 		mag.getHeading(&mx, &my, &mz);
 		raw_values[6] = mx;
 		raw_values[7] = my;
@@ -890,7 +1298,6 @@ void FreeIMU::getRawValues(int * raw_values) {
       raw_values[3] = gx;
       raw_values[4] = gy;
       raw_values[5] = gz;
-      rt = accgyro.getTemperature();	  
       raw_values[9] = rt; 
     #endif
   #endif 
@@ -916,6 +1323,7 @@ void FreeIMU::getRawValues(int * raw_values) {
     raw_values[8] = compass.m.z;
   #endif	
   
+  releaseBus();
 }
 
 
@@ -923,10 +1331,17 @@ void FreeIMU::getRawValues(int * raw_values) {
  * Populates values with calibrated readings from the sensors
 */
 void FreeIMU::getValues(float * values) { 
+  claimBus();
+  readValues(values, true);
+  releaseBus();
+}
 
-  float acgyro_corr[9] = {0.,0.,0.,0.,0.,0.,0.,0.,0.};
+/**
+ * getValues for the fusion loop: the magnetometer is only read if read_mag is
+ * set, otherwise its last reading is reported again.
+*/
+void FreeIMU::readValues(float * values, bool read_mag) {
   float values_cal[9] = {0.,0.,0.,0.,0.,0.,0.,0.,0.};
-  uint8_t i;
 
   #if HAS_ITG3200()  //assumes adxl3345
     int accval[3];
@@ -937,14 +1352,16 @@ void FreeIMU::getValues(float * values) {
 	
     gyro.readGyro(&values_cal[3]);	
 	gyro.readTemp(&senTemp);
-	if(temp_corr_on == 1) {
-		if(senTemp < senTemp_break) {
-			for(i = 0; i < 9; i++) { 
-				acgyro_corr[i] = c3[i]*(senTemp*senTemp*senTemp) + c2[i]*(senTemp*senTemp) + c1[i]*senTemp + c0[i];
-			}		
-		} 
+	if(temp_corr_on == 1 && senTemp < senTemp_break) {
+	  #if TEMP_CORR_LUT > 0
+		temp_lut.at(senTemp, acgyro_corr);
+	  #else
+		for(uint8_t i = 0; i < 9; i++) { 
+			acgyro_corr[i] = c3[i]*(senTemp*senTemp*senTemp) + c2[i]*(senTemp*senTemp) + c1[i]*senTemp + c0[i];
+		}		
+	  #endif
 	} else {
-		for(i = 0; i < 9; i++) { 
+		for(uint8_t i = 0; i < 9; i++) { 
 			acgyro_corr[i] = 0.0f;
 		}
 	}
@@ -952,10 +1369,7 @@ void FreeIMU::getValues(float * values) {
 	values_cal[0] = (float) accval[0] - acgyro_corr[0];
 	values_cal[1] = (float) accval[1] - acgyro_corr[1];
 	values_cal[2] = (float) accval[2] - acgyro_corr[2];
-		
-	values_cal[3] = (values_cal[3] - gyro_off_x)/gyro_sensitivity;
-	values_cal[4] = (values_cal[4] - gyro_off_y)/gyro_sensitivity;
-	values_cal[5] = (values_cal[5] - gyro_off_z)/gyro_sensitivity;
+	// gyro offsets and sensitivity are applied with the calibration (gyro_cal)
 
   #elif HAS_ALTIMU10()
 	gyro.read();
@@ -973,102 +1387,121 @@ void FreeIMU::getValues(float * values) {
     values_cal[7] = (float) compass.m.y; 
     values_cal[8] = (float) compass.m.z;
 	
-	values_cal[3] = (values_cal[3] - gyro_off_x) / gyro_sensitivity;  //Sensitivity set at 70 for +/-2000 deg/sec, L3GD20H
-	values_cal[4] = (values_cal[4] - gyro_off_y) / gyro_sensitivity;
-	values_cal[5] = (values_cal[5] - gyro_off_z) / gyro_sensitivity;
-	
   #else  // MPU6050
     int16_t accgyroval[9];
-	#if HAS_MPU9150() || HAS_MPU9250()
-		mag.getHeading(&accgyroval[6], &accgyroval[7], &accgyroval[8]);	
-		delay(10);
-		accgyro.getMotion6(&accgyroval[0], &accgyroval[1], &accgyroval[2], 
-						   &accgyroval[3], &accgyroval[4], &accgyroval[5]);	   
-		// read raw heading measurements from device
+	#if HAS_MAG_AUX()
+		// the magnetometer comes in the same burst at no extra cost; a fresh reading is taken
+		// when read_mag asks for one, stale and overflowed ones are skipped
+		mag_status = accgyro.getMotion9(&accgyroval[0], &accgyroval[1], &accgyroval[2],
+		                                &accgyroval[3], &accgyroval[4], &accgyroval[5],
+		                                &accgyroval[6], &accgyroval[7], &accgyroval[8], &DTemp);
+		if(read_mag && (mag_status & (MPU60X0_MAG_FRESH | MPU60X0_MAG_OVERFLOW)) == MPU60X0_MAG_FRESH) {
+			mag_raw[0] = mfilter_mx.filter((float) accgyroval[6]);
+			mag_raw[1] = mfilter_my.filter((float) accgyroval[7]);
+			mag_raw[2] = mfilter_mz.filter((float) accgyroval[8]);
+		}
+		accgyroval[0] = mfilter_accx.filter((float) accgyroval[0]);
+		accgyroval[1] = mfilter_accy.filter((float) accgyroval[1]);
+		accgyroval[2] = mfilter_accz.filter((float) accgyroval[2]);
+		
+		values_cal[6] = mag_raw[0];
+		values_cal[7] = mag_raw[1];
+		values_cal[8] = mag_raw[2];
+	#elif HAS_MPU9150() || HAS_MPU9250()
+		if(read_mag) {
+			// read raw heading measurements from device
+			mag.getHeading(&accgyroval[6], &accgyroval[7], &accgyroval[8]);	
+			delay(10);
+			mag_raw[0] = mfilter_mx.filter((float) accgyroval[6]);
+			mag_raw[1] = mfilter_my.filter((float) accgyroval[7]);
+			mag_raw[2] = mfilter_mz.filter((float) accgyroval[8]); 
+		}
+		accgyro.getMotion7(&accgyroval[0], &accgyroval[1], &accgyroval[2], 
+						   &accgyroval[3], &accgyroval[4], &accgyroval[5], &DTemp);
 		
 		accgyroval[0] = mfilter_accx.filter((float) accgyroval[0]);
 		accgyroval[1] = mfilter_accy.filter((float) accgyroval[1]);
 		accgyroval[2] = mfilter_accz.filter((float) accgyroval[2]);
 		
-		values_cal[6] = mfilter_mx.filter((float) accgyroval[6]);
-		values_cal[7] = mfilter_my.filter((float) accgyroval[7]);
-		values_cal[8] = mfilter_mz.filter((float) accgyroval[8]); 
+		values_cal[6] = mag_raw[0];
+		values_cal[7] = mag_raw[1];
+		values_cal[8] = mag_raw[2];
 
 	#else
-		accgyro.getMotion6(&accgyroval[0], &accgyroval[1], &accgyroval[2], 
-						   &accgyroval[3], &accgyroval[4], &accgyroval[5]);
+		// the temperature comes with the burst, no getTemperature() transaction
+		accgyro.getMotion7(&accgyroval[0], &accgyroval[1], &accgyroval[2], 
+						   &accgyroval[3], &accgyroval[4], &accgyroval[5], &DTemp);
 	#endif
-	
-	DTemp = accgyro.getTemperature();
+	calibrateAccGyro(accgyroval, values_cal);
+  #endif
+  
+  #if HAS_HMC5883L()
+    if(read_mag) magn.getValues(mag_raw);
+	values_cal[6] = mag_raw[0];
+	values_cal[7] = mag_raw[1];
+	values_cal[8] = mag_raw[2];
+  #endif
+  
+  applyCalibration(values_cal, values);
+}
 
-	if(temp_corr_on == 1){
-		if(DTemp < temp_break){    
+/**
+ * Subtracts the temperature correction for DTemp (acgyro_corr) from a raw MPU60X0
+ * accel/gyro sample, fills values_cal[0..5] in raw counts.  Offsets, scales and the gyro
+ * sensitivity are left to the folded CalibTransforms of applyCalibration.
+*/
+void FreeIMU::calibrateAccGyro(int16_t * accgyroval, float * values_cal) {
+	uint8_t i;
+
+	// the raw temperature moves by a count every few samples at most, the
+	// correction is kept until it does (corr_temp, cleared by setTempCalib)
+	if(!corr_valid || DTemp != corr_temp) {
+		if(temp_corr_on == 1 && DTemp < temp_break){    
+		  #if TEMP_CORR_LUT > 0
+			temp_lut.at(DTemp, acgyro_corr);
+		  #else
+			float t = DTemp;	// t^3 overflows an int
 			for( i = 0; i < 9; i++) { 
-				acgyro_corr[i] = c3[i]*(DTemp*DTemp*DTemp) + c2[i]*(DTemp*DTemp) + c1[i]*DTemp + c0[i];
+				acgyro_corr[i] = ((c3[i]*t + c2[i])*t + c1[i])*t + c0[i];
 			}
-		} 
-	} else {
-		for( i = 0; i < 9; i++) { 
-			acgyro_corr[i] = 0.0f;
-	  }
+		  #endif
+		} else {
+			for( i = 0; i < 9; i++) { 
+				acgyro_corr[i] = 0.0f;
+		  }
+		}
+		corr_temp = DTemp;
+		corr_valid = true;
 	}
 	
-    // remove offsets from the gyroscope
-	if(temp_corr_on == 1){
-		//accgyroval[3] = accgyroval[3] - acgyro_corr[3];
-		//accgyroval[4] = accgyroval[4] - acgyro_corr[4];
-		//accgyroval[5] = accgyroval[5] - acgyro_corr[5];
-		
-		values_cal[3] = (float) accgyroval[3] - acgyro_corr[3];
-		values_cal[4] = (float) accgyroval[4] - acgyro_corr[4];
-		values_cal[5] = (float) accgyroval[5] - acgyro_corr[5];
-		}
-	  else {
-		values_cal[3] = (float) accgyroval[3] - gyro_off_x;
-		values_cal[4] = (float) accgyroval[4] - gyro_off_y;
-		values_cal[5] = (float) accgyroval[5] - gyro_off_z;
-	  }
-	  
+	// offsets, scales and gyro sensitivity are applied with the calibration (applyCalibration),
+	// acgyro_corr is 0 without temperature correction
     for( i = 0; i<6; i++) {
-      if( i < 3 ) {
-        values_cal[i] = (float) accgyroval[i] - acgyro_corr[i];
-      }
-      else {
-        //values[i] = ((float) accgyroval[i] - acgyro_corr[i])/ 16.4f; // NOTE: this depends on the sensitivity chosen
-		values_cal[i] = values_cal[i] / gyro_sensitivity;   //for 6050 etc
-	  }
+      values_cal[i] = (float) accgyroval[i] - acgyro_corr[i];
     }	
-  #endif
+}
 
-  
-  #warning Accelerometer calibration active: have you calibrated your device?
-  // remove offsets and scale accelerometer (calibration)
-  values_cal[0] = (values_cal[0] - acc_off_x) / acc_scale_x;
-  values_cal[1] = (values_cal[1] - acc_off_y) / acc_scale_y;
-  values_cal[2] = (values_cal[2] - acc_off_z) / acc_scale_z;
-  
-  #if HAS_HMC5883L()
-    magn.getValues(&values_cal[6]);
+/**
+ * Calibrates values_cal (raw, temperature corrected) into values, board axes:
+ * one CalibTransform per sensor, see calFold.
+*/
+void FreeIMU::applyCalibration(float * values_cal, float * values) {
+  #if GYRO_BIAS_BACKGROUND
+	gyroBiasUpdate(values_cal);
   #endif
+  #warning Accelerometer calibration active: have you calibrated your device?
+  acc_cal.apply(&values_cal[0], &values[0]);
+  gyro_cal.apply(&values_cal[3], &values[3]);
   
   #if HAS_HMC5883L() || HAS_MPU9150() || HAS_MPU9250() || HAS_LSM303()
-    // calibration
+	#warning Magnetometer calibration active: have you calibrated your device?
 	if(temp_corr_on == 1) {
-		values_cal[6] = (values_cal[6] - acgyro_corr[6] - magn_off_x) / magn_scale_x;
-		values_cal[7] = (values_cal[7] - acgyro_corr[7] - magn_off_y) / magn_scale_y;
-		values_cal[8] = (values_cal[8] - acgyro_corr[8] - magn_off_z) / magn_scale_z;
-	}	
-	else {
-		#warning Magnetometer calibration active: have you calibrated your device?
-		values_cal[6] = (values_cal[6] - magn_off_x) / magn_scale_x;
-		values_cal[7] = (values_cal[7] - magn_off_y) / magn_scale_y;
-		values_cal[8] = (values_cal[8] - magn_off_z) / magn_scale_z;	
+		values_cal[6] -= acgyro_corr[6];
+		values_cal[7] -= acgyro_corr[7];
+		values_cal[8] -= acgyro_corr[8];
 	}
   #endif
-  
-  for(int i = 0; i < 9; i++) {
-	values[i] = sensor_sign[i] * values_cal[sensor_order[i]];
-  }
+  magn_cal.apply(&values_cal[6], &values[6]);
 }
 
 
@@ -1077,17 +1510,17 @@ void FreeIMU::getValues(float * values) {
 */
 void FreeIMU::zeroGyro() {
   const int totSamples = nsamples;
-  int raw[11];
-  float values[11]; 
   float tmpOffsets[] = {0,0,0};
   
   for (int i = 0; i < totSamples; i++){
 	#if HAS_ITG3200()
+		float values[11];
 		gyro.readGyro(&values[3]);
 		tmpOffsets[0] += values[3];
 		tmpOffsets[1] += values[4];
 		tmpOffsets[2] += values[5];		
 	#else
+		int raw[11];
 		getRawValues(raw);
 		tmpOffsets[0] += raw[3];
 		tmpOffsets[1] += raw[4];
@@ -1098,6 +1531,7 @@ void FreeIMU::zeroGyro() {
   gyro_off_x = tmpOffsets[0] / totSamples;
   gyro_off_y = tmpOffsets[1] / totSamples;
   gyro_off_z = tmpOffsets[2] / totSamples;
+  gyroBiasSet(true);
 
   delay(5);
 }
@@ -1128,7 +1562,7 @@ void FreeIMU::initGyros() {
     // we try to get a good calibration estimate for up to 10 seconds
     // if the gyros are stable, we should get it in 1 second
 	for (int16_t j = 0; j <= 10 && num_converged < num_gyros; j++) {
-		Vector3f gyro_sum[INS_MAX_INSTANCES], gyro_avg[INS_MAX_INSTANCES], gyro_diff[INS_MAX_INSTANCES];
+		Vector3f gyro_avg[INS_MAX_INSTANCES], gyro_diff[INS_MAX_INSTANCES];
 		float diff_norm[INS_MAX_INSTANCES];
 		
 		//For FreeIMU and most boards we are using only one gyro
@@ -1167,6 +1601,7 @@ void FreeIMU::initGyros() {
 		gyro_off_x = gyro_offset[0].x;
 		gyro_off_y = gyro_offset[0].y;
 		gyro_off_z = gyro_offset[0].z;
+		gyroBiasSet(true);
 		////digitalWrite(12,LOW);
 		return;
 	}
@@ -1182,6 +1617,7 @@ void FreeIMU::initGyros() {
 	gyro_off_x = gyro_offset[0].x;
 	gyro_off_y = gyro_offset[0].y;
 	gyro_off_z = gyro_offset[0].z;
+	gyroBiasSet(true);
 	
 	//digitalWrite(12,LOW);
 	
@@ -1196,60 +1632,128 @@ void FreeIMU::initGyros() {
  * @param q the quaternion to populate
 */
 void FreeIMU::getQ(float * q, float * val) {
-  //float val[11];
-  getValues(val);
-  //DEBUG_PRINT(val[3] * M_PI/180);
-  //DEBUG_PRINT(val[4] * M_PI/180);
-  //DEBUG_PRINT(val[5] * M_PI/180);
-  //DEBUG_PRINT(val[0]);
-  //DEBUG_PRINT(val[1]);
-  //DEBUG_PRINT(val[2]);
-  //DEBUG_PRINT(val[6]);
-  //DEBUG_PRINT(val[7]);
-  //DEBUG_PRINT(val[8]);
- 
-  now = micros();
-  sampleFreq = 1.0 / ((now - lastUpdate) / 1000000.0);
-  lastUpdate = now;
-  
-  // Set up call to the appropriate filter using the axes alignment information
-  // gyro values are expressed in deg/sec, the * M_PI/180 will convert it to radians/sec
-  #if(MARG < 4)
-	#if IS_9DOM() && not defined(DISABLE_MAGN)
-		#if MARG == 0
-			AHRSupdate(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8]);
-		#elif MARG == 1
-			MadgwickAHRSupdate(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8]);
-		#elif MARG == 3	
-			MARGUpdateFilter(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8]);
-		#endif
-		val[9] = maghead.iheading(1, 0, 0, val[0], val[1], val[2], val[6], val[7], val[8]);
-	#else
-		#if MARG == 0
-			AHRSupdateIMU(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2]);
-		#elif MARG == 1
-			MadgwickAHRSupdate(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], 0, 0, 0);
-		#elif  MARG == 3
-			MARGUpdateFilterIMU(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2]);
-		#endif
-		val[9] = -9999.0f;
-	#endif
-
-	q[0] = q0;	
-	q[1] = q1;
-  	q[2] = q2;
-  	q[3] = q3;
+  getQ(q, val, micros());
+}
 
-  #endif
+/**
+ * getQ with the sample timestamp supplied by the caller, e.g. captured in the
+ * sensor data ready interrupt, instead of micros() at the time of the call.
+ * The time step is the difference between consecutive timestamps, so it does
+ * not include the jitter of the main loop.  Log t_us with the getValues
+ * output to replay the run with replayQ.
+ *
+ * With FIFO_BURST the samples are timed by the FIFO sample counter and t_us
+ * is only recorded in dt_jitter.
+ *
+ * @param t_us timestamp of the sample in microseconds
+*/
+void FreeIMU::getQ(float * q, float * val, uint32_t t_us) {
+  float dt;
   
-  #if MARG == 4
-     val[9] = maghead.iheading(1, 0, 0, val[0], val[1], val[2], val[6], val[7], val[8]);
-	dcm.setSensorVals(val);
-	dcm.G_Dt = 1./ sampleFreq;
-  	dcm.calDCM();
-  	dcm.getDCM2Q(q);
+  dt_jitter.add(t_us);
+  lastUpdate = t_us;
+  
+  #if HAS_MPU_FIFO()
+	dt = getFIFOQ(q, val);
+	if(dt == 0.0f) {
+		// no new sample: q and val are the last fused ones, nothing to update
+		return;
+	}
+  #else
+	uint8_t due;
+	
+	// the time step comes first so the magnetometer is only read when its correction is due
+	dt = sampleStep(t_us);
+	due = fusion_rates.advance(dt);
+	
+	//float val[11];
+	readValues(val, due & FUSION_MAG);
+	//DEBUG_PRINT(val[3] * M_PI/180);
+	//DEBUG_PRINT(val[4] * M_PI/180);
+	//DEBUG_PRINT(val[5] * M_PI/180);
+	//DEBUG_PRINT(val[0]);
+	//DEBUG_PRINT(val[1]);
+	//DEBUG_PRINT(val[2]);
+	//DEBUG_PRINT(val[6]);
+	//DEBUG_PRINT(val[7]);
+	//DEBUG_PRINT(val[8]);
+	
+	fusionUpdate(q, val, dt, due);
   #endif
 	
+  motionUpdate(q, val);
+  orientation.set(q, val[9]);
+  
+  #if HAS_PRESS()
+	val[10] = getEstAltitude(q, val, dt);
+  #endif
+  
+  #if HAS_MPU_FIFO()
+	memcpy(fifo_val, val, sizeof(fifo_val));
+  #endif
+}
+
+/**
+ * Runs the same fusion as getQ on a logged sample instead of the sensors, with
+ * no calls to micros().  Given the same samples and timestamps from the same
+ * starting state it reproduces the orientation of the live run bit for bit on
+ * the same target.
+ *
+ * @param q the quaternion to populate
+ * @param val calibrated sample as returned by getValues (val[0..8]) and, with a
+ *        barometer, the barometric altitude in val[10]; on return val[9], val[10]
+ *        and val[11] hold the heading, fused altitude and motion flag like getQ
+ * @param t_us timestamp of the sample in microseconds, as given to getQ or
+ *        returned by getSampleTime
+*/
+void FreeIMU::replayQ(float * q, float * val, uint32_t t_us) {
+  float dt;
+  
+  dt_jitter.add(t_us);
+  dt = sampleStep(t_us);
+  fusionUpdate(q, val, dt, fusion_rates.advance(dt));
+  motionUpdate(q, val);
+  orientation.set(q, val[9]);
+  
+  #if HAS_PRESS()
+	val[10] = getEstAltitude(q, val, val[10], dt);
+  #endif
+}
+
+/**
+ * @return timestamp of the last fused sample in microseconds: the getQ
+ *         timestamp, or with FIFO_BURST the FIFO sample counter converted to
+ *         microseconds since init
+*/
+uint32_t FreeIMU::getSampleTime() {
+  return sample_time;
+}
+
+/**
+ * Time step from the previous sample to the sample at t_us, in seconds.  The
+ * difference is taken in integer microseconds so it is exact and wraps with
+ * the timestamps; the first sample after init has no time step, nor does a
+ * repeated timestamp, which leaves sampleFreq as it was like updateBatch.
+*/
+float FreeIMU::sampleStep(uint32_t t_us) {
+  float dt = 0.0f;
+  
+  if(sample_time_set) {
+	dt = (t_us - sample_time) * 1e-6f;
+	if(dt <= 0.0f) return 0.0f;
+	sampleFreq = 1.0f / dt;
+  }
+  sample_time = t_us;
+  sample_time_set = true;
+  return dt;
+}
+
+/**
+ * Motion detection on the fused sample.  On the transition to no motion the
+ * orientation is reset from the accelerometer and magnetometer to speed up
+ * the yaw convergence.
+*/
+void FreeIMU::motionUpdate(float * q, float * val) {
   MotionDetect( val );
 
   #if IS_9DOM() && not defined(DISABLE_MAGN)
@@ -1259,189 +1763,615 @@ void FreeIMU::getQ(float * q, float * val) {
   #endif
  
   motiondetect_old = val[11];
-  
-  #if HAS_PRESS()
-	val[10] = getEstAltitude(q, val, (1./sampleFreq));
+}
+
+/**
+ * Runs one step of the active fusion engine, and of the shadow engine if one is
+ * set, on the calibrated sample in val and returns the new orientation in q.
+ * Also sets the heading in val[9].
+ *
+ * @param dt time since the previous sample in seconds
+ * @param due corrections to run, from fusion_rates.advance()
+*/
+void FreeIMU::fusionUpdate(float * q, float * val, float dt, uint8_t due) {
+  // gyro values are expressed in deg/sec, the engines convert them to radians/sec
+  #if IS_9DOM() && not defined(DISABLE_MAGN)
+	if(due & FUSION_MAG) {
+		mag_heading = maghead.iheading(1, 0, 0, val[0], val[1], val[2], val[6], val[7], val[8]);
+	}
+	val[9] = mag_heading;
+	const float * sample = val;
+  #else
+	// accel/gyro only update, the engines get neither mag nor heading
+	float sample[10] = {val[0], val[1], val[2], val[3], val[4], val[5], 0.0f, 0.0f, 0.0f, 0.0f};
+	val[9] = -9999.0f;
   #endif
   
+  runEngine(fusion_active, sample, dt, due, q);
+  
+  if(fusion_shadow != FUSION_NONE) {
+	float qs[4];
+	runEngine(fusion_shadow, sample, dt, due, qs);
+	fusion_shadow_diff = fusionQuatAngle(q, qs);
+  }
+  fusion_rates.done(due);
 }
 
-float def_sea_press = 1013.25;
+/**
+ * Runs one timed update of the given engine and returns its orientation in q.
+*/
+void FreeIMU::runEngine(uint8_t engine, const float * val, float dt, uint8_t due, float * q) {
+  switch(engine) {
+	#if HAS_ENGINE(FUSION_MAHONY)
+	case FUSION_MAHONY:
+		fusionTimedUpdate(mahony, val, dt, fusion_rates, due, fusion_stats[FUSION_MAHONY]);
+		mahony.getQ(q);
+		break;
+	#endif
+	#if HAS_ENGINE(FUSION_MADGWICK)
+	case FUSION_MADGWICK:
+		fusionTimedUpdate(madgwick, val, dt, fusion_rates, due, fusion_stats[FUSION_MADGWICK]);
+		madgwick.getQ(q);
+		break;
+	#endif
+	#if HAS_ENGINE(FUSION_MARG)
+	case FUSION_MARG:
+		fusionTimedUpdate(marg, val, dt, fusion_rates, due, fusion_stats[FUSION_MARG]);
+		marg.getQ(q);
+		break;
+	#endif
+	#if HAS_ENGINE(FUSION_DCM)
+	case FUSION_DCM:
+		fusionTimedUpdate(dcmEngine, val, dt, fusion_rates, due, fusion_stats[FUSION_DCM]);
+		dcmEngine.getQ(q);
+		break;
+	#endif
+	#if HAS_ENGINE(FUSION_EKF)
+	case FUSION_EKF:
+		fusionTimedUpdate(ekf, val, dt, fusion_rates, due, fusion_stats[FUSION_EKF]);
+		ekf.getQ(q);
+		break;
+	#endif
+  }
+}
 
-#if HAS_MS5611() && !HAS_APM25()
-	/**
-	* Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
-	*/
-	float FreeIMU::getBaroAlt(float sea_press) {
-		float temp = baro.getTemperature(MS561101BA_OSR_4096);
-		float press = baro.getPressure(MS561101BA_OSR_4096);
-        float new_press = kPress.measureRSSI(press);
-		return ((pow((sea_press / new_press), 1/5.257) - 1.0) * (temp + 273.15)) / 0.0065;
-	}
+void FreeIMU::getEngineQ(uint8_t engine, float * q) {
+  switch(engine) {
+	#if HAS_ENGINE(FUSION_MAHONY)
+	case FUSION_MAHONY: mahony.getQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MADGWICK)
+	case FUSION_MADGWICK: madgwick.getQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MARG)
+	case FUSION_MARG: marg.getQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_DCM)
+	case FUSION_DCM: dcmEngine.getQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_EKF)
+	case FUSION_EKF: ekf.getQ(q); break;
+	#endif
+	default:
+		// not compiled in
+		q[0] = 1.0f;
+		q[1] = q[2] = q[3] = 0.0f;
+		break;
+  }
+}
 
-	// Returns temperature from MS5611 - added by MJS
-	float FreeIMU::getBaroTemperature() {
-		float temp1 = baro.getTemperature(MS561101BA_OSR_4096);
-		return(temp1);
-	}
+void FreeIMU::setEngineQ(uint8_t engine, const float * q) {
+  switch(engine) {
+	#if HAS_ENGINE(FUSION_MAHONY)
+	case FUSION_MAHONY: mahony.setQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MADGWICK)
+	case FUSION_MADGWICK: madgwick.setQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MARG)
+	case FUSION_MARG: marg.setQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_DCM)
+	case FUSION_DCM: dcmEngine.setQ(q); break;
+	#endif
+	#if HAS_ENGINE(FUSION_EKF)
+	case FUSION_EKF: ekf.setQ(q); break;
+	#endif
+  }
+}
 
-	float FreeIMU::getBaroPressure() {
-		float temp2 = baro.getPressure(MS561101BA_OSR_4096);
-		return(temp2);
-	}
+/**
+ * Resets the orientation and integral terms of every quaternion engine (bias and
+ * covariance for the EKF).  The DCM engine re-aligns itself and is left alone, as before.
+*/
+void FreeIMU::resetEngines() {
+  #if HAS_ENGINE(FUSION_MAHONY)
+	mahony.reset();
+	mahony.setGains(twoKpDef, twoKiDef);
+  #endif
+  #if HAS_ENGINE(FUSION_MADGWICK)
+	madgwick.reset();
+  #endif
+  #if HAS_ENGINE(FUSION_MARG)
+	marg.reset();
+  #endif
+  #if HAS_ENGINE(FUSION_EKF)
+	ekf.reset();
+  #endif
+}
 
-	/**
-	* Returns an altitude estimate from baromether readings only using a default sea level pressure
-	*/
-	float FreeIMU::getBaroAlt() {
-		return getBaroAlt(def_sea_press);
-	}
+/**
+ * Sets the rates of the accelerometer and magnetometer corrections, the gyro is
+ * integrated on every sample.  See FUSION_ACC_RATE in FreeIMU.h.
+ *
+ * @param acc_hz accelerometer correction rate in Hz, 0 = every sample
+ * @param mag_hz magnetometer read and correction rate in Hz, 0 = every sample
+*/
+void FreeIMU::setCorrectionRates(float acc_hz, float mag_hz) {
+  fusion_rates.setRates(acc_hz, mag_hz);
+}
 
-#endif
+/**
+ * @return true if the engine is compiled in, see FUSION_ENGINES in FreeIMU.h
+*/
+bool FreeIMU::hasFusionEngine(uint8_t engine) {
+  return engine < FUSION_SLOTS && HAS_ENGINE(engine);
+}
 
-#if HAS_MS5611() && HAS_APM25()
-	/**
-	* Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
-	*/
-	float FreeIMU::getBaroAlt(float sea_press) {
-		//baro.read();
-		float temp = baro.get_temperature()/100.0f;
-		float press = baro.get_pressure()/100.0f;
-        float new_press = kPress.measureRSSI(press);
-		return ((pow((sea_press / new_press), 1/5.257) - 1.0) * (temp + 273.15)) / 0.0065;
-	}
+/**
+ * Selects the engine whose orientation getQ returns.  The engine starts from the
+ * orientation of the previously active one.
+ *
+ * @param engine FUSION_MAHONY, FUSION_MADGWICK, FUSION_MARG, FUSION_DCM or FUSION_EKF
+ * @return false if the engine is not compiled in
+*/
+bool FreeIMU::setFusionEngine(uint8_t engine) {
+  float q[4];
+  
+  if(!hasFusionEngine(engine)) return false;
+  if(engine == fusion_active) return true;
+  
+  getEngineQ(fusion_active, q);
+  setEngineQ(engine, q);
+  if(fusion_shadow == engine) fusion_shadow = FUSION_NONE;
+  fusion_active = engine;
+  return true;
+}
 
-	// Returns temperature from MS5611 - added by MJS
-	float FreeIMU::getBaroTemperature() {
-		baro.read();
-		float temp1 = baro.get_temperature()/100.0f;
-		return(temp1);
-	}
+/**
+ * Runs a second engine on the same samples as the active one.  Its cost is kept in
+ * fusion_stats and the angle between the two orientations in fusion_shadow_diff.
+ * The shadow engine starts from the active engine's orientation.
+ *
+ * @param engine engine id or FUSION_NONE to stop shadowing
+ * @return false if the engine is not compiled in or is the active one
+*/
+bool FreeIMU::setShadowEngine(uint8_t engine) {
+  float q[4];
+  
+  if(engine == FUSION_NONE) {
+	fusion_shadow = FUSION_NONE;
+	return true;
+  }
+  if(!hasFusionEngine(engine) || engine == fusion_active) return false;
+  
+  getEngineQ(fusion_active, q);
+  setEngineQ(engine, q);
+  fusion_stats[engine].clear();
+  fusion_shadow_diff = 0.0f;
+  fusion_shadow = engine;
+  return true;
+}
 
-	float FreeIMU::getBaroPressure() {
-		baro.read();
-		float temp2 = baro.get_pressure()/100.0f;
-		return(temp2);
-	}
+void FreeIMU::clearFusionStats() {
+  for(uint8_t i = 0; i < FUSION_SLOTS; i++) fusion_stats[i].clear();
+}
 
-	/**
-	* Returns an altitude estimate from baromether readings only using a default sea level pressure
-	*/
-	float FreeIMU::getBaroAlt() {
-		return getBaroAlt(def_sea_press);
+/**
+ * updateBatch loop for one engine, kept as a template so each engine's update
+ * is called directly.  Takes the same path as fusionUpdate: the corrections
+ * are scheduled by fusion_rates, the shadow engine runs on every sample and
+ * the magnetometer heading is only recomputed when its correction is due.
+*/
+template <class Engine>
+void FreeIMU::batchUpdate(FusionEngine<Engine> &e, const FusionBatch &batch, float * q_all) {
+  float dt = batch.dt;
+  float v[10] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  uint8_t due;
+  
+  for(uint16_t i = 0; i < batch.n; i++) {
+	if(batch.t_us != NULL) {
+		if(i > 0) {
+			dt = (batch.t_us[i] - batch.t_us[i - 1]) * 1e-6f;
+		} else if(sample_time_set) {
+			dt = (batch.t_us[0] - sample_time) * 1e-6f;
+		}
 	}
-
-#endif
-
-#if HAS_BMP085()
-	//used for BMP085
-	long Temperature = 0, Pressure = 0, Altitude = 0;
 	
-	// Returns temperature from BMP085 - added by MJS
-	float FreeIMU::getBaroTemperature() {
-		baro085.getTemperature(&Temperature);
-		float temp1 = Temperature * 0.1;		
-		return(temp1);
-	}
-
-	float FreeIMU::getBaroPressure() {
-		baro085.getPressure(&Pressure);
-		float temp3 = Pressure * 0.01;
-        //float new_press = kPress.measureRSSI(Pressure * 0.01);
-		return(temp3);
-	}
-
-	/**
-	* Returns an altitude estimate from baromether readings only using a default sea level pressure
-	*/
-	float FreeIMU::getBaroAlt() {
-		//baro085.getAltitude(&Altitude);
-		//return Altitude * 0.01;
-		return getBaroAlt(def_sea_press);
+	due = fusion_rates.advance(dt);
+	
+	v[0] = batch.ax[i];
+	v[1] = batch.ay[i];
+	v[2] = batch.az[i];
+	v[3] = batch.gx[i];
+	v[4] = batch.gy[i];
+	v[5] = batch.gz[i];
+	if(batch.mx != NULL) {
+		v[6] = batch.mx[i];
+		v[7] = batch.my[i];
+		v[8] = batch.mz[i];
+		#if IS_9DOM()
+			if(due & FUSION_MAG) {
+				mag_heading = maghead.iheading(1, 0, 0, v[0], v[1], v[2], v[6], v[7], v[8]);
+			}
+			v[9] = mag_heading;
+		#endif
 	}
 	
-	/**
-	* Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
-	*/
-	float FreeIMU::getBaroAlt(float sea_press) {
-		float temp = getBaroTemperature();
-		float press = getBaroPressure();
-        float new_press = kPress.measureRSSI(press);
-		return ((pow((sea_press / new_press), 1/5.257) - 1.0) * (temp + 273.15)) / 0.0065;
+	fusionTimedUpdate(e, v, dt, fusion_rates, due, fusion_stats[fusion_active]);
+	
+	if(fusion_shadow != FUSION_NONE) {
+		float qa[4], qs[4];
+		e.getQ(qa);
+		runEngine(fusion_shadow, v, dt, due, qs);
+		fusion_shadow_diff = fusionQuatAngle(qa, qs);
 	}
+	fusion_rates.done(due);
 	
-#endif
+	if(q_all != NULL) e.getQ(&q_all[4 * i]);
+  }
+  // an empty batch or repeated timestamps leave the rate as it was
+  if(batch.n > 0 && dt > 0.0f) {
+	sampleFreq = 1.0f / dt;
+  }
+}
 
-#if HAS_LPS331()
+/**
+ * Runs the active engine over a batch of already calibrated samples, with
+ * no sensor reads and no calls to micros().  Used to replay logged data or to
+ * catch up on a backlog of samples in one tight loop.
+ *
+ * The time step of sample i is t_us[i] - t_us[i-1].  For the first sample the
+ * timestamp of the last sample of the previous batch is used, so consecutive
+ * batches chain; batch.dt is used when there is no previous timestamp or when
+ * t_us is NULL.  The corrections follow fusion_rates and the shadow engine,
+ * if set, is run on the same samples, as in getQ.
+ *
+ * @param batch the samples, see FusionBatch
+ * @param q populated with the orientation after the last sample
+ * @param q_all if not NULL, populated with batch.n quaternions (4 floats each),
+ *        the orientation after every sample
+*/
+void FreeIMU::updateBatch(const FusionBatch &batch, float * q, float * q_all) {
+  switch(fusion_active) {
+	#if HAS_ENGINE(FUSION_MAHONY)
+	case FUSION_MAHONY: batchUpdate(mahony, batch, q_all); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MADGWICK)
+	case FUSION_MADGWICK: batchUpdate(madgwick, batch, q_all); break;
+	#endif
+	#if HAS_ENGINE(FUSION_MARG)
+	case FUSION_MARG: batchUpdate(marg, batch, q_all); break;
+	#endif
+	#if HAS_ENGINE(FUSION_DCM)
+	case FUSION_DCM: batchUpdate(dcmEngine, batch, q_all); break;
+	#endif
+	#if HAS_ENGINE(FUSION_EKF)
+	case FUSION_EKF: batchUpdate(ekf, batch, q_all); break;
+	#endif
+  }
+  
+  if(batch.t_us != NULL && batch.n > 0) {
+	sample_time = batch.t_us[batch.n - 1];
+	sample_time_set = true;
+  }
+  
+  getEngineQ(fusion_active, q);
+  orientation.set(q, mag_heading);
+}
 
-	// Returns temperature from LPS331 - added by MJS
-	float FreeIMU::getBaroTemperature() {
-		float temp1 = baro331.readTemperatureC();		
-		return(temp1);
+#if HAS_MPU_FIFO()
+/**
+ * Moves whole frames from the MPU60X0 FIFO into fifoRing, one Wire sized chunk
+ * at a time, until the FIFO is empty or the ring is full.  Frames that do not
+ * fit stay in the FIFO for the next call.
+ *
+ * @return number of samples added to the ring
+*/
+uint8_t FreeIMU::fillFIFO() {
+  uint8_t chunk[MPU60X0_FIFO_CHUNK_SIZE];
+  uint8_t added = 0;
+  
+  while(fifoRing.space() > 0) {
+	uint8_t want = MPU60X0_FIFO_CHUNK_SIZE / MPU60X0_FIFO_FRAME_SIZE;
+	if(want > fifoRing.space()) want = fifoRing.space();
+	
+	int16_t n = accgyro.getFIFOFrames(chunk, want);
+	if(n < 0) {
+		fifo_overflows++;
+		break;
 	}
+	added += fifoRing.pushFrames(chunk, n * MPU60X0_FIFO_FRAME_SIZE);
+	if(n < want) break;
+  }
+  return added;
+}
 
-	float FreeIMU::getBaroPressure() {
-        //float new_press = kPress.measureRSSI(baro331.readPressureMillibars());
-		float new_press = baro331.readPressureMillibars();
-		return(new_press);
+/**
+ * FIFO burst version of getValues + filter update.  Drains the MPU60X0 FIFO and
+ * runs the filter once for every buffered sample with the FIFO sample period as
+ * its time step.  The magnetometer is read once per call and shared by all the
+ * samples of the burst.  val holds the last sample fused.  With no sample pending
+ * q and val are set to the last fused orientation and sample, as getQ left them.
+ *
+ * @return time covered by the samples fused in seconds, 0 if none were pending
+*/
+float FreeIMU::getFIFOQ(float * q, float * val) {
+  float values_cal[9];
+  int16_t accgyroval[6];
+  MotionSample s;
+  float dt = 0.0f;
+  uint8_t due;
+  // the magnetometer is read at most once per call, when the first sample will need it
+  bool mag_fresh = fusion_rates.magDue(fifo_dt);
+  
+  if(mag_fresh) {
+	claimBus();
+	#if HAS_MAG_AUX()
+		int16_t magval[3];
+		mag_status = accgyro.getAuxMagnetometer(&magval[0], &magval[1], &magval[2]);
+		if((mag_status & (MPU60X0_MAG_FRESH | MPU60X0_MAG_OVERFLOW)) == MPU60X0_MAG_FRESH) {
+			mag_raw[0] = mfilter_mx.filter((float) magval[0]);
+			mag_raw[1] = mfilter_my.filter((float) magval[1]);
+			mag_raw[2] = mfilter_mz.filter((float) magval[2]);
+		}
+	#elif HAS_MPU9150() || HAS_MPU9250()
+		int16_t magval[3];
+		mag.getHeading(&magval[0], &magval[1], &magval[2]);
+		delay(10);
+		mag_raw[0] = mfilter_mx.filter((float) magval[0]);
+		mag_raw[1] = mfilter_my.filter((float) magval[1]);
+		mag_raw[2] = mfilter_mz.filter((float) magval[2]);
+	#elif HAS_HMC5883L()
+		magn.getValues(mag_raw);
+	#endif
+	releaseBus();
+  }
+  
+  sampleFreq = 1.0f / fifo_dt;
+  
+  do {
+	while(fifoRing.pop(s)) {
+		accgyroval[0] = s.ax;
+		accgyroval[1] = s.ay;
+		accgyroval[2] = s.az;
+		accgyroval[3] = s.gx;
+		accgyroval[4] = s.gy;
+		accgyroval[5] = s.gz;
+		#if HAS_MPU9150() || HAS_MPU9250()
+			accgyroval[0] = mfilter_accx.filter((float) accgyroval[0]);
+			accgyroval[1] = mfilter_accy.filter((float) accgyroval[1]);
+			accgyroval[2] = mfilter_accz.filter((float) accgyroval[2]);
+		#endif
+		DTemp = s.temp;
+		
+		calibrateAccGyro(accgyroval, values_cal);
+		values_cal[6] = mag_raw[0];
+		values_cal[7] = mag_raw[1];
+		values_cal[8] = mag_raw[2];
+		applyCalibration(values_cal, val);
+		
+		due = fusion_rates.advance(fifo_dt);
+		if(mag_fresh) {
+			mag_fresh = !(due & FUSION_MAG);
+		} else {
+			due &= ~FUSION_MAG;		// wait for the next reading
+		}
+		fusionUpdate(q, val, fifo_dt, due);
+		dt += fifo_dt;
+		sample_time += FIFO_PERIOD_US;
 	}
+  #if HAS_FIFO_INT()
+  } while(false);		// fifoISR fills the ring
+  #else
+  } while(fillFIFO() > 0);
+  #endif
+  
+  if(dt == 0.0f) {
+	// nothing new in the FIFO, report the current orientation and sample
+	getEngineQ(fusion_active, q);
+	memcpy(val, fifo_val, sizeof(fifo_val));
+  } else {
+	sample_time_set = true;
+  }
+  
+  return dt;
+}
+#endif
 
-	/**
-	* Returns an altitude estimate from baromether readings only using a default sea level pressure
-	*/
-	float FreeIMU::getBaroAlt() {        
-        //float new_press = kPress.measureRSSI(baro331.readPressureMillibars());
-		//float temp3 = baro331.pressureToAltitudeMeters(def_sea_press);
-		return getBaroAlt(def_sea_press);
-	}
+/**
+ * Copies the FIFO acquisition counters, all zero without FIFO_BURST.
+ * The copy is taken with interrupts off so it is consistent with FIFO_INT_PIN.
+*/
+void FreeIMU::getFIFOStats(FIFOStats &st) {
+  memset(&st, 0, sizeof(st));
+  #if HAS_MPU_FIFO()
+	noInterrupts();
+	st.depth = fifoRing.count();
+	st.peak = fifoRing.peak;
+	st.overruns = fifoRing.overruns;
+	st.overflows = fifo_overflows;
+	#if HAS_FIFO_INT()
+		st.interrupts = fifo_interrupts;
+		st.deferred = fifo_deferred;
+	#endif
+	interrupts();
+  #endif
+}
 
-	/**
-	* Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
-	*/
-	float FreeIMU::getBaroAlt(float sea_press) {
-		float temp = baro331.readTemperatureC();
-		float press = baro331.readPressureMillibars();
-        float new_press = kPress.measureRSSI(press);
-		return ((pow((sea_press / new_press), 1/5.257) - 1.0) * (temp + 273.15)) / 0.0065;
-	}
-	
+/**
+ * Moves the samples waiting in the MPU FIFO into the ring without fusing them,
+ * for a loop that reads the FIFO more often than it calls getQ so the FIFO does
+ * not overflow while the loop is busy elsewhere.  Does nothing without
+ * FIFO_BURST, or with FIFO_INT_PIN where the interrupt reads the FIFO.
+ *
+ * @return number of samples added to the ring
+*/
+uint8_t FreeIMU::acquire() {
+  #if HAS_MPU_FIFO() && !HAS_FIFO_INT()
+	return fillFIFO();
+  #else
+	return 0;
+  #endif
+}
+
+#if HAS_FIFO_INT()
+FreeIMU * FreeIMU::fifo_owner = NULL;
+
+/**
+ * MPU60X0 data-ready interrupt: moves the FIFO into fifoRing, the producer side
+ * of the ring.  Interrupts are re-enabled for the transfers because Wire needs
+ * its own interrupt to complete them (on ARM cores the Wire interrupt must have
+ * a higher priority than the pin interrupt).  If the loop holds the bus the read
+ * is left to releaseBus, and interrupts arriving during the read are folded
+ * into it, the FIFO is read until empty anyway.
+*/
+void FreeIMU::fifoISR() {
+  FreeIMU * imu = fifo_owner;
+  
+  imu->fifo_interrupts++;
+  if(imu->bus_claims) {
+	imu->fifo_int_pending = true;
+	imu->fifo_deferred++;
+	return;
+  }
+  imu->bus_claims = 1;
+  do {
+	imu->fifo_int_pending = false;
+	interrupts();
+	imu->fillFIFO();
+	noInterrupts();
+  } while(imu->fifo_int_pending);
+  imu->bus_claims = 0;
+}
+
+/**
+ * Claims the I2C bus for the loop: until releaseBus the data-ready interrupt
+ * only records that the FIFO needs reading, so it never starts a transfer in
+ * the middle of one of the loop's.  getQ, getValues, getRawValues and the baro
+ * getters claim the bus themselves, a sketch that talks to other devices on
+ * the bus (or to the sensors directly) has to do the same.  Claims nest.
+*/
+void FreeIMU::claimBus() {
+  noInterrupts();
+  bus_claims++;
+  interrupts();
+}
+
+/**
+ * Releases a claimBus.  The last release reads the FIFO if an interrupt came
+ * in meanwhile, still holding the bus so the interrupt stays out.
+*/
+void FreeIMU::releaseBus() {
+  noInterrupts();
+  while(bus_claims == 1 && fifo_int_pending) {
+	fifo_int_pending = false;
+	interrupts();
+	fillFIFO();
+	noInterrupts();
+  }
+  bus_claims--;
+  interrupts();
+}
 #endif
 
-#if HAS_MPL3115A2()
-	// Returns temperature, pressure and altitude from MPL3115A2
-	// added by https://github.com/mariocannistra
-	
-	float FreeIMU::getBaroTemperature() {
-		float temp1 = baro3115.readTemp();
-		// also available in °F float temp1 = baro3115.readTempF();
-		return(temp1);
-	}
+float def_sea_press = 1013.25;
 
-	float FreeIMU::getBaroPressure() {
-		// 1 kPa = 10 hPa = 1000 Pa
-		// 100 Pascals = 1 hPa = 1 mb
-		// sensor output is in Pa
-		// need to convert Pascals to millibars:
-		float new_press = baro3115.readPressure() / 100 ;
-		return(new_press);
-	}
+#if HAS_BARO()
+// the barometer of the board; all drivers have the same start/poll/collect interface
+#if HAS_MS5611()
+	#define BARO_DEVICE baro
+#elif HAS_BMP085()
+	#define BARO_DEVICE baro085
+#elif HAS_LPS331()
+	#define BARO_DEVICE baro331
+#elif HAS_MPL3115A2()
+	#define BARO_DEVICE baro3115
+#endif
+#if HAS_MS5611() && !HAS_APM25()
+	#define BARO_START() baro.startMeasurement(MS561101BA_OSR_4096)
+#else
+	#define BARO_START() BARO_DEVICE.startMeasurement()
+#endif
+#if HAS_MPL3115A2() && !HAS_MS5611() && !HAS_BMP085() && !HAS_LPS331()
+	#define BARO_MBAR 0.01f		// MPL3115A2 reports Pa
+#else
+	#define BARO_MBAR 1.0f
+#endif
 
-	/**
-	* Returns an altitude estimate from baromether readings only using a default sea level pressure
-	*/
-	float FreeIMU::getBaroAlt() {
-		return getBaroAlt(def_sea_press);
-	}
+/**
+ * Advances the barometer conversion without waiting for it: collects the
+ * sample once the driver has completed it and starts the next one, so the
+ * barometer runs at its own rate (about 55Hz for the MS5611 at OSR 4096) next
+ * to a much faster attitude loop.  The getBaro* functions call it and report
+ * the latest completed sample.
+ *
+ * @return true if a new sample was collected
+*/
+bool FreeIMU::pollBaro() {
+  float press = 0.0f;
+  claimBus();
+  bool fresh = BARO_DEVICE.pollMeasurement();
+  if(fresh) {
+	press = BARO_DEVICE.getMeasuredPressure() * BARO_MBAR;
+	baro_temp = BARO_DEVICE.getMeasuredTemperature();
+	BARO_START();
+  }
+  releaseBus();
+  if(fresh) {
+	baro_press = press;
+	baro_press_filt = kPress.measureRSSI(press);
+  }
+  return fresh;
+}
 
-	/**
-	* Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
-	*/
-	float FreeIMU::getBaroAlt(float sea_press) {
-		float temp = baro3115.readTemp();
-		float press = baro3115.readPressure() / 100.;
-        float new_press = kPress.measureRSSI(press);
-		return ((pow((sea_press / new_press), 1/5.257) - 1.0) * (temp + 273.15)) / 0.0065;
-	}	
+/**
+ * Starts the barometer and waits for its first sample, at most 600ms, so the
+ * getters never report an empty one.  Called by init.
+*/
+void FreeIMU::startBaro() {
+  claimBus();
+  BARO_START();
+  releaseBus();
+  for(int i = 0; i < 600 && !pollBaro(); i++) delay(1);
+}
+
+/**
+ * Returns an altitude estimate from barometer readings only using sea_press as current sea level pressure
+*/
+float FreeIMU::getBaroAlt(float sea_press) {
+	pollBaro();
+	return ((pow((sea_press / baro_press_filt), 1/5.257) - 1.0) * (baro_temp + 273.15)) / 0.0065;
+}
+
+/**
+ * Returns an altitude estimate from baromether readings only using a default sea level pressure
+*/
+float FreeIMU::getBaroAlt() {
+	return getBaroAlt(def_sea_press);
+}
+
+// Returns temperature of the latest barometer sample - added by MJS
+float FreeIMU::getBaroTemperature() {
+	pollBaro();
+	return baro_temp;
+}
+
+// Returns pressure in mbar of the latest barometer sample, not filtered
+float FreeIMU::getBaroPressure() {
+	pollBaro();
+	return baro_press;
+}
 #endif
 
 
@@ -1451,6 +2381,14 @@ float def_sea_press = 1013.25;
 */
 #if HAS_PRESS()
 float FreeIMU::getEstAltitude(float * q1, float * val, float dt2) {
+  return getEstAltitude(q1, val, getBaroAlt(), dt2);
+}
+
+/**
+ * getEstAltitude with the barometric altitude supplied by the caller, used by
+ * replayQ.
+*/
+float FreeIMU::getEstAltitude(float * q1, float * val, float alt, float dt2) {
   //float q1[4]; // quaternion
   float q2[4]; // quaternion
   //float val[11];
@@ -1479,8 +2417,6 @@ float FreeIMU::getEstAltitude(float * q1, float * val, float dt2) {
   //q2[1] = -q1[1]; q2[2] = -q1[2]; q2[3] = -q1[3]; q2[0] = q1[0]; //Conjugating
   q2[1] = -q1[1]; q2[2] = -q1[2]; q2[3] = -q1[3]; q2[0] = q1[0]; //Conjugating
   Qmultiply(dyn_acc_earth, dyn_acc_temp, q2);
-  
-  float alt = getBaroAlt();
 	
    //lastUpdate1 = now1;
   //return altComp.update(dyn_acc_earth[3], alt, (1./(sampleFreq*4)));
@@ -1497,13 +2433,8 @@ float FreeIMU::getEstAltitude(float * q1, float * val, float dt2) {
  * @param angles three floats array which will be populated by the Euler angles in radians
 */
 void FreeIMU::getEulerRad(float * angles) {
-  float q[4]; // quaternion
-  float val[11];
-  
-  getQ(q, val);
-  angles[0] = atan2(2 * q[1] * q[2] - 2 * q[0] * q[3], 2 * q[0]*q[0] + 2 * q[1] * q[1] - 1); // psi
-  angles[1] = -asin(2 * q[1] * q[3] + 2 * q[0] * q[2]); // theta
-  angles[2] = atan2(2 * q[2] * q[3] - 2 * q[0] * q[1], 2 * q[0] * q[0] + 2 * q[3] * q[3] - 1); // phi
+  refreshOrientation(ORIENT_EULER);
+  arr3_copy(orientation.getEuler(), angles);
 }
 
 
@@ -1531,18 +2462,44 @@ void FreeIMU::getEuler(float * angles) {
  * @param ypr three floats array which will be populated by Yaw, Pitch and Roll angles in radians
 */
 void FreeIMU::getYawPitchRollRad(float * ypr) {
-  float q[4]; // quaternion
-  float val[11];
-  float gx, gy, gz; // estimated gravity direction
-  getQ(q, val);
-  
-  gx = 2 * (q[1]*q[3] - q[0]*q[2]);
-  gy = 2 * (q[0]*q[1] + q[2]*q[3]);
-  gz = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
-  
-  ypr[0] = atan2(2 * q[1] * q[2] - 2 * q[0] * q[3], 2 * q[0]*q[0] + 2 * q[1] * q[1] - 1);
-  ypr[1] = atan(gx / sqrt(gy*gy + gz*gz));
-  ypr[2] = atan(gy / sqrt(gx*gx + gz*gz));
+  refreshOrientation(ORIENT_YPR);
+  arr3_copy(orientation.getYawPitchRoll(), ypr);
+}
+
+/**
+ * Returns the rotation matrix of the current orientation, taking sensor frame vectors to
+ * the Earth frame.
+ * 
+ * @param m nine floats array which will be populated row by row
+*/
+void FreeIMU::getRotationMatrix(float * m) {
+  refreshOrientation(ORIENT_MATRIX);
+  const float * r = orientation.getMatrix();
+  for(uint8_t i = 0; i < 9; i++) m[i] = r[i];
+}
+
+/**
+ * Returns the estimated gravity direction in the sensor frame, a unit vector.
+ * 
+ * @param g three floats array which will be populated with the x, y, z components
+*/
+void FreeIMU::getGravity(float * g) {
+  refreshOrientation(ORIENT_GRAVITY);
+  arr3_copy(orientation.getGravity(), g);
+}
+
+/**
+ * Makes sure the orientation snapshot is current for the getter reading part: if that
+ * getter already read this snapshot the sketch is polling it without calling getQ,
+ * so the filter is updated first.
+*/
+void FreeIMU::refreshOrientation(uint8_t part) {
+  if(orientation.consume(part)) {
+	float q[4];
+	float val[12];
+	getQ(q, val);
+	orientation.consume(part);
+  }
 }
 
 /**
@@ -1583,37 +2540,8 @@ void FreeIMU::getYawPitchRollRadAHRS(float * ypr, float * q) {
  * @param ypr three floats array which will be populated by Yaw, Pitch and Roll angles in degrees
 */
 void FreeIMU::getYawPitchRoll180(float * ypr) {
-	float q[4];				// quaternion
-	float val[11];
-	float gx, gy, gz;		// estimated gravity direction
-	
-	getQ(q, val);
-
-	gx = 2 * (q[1]*q[3] - q[0]*q[2]);
-	gy = 2 * (q[0]*q[1] + q[2]*q[3]);
-	gz = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
-
-	//calculating yaw
-	//ypr[0] = atan2(2 * q[1] * q[2] - 2 * q[0] * q[3], 2 * q[0]*q[0] + 2 * q[1] * q[1] - 1);	
-	ypr[0] = val[9];
-	if(ypr[0] > 180.) ypr[0] = ypr[0] - 360.;
-	ypr[0] = ypr[0] * 0.0174532925;
-	
-	//calculating Pitch1
-	//Serial.print(gx); Serial.print("       "); Serial.print(gz); Serial.print("       ");
-	if(gx > 0 && gz > 0) {
-		ypr[1] = atan(gx / sqrt(gy*gy + gz*gz));
-	} else if(gx > 0 && gz <= 0) {
-		ypr[1] = PI - atan(gx / sqrt(gy*gy + gz*gz));
-	} else if(gx < 0 && gz < 0) {
-		ypr[1] = (-PI - atan(gx / sqrt(gy*gy + gz*gz)));
-	} else  {
-		ypr[1] =  atan(gx / sqrt(gy*gy + gz*gz));
-	}
-	
-	//Calculating Roll1
-    ypr[2] = atan(gy / sqrt(gx*gx + gz*gz));
-
+  refreshOrientation(ORIENT_YPR180);
+  arr3_copy(orientation.getYawPitchRoll180(), ypr);
 }
 
 /**
@@ -1648,14 +2576,12 @@ float FreeIMU::calcMagHeading(float q0, float q1, float q2, float q3, float bx,
   gy = 2 * (q0*q1 + q2*q3);
   gz = q0*q0 - q1*q1 - q2*q2 + q3*q3;
   
-  ypr[0] = atan2(2 * q1 * q2 - 2 * q0 * q3, 2 * q0*q0 + 2 * q1 * q1 - 1);
-  ypr[1] = atan(gx / sqrt(gy*gy + gz*gz));
-  ypr[2] = atan(gy / sqrt(gx*gx + gz*gz)); 
+  ypr[0] = fastAtan2(2 * q1 * q2 - 2 * q0 * q3, 2 * q0*q0 + 2 * q1 * q1 - 1);
+  ypr[1] = fastAtan(gx / fastSqrt(gy*gy + gz*gz));
+  ypr[2] = fastAtan(gy / fastSqrt(gx*gx + gz*gz)); 
 
-  cos_roll = cos(-ypr[2]);
-  sin_roll = sin(-ypr[2]);
-  cos_pitch = cos(ypr[1]);
-  sin_pitch = sin(ypr[1]);
+  fastSinCos(-ypr[2], &sin_roll, &cos_roll);
+  fastSinCos(ypr[1], &sin_pitch, &cos_pitch);
   
   //Example calc
   //Xh = bx * cos(theta) + by * sin(phi) * sin(theta) + bz * cos(phi) * sin(theta)
@@ -1667,7 +2593,7 @@ float FreeIMU::calcMagHeading(float q0, float q1, float q2, float q3, float bx,
   // Tilt compensated Magnetic field Y component:
   Head_Y = by*cos_roll - bz*sin_roll;
   // Magnetic Heading
-  return (atan2(-Head_Y,Head_X)*180./M_PI) + MAG_DEC;
+  return (fastAtan2(-Head_Y,Head_X)*180./M_PI) + MAG_DEC;
  
 }
 
@@ -1677,16 +2603,27 @@ float FreeIMU::calcMagHeading(float q0, float q1, float q2, float q3, float bx,
 */
 void FreeIMU::setTempCalib(int opt_temp_cal) {
    temp_corr_on = opt_temp_cal;
+   corr_valid = false;
    if(temp_corr_on == 1) {
 		gyro_off_x = 0.0;
 		gyro_off_y = 0.0;
 		gyro_off_z = 0.0;
 	}
 	if(temp_corr_on == 0) {
+	  #if GYRO_BIAS_BACKGROUND
+		// from the last estimate until new windows agree, the loop keeps running
+		gyro_bias.restart();
+		const float * b = gyro_bias.bias();
+		gyro_off_x = b[0];
+		gyro_off_y = b[1];
+		gyro_off_z = b[2];
+	  #else
 		//digitalWrite(12,HIGH);
 		initGyros();
 		//digitalWrite(12,LOW);
+	  #endif
 	}
+	calGyroOffsets();
 }
 
 /**
@@ -1698,40 +2635,77 @@ void FreeIMU::setSeaPress(float sea_press_inp) {
 	def_sea_press = sea_press_inp;
 }
 
+/**
+ * Orientation from the accelerometer and magnetometer alone, in the frame of the
+ * fusion engines: the accelerometer gives up, the part of the field normal to it
+ * north.  The active and shadow engines are restarted from it.
+ *
+ * @param q if not NULL, populated with the orientation
+ * @param val calibrated sample, val[0..2] accelerometer and val[6..8] magnetometer
+*/
 void FreeIMU::getQ_simple(float * q, float * val)
 {
- 
-  float yaw;
-  float pitch = atan2(val[0], sqrt(val[1]*val[1]+val[2]*val[2]));
-  float roll = -atan2(val[1], sqrt(val[0]*val[0]+val[2]*val[2]));
-  
-  yaw = val[9] - MAG_DEC;
-  
-  if(val[9] > 180.) {	yaw = (yaw - 360.) * M_PI/180;
-   } else {
-    yaw = yaw * M_PI/180;
-   }
-  
-  float rollOver2 = roll * 0.5f;
-  float sinRollOver2 = (float)sin(rollOver2);
-  float cosRollOver2 = (float)cos(rollOver2);
-  float pitchOver2 = pitch * 0.5f;
-  float sinPitchOver2 = (float)sin(pitchOver2);
-  float cosPitchOver2 = (float)cos(pitchOver2);
-  float yawOver2 = yaw * 0.5f;
-  float sinYawOver2 = (float)sin(yawOver2);
-  float cosYawOver2 = (float)cos(yawOver2);
-
-  q1 = cosYawOver2 * cosPitchOver2 * sinRollOver2 - sinYawOver2 * sinPitchOver2 * cosRollOver2;
-  q0 = cosYawOver2 * cosPitchOver2 * cosRollOver2 + sinYawOver2 * sinPitchOver2 * sinRollOver2;
-  q2 = sinYawOver2 * cosPitchOver2 * cosRollOver2 - cosYawOver2 * sinPitchOver2 * sinRollOver2;
-  q3 = cosYawOver2 * sinPitchOver2 * cosRollOver2 + sinYawOver2 * cosPitchOver2 * sinRollOver2;
+  float up[3], north[3], west[3], qs[4];
+  float n, d, s;
+  
+  // earth axes in the sensor frame
+  n = invSqrt(val[0]*val[0] + val[1]*val[1] + val[2]*val[2]);
+  for(uint8_t i = 0; i < 3; i++) up[i] = val[i] * n;
+  d = val[6]*up[0] + val[7]*up[1] + val[8]*up[2];
+  for(uint8_t i = 0; i < 3; i++) north[i] = val[6 + i] - d * up[i];
+  n = north[0]*north[0] + north[1]*north[1] + north[2]*north[2];
+  if(n < 1e-12f) {
+	// no field, the sensor x axis is taken as north
+	d = up[0];
+	north[0] = 1.0f - d * up[0];
+	north[1] = -d * up[1];
+	north[2] = -d * up[2];
+	n = north[0]*north[0] + north[1]*north[1] + north[2]*north[2];
+  }
+  n = invSqrt(n);
+  for(uint8_t i = 0; i < 3; i++) north[i] *= n;
+  west[0] = up[1]*north[2] - up[2]*north[1];
+  west[1] = up[2]*north[0] - up[0]*north[2];
+  west[2] = up[0]*north[1] - up[1]*north[0];
+  
+  // the rows of the sensor to earth rotation are north, west and up, converted from
+  // the largest of the four quaternion components
+  float tr = north[0] + west[1] + up[2];
+  if(tr > 0.0f) {
+	s = 0.5f * invSqrt(tr + 1.0f);
+	qs[0] = 0.25f / s;
+	qs[1] = (up[1] - west[2]) * s;
+	qs[2] = (north[2] - up[0]) * s;
+	qs[3] = (west[0] - north[1]) * s;
+  } else if(north[0] > west[1] && north[0] > up[2]) {
+	s = 0.5f * invSqrt(1.0f + north[0] - west[1] - up[2]);
+	qs[0] = (up[1] - west[2]) * s;
+	qs[1] = 0.25f / s;
+	qs[2] = (north[1] + west[0]) * s;
+	qs[3] = (north[2] + up[0]) * s;
+  } else if(west[1] > up[2]) {
+	s = 0.5f * invSqrt(1.0f + west[1] - north[0] - up[2]);
+	qs[0] = (north[2] - up[0]) * s;
+	qs[1] = (north[1] + west[0]) * s;
+	qs[2] = 0.25f / s;
+	qs[3] = (west[2] + up[1]) * s;
+  } else {
+	s = 0.5f * invSqrt(1.0f + up[2] - north[0] - west[1]);
+	qs[0] = (west[0] - north[1]) * s;
+	qs[1] = (north[2] + up[0]) * s;
+	qs[2] = (west[2] + up[1]) * s;
+	qs[3] = 0.25f / s;
+  }
+  
+  // restart the engines from the accel/mag orientation
+  setEngineQ(fusion_active, qs);
+  if(fusion_shadow != FUSION_NONE) setEngineQ(fusion_shadow, qs);
   
   if (q!=NULL){
-	  q[0] = q0;
-	  q[1] = q1;
-	  q[2] = q2;
-	  q[3] = q3;
+	  q[0] = qs[0];
+	  q[1] = qs[1];
+	  q[2] = qs[2];
+	  q[3] = qs[3];
   }
 
 }
@@ -1827,6 +2801,15 @@ void FreeIMU::MotionDetect(float * val) {
     } else {
 		val[11] = 0.0f;
 	}
+	
+  #if GYRO_BIAS_BACKGROUND
+	// the angular rate test sees the bias as motion until it is known
+	if(gyro_bias.converged()) {
+		motion_still = val[11] == 0.0f;
+	} else {
+		motion_still = (accnormtestavg + accnorm_var_test) == 0;
+	}
+  #endif
 }
 
 
@@ -1877,6 +2860,15 @@ void arr3_rad_to_deg(float * arr) {
   arr[2] *= 180/M_PI;
 }
 
+/**
+ * Copies the 3 elements array src into dst
+*/
+void arr3_copy(const float * src, float * dst) {
+  dst[0] = src[0];
+  dst[1] = src[1];
+  dst[2] = src[2];
+}
+
 /* Madgwick IMU/AHRS and Fast Inverse Square Root
 http://www.diydrones.com/forum/topics/madgwick-imu-ahrs-and-fast-inverse-square-root
 
@@ -1891,31 +2883,8 @@ Posted by Tobias Simon on November 2, 2012
 //int instability_fix = 1;
 
 float FreeIMU::invSqrt(float x) {
-        if (instability_fix == 0)
-        {
-             union {
-               float f;
-               int32_t i;
-               } y;
-
-             y.f = x;
-             y.i = 0x5f375a86 - (y.i >> 1);
-             y.f = y.f * ( 1.5f - ( x * 0.5f * y.f * y.f ) );
-             return y.f;
-        }
-        else if (instability_fix == 1)
-        {
-                /* close-to-optimal  method with low cost from
-				http://pizer.wordpress.com/2008/10/12/fast-inverse-square-root */
-                uint32_t i = 0x5F1F1412 - (*(uint32_t*)&x >> 1);
-                float tmp = *(float*)&i;
-                return tmp * (1.69000231f - 0.714158168f * x * tmp * tmp);
-        }
-        else
-        {
-                /* optimal but expensive method: */
-                return 1.0f / sqrt(x);
-        }
+        // shared with the fusion engines, see fusionInvSqrt in FusionEngine.h
+        return fusionInvSqrt(x);
 }
 
 /**
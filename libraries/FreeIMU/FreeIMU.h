@@ -49,7 +49,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#define GY_87  //GY-87 Sensor Board from eBay, NOTE: Pressusre sensor is BMP180 but BMP085 library should work
 //#define Mario   // MPU-9150 plus Altitude/Pressure Sensor Breakout - MPL3115A2  https://www.sparkfun.com/products/11084
 //#define APM_2_5  //  APMM 2.5.2 (EBAY)
+// The host build (debug/Makefile) selects the board on the command line instead
+#ifndef FREEIMU_BOARD_SELECTED
 #define Microduino
+#endif
 
 //#define DISABLE_MAGN // Uncomment this line to disable the magnetometer in the sensor fusion algorithm
 
@@ -62,8 +65,29 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define WINDOW_SIZE 1 //Set to 1 to turn off the Running Average
 
 // Set filter type: 1 = Madgwick Gradient Descent, 0 - Madgwick implementation of Mahoney DCM
-// in Quaternion form, 3 = Madwick Original Paper AHRS, 4 - DCM Implementation
-#define MARG 4
+// in Quaternion form, 3 = Madwick Original Paper AHRS, 4 - DCM Implementation,
+// 5 = error-state Kalman filter with gyro bias estimation.  The host build takes -DMARG=n.
+#ifndef MARG
+	#define MARG 4
+#endif
+
+// Fusion engines compiled in, bit n = filter type n above.  MARG is always included and is
+// the engine active at start up, the others can be selected at run time or run in shadow
+// mode next to it for comparison.  All of them on ARM, only MARG on AVR to save flash/RAM.
+// The host build takes -DFUSION_ENGINES=n.
+#if defined(FUSION_ENGINES)
+#elif defined(__arm__)
+	#define FUSION_ENGINES ((1 << 0) | (1 << 1) | (1 << 3) | (1 << 4) | (1 << 5))
+#else
+	#define FUSION_ENGINES (1 << MARG)
+#endif
+
+// Number format of the Mahony (0) and Madgwick (1) engines: 0 = float, 15 = Q1.15 fixed point
+// for 8-bit AVRs, 30 = Q2.30 fixed point for 32-bit boards without FPU.  See FusionFixed.h.
+// The host build takes -DFUSION_FIXED=n.
+#ifndef FUSION_FIXED
+	#define FUSION_FIXED 0
+#endif
 
 // proportional gain governs rate of convergence to accelerometer/magnetometer
 // integral gain governs rate of convergence of gyroscope biases
@@ -162,9 +186,70 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
   #define temp_break  -1000	  //original temp_break = -4300;
   #define senTemp_break  32
   #define temp_corr_on_default  0
+
+// temp_corr_on: the corrections come from a table of TEMP_CORR_LUT nodes built by init over
+// TEMP_CORR_MIN..temp_break of the raw MPU60X0 temperature (senTemp_min..senTemp_break degC
+// with the ITG3200), interpolated linearly.  RAM and error per size in TempCorrLUT.h.
+// 0 = the c3..c0 cubics are evaluated on every change of the temperature.
+#ifndef TEMP_CORR_LUT
+  #if defined(__AVR__)
+    #define TEMP_CORR_LUT 0
+  #else
+    #define TEMP_CORR_LUT 33
+  #endif
+#endif
+  #define TEMP_CORR_MIN  -12420	// 0 degC on the MPU-6050
+  #define senTemp_min  0
   #define nsamples 75
   #define instability_fix 1
 
+// Gyro bias: 1 = estimated by getQ in the background while the motion detector finds the board
+// still (GyroBias.h), the fusion runs from the first sample and init does not wait for the gyro;
+// 0 = init calls initGyros, which blocks until it converged.  Takes about 100 bytes of RAM.
+// GYRO_BIAS_STORE below.
+#ifndef GYRO_BIAS_BACKGROUND
+  #define GYRO_BIAS_BACKGROUND 1
+#endif
+
+// Error-state Kalman filter (MARG 5) noise figures, see EKFEngine.h.  Gyro noise and bias
+// random walk in rad/s/sqrt(Hz) and rad/s^2/sqrt(Hz), accelerometer and magnetometer as
+// standard deviation of the normalised vectors.
+  #define ekfGyroNoiseDef 1e-3f
+  #define ekfBiasNoiseDef 2e-5f
+  #define ekfAccNoiseDef  0.02f
+  #define ekfMagNoiseDef  0.05f
+  #define EKF_MAG_DISTURBANCE 0	// 1 = also estimate a magnetic disturbance (9 states)
+
+// Multi-rate fusion: the gyro is integrated on every sample (every getQ call, or every FIFO
+// sample with FIFO_BURST), the accelerometer and magnetometer corrections run at these rates
+// in Hz and the magnetometer is only read when its correction is due.  0 = every sample,
+// as before.  E.g. 200 and 50 with a 1kHz loop.  Can be changed with setCorrectionRates.
+  #define FUSION_ACC_RATE 0
+  #define FUSION_MAG_RATE 0
+
+// MPU60X0 FIFO burst acquisition: getQ drains every sample buffered in the
+// FIFO and runs the filter once per sample (MPU6050/6000/9150/9250 boards only)
+#ifndef FIFO_BURST
+  #define FIFO_BURST 0
+#endif
+  #define FIFO_RATE_DIV 4		// FIFO sample rate = 1kHz / (1 + FIFO_RATE_DIV)
+  #define FIFO_RING_SIZE 16		// samples held between FIFO reads, power of two
+
+// Data-ready acquisition (with FIFO_BURST): the MPU60X0 INT pin, wired to this Arduino pin,
+// pulses for every FIFO sample and the interrupt handler moves the FIFO into fifoRing, getQ
+// only fuses what is already there.  -1 = getQ polls the FIFO.  See claimBus.
+#ifndef FIFO_INT_PIN
+  #define FIFO_INT_PIN -1
+#endif
+
+// MPU-9150/9250: the MPU's auxiliary I2C master reads the AK8975/AK8963 at MAG_AUX_RATE Hz
+// into its EXT_SENS_DATA registers and one burst returns accel, temperature, gyro and mag,
+// with no delay(10) for the conversion.  0 = read the magnetometer through the bypass switch.
+#ifndef MAG_AUX_MASTER
+  #define MAG_AUX_MASTER 1
+#endif
+  #define MAG_AUX_RATE 100
+
 // ****************************************************
 // *** No configuration needed below this line      ***
 // *** Unless you are defining a new IMU            ***
@@ -276,6 +361,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 					|| defined(GY_87) ||defined(GY_88) || defined(DFROBOT) || defined(APM_2_5) \
 					|| defined(Mario) || defined(Microduino) )
 					
+#define HAS_BARO() (HAS_MS5611() || HAS_BMP085() || HAS_LPS331() || HAS_MPL3115A2())
+					
 #define IS_6DOM() (defined(SEN_10121) || defined(GEN_MPU6050))
 #define IS_9DOM() (defined(GY_87) ||defined(GY_88) || defined(Altimu10) || defined(GEN_MPU9250) || defined(MPU9250_5611) \
 				   || defined(GEN_MPU9150) || defined(DFROBOT) || defined(FREEIMU_v01) || defined(FREEIMU_v02) \
@@ -288,21 +375,97 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 							|| defined(FREEIMU_v035_BMP) || defined(FREEIMU_v04) || defined(SEN_10121) \
 							|| defined(SEN_10736) || defined(GY_87) || defined(Microduino) )
 
+#define HAS_ENGINE(n) ((((FUSION_ENGINES) | (1 << MARG)) >> (n)) & 1)
+
+#define HAS_MPU_FIFO() (FIFO_BURST && (HAS_MPU6050() || HAS_MPU6000() || HAS_MPU9150() || HAS_MPU9250()))
+#define FIFO_PERIOD_US ((1 + FIFO_RATE_DIV) * 1000UL)
+#define HAS_FIFO_INT() (HAS_MPU_FIFO() && FIFO_INT_PIN >= 0)
+#define HAS_MAG_AUX() (MAG_AUX_MASTER && (HAS_MPU9150() || HAS_MPU9250()))
+// samples per magnetometer read by the aux master at sample rate 1kHz / (1 + rate_div)
+#define MAG_AUX_DIV(rate_div) ((1000 / (1 + (rate_div))) / MAG_AUX_RATE)
+
 #include <Wire.h>
 #include "Arduino.h"
 #include "calibration.h"
 #include <MovingAvarageFilter.h>
 
-#ifndef CALIBRATION_H
+// the gyro bias is stored in the EEPROM with its temperature once it converged, and taken as
+// converged at the next start if the temperature is within GYRO_BIAS_WARM_TEMP; by default
+// where the EEPROM holds the calibration
+#ifndef GYRO_BIAS_STORE
+  #ifdef CALIBRATION_H
+    #define GYRO_BIAS_STORE 0
+  #else
+    #define GYRO_BIAS_STORE GYRO_BIAS_BACKGROUND
+  #endif
+#endif
+#if HAS_ITG3200()
+  #define GYRO_BIAS_WARM_TEMP 5.0f		// degC
+#else
+  #define GYRO_BIAS_WARM_TEMP 1700.0f	// raw MPU60X0 temperature, 5 degC
+#endif
+
+#if !defined(CALIBRATION_H) || GYRO_BIAS_STORE
 	#include <EEPROM.h>
 #endif
 
 #define FREEIMU_EEPROM_BASE 0x0A
-#define FREEIMU_EEPROM_SIGNATURE 0x19
+#define FREEIMU_EEPROM_SIGNATURE 0x19		// offsets and scales (int16 acc/magn offsets, float acc/magn scales)
+#define FREEIMU_EEPROM_SIGNATURE_MAT 0x1A	// offsets and matrices (int16 acc/magn offsets, float acc/magn/gyro 3x3)
+#define FREEIMU_EEPROM_MAT_SIZE (6 * 2 + 27 * 4)	// bytes after the signature, see calStore
+#define FREEIMU_EEPROM_GYRO_BASE (FREEIMU_EEPROM_BASE + 1 + FREEIMU_EEPROM_MAT_SIZE)
+#define FREEIMU_EEPROM_SIGNATURE_GYRO 0x1B	// gyro bias and its temperature (float x, y, z, t)
+
+// largest raw magnetometer value per axis, see calRange: 12 bit HMC5883L divided by its self
+// test gains, 13 bit AK8975, int16 for the others; accel and gyro span the int16
+#if HAS_HMC5883L() || HAS_MPU9150()
+	#define MAGN_RAW_RANGE 4096.0f
+#else
+	#define MAGN_RAW_RANGE 32768.0f
+#endif
 
-#if(MARG == 4)
+#if HAS_ENGINE(4)
 	#include "DCM.h"
 #endif
+#include "FusionEngine.h"
+#include "OrientationState.h"
+#include "BoardAxes.h"
+#include "CalibTransform.h"
+#if HAS_ENGINE(5)
+	#include "EKFEngine.h"
+#endif
+#if FUSION_FIXED == 15
+	#include "FusionFixed.h"
+	typedef MahonyFixedEngine<FixQ15> MahonyFusion;
+	typedef MadgwickFixedEngine<FixQ15> MadgwickFusion;
+#elif FUSION_FIXED == 30
+	#include "FusionFixed.h"
+	typedef MahonyFixedEngine<FixQ30> MahonyFusion;
+	typedef MadgwickFixedEngine<FixQ30> MadgwickFusion;
+#else
+	typedef MahonyEngine MahonyFusion;
+	typedef MadgwickEngine MadgwickFusion;
+#endif
+
+#if HAS_MPU_FIFO()
+	#include "MotionRing.h"
+#endif
+#if TEMP_CORR_LUT > 0
+	#include "TempCorrLUT.h"
+#endif
+#if GYRO_BIAS_BACKGROUND
+	#include "GyroBias.h"
+#endif
+
+// FIFO acquisition counters, see getFIFOStats
+struct FIFOStats {
+	uint8_t depth;			// samples in fifoRing, read but not fused yet
+	uint8_t peak;			// most samples in fifoRing at once
+	uint16_t overruns;		// samples refused by a full fifoRing
+	uint16_t overflows;		// MPU60X0 FIFO overflows, the FIFO was reset and samples lost
+	uint16_t interrupts;	// data-ready interrupts taken
+	uint16_t deferred;		// interrupts that found the bus claimed, serviced by releaseBus
+};
 
 //#if FREEIMU_VER <= 3
 #if HAS_ADXL345()
@@ -405,6 +568,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
     #define cbi(sfr, bit) (_SFR_BYTE(sfr) &= ~_BV(bit))
 #endif
 
+// Calibrated samples in structure-of-arrays form for FreeIMU::updateBatch.
+// Units are the same as getValues: acc in g, gyro in deg/s, calibrated mag.
+struct FusionBatch {
+	uint16_t n;						// number of samples
+	const float *ax, *ay, *az;
+	const float *gx, *gy, *gz;
+	const float *mx, *my, *mz;		// NULL for accel/gyro only updates
+	const uint32_t *t_us;			// sample timestamps in microseconds, NULL to use dt
+	float dt;						// sample period in seconds if t_us is NULL
+};
+
 class FreeIMU
 {
   public:
@@ -429,17 +603,27 @@ class FreeIMU
 	
     #ifndef CALIBRATION_H
 		void calLoad();
+		void calStore(const uint8_t * data);
     #endif
+	void calFold();
+	float calRange(uint8_t sensor);
 	
     void zeroGyro();
 	void initGyros();
+	bool gyroBiasConverged();
     void getRawValues(int * raw_values);
     void getValues(float * values);
     void getQ(float * q, float * val);
+    void getQ(float * q, float * val, uint32_t t_us);
+    void replayQ(float * q, float * val, uint32_t t_us);
+    uint32_t getSampleTime();
+    void updateBatch(const FusionBatch &batch, float * q, float * q_all = NULL);
     void getEuler(float * angles);
     void getYawPitchRoll(float * ypr);
     void getEulerRad(float * angles);
     void getYawPitchRollRad(float * ypr);
+    void getRotationMatrix(float * m);
+    void getGravity(float * g);
 	void getYawPitchRollRadAHRS(float * ypr, float * q);
 	void getYawPitchRoll180(float * ypr);
 	float invSqrt(float x);
@@ -450,36 +634,69 @@ class FreeIMU
 	void MotionDetect(float * val);
 	
 	
-    #if HAS_MS5611()
-      float getBaroAlt();
-      float getBaroAlt(float sea_press);
-	  float getBaroTemperature();
-	  float getBaroPressure();
-    #elif HAS_BMP085()
-      float getBaroAlt();
-      float getBaroAlt(float sea_press);
-	  float getBaroTemperature();
-	  float getBaroPressure();
-	#elif HAS_LPS331()
+    #if HAS_BARO()
       float getBaroAlt();
       float getBaroAlt(float sea_press);
 	  float getBaroTemperature();
 	  float getBaroPressure();
-	#elif HAS_MPL3115A2()
-      float getBaroAlt();
-      float getBaroAlt(float sea_press);
-	  float getBaroTemperature();
-	  float getBaroPressure();	  
+	  bool pollBaro();
     #endif	
     
 	#if HAS_PRESS()
       //float getEstAltitude();
 	  float getEstAltitude(float * q, float * val, float dt2);
+	  float getEstAltitude(float * q, float * val, float baro_alt, float dt2);
     #endif
 	
 
-	#if(MARG == 4)
+	bool setFusionEngine(uint8_t engine);
+	bool setShadowEngine(uint8_t engine);
+	bool hasFusionEngine(uint8_t engine);
+	void clearFusionStats();
+	void setCorrectionRates(float acc_hz, float mag_hz);
+
+	#if HAS_ENGINE(FUSION_MAHONY)
+		MahonyFusion mahony;
+	#endif
+	#if HAS_ENGINE(FUSION_MADGWICK)
+		MadgwickFusion madgwick;
+	#endif
+	#if HAS_ENGINE(FUSION_MARG)
+		MARGEngine marg;
+	#endif
+	#if HAS_ENGINE(FUSION_DCM)
 		DCM dcm;
+		DCMEngine dcmEngine;
+	#endif
+	#if HAS_ENGINE(FUSION_EKF)
+		EKFEngine ekf;
+	#endif
+	
+	FusionStats fusion_stats[FUSION_SLOTS];	// update cost of each engine, indexed by engine id
+	uint8_t fusion_active;					// engine whose orientation getQ returns
+	uint8_t fusion_shadow;					// engine run on the same samples, FUSION_NONE if off
+	float fusion_shadow_diff;				// angle between active and shadow orientation in degrees
+	FusionRates fusion_rates;				// accelerometer/magnetometer correction schedule
+	FusionJitter dt_jitter;					// jitter of the getQ/replayQ timestamps
+	OrientationState orientation;			// orientation after the last getQ, read by the angle getters
+	#if HAS_MAG_AUX()
+		uint8_t mag_status;					// MPU60X0_MAG_FRESH/_OVERFLOW of the last magnetometer read
+	#endif
+	
+	#if HAS_MPU_FIFO()
+		MotionRing<FIFO_RING_SIZE> fifoRing;	// samples read from the FIFO, not yet fused
+		volatile uint16_t fifo_overflows;		// number of times the MPU FIFO overflowed and was reset
+		float fifo_dt;							// FIFO sample period in seconds
+		float fifo_val[12];						// val of the last fused sample, for getQ with no new sample
+	#endif
+	void getFIFOStats(FIFOStats &st);
+	uint8_t acquire();
+	#if HAS_FIFO_INT()
+		void claimBus();
+		void releaseBus();
+	#else
+		void claimBus() {}
+		void releaseBus() {}
 	#endif
 	
     // we make them public so that users can interact directly with device classes
@@ -537,18 +754,40 @@ class FreeIMU
       KalmanFilter kPress; // Altitude Kalman Filter.
       AltComp altComp; // Altitude Complementary Filter.
     #endif
+    #if HAS_BARO()
+      float baro_press, baro_temp;		// latest completed barometer sample, mbar and C
+      float baro_press_filt;			// baro_press through kPress
+    #endif
      
 	//Global Variables
 	 
     int* raw_acc, raw_gyro, raw_magn;
-    // calibration parameters
-    int16_t gyro_off_x, gyro_off_y, gyro_off_z;
+    // calibration parameters, calibrated = mat * (raw - off) / scale, see calFold
+    float gyro_off_x, gyro_off_y, gyro_off_z;
     int16_t acc_off_x, acc_off_y, acc_off_z, magn_off_x, magn_off_y, magn_off_z;
     float acc_scale_x, acc_scale_y, acc_scale_z, magn_scale_x, magn_scale_y, magn_scale_z;
+    float acc_mat[9], magn_mat[9], gyro_mat[9];	// row major, misalignment and soft iron
+    CalibTransform acc_cal, gyro_cal, magn_cal;	// the above folded with BoardAxes and gyro_sensitivity
 	float val[12], motiondetect_old;
 	//int8_t nsamples, temp_break, instability_fix, senTemp_break;
 	int16_t DTemp, temp_corr_on; 
 	float rt, senTemp, gyro_sensitivity;
+	float acgyro_corr[9];	// temperature correction applied to the last sample
+	int16_t corr_temp;		// DTemp acgyro_corr was computed for
+	bool corr_valid;
+	#if TEMP_CORR_LUT > 0
+		TempCorrLUT<9, TEMP_CORR_LUT> temp_lut;	// c3..c0 at TEMP_CORR_LUT temperatures
+	#endif
+	#if GYRO_BIAS_BACKGROUND
+		GyroBias gyro_bias;			// estimate of gyro_off_*
+		bool motion_still;			// MotionDetect found no motion, from the accelerometer alone until gyro_bias converged
+	#endif
+	#if GYRO_BIAS_STORE
+		float gyro_store[4];		// bias and temperature in the EEPROM, or being written there
+		int8_t gyro_store_pos;		// next byte of gyro_store to write, -1 none
+		bool gyro_stored;			// gyro_store is in the EEPROM
+		bool gyro_warm_check;		// compare the temperature of the first sample with gyro_store
+	#endif
 	float sampleFreq; // half the sample period expressed in seconds
 	byte deviceType;
 	int zeroMotioncount = 0;
@@ -564,22 +803,17 @@ class FreeIMU
 	// --------------------------------------------------------------------
 	// Define IMU Axis Alignment here
 	// --------------------------------------------------------------------	
+	// the maps are in BoardAxes.h, a new board adds its AxisMap there
 	#if HAS_AXIS_ALIGNED()
-		//accx, accy, accz, gyrox, gyroy, gyroz, magx, magy, magz
-		int sensor_order[9] = {0,1,2,3,4,5,6,7,8};
-		int sensor_sign[9] = {1,1,1,1,1,1,1,1,1};
+		typedef AlignedAxes BoardAxes;
 	#elif defined(SEN_10724)
-		int sensor_order[9] = {0,1,2,3,4,5,7,6,8};
-		int sensor_sign[9] = {1,1,1,1,1,1,1,-1,1};	
+		typedef SEN10724Axes BoardAxes;
 	#elif defined(ARDUIMU_v3)
-		int sensor_order[9] = {0,1,2,3,4,5,6,7,8};
-		int sensor_sign[9] = {1,1,1,1,1,1,-1,-1,1};	
+		typedef ArduIMUv3Axes BoardAxes;
 	#elif defined(GEN_MPU9150) || defined(MPU9250_5611) || defined(GEN_MPU9250)
-		int sensor_order[9] = {0,1,2,3,4,5,7,6,8};
-		int sensor_sign[9] = {1,1,1,1,1,1,1,-1};	
+		typedef MPU9x50Axes BoardAxes;
 	#elif defined(APM_2_5)	
-		int sensor_order[9] = {1,0,2,4,3,5,7,6,8};
-		int sensor_sign[9] = {1,-1,1,1,-1,1,-1,1,1};
+		typedef APM25Axes BoardAxes;
 	#endif 	
 
 	// --------------------------------------------------------------------
@@ -594,37 +828,57 @@ class FreeIMU
 	float bx, by, bz;
     float iq0, iq1, iq2, iq3;
     float exInt, eyInt, ezInt;  			// scaled integral error
-    volatile float twoKp;      				// 2 * proportional gain (Kp)
-    volatile float twoKi;      				// 2 * integral gain (Ki)
-    volatile float q0, q1, q2, q3, q3old; 	// quaternion of sensor frame relative to auxiliary frame
-    volatile float integralFBx,  integralFBy, integralFBz;
     unsigned long lastUpdate, now; 			// sample period expressed in milliseconds
 	unsigned long lastUpdate1 = 0;
 	unsigned long now1;
-	
-	//Madgwick AHRS Gradient Descent 
-    volatile float beta;				// algorithm gain
-
-	//Following lines defines Madgwicks Grad Descent Algorithm from his original paper
-	// Global system variables
-	float SEq_1 = 1, SEq_2 = 0, SEq_3 = 0, SEq_4 = 0; 	// estimated orientation quaternion elements with initial conditions
-	float b_x = 1, b_z = 0; 				// reference direction of flux in earth frame
-	float w_bx = 0, w_by = 0, w_bz = 0; // estimate gyroscope biases error
-
-	#if(MARG == 0)
-		void AHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
-		//void AHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az);
-  	#elif(MARG == 1)
-		void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
-		void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az);
-	#elif(MARG == 3)
-		void MARGUpdateFilter(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
-		void MARGUpdateFilterIMU(float gx, float gy, float gz, float ax, float ay, float az);
+
+
+	float mag_raw[3];						// last magnetometer reading, before calibration
+	float mag_heading;						// heading of the last magnetometer reading
+	uint32_t sample_time;					// timestamp of the last fused sample in microseconds
+	bool sample_time_set;					// false until the first sample is fused
+
+	void readValues(float * values, bool read_mag);
+	float sampleStep(uint32_t t_us);
+	void motionUpdate(float * q, float * val);
+	void refreshOrientation(uint8_t part);
+	void calibrateAccGyro(int16_t * accgyroval, float * values_cal);
+	void calGyroOffsets();
+	void gyroBiasSet(bool converged);
+	#if GYRO_BIAS_BACKGROUND
+		void gyroBiasStart();
+		void gyroBiasUpdate(const float * values_cal);
+	#endif
+	#if GYRO_BIAS_STORE
+		void gyroStoreStep();
+	#endif
+	void applyCalibration(float * values_cal, float * values);
+	void fusionUpdate(float * q, float * val, float dt, uint8_t due);
+	void runEngine(uint8_t engine, const float * val, float dt, uint8_t due, float * q);
+	void getEngineQ(uint8_t engine, float * q);
+	void setEngineQ(uint8_t engine, const float * q);
+	void resetEngines();
+	#if HAS_BARO()
+		void startBaro();
+	#endif
+	template <class Engine> void batchUpdate(FusionEngine<Engine> &e, const FusionBatch &batch, float * q_all);
+	#if HAS_MPU_FIFO()
+		uint8_t fillFIFO();
+		float getFIFOQ(float * q, float * val);
+	#endif
+	#if HAS_FIFO_INT()
+		static FreeIMU * fifo_owner;		// instance served by fifoISR
+		volatile uint8_t bus_claims;		// claimBus nesting, 1 while fifoISR reads the FIFO
+		volatile bool fifo_int_pending;		// an interrupt found the bus claimed
+		volatile uint16_t fifo_interrupts;
+		volatile uint16_t fifo_deferred;
+		static void fifoISR();
 	#endif
 };
 
 float invSqrt(float number);
 void arr3_rad_to_deg(float * arr);
+void arr3_copy(const float * src, float * dst);
 void Qmultiply(float *  q, float *  q1, float * q2);
 void gravityCompensateAcc(float * acc, float * q);
 
@@ -0,0 +1,485 @@
+//=====================================================================================================
+// FusionEngine.h
+//=====================================================================================================
+//
+// Common interface for the sensor fusion filters so several of them can be compiled into one
+// binary, selected at run time and run side by side (shadow mode) on the same samples.
+//
+// Dispatch is static (CRTP): FusionEngine<Engine>::update() calls Engine::step() directly, so
+// there are no virtual calls and the filter code can be inlined into the caller.
+//
+// Every engine takes the sample in the layout used by FreeIMU::getValues:
+//   val[0..2] accelerometer, val[3..5] gyro in deg/s, val[6..8] magnetometer (all 0 = no mag),
+//   val[9] tilt compensated heading in degrees (only used by the DCM engine)
+// and the time step in seconds.
+//
+// update() runs gyro integration and correction on every sample.  Engines that set MULTI_RATE
+// also have the two halves separately: predict() integrates the gyro, correct() applies the
+// accelerometer or magnetometer correction with the time since that sensor's last correction,
+// so the corrections can run at lower rates than the gyro (see FusionRates).
+//
+// The filter algorithms themselves live in AHRS.h, MadgwickAHRS.h and MARGUpdateFilter.h,
+// the DCM engine wraps the DCM library.  The Kalman filter engine is in EKFEngine.h.
+//
+//=====================================================================================================
+
+#ifndef FusionEngine_h
+#define FusionEngine_h
+
+#include <inttypes.h>
+#include <math.h>
+
+// Engine ids, same values as the MARG option in FreeIMU.h
+#define FUSION_MAHONY		0
+#define FUSION_MADGWICK		1
+#define FUSION_MARG			3
+#define FUSION_DCM			4
+#define FUSION_EKF			5
+#define FUSION_SLOTS		6
+#define FUSION_NONE			0xFF
+
+// Sensors of a correction step
+#define FUSION_ACC			0x01
+#define FUSION_MAG			0x02
+#define FUSION_ALL			(FUSION_ACC | FUSION_MAG)
+
+// Cycle counter used for the per engine statistics.  Teensy 3.x has a real cycle counter,
+// other boards derive cycles from micros() so the resolution is 4us on 16MHz AVRs.  Host
+// builds count clock() ticks.
+#ifndef FUSION_CYCLES
+	#if defined(ARM_DWT_CYCCNT)
+		#define FUSION_CYCLES() ((uint32_t) ARM_DWT_CYCCNT)
+	#elif defined(ARDUINO)
+		#define FUSION_CYCLES() ((uint32_t) micros() * (uint32_t)(F_CPU / 1000000L))
+	#else
+		#include <time.h>
+		#define FUSION_CYCLES() ((uint32_t) clock())
+	#endif
+#endif
+
+#ifndef instability_fix
+	#define instability_fix 1
+#endif
+
+/**
+ * Inverse square root used by the filters, see FreeIMU::invSqrt for the
+ * instability_fix options.
+*/
+static inline float fusionInvSqrt(float x) {
+	if (instability_fix == 0) {
+		union {
+			float f;
+			int32_t i;
+		} y;
+
+		y.f = x;
+		y.i = 0x5f375a86 - (y.i >> 1);
+		y.f = y.f * ( 1.5f - ( x * 0.5f * y.f * y.f ) );
+		return y.f;
+	}
+	else if (instability_fix == 1) {
+		/* close-to-optimal  method with low cost from
+		http://pizer.wordpress.com/2008/10/12/fast-inverse-square-root */
+		union {
+			float f;
+			uint32_t i;
+		} y;
+
+		y.f = x;
+		y.i = 0x5F1F1412 - (y.i >> 1);
+		return y.f * (1.69000231f - 0.714158168f * x * y.f * y.f);
+	}
+	else {
+		/* optimal but expensive method: */
+		return 1.0f / sqrt(x);
+	}
+}
+
+/**
+ * Update timing of one engine, in CPU cycles.  The average decays: once
+ * 1024 updates have been summed both the sum and the count are halved.
+*/
+struct FusionStats {
+	uint32_t updates;			// total number of updates
+	uint32_t cycles_last;
+	uint32_t cycles_max;
+	uint32_t cycles_sum;
+	uint16_t sum_count;
+
+	void clear() {
+		updates = cycles_last = cycles_max = cycles_sum = 0;
+		sum_count = 0;
+	}
+
+	void add(uint32_t cycles) {
+		updates++;
+		cycles_last = cycles;
+		if(cycles > cycles_max) cycles_max = cycles;
+		if(sum_count >= 1024) {
+			cycles_sum >>= 1;
+			sum_count >>= 1;
+		}
+		cycles_sum += cycles;
+		sum_count++;
+	}
+
+	uint32_t cycles_avg() const {
+		return sum_count ? cycles_sum / sum_count : 0;
+	}
+};
+
+#define FUSION_JITTER_BINS 12
+
+/**
+ * Jitter of a sample clock: histogram of the change of the period between
+ * consecutive timestamps.  Bin 0 counts changes under 4us (the micros()
+ * resolution of 16MHz AVRs), bin i changes under 4us << i, the last bin all
+ * larger ones.  Counts stop at 65535.
+*/
+struct FusionJitter {
+	uint32_t samples;			// timestamps seen
+	uint32_t last_t;			// previous timestamp
+	uint32_t period_last;
+	uint32_t period_min;
+	uint32_t period_max;
+	uint16_t bins[FUSION_JITTER_BINS];
+
+	void clear() {
+		samples = last_t = period_last = period_max = 0;
+		period_min = 0xFFFFFFFF;
+		for(uint8_t i = 0; i < FUSION_JITTER_BINS; i++) bins[i] = 0;
+	}
+
+	void add(uint32_t t_us) {
+		uint32_t period = t_us - last_t;
+		last_t = t_us;
+		if(samples > 0) {
+			if(period < period_min) period_min = period;
+			if(period > period_max) period_max = period;
+		}
+		if(samples > 1) {
+			uint32_t change = period > period_last ? period - period_last : period_last - period;
+			uint8_t i = 0;
+			while(i < FUSION_JITTER_BINS - 1 && change >= binLimit(i)) i++;
+			if(bins[i] != 0xFFFF) bins[i]++;
+		}
+		period_last = period;
+		samples++;
+	}
+
+	// upper limit of bin i in microseconds, the last bin has none
+	static uint32_t binLimit(uint8_t i) {
+		return 4UL << i;
+	}
+};
+
+/**
+ * Base of all fusion engines.  Holds the orientation quaternion; engines that
+ * keep their state in another form (DCM) provide their own readQ/writeQ.
+*/
+template <class Engine>
+class FusionEngine
+{
+  public:
+	FusionEngine() : q0(1.0f), q1(0.0f), q2(0.0f), q3(0.0f) {}
+
+	// true if the engine implements predictStep/correctStep
+	static const bool MULTI_RATE = false;
+
+	void update(const float * val, float dt) {
+		static_cast<Engine*>(this)->step(val, dt);
+	}
+
+	void predict(const float * val, float dt) {
+		static_cast<Engine*>(this)->predictStep(val, dt);
+	}
+
+	/**
+	 * @param sensors FUSION_ACC and/or FUSION_MAG
+	 * @param dt time since the previous correction with these sensors
+	*/
+	void correct(const float * val, uint8_t sensors, float dt) {
+		static_cast<Engine*>(this)->correctStep(val, sensors, dt);
+	}
+
+	void getQ(float * q) {
+		static_cast<Engine*>(this)->readQ(q);
+	}
+
+	void setQ(const float * q) {
+		static_cast<Engine*>(this)->writeQ(q);
+	}
+
+	void reset() {
+		q0 = 1.0f;
+		q1 = 0.0f;
+		q2 = 0.0f;
+		q3 = 0.0f;
+		static_cast<Engine*>(this)->resetState();
+	}
+
+	// defaults, hidden by engines that need something else
+	void readQ(float * q) {
+		q[0] = q0;
+		q[1] = q1;
+		q[2] = q2;
+		q[3] = q3;
+	}
+
+	void writeQ(const float * q) {
+		q0 = q[0];
+		q1 = q[1];
+		q2 = q[2];
+		q3 = q[3];
+	}
+
+	void resetState() {}
+
+	// only called when MULTI_RATE is set
+	void predictStep(const float * val, float dt) {}
+	void correctStep(const float * val, uint8_t sensors, float dt) {}
+
+	static float invSqrt(float x) {
+		return fusionInvSqrt(x);
+	}
+
+	float q0, q1, q2, q3;	// quaternion of sensor frame relative to auxiliary frame
+};
+
+/**
+ * Rates of the accelerometer and magnetometer corrections relative to the gyro
+ * integration, which runs on every sample.  advance() is called once per sample
+ * and returns the corrections that are due; they run at most at the set rate,
+ * on the first sample at least one period after the previous correction.
+*/
+struct FusionRates {
+	float acc_period, mag_period;	// seconds between corrections, 0 = every sample
+	float acc_dt, mag_dt;			// time since the last correction
+
+	/**
+	 * @param acc_hz accelerometer correction rate, 0 = every sample
+	 * @param mag_hz magnetometer correction rate, 0 = every sample
+	*/
+	void setRates(float acc_hz, float mag_hz) {
+		acc_period = acc_hz > 0.0f ? 1.0f / acc_hz : 0.0f;
+		mag_period = mag_hz > 0.0f ? 1.0f / mag_hz : 0.0f;
+		acc_dt = mag_dt = 0.0f;
+	}
+
+	// both corrections on every sample, the engines run their combined update()
+	bool singleRate() const {
+		return acc_period == 0.0f && mag_period == 0.0f;
+	}
+
+	// corrections due after a sample of length dt, on the sample nearest to each period
+	uint8_t advance(float dt) {
+		uint8_t due = 0;
+		acc_dt += dt;
+		mag_dt += dt;
+		if(acc_dt + 0.5f * dt >= acc_period) due |= FUSION_ACC;
+		if(mag_dt + 0.5f * dt >= mag_period) due |= FUSION_MAG;
+		return due;
+	}
+
+	// true if the next sample of length dt will need the magnetometer
+	bool magDue(float dt) const {
+		return mag_dt + 1.5f * dt >= mag_period;
+	}
+
+	void done(uint8_t due) {
+		if(due & FUSION_ACC) acc_dt = 0.0f;
+		if(due & FUSION_MAG) mag_dt = 0.0f;
+	}
+};
+
+/**
+ * Runs one sample through engine e and records its cost in st.  With a single
+ * rate schedule, or for engines without predict/correct, this is update();
+ * otherwise the gyro is integrated and the corrections in due are applied.
+ * Engines without MULTI_RATE see the last magnetometer reading in val.
+*/
+template <class Engine>
+inline void fusionTimedUpdate(FusionEngine<Engine> &e, const float * val, float dt, const FusionRates &r, uint8_t due, FusionStats &st) {
+	uint32_t t0 = FUSION_CYCLES();
+	if(!Engine::MULTI_RATE || r.singleRate()) {
+		e.update(val, dt);
+	} else {
+		e.predict(val, dt);
+		if(due & FUSION_ACC) e.correct(val, FUSION_ACC, r.acc_dt);
+		if(due & FUSION_MAG) e.correct(val, FUSION_MAG, r.mag_dt);
+	}
+	st.add(FUSION_CYCLES() - t0);
+}
+
+/**
+ * Angle in degrees between two orientation quaternions, used to compare the
+ * active and the shadow engine.  Computed from the relative rotation with atan2,
+ * so it does not depend on the quaternions being exactly unit length and keeps
+ * its precision for small angles.
+*/
+static inline float fusionQuatAngle(const float * qa, const float * qb) {
+	float r0 = qa[0]*qb[0] + qa[1]*qb[1] + qa[2]*qb[2] + qa[3]*qb[3];
+	float r1 = qa[0]*qb[1] - qa[1]*qb[0] - qa[2]*qb[3] + qa[3]*qb[2];
+	float r2 = qa[0]*qb[2] + qa[1]*qb[3] - qa[2]*qb[0] - qa[3]*qb[1];
+	float r3 = qa[0]*qb[3] - qa[1]*qb[2] + qa[2]*qb[1] - qa[3]*qb[0];
+	return 2.0f * atan2(sqrt(r1*r1 + r2*r2 + r3*r3), fabs(r0)) * 180.0f / M_PI;
+}
+
+
+//---------------------------------------------------------------------------------------------------
+// Madgwick's implementation of Mayhony's AHRS algorithm, see AHRS.h
+
+class MahonyEngine : public FusionEngine<MahonyEngine>
+{
+  public:
+	static const bool MULTI_RATE = true;
+
+	MahonyEngine() : twoKp(0.0f), twoKi(0.0f), integralFBx(0.0f), integralFBy(0.0f), integralFBz(0.0f) {}
+
+	void setGains(float twoKpIn, float twoKiIn) {
+		twoKp = twoKpIn;
+		twoKi = twoKiIn;
+	}
+
+	void step(const float * val, float dt) {
+		AHRSupdate(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8], dt);
+	}
+
+	void resetState() {
+		integralFBx = 0.0f;
+		integralFBy = 0.0f;
+		integralFBz = 0.0f;
+	}
+
+	void predictStep(const float * val, float dt);
+	void correctStep(const float * val, uint8_t sensors, float dt);
+
+	void AHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+	void fieldError(float ax, float ay, float az, float mx, float my, float mz, float * halfe);
+	void integrate(float gx, float gy, float gz, float dt);
+
+	float twoKp;		// 2 * proportional gain (Kp)
+	float twoKi;		// 2 * integral gain (Ki)
+	float integralFBx, integralFBy, integralFBz;
+};
+
+
+//---------------------------------------------------------------------------------------------------
+// Madgwick's gradient descent AHRS, see MadgwickAHRS.h
+
+class MadgwickEngine : public FusionEngine<MadgwickEngine>
+{
+  public:
+	static const bool MULTI_RATE = true;
+
+	MadgwickEngine() : beta(0.1f) {}
+
+	void setGains(float betaIn) {
+		beta = betaIn;
+	}
+
+	void step(const float * val, float dt) {
+		MadgwickAHRSupdate(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8], dt);
+	}
+
+	void predictStep(const float * val, float dt);
+	void correctStep(const float * val, uint8_t sensors, float dt);
+
+	void MadgwickAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, float dt);
+	void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az, float dt);
+	void gradientStep(float s0, float s1, float s2, float s3, float dt);
+
+	float beta;			// algorithm gain
+};
+
+
+//---------------------------------------------------------------------------------------------------
+// Madgwick's gradient descent filter as in his original paper, see MARGUpdateFilter.h
+
+class MARGEngine : public FusionEngine<MARGEngine>
+{
+  public:
+	MARGEngine() : beta(0.1f) { resetState(); }
+
+	// the gain of the full update is beta1/zeta from FreeIMU.h
+	void setGains(float betaIn) {
+		beta = betaIn;
+	}
+
+	void step(const float * val, float dt) {
+		if((val[6] != 0.0f) || (val[7] != 0.0f) || (val[8] != 0.0f)) {
+			MARGUpdateFilter(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], val[6], val[7], val[8], dt);
+		} else {
+			MARGUpdateFilterIMU(val[3] * M_PI/180, val[4] * M_PI/180, val[5] * M_PI/180, val[0], val[1], val[2], dt);
+		}
+	}
+
+	void writeQ(const float * q) {
+		FusionEngine<MARGEngine>::writeQ(q);
+		SEq_1 = q[0];
+		SEq_2 = q[1];
+		SEq_3 = q[2];
+		SEq_4 = q[3];
+	}
+
+	void resetState() {
+		SEq_1 = 1.0f; SEq_2 = 0.0f; SEq_3 = 0.0f; SEq_4 = 0.0f;
+		b_x = 1.0f; b_z = 0.0f;
+		w_bx = 0.0f; w_by = 0.0f; w_bz = 0.0f;
+	}
+
+	void MARGUpdateFilter(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z, float m_x, float m_y, float m_z, float deltat);
+	void MARGUpdateFilterIMU(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z, float deltat);
+
+	float beta;							// gain of the accelerometer only update
+	float SEq_1, SEq_2, SEq_3, SEq_4;	// estimated orientation quaternion elements
+	float b_x, b_z;						// reference direction of flux in earth frame
+	float w_bx, w_by, w_bz;				// estimate gyroscope biases error
+};
+
+
+//---------------------------------------------------------------------------------------------------
+// Razor AHRS direction cosine matrix filter from the DCM library
+
+#ifdef DCM_H
+class DCMEngine : public FusionEngine<DCMEngine>
+{
+  public:
+	static const bool MULTI_RATE = true;
+
+	DCMEngine() : dcm(NULL) {}
+
+	void attach(DCM * d) {
+		dcm = d;
+	}
+
+	void step(const float * val, float dt) {
+		dcm->setSensorVals((float *) val);
+		dcm->G_Dt = dt;
+		dcm->calDCM();
+	}
+
+	// the drift correction terms are held until the next correction
+	void predictStep(const float * val, float dt) {
+		dcm->setSensorVals((float *) val);
+		dcm->G_Dt = dt;
+		dcm->predictDCM();
+	}
+
+	void correctStep(const float * val, uint8_t sensors, float dt) {
+		dcm->correctDCM(sensors & FUSION_ACC, sensors & FUSION_MAG);
+	}
+
+	void readQ(float * q) {
+		dcm->getDCM2Q(q);
+	}
+
+	void writeQ(const float * q) {
+		dcm->setQ2DCM(q);
+	}
+
+	DCM * dcm;
+};
+#endif
+
+#endif // FusionEngine_h
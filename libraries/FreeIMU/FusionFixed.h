@@ -0,0 +1,448 @@
+//=====================================================================================================
+// FusionFixed.h
+//=====================================================================================================
+//
+// Fixed point versions of the Mahony (AHRS.h) and Madgwick (MadgwickAHRS.h) filters for CPUs
+// without an FPU.  The number format is a template parameter:
+//
+//   FixQ15  Q1.15 in int16_t, int32_t products.  For 8-bit AVRs, where 16x16 bit multiplies are
+//           cheap and float is emulated.  Quaternion resolution is 3e-5, which limits the smallest
+//           rotation per update, see the accuracy report of debug/fixed_replay.cpp.
+//   FixQ30  Q2.30 in int32_t, int64_t products.  For 32-bit MCUs without FPU (Due, Teensy 3.0/3.1),
+//           accuracy is within float rounding of the float filters.
+//
+// The engines take the same float sample as the float engines (FusionEngine.h).  Only the
+// conversion of the inputs uses float: the gyro rates are scaled by dt once, the accelerometer
+// and magnetometer are converted with a shared power of two exponent (frexp/ldexp), so their
+// units do not matter.  Everything else, including the vector normalisations, is integer.
+//
+// Quaternion renormalisation is saturating: a component that rounds outside the format range
+// is clamped (Q1.15 cannot represent +1.0 exactly, it becomes 32767/32768).
+//
+//=====================================================================================================
+
+#ifndef FusionFixed_h
+#define FusionFixed_h
+
+#include "FusionEngine.h"
+
+struct FixQ15 {
+	typedef int16_t value;		// Q1.15
+	typedef int32_t wide;		// Q15 with 16 integer bits, holds products and sums
+	static const uint8_t FRAC = 15;
+	static const int32_t VMAX = 32767;
+	static const int32_t VMIN = -32768;
+};
+
+struct FixQ30 {
+	typedef int32_t value;		// Q2.30
+	typedef int64_t wide;		// Q30 with 34 integer bits
+	static const uint8_t FRAC = 30;
+	static const int32_t VMAX = 2147483647L;
+	static const int32_t VMIN = -2147483647L - 1;
+};
+
+/**
+ * Arithmetic shared by the fixed point engines.  Products must stay below
+ * 2.0 in magnitude for FixQ15 (8.0 for FixQ30) or the wide type overflows,
+ * the filters below are arranged so they do.
+*/
+template <class Fmt>
+struct FixMath {
+	typedef typename Fmt::value value;
+	typedef typename Fmt::wide wide;
+
+	static wide one() { return (wide) 1 << Fmt::FRAC; }
+
+	static value sat(wide x) {
+		if(x > (wide) Fmt::VMAX) return (value) Fmt::VMAX;
+		if(x < (wide) Fmt::VMIN) return (value) Fmt::VMIN;
+		return (value) x;
+	}
+
+	// value * value, the fast path (16x16 bit on AVR)
+	static wide mul(value a, value b) {
+		return ((wide) a * b + ((wide) 1 << (Fmt::FRAC - 1))) >> Fmt::FRAC;
+	}
+
+	static wide mulw(wide a, wide b) {
+		return (a * b + ((wide) 1 << (Fmt::FRAC - 1))) >> Fmt::FRAC;
+	}
+
+	static wide fromFloat(float x) {
+		return (wide) ldexp(x, Fmt::FRAC);
+	}
+
+	static float toFloat(wide x) {
+		return ldexp((float) x, -Fmt::FRAC);
+	}
+
+	/**
+	 * 1/sqrt(x) for x > 0, by range reduction to [0.25, 1) and Newton
+	 * iterations on z = 1/(2 sqrt(x)), which stays below 1.2.
+	*/
+	static wide invSqrt(wide x) {
+		const wide ONE = one();
+		int8_t k = 0;
+
+		if(x <= 0) return 0;
+		while(x >= ONE) { x >>= 2; k--; }
+		while(x < (ONE >> 2)) { x *= 4; k++; }
+
+		// linear start, exact at both ends of the interval
+		wide z = ONE + ONE / 6 - mulw(x, (2 * ONE) / 3);
+		for(uint8_t i = 0; i < (Fmt::FRAC > 16 ? 4 : 3); i++) {
+			z = mulw(z, ONE + (ONE >> 1) - 2 * mulw(x, mulw(z, z)));
+		}
+
+		// 1/sqrt(x) = 2z * 2^k
+		k += 1;
+		return k >= 0 ? z << k : z >> -k;
+	}
+
+	/**
+	 * Normalises a vector of n <= 4 wide components into out.  The vector is
+	 * first shifted so its largest component is in [0.25, 0.5) to keep the
+	 * precision of small vectors and the range of large ones.
+	 *
+	 * @return false for a zero vector, out is then left untouched
+	*/
+	static bool normalize(wide * v, uint8_t n, value * out) {
+		wide m = 0, ss = 0;
+		uint8_t i;
+
+		for(i = 0; i < n; i++) {
+			wide a = v[i] < 0 ? -v[i] : v[i];
+			if(a > m) m = a;
+		}
+		if(m == 0) return false;
+
+		while(m >= (one() >> 1)) {
+			for(i = 0; i < n; i++) v[i] >>= 1;
+			m >>= 1;
+		}
+		while(m < (one() >> 2)) {
+			for(i = 0; i < n; i++) v[i] *= 2;
+			m *= 2;
+		}
+
+		for(i = 0; i < n; i++) ss += mulw(v[i], v[i]);
+		wide r = invSqrt(ss);
+		for(i = 0; i < n; i++) out[i] = sat(mulw(v[i], r));
+		return true;
+	}
+
+	/**
+	 * Converts a float vector to fixed point with one power of two shared by all
+	 * components, so the largest lands in [0.25, 0.5).  Only used on vectors that
+	 * are normalised afterwards.
+	*/
+	static void fromFloatVec(const float * f, wide * v) {
+		int e, emax = -126;
+		for(uint8_t i = 0; i < 3; i++) {
+			if(f[i] != 0.0f) {
+				frexp(f[i], &e);
+				if(e > emax) emax = e;
+			}
+		}
+		for(uint8_t i = 0; i < 3; i++) v[i] = (wide) ldexp(f[i], Fmt::FRAC - 1 - emax);
+	}
+
+	/**
+	 * Renormalises the quaternion n into q, saturating.  Near unit length a
+	 * single Newton step from 1 is exact to the LSB, otherwise the general
+	 * normalisation is used.
+	*/
+	static void renormQ(wide * n, value * q) {
+		const wide ONE = one();
+		wide n2 = mulw(n[0], n[0]) + mulw(n[1], n[1]) + mulw(n[2], n[2]) + mulw(n[3], n[3]);
+
+		if(n2 > (ONE >> 1) && n2 < ONE + (ONE >> 1)) {
+			wide r = (3 * ONE - n2) >> 1;
+			r = mulw(r, ONE + (ONE >> 1) - mulw(n2 >> 1, mulw(r, r)));
+			for(uint8_t i = 0; i < 4; i++) q[i] = sat(mulw(n[i], r));
+		} else {
+			normalize(n, 4, q);
+		}
+	}
+};
+
+/**
+ * State and conversions common to the fixed point engines.  Engine is the
+ * concrete engine, Fmt its number format.
+*/
+template <class Engine, class Fmt>
+class FixedEngineBase : public FusionEngine<Engine>
+{
+  public:
+	typedef FixMath<Fmt> M;
+	typedef typename Fmt::value value;
+	typedef typename Fmt::wide wide;
+
+	FixedEngineBase() { resetQ(); }
+
+	void readQ(float * q) {
+		for(uint8_t i = 0; i < 4; i++) q[i] = M::toFloat(qf[i]);
+	}
+
+	void writeQ(const float * q) {
+		for(uint8_t i = 0; i < 4; i++) qf[i] = M::sat(M::fromFloat(q[i]));
+	}
+
+	void resetQ() {
+		qf[0] = M::sat(M::one());
+		qf[1] = qf[2] = qf[3] = 0;
+	}
+
+  protected:
+	/**
+	 * Converts the float sample to fixed point.  hg is half the rotation of
+	 * this step (0.5 * gyro * dt in rad), a and m are unit vectors.
+	 *
+	 * @return bit 0 set if a is valid, bit 1 set if m is valid
+	*/
+	uint8_t convert(const float * val, float dt, wide * hg, value * a, value * m) {
+		const float k = 0.5f * dt * (float)(M_PI / 180.0);
+		wide v[3];
+		uint8_t valid = 0;
+
+		for(uint8_t i = 0; i < 3; i++) hg[i] = M::fromFloat(val[3 + i] * k);
+
+		M::fromFloatVec(&val[0], v);
+		if(M::normalize(v, 3, a)) valid |= 1;
+		M::fromFloatVec(&val[6], v);
+		if(M::normalize(v, 3, m)) valid |= 2;
+		return valid;
+	}
+
+	/**
+	 * Earth frame magnetic reference (bx, 0, bz) from the measured direction m,
+	 * the same as hx, hy, bx, bz in AHRS.h.
+	*/
+	void fluxReference(const value * m, value &bx, value &bz) {
+		const value * q = qf;
+		wide q0q2 = M::mul(q[0], q[2]), q0q3 = M::mul(q[0], q[3]), q1q2 = M::mul(q[1], q[2]);
+		wide q1q3 = M::mul(q[1], q[3]), q0q1 = M::mul(q[0], q[1]), q2q3 = M::mul(q[2], q[3]);
+		wide q1q1 = M::mul(q[1], q[1]), q2q2 = M::mul(q[2], q[2]), q3q3 = M::mul(q[3], q[3]);
+		const wide HALF = M::one() >> 1;
+
+		// half of hx, hy, hz, at most 0.5
+		value hx = M::sat(M::mul(m[0], M::sat(HALF - q2q2 - q3q3)) + M::mul(m[1], M::sat(q1q2 - q0q3)) + M::mul(m[2], M::sat(q1q3 + q0q2)));
+		value hy = M::sat(M::mul(m[0], M::sat(q1q2 + q0q3)) + M::mul(m[1], M::sat(HALF - q1q1 - q3q3)) + M::mul(m[2], M::sat(q2q3 - q0q1)));
+		value hz = M::sat(M::mul(m[0], M::sat(q1q3 - q0q2)) + M::mul(m[1], M::sat(q2q3 + q0q1)) + M::mul(m[2], M::sat(HALF - q1q1 - q2q2)));
+
+		wide hxy2 = M::mul(hx, hx) + M::mul(hy, hy);
+		bx = M::sat(2 * M::mulw(hxy2, M::invSqrt(hxy2)));
+		bz = M::sat(2 * (wide) hz);
+	}
+
+	value qf[4];
+};
+
+
+//---------------------------------------------------------------------------------------------------
+// Mahony filter, same algorithm as MahonyEngine::AHRSupdate
+
+template <class Fmt>
+class MahonyFixedEngine : public FixedEngineBase<MahonyFixedEngine<Fmt>, Fmt>
+{
+  public:
+	typedef FixedEngineBase<MahonyFixedEngine<Fmt>, Fmt> Base;
+	typedef FixMath<Fmt> M;
+	typedef typename Fmt::value value;
+	typedef typename Fmt::wide wide;
+
+	MahonyFixedEngine() : twoKp(0.0f), twoKi(0.0f) { resetState(); }
+
+	void setGains(float twoKpIn, float twoKiIn) {
+		twoKp = twoKpIn;
+		twoKi = twoKiIn;
+	}
+
+	void resetState() {
+		Base::resetQ();
+		integralFB[0] = integralFB[1] = integralFB[2] = 0;
+	}
+
+	void step(const float * val, float dt) {
+		wide hg[3];
+		value a[3], m[3];
+		uint8_t valid = Base::convert(val, dt, hg, a, m);
+		update(hg, a, m, valid, M::sat(M::fromFloat(0.5f * dt)), M::sat(M::fromFloat(0.5f * dt * twoKp)), M::sat(M::fromFloat(dt * twoKi)));
+	}
+
+	/**
+	 * The integer kernel.
+	 *
+	 * @param hg half rotation of this step, 0.5 * gyro * dt in rad
+	 * @param a, m unit accelerometer and magnetometer vectors
+	 * @param valid bit 0: a valid, bit 1: m valid
+	 * @param hdt 0.5 * dt, kp 0.5 * dt * twoKp, ki dt * twoKi
+	*/
+	void update(const wide * hg, const value * a, const value * m, uint8_t valid, value hdt, value kp, value ki) {
+		value * q = Base::qf;
+		const wide HALF = M::one() >> 1;
+		wide e[3] = {0, 0, 0};
+		wide d[3], n[4];
+
+		wide q0q0 = M::mul(q[0], q[0]), q0q1 = M::mul(q[0], q[1]), q0q2 = M::mul(q[0], q[2]), q0q3 = M::mul(q[0], q[3]);
+		wide q1q1 = M::mul(q[1], q[1]), q1q2 = M::mul(q[1], q[2]), q1q3 = M::mul(q[1], q[3]);
+		wide q2q2 = M::mul(q[2], q[2]), q2q3 = M::mul(q[2], q[3]), q3q3 = M::mul(q[3], q[3]);
+
+		if(valid & 2) {
+			value bx, bz;
+			Base::fluxReference(m, bx, bz);
+
+			// estimated direction of magnetic field
+			value halfwx = M::sat(M::mul(bx, M::sat(HALF - q2q2 - q3q3)) + M::mul(bz, M::sat(q1q3 - q0q2)));
+			value halfwy = M::sat(M::mul(bx, M::sat(q1q2 - q0q3)) + M::mul(bz, M::sat(q0q1 + q2q3)));
+			value halfwz = M::sat(M::mul(bx, M::sat(q0q2 + q1q3)) + M::mul(bz, M::sat(HALF - q1q1 - q2q2)));
+
+			e[0] += M::mul(m[1], halfwz) - M::mul(m[2], halfwy);
+			e[1] += M::mul(m[2], halfwx) - M::mul(m[0], halfwz);
+			e[2] += M::mul(m[0], halfwy) - M::mul(m[1], halfwx);
+		}
+
+		if(valid & 1) {
+			// estimated direction of gravity
+			value halfvx = M::sat(q1q3 - q0q2);
+			value halfvy = M::sat(q0q1 + q2q3);
+			value halfvz = M::sat(q0q0 - HALF + q3q3);
+
+			e[0] += M::mul(a[1], halfvz) - M::mul(a[2], halfvy);
+			e[1] += M::mul(a[2], halfvx) - M::mul(a[0], halfvz);
+			e[2] += M::mul(a[0], halfvy) - M::mul(a[1], halfvx);
+		}
+
+		for(uint8_t i = 0; i < 3; i++) {
+			d[i] = hg[i];
+			if(e[0] != 0 || e[1] != 0 || e[2] != 0) {
+				if(ki > 0) {
+					integralFB[i] += M::mulw(ki, e[i]);
+					d[i] += M::mulw(hdt, integralFB[i]);
+				} else {
+					integralFB[i] = 0;
+				}
+				d[i] += M::mulw(kp, e[i]);
+			}
+		}
+
+		// integrate rate of change of quaternion
+		n[0] = q[0] + (-M::mulw(q[1], d[0]) - M::mulw(q[2], d[1]) - M::mulw(q[3], d[2]));
+		n[1] = q[1] + (M::mulw(q[0], d[0]) + M::mulw(q[2], d[2]) - M::mulw(q[3], d[1]));
+		n[2] = q[2] + (M::mulw(q[0], d[1]) - M::mulw(q[1], d[2]) + M::mulw(q[3], d[0]));
+		n[3] = q[3] + (M::mulw(q[0], d[2]) + M::mulw(q[1], d[1]) - M::mulw(q[2], d[0]));
+
+		M::renormQ(n, q);
+	}
+
+	float twoKp;			// 2 * proportional gain (Kp)
+	float twoKi;			// 2 * integral gain (Ki)
+	wide integralFB[3];		// integral feedback in rad/s
+};
+
+
+//---------------------------------------------------------------------------------------------------
+// Madgwick gradient descent filter, same algorithm as MadgwickEngine::MadgwickAHRSupdate(IMU)
+
+template <class Fmt>
+class MadgwickFixedEngine : public FixedEngineBase<MadgwickFixedEngine<Fmt>, Fmt>
+{
+  public:
+	typedef FixedEngineBase<MadgwickFixedEngine<Fmt>, Fmt> Base;
+	typedef FixMath<Fmt> M;
+	typedef typename Fmt::value value;
+	typedef typename Fmt::wide wide;
+
+	MadgwickFixedEngine() : beta(0.1f) {}
+
+	void setGains(float betaIn) {
+		beta = betaIn;
+	}
+
+	void resetState() {
+		Base::resetQ();
+	}
+
+	void step(const float * val, float dt) {
+		wide hg[3];
+		value a[3], m[3];
+		uint8_t valid = Base::convert(val, dt, hg, a, m);
+		update(hg, a, m, valid, M::sat(M::fromFloat(beta * dt)));
+	}
+
+	/**
+	 * The integer kernel.  The gradient is computed as J'f with the objective
+	 * function halved, which keeps every product within range; its scale does
+	 * not matter since it is normalised.
+	 *
+	 * @param hg half rotation of this step, 0.5 * gyro * dt in rad
+	 * @param a, m unit accelerometer and magnetometer vectors
+	 * @param valid bit 0: a valid, bit 1: m valid
+	 * @param bdt beta * dt
+	*/
+	void update(const wide * hg, const value * a, const value * m, uint8_t valid, value bdt) {
+		value * q = Base::qf;
+		const wide ONE = M::one();
+		const wide HALF = ONE >> 1;
+		wide s[4] = {0, 0, 0, 0};
+		wide n[4];
+		value sn[4];
+
+		// rate of change of quaternion from gyroscope, times dt
+		n[0] = q[0] + (-M::mulw(q[1], hg[0]) - M::mulw(q[2], hg[1]) - M::mulw(q[3], hg[2]));
+		n[1] = q[1] + (M::mulw(q[0], hg[0]) + M::mulw(q[2], hg[2]) - M::mulw(q[3], hg[1]));
+		n[2] = q[2] + (M::mulw(q[0], hg[1]) - M::mulw(q[1], hg[2]) + M::mulw(q[3], hg[0]));
+		n[3] = q[3] + (M::mulw(q[0], hg[2]) + M::mulw(q[1], hg[1]) - M::mulw(q[2], hg[0]));
+
+		if(valid & 1) {
+			wide q0q1 = M::mul(q[0], q[1]), q0q2 = M::mul(q[0], q[2]), q1q3 = M::mul(q[1], q[3]);
+			wide q2q3 = M::mul(q[2], q[3]), q1q1 = M::mul(q[1], q[1]), q2q2 = M::mul(q[2], q[2]);
+
+			// half of the accelerometer objective function, at most 1
+			value fa1 = M::sat(q1q3 - q0q2 - (a[0] >> 1));
+			value fa2 = M::sat(q0q1 + q2q3 - (a[1] >> 1));
+			value fa3 = M::sat(HALF - q1q1 - q2q2 - (a[2] >> 1));
+
+			s[0] = 2 * (-M::mul(q[2], fa1) + M::mul(q[1], fa2));
+			s[1] = 2 * (M::mul(q[3], fa1) + M::mul(q[0], fa2)) - 4 * M::mul(q[1], fa3);
+			s[2] = 2 * (-M::mul(q[0], fa1) + M::mul(q[3], fa2)) - 4 * M::mul(q[2], fa3);
+			s[3] = 2 * (M::mul(q[1], fa1) + M::mul(q[2], fa2));
+
+			if(valid & 2) {
+				value bx, bz;
+				Base::fluxReference(m, bx, bz);
+
+				wide q0q3 = M::mul(q[0], q[3]), q1q2 = M::mul(q[1], q[2]), q3q3 = M::mul(q[3], q[3]);
+
+				// half of the magnetometer objective function, at most 0.75
+				value hbx = bx >> 1, hbz = bz >> 1;
+				value fm1 = M::sat(M::mul(hbx, M::sat(HALF - q2q2 - q3q3)) + M::mul(hbz, M::sat(q1q3 - q0q2)) - (m[0] >> 1));
+				value fm2 = M::sat(M::mul(hbx, M::sat(q1q2 - q0q3)) + M::mul(hbz, M::sat(q0q1 + q2q3)) - (m[1] >> 1));
+				value fm3 = M::sat(M::mul(hbx, M::sat(q0q2 + q1q3)) + M::mul(hbz, M::sat(HALF - q1q1 - q2q2)) - (m[2] >> 1));
+
+				value bxq[4], bzq[4];
+				for(uint8_t i = 0; i < 4; i++) {
+					bxq[i] = M::sat(M::mul(bx, q[i]));
+					bzq[i] = M::sat(M::mul(bz, q[i]));
+				}
+
+				s[0] += -M::mul(bzq[2], fm1) + (-M::mul(bxq[3], fm2) + M::mul(bzq[1], fm2)) + M::mul(bxq[2], fm3);
+				s[1] += M::mul(bzq[3], fm1) + (M::mul(bxq[2], fm2) + M::mul(bzq[0], fm2)) + (M::mul(bxq[3], fm3) - 2 * M::mul(bzq[1], fm3));
+				s[2] += (-2 * M::mul(bxq[2], fm1) - M::mul(bzq[0], fm1)) + (M::mul(bxq[1], fm2) + M::mul(bzq[3], fm2)) + (M::mul(bxq[0], fm3) - 2 * M::mul(bzq[2], fm3));
+				s[3] += (-2 * M::mul(bxq[3], fm1) + M::mul(bzq[1], fm1)) + (-M::mul(bxq[0], fm2) + M::mul(bzq[2], fm2)) + M::mul(bxq[1], fm3);
+			}
+
+			// apply feedback step
+			if(M::normalize(s, 4, sn)) {
+				for(uint8_t i = 0; i < 4; i++) n[i] -= M::mul(bdt, sn[i]);
+			}
+		}
+
+		M::renormQ(n, q);
+	}
+
+	float beta;		// algorithm gain
+};
+
+#endif // FusionFixed_h
@@ -0,0 +1,126 @@
+//=====================================================================================================
+// GyroBias.h
+//=====================================================================================================
+//
+// Gyro bias estimated in the background, one sample per add() from the sample loop, in place of
+// the blocking rounds of zeroGyro in FreeIMU::initGyros.  The gyro readings (sensor units, before
+// offsets and sensitivity) and the accelerometer readings are averaged over windows of WINDOW
+// samples taken while the caller reports the board still.  A window is kept if the gyro spread
+// within it stays under spread and the accelerometer direction did not move since the previous
+// window (ACC_MOVE), which the accelerometer norm test of the motion detector cannot see.  As in
+// initGyros the bias is taken once the means of two consecutive windows agree within agree;
+// after that every pair that agrees moves it by GAIN of the difference, so it follows drift.
+//
+// set() starts from a known bias, e.g. stored at the last run, converged or only as a first guess.
+// Has no Arduino dependencies, see debug/gyro_bias_sim.cpp.
+//
+// A turn at constant rate about the vertical passes every test; as with initGyros the board must
+// not be turned that way while the bias converges.
+//
+//=====================================================================================================
+
+#ifndef GyroBias_h
+#define GyroBias_h
+
+#include <inttypes.h>
+#include <math.h>
+
+class GyroBias
+{
+  public:
+	/**
+	 * Thresholds in gyro units and the window length in samples, restarts from a zero bias.
+	*/
+	void begin(float agree, float spread, uint8_t window) {
+		const float zero[3] = {0.0f, 0.0f, 0.0f};
+		this->agree = agree;
+		this->spread = spread;
+		this->window = window;
+		set(zero, false);
+	}
+
+	/**
+	 * Starts from bias, as the estimate if converged, otherwise until the first agreeing windows.
+	*/
+	void set(const float * bias, bool converged) {
+		for(uint8_t k = 0; k < 3; k++) b[k] = bias[k];
+		conv = converged;
+		n = 0;
+		have_prev = false;
+	}
+
+	/**
+	 * Forgets the convergence, not the bias: the next agreeing windows replace it.
+	*/
+	void restart() { set(b, false); }
+
+	/**
+	 * Adds a sample, still from the motion detector.  Returns true when the bias changed.
+	*/
+	bool add(const float * acc, const float * gyro, bool still) {
+		if(!still) {
+			n = 0;
+			have_prev = false;
+			return false;
+		}
+		for(uint8_t k = 0; k < 3; k++) {
+			if(n == 0) {
+				lo[k] = hi[k] = gyro[k];
+				gsum[k] = asum[k] = 0.0f;
+			}
+			gsum[k] += gyro[k];
+			asum[k] += acc[k];
+			if(gyro[k] < lo[k]) lo[k] = gyro[k];
+			if(gyro[k] > hi[k]) hi[k] = gyro[k];
+		}
+		if(++n < window) return false;
+		n = 0;
+
+		float g[3], a[3];
+		bool steady = true;
+		for(uint8_t k = 0; k < 3; k++) {
+			g[k] = gsum[k] / window;
+			a[k] = asum[k] / window;
+			steady = steady && hi[k] - lo[k] <= spread;
+		}
+		bool agrees = false;
+		if(steady && have_prev) {
+			float da = 0.0f, pa = 0.0f, dg = 0.0f;
+			for(uint8_t k = 0; k < 3; k++) {
+				da += (a[k] - prev_a[k]) * (a[k] - prev_a[k]);
+				pa += prev_a[k] * prev_a[k];
+				dg = fmaxf(dg, fabsf(g[k] - prev_g[k]));
+			}
+			agrees = da <= ACC_MOVE * ACC_MOVE * pa && dg <= agree;
+		}
+		if(agrees) {
+			for(uint8_t k = 0; k < 3; k++) {
+				float m = 0.5f * (g[k] + prev_g[k]);
+				b[k] = conv ? b[k] + (m - b[k]) * GAIN : m;
+			}
+			conv = true;
+		}
+		have_prev = steady;
+		for(uint8_t k = 0; k < 3; k++) {
+			prev_g[k] = g[k];
+			prev_a[k] = a[k];
+		}
+		return agrees;
+	}
+
+	bool converged() const { return conv; }
+	const float * bias() const { return b; }
+
+  private:
+	static constexpr float ACC_MOVE = 0.005f;	// rad, about 0.3 degrees between windows
+	static constexpr float GAIN = 0.125f;
+
+	float b[3];
+	float gsum[3], asum[3], lo[3], hi[3];	// window being summed
+	float prev_g[3], prev_a[3];				// means of the last window
+	float agree, spread;
+	uint8_t window, n;
+	bool conv, have_prev;
+};
+
+#endif // GyroBias_h
@@ -0,0 +1,175 @@
+//=====================================================================================================
+// LoopScheduler.h
+//=====================================================================================================
+//
+// Cooperative fixed-rate scheduler for the loop() of a sketch.  Each task is a function with a
+// period in microseconds; run() runs one task per call, the one whose release is oldest, so a
+// slow task (telemetry on a slow serial port, parsing a GPS sentence) delays the others by its
+// own run time only, instead of by everything else the loop does.  Tasks with period 0 are
+// background tasks: they take turns whenever no periodic task is due.
+//
+// A task that starts a whole period or more after its release has missed a deadline: the
+// releases it missed are counted in TaskStats.misses and skipped, not run in a burst, and the
+// task keeps its phase.  TaskStats also keeps the run time (last, max, average over the last
+// 1024 runs at least, as FusionStats) and the largest delay between release and start.
+//
+// The clock is given to the constructor, micros on the board, so a host program can run the
+// scheduler on a simulated clock (debug/scheduler_sim.cpp).  Times are uint32_t microseconds
+// compared by difference, micros wrapping around after 71 minutes does not disturb it.  Has no
+// Arduino dependencies.
+//
+//=====================================================================================================
+
+#ifndef LoopScheduler_h
+#define LoopScheduler_h
+
+#include <inttypes.h>
+#include <stddef.h>
+
+struct TaskStats {
+	uint32_t runs;
+	uint32_t misses;			// releases skipped, the task started a period late or more
+	uint32_t late_max;			// largest delay between release and start in us
+	uint32_t time_last;			// run time in us
+	uint32_t time_max;
+	uint32_t time_sum;
+	uint16_t sum_count;
+
+	void clear() {
+		runs = misses = late_max = time_last = time_max = time_sum = 0;
+		sum_count = 0;
+	}
+
+	void add(uint32_t time, uint32_t late) {
+		runs++;
+		time_last = time;
+		if(time > time_max) time_max = time;
+		if(late > late_max) late_max = late;
+		if(sum_count >= 1024) {
+			time_sum >>= 1;
+			sum_count >>= 1;
+		}
+		time_sum += time;
+		sum_count++;
+	}
+
+	uint32_t time_avg() const {
+		return sum_count ? time_sum / sum_count : 0;
+	}
+};
+
+typedef void (*LoopTask)();
+
+/**
+ * Scheduler of up to N tasks.
+*/
+template <uint8_t N>
+class LoopScheduler
+{
+  public:
+	LoopScheduler(uint32_t (*clock)()) : clock(clock), count(0), next_background(0), skipped(0) {}
+
+	/**
+	 * Adds fn, run every period_us from now on, or a background task with period 0.
+	 *
+	 * @return index of the task, -1 if there are N already
+	*/
+	int8_t add(LoopTask fn, uint32_t period_us, const char * name) {
+		if(count >= N) return -1;
+		Task &t = tasks[count];
+		t.fn = fn;
+		t.name = name;
+		t.period = period_us;
+		t.release = clock();
+		t.enabled = true;
+		t.stats.clear();
+		return count++;
+	}
+
+	/**
+	 * Changes the period of task i, the next release is a new period from now.
+	*/
+	void setPeriod(uint8_t i, uint32_t period_us) {
+		tasks[i].period = period_us;
+		tasks[i].release = clock() + period_us;
+	}
+
+	/**
+	 * Stops running task i, or starts it again released now.
+	*/
+	void enable(uint8_t i, bool on) {
+		if(on && !tasks[i].enabled) tasks[i].release = clock();
+		tasks[i].enabled = on;
+	}
+
+	/**
+	 * Runs the due task released the longest ago, or if none is due the next background task.
+	 *
+	 * @return index of the task run, -1 if none was due and there is no background task
+	*/
+	int8_t run() {
+		uint32_t now = clock();
+		int8_t pick = -1;
+		uint32_t late = 0;
+		for(uint8_t i = 0; i < count; i++) {
+			const Task &t = tasks[i];
+			if(!t.enabled || t.period == 0) continue;
+			uint32_t l = now - t.release;
+			if((int32_t) l >= 0 && (pick < 0 || l > late)) {
+				pick = i;
+				late = l;
+			}
+		}
+		if(pick >= 0) {
+			Task &t = tasks[pick];
+			uint32_t missed = late / t.period;
+			t.stats.misses += missed;
+			t.release += (missed + 1) * t.period;
+			skipped = missed;
+		} else {
+			for(uint8_t n = 0; n < count && pick < 0; n++) {
+				uint8_t i = (next_background + n) % count;
+				if(tasks[i].enabled && tasks[i].period == 0) pick = i;
+			}
+			if(pick < 0) return -1;
+			next_background = pick + 1;
+			skipped = 0;
+		}
+		uint32_t t0 = clock();
+		tasks[pick].fn();
+		tasks[pick].stats.add(clock() - t0, late);
+		return pick;
+	}
+
+	/**
+	 * Releases the running task skipped before this run, for a task that counts them itself.
+	*/
+	uint32_t missed() const { return skipped; }
+
+	uint8_t size() const { return count; }
+	const char * name(uint8_t i) const { return tasks[i].name; }
+	uint32_t period(uint8_t i) const { return tasks[i].period; }
+	const TaskStats & stats(uint8_t i) const { return tasks[i].stats; }
+
+	void clearStats() {
+		for(uint8_t i = 0; i < count; i++) tasks[i].stats.clear();
+	}
+
+  private:
+	struct Task {
+		LoopTask fn;
+		const char * name;
+		uint32_t period;		// us, 0 background
+		uint32_t release;		// next release, clock() time
+		bool enabled;
+		TaskStats stats;
+	};
+
+	uint32_t (*clock)();
+	Task tasks[N];
+	uint8_t count;
+	uint8_t next_background;	// background task to try first
+	uint32_t skipped;			// releases the running task skipped
+};
+
+#endif // LoopScheduler_h
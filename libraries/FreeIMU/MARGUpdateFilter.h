@@ -17,7 +17,7 @@
 
 #include <math.h>
 
-void FreeIMU::MARGUpdateFilter(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z, float m_x, float m_y, float m_z)
+void MARGEngine::MARGUpdateFilter(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z, float m_x, float m_y, float m_z, float deltat)
 {
     // local system variables
     float norm; // vector norm
@@ -28,7 +28,6 @@ void FreeIMU::MARGUpdateFilter(float w_x, float w_y, float w_z, float a_x, float
     float SEqHatDot_1, SEqHatDot_2, SEqHatDot_3, SEqHatDot_4; // estimated direction of the gyroscope error
     float w_err_x, w_err_y, w_err_z; // estimated direction of the gyroscope error (angular)
     float h_x, h_y, h_z; // computed flux in the earth frame
-	float deltat = 1/sampleFreq;
 	
 	//float a_x, a_y, a_z; 					// accelerometer measurements
 	//float w_x, w_y, w_z; 					// gyroscope measurements in rad/s
@@ -167,7 +166,7 @@ void FreeIMU::MARGUpdateFilter(float w_x, float w_y, float w_z, float a_x, float
 	q3 = SEq_4;
 }
 
-void FreeIMU::MARGUpdateFilterIMU(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z)
+void MARGEngine::MARGUpdateFilterIMU(float w_x, float w_y, float w_z, float a_x, float a_y, float a_z, float deltat)
 {
 	// Local system variables
 	float norm; // vector norm
@@ -185,8 +184,6 @@ void FreeIMU::MARGUpdateFilterIMU(float w_x, float w_y, float w_z, float a_x, fl
 	float twoSEq_2 = 2.0f * SEq_2;
 	float twoSEq_3 = 2.0f * SEq_3;
 
-	float deltat = 1/sampleFreq;
-	
 	// Normalise the accelerometer measurement
 	norm = sqrt(a_x * a_x + a_y * a_y + a_z * a_z);
 	a_x /= norm;
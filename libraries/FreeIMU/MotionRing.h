@@ -0,0 +1,105 @@
+//=====================================================================================================
+// MotionRing.h
+//=====================================================================================================
+//
+// Ring of raw accel/temp/gyro samples drained from the MPU60X0 FIFO, so getQ can run the filter
+// once per sample instead of once per loop.  Has no Arduino dependencies so a captured or
+// simulated FIFO byte stream can be pushed through it on a PC.
+//
+// The ring is single producer / single consumer and needs no lock: the producer (push,
+// pushFrames) only writes head, the consumer (pop) only writes tail, and the 8 bit indices are
+// read and written in one access on every target.  With FIFO_INT_PIN the producer is the
+// data-ready interrupt and the consumer getQ.
+//
+//=====================================================================================================
+
+#ifndef MotionRing_h
+#define MotionRing_h
+
+#include <inttypes.h>
+
+// keeps the compiler from moving the sample copy across the index update that publishes it
+#define MOTION_RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define MOTION_FRAME_SIZE 14	// accel(6) + temp(2) + gyro(6), big endian, MPU60X0 register order
+
+struct MotionSample {
+	int16_t ax, ay, az;
+	int16_t temp;
+	int16_t gx, gy, gz;
+};
+
+/**
+ * Fixed size ring of MotionSample. N must be a power of two no larger than 128.
+ * When the ring is full new samples are refused and counted in overruns.
+ * overruns and peak belong to the producer; clear() may only be called while
+ * neither side is running, e.g. with the interrupt detached or masked.
+*/
+template <uint8_t N>
+class MotionRing
+{
+  public:
+	MotionRing() : overruns(0), peak(0), head(0), tail(0) {}
+
+	uint8_t count() const { return (uint8_t)(head - tail); }
+	uint8_t space() const { return N - count(); }
+	void clear() { head = tail = 0; overruns = 0; peak = 0; }
+
+	bool push(const MotionSample &s) {
+		uint8_t h = head;
+		uint8_t n = (uint8_t)(h - tail);
+		if(n >= N) {
+			overruns++;
+			return false;
+		}
+		buf[h & (N - 1)] = s;
+		MOTION_RING_BARRIER();
+		head = h + 1;
+		if(n + 1 > peak) peak = n + 1;
+		return true;
+	}
+
+	bool pop(MotionSample &s) {
+		uint8_t t = tail;
+		if(head == t) return false;
+		s = buf[t & (N - 1)];
+		MOTION_RING_BARRIER();
+		tail = t + 1;
+		return true;
+	}
+
+	/**
+	 * Decodes every whole frame of a FIFO byte stream into the ring.
+	 * A trailing partial frame is ignored.
+	 *
+	 * @return number of samples stored
+	*/
+	uint8_t pushFrames(const uint8_t * stream, uint16_t length) {
+		uint8_t stored = 0;
+		MotionSample s;
+		for(uint16_t i = 0; i + MOTION_FRAME_SIZE <= length; i += MOTION_FRAME_SIZE) {
+			decodeFrame(&stream[i], s);
+			if(push(s)) stored++;
+		}
+		return stored;
+	}
+
+	static void decodeFrame(const uint8_t * frame, MotionSample &s) {
+		s.ax   = (((int16_t)frame[0]) << 8) | frame[1];
+		s.ay   = (((int16_t)frame[2]) << 8) | frame[3];
+		s.az   = (((int16_t)frame[4]) << 8) | frame[5];
+		s.temp = (((int16_t)frame[6]) << 8) | frame[7];
+		s.gx   = (((int16_t)frame[8]) << 8) | frame[9];
+		s.gy   = (((int16_t)frame[10]) << 8) | frame[11];
+		s.gz   = (((int16_t)frame[12]) << 8) | frame[13];
+	}
+
+	volatile uint16_t overruns;
+	volatile uint8_t peak;		// most samples held at once since the last clear
+
+  private:
+	MotionSample buf[N];
+	volatile uint8_t head, tail;
+};
+
+#endif // MotionRing_h
@@ -0,0 +1,148 @@
+//=====================================================================================================
+// OrientationState.h
+//=====================================================================================================
+//
+// Snapshot of the orientation after the last getQ: the quaternion and heading, and the values
+// derived from them (rotation matrix, Euler angles, gravity direction, yaw/pitch/roll).  Each
+// derived value is computed the first time it is asked for after an update and then kept, so
+// a sketch that reads the quaternion and several angle sets runs the trigonometry once per
+// sample and reads the sensors once.
+//
+// consumed has a bit for every getter that has read the current snapshot.  The FreeIMU angle
+// getters call getQ again only when their own bit is already set, i.e. when they are polled
+// without a getQ in between, so sketches that only call getYawPitchRoll still run the filter
+// on every call.
+//
+//=====================================================================================================
+
+#ifndef OrientationState_h
+#define OrientationState_h
+
+#include <inttypes.h>
+#include <math.h>
+#include "FastMath.h"
+
+// Parts of the snapshot, for valid and consumed
+#define ORIENT_Q			0x01
+#define ORIENT_MATRIX		0x02
+#define ORIENT_GRAVITY		0x04
+#define ORIENT_EULER		0x08
+#define ORIENT_YPR			0x10
+#define ORIENT_YPR180		0x20
+#define ORIENT_ALL			0xFF
+
+struct OrientationState {
+	float q[4];
+	float heading;				// tilt compensated heading in degrees, val[9] of getQ
+	uint8_t valid;				// derived values computed for this q
+	uint8_t consumed;			// getters that have read this snapshot
+
+	float m[9];					// rotation matrix, row major, sensor to earth frame
+	float gravity[3];			// gravity direction in the sensor frame
+	float euler[3];				// psi, theta, phi in radians
+	float ypr[3];				// yaw, pitch, roll in radians
+	float ypr180[3];			// yaw from heading, pitch and roll over +-180 degrees, radians
+
+	// empty snapshot, the first read of any part asks for an update
+	void clear() {
+		q[0] = 1.0f;
+		q[1] = q[2] = q[3] = 0.0f;
+		heading = 0.0f;
+		valid = ORIENT_Q;
+		consumed = ORIENT_ALL;
+	}
+
+	void set(const float * nq, float nheading) {
+		q[0] = nq[0];
+		q[1] = nq[1];
+		q[2] = nq[2];
+		q[3] = nq[3];
+		heading = nheading;
+		valid = ORIENT_Q;
+		consumed = 0;
+	}
+
+	/**
+	 * Marks part as read.
+	 * @return true if it had already been read since the last set(), the
+	 *         caller should update the snapshot first
+	*/
+	bool consume(uint8_t part) {
+		bool stale = consumed & part;
+		consumed |= part;
+		return stale;
+	}
+
+	const float * getMatrix() {
+		if(!(valid & ORIENT_MATRIX)) {
+			float q0q0 = q[0]*q[0], q1q1 = q[1]*q[1], q2q2 = q[2]*q[2], q3q3 = q[3]*q[3];
+			m[0] = q0q0 + q1q1 - q2q2 - q3q3;
+			m[1] = 2 * (q[1]*q[2] - q[0]*q[3]);
+			m[2] = 2 * (q[1]*q[3] + q[0]*q[2]);
+			m[3] = 2 * (q[1]*q[2] + q[0]*q[3]);
+			m[4] = q0q0 - q1q1 + q2q2 - q3q3;
+			m[5] = 2 * (q[2]*q[3] - q[0]*q[1]);
+			m[6] = 2 * (q[1]*q[3] - q[0]*q[2]);
+			m[7] = 2 * (q[0]*q[1] + q[2]*q[3]);
+			m[8] = q0q0 - q1q1 - q2q2 + q3q3;
+			valid |= ORIENT_MATRIX;
+		}
+		return m;
+	}
+
+	// last row of the rotation matrix
+	const float * getGravity() {
+		if(!(valid & ORIENT_GRAVITY)) {
+			gravity[0] = 2 * (q[1]*q[3] - q[0]*q[2]);
+			gravity[1] = 2 * (q[0]*q[1] + q[2]*q[3]);
+			gravity[2] = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+			valid |= ORIENT_GRAVITY;
+		}
+		return gravity;
+	}
+
+	const float * getEuler() {
+		if(!(valid & ORIENT_EULER)) {
+			euler[0] = fastAtan2(2 * q[1] * q[2] - 2 * q[0] * q[3], 2 * q[0]*q[0] + 2 * q[1] * q[1] - 1); // psi
+			euler[1] = -fastAsin(2 * q[1] * q[3] + 2 * q[0] * q[2]); // theta
+			euler[2] = fastAtan2(2 * q[2] * q[3] - 2 * q[0] * q[1], 2 * q[0] * q[0] + 2 * q[3] * q[3] - 1); // phi
+			valid |= ORIENT_EULER;
+		}
+		return euler;
+	}
+
+	const float * getYawPitchRoll() {
+		if(!(valid & ORIENT_YPR)) {
+			const float * g = getGravity();
+			ypr[0] = getEuler()[0];
+			ypr[1] = fastAtan(g[0] / fastSqrt(g[1]*g[1] + g[2]*g[2]));
+			ypr[2] = fastAtan(g[1] / fastSqrt(g[0]*g[0] + g[2]*g[2]));
+			valid |= ORIENT_YPR;
+		}
+		return ypr;
+	}
+
+	const float * getYawPitchRoll180() {
+		if(!(valid & ORIENT_YPR180)) {
+			const float * g = getGravity();
+			float pitch = getYawPitchRoll()[1];
+
+			ypr180[0] = heading;
+			if(ypr180[0] > 180.) ypr180[0] = ypr180[0] - 360.;
+			ypr180[0] = ypr180[0] * 0.0174532925;
+
+			if(g[0] > 0 && g[2] <= 0) {
+				ypr180[1] = M_PI - pitch;
+			} else if(g[0] < 0 && g[2] < 0) {
+				ypr180[1] = -M_PI - pitch;
+			} else {
+				ypr180[1] = pitch;
+			}
+			ypr180[2] = ypr[2];
+			valid |= ORIENT_YPR180;
+		}
+		return ypr180;
+	}
+};
+
+#endif // OrientationState_h
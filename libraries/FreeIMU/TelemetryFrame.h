@@ -0,0 +1,265 @@
+//=====================================================================================================
+// TelemetryFrame.h
+//=====================================================================================================
+//
+// Binary telemetry frames, the compact alternative to the hex floats of serialPrintFloatArr
+// (9 characters per float).  A frame is
+//
+//   0xA5 0x5A  length  type  seq  payload[length]  crc16
+//
+// with length the payload size, seq counting the frames of a sender modulo 256 so a receiver
+// can count the lost ones, and crc16 (CRC-16/CCITT, 0x1021 from 0xFFFF, little endian) over
+// length, type, seq and payload.  Payload values are little endian: float32 as stored, or int16
+// scaled, Q15 for quaternion components (FRAME_Q15) and hundredths of a degree for angles
+// (FRAME_CDEG), or signed varints (zigzag, 7 bits a byte) for the deltas of TelemetryPack.h.
+// A 'z' line of 18 floats is 79 bytes instead of 163.
+//
+// FrameEncoder builds a frame in a buffer of the caller, no heap and no printf, for
+// CommunicationUtils on the board.  FrameDecoder takes a byte stream one byte at a time, finds
+// the frames in it, drops the damaged ones and resynchronizes on the next marker; FrameReader
+// reads the payload of a decoded frame.  Has no Arduino dependencies, the host decoder is this
+// header, see debug/frame_bench.cpp and debug/frame_dump.cpp.
+//
+//=====================================================================================================
+
+#ifndef TelemetryFrame_h
+#define TelemetryFrame_h
+
+#include <inttypes.h>
+#include <string.h>
+
+#define FRAME_SYNC1			0xA5
+#define FRAME_SYNC2			0x5A
+#define FRAME_HEADER		5		// sync1, sync2, length, type, seq
+#define FRAME_OVERHEAD		7		// header and crc
+#define FRAME_MAX_PAYLOAD	96		// 24 floats, bounds the frame buffers on the board
+
+// message types
+#define FRAME_FLOATS		0x01	// float32[n]
+#define FRAME_INT16			0x02	// int16[n], raw sensor values as writeArr sends them
+#define FRAME_QUAT16		0x03	// int16[4] quaternion in Q15
+#define FRAME_ANGLES16		0x04	// int16[3] yaw, pitch, roll in hundredths of a degree
+#define FRAME_VALUES		0x10	// float32[n], the 'z' line: q, acc, gyro, magn, temp, press...
+#define FRAME_GPS			0x11	// float32[n], the GPS line of 'z'
+#define FRAME_PACK_KEY		0x12	// packed q, sensors and slow channels, see TelemetryPack.h
+#define FRAME_PACK			0x13	// the same with the slow channels as deltas to the keyframe
+#define FRAME_STATUS		0x20	// uint16 rate, uint8 fields, uint32 ticks, uint32 dropped (, float32 pack scales), see TelemetryStream.h
+
+#define FRAME_Q15			32767.0f
+#define FRAME_CDEG			100.0f
+
+static inline uint16_t frameCrc(uint16_t crc, uint8_t c) {
+	crc ^= (uint16_t) c << 8;
+	for(uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	return crc;
+}
+
+/**
+ * Builds one frame in buf, which must hold FRAME_OVERHEAD + the payload.
+*/
+class FrameEncoder
+{
+  public:
+	FrameEncoder(uint8_t * buf, uint8_t size) : buf(buf), size(size), n(0), overflow(false) {}
+
+	void begin(uint8_t type, uint8_t seq) {
+		n = FRAME_HEADER;
+		overflow = size < FRAME_OVERHEAD;
+		if(!overflow) {
+			buf[0] = FRAME_SYNC1;
+			buf[1] = FRAME_SYNC2;
+			buf[3] = type;
+			buf[4] = seq;
+		}
+	}
+
+	void putU8(uint8_t v) {
+		if(n + 2 >= size || n - FRAME_HEADER >= FRAME_MAX_PAYLOAD) overflow = true;
+		else buf[n++] = v;
+	}
+
+	void putU16(uint16_t v) {
+		putU8(v & 0xFF);
+		putU8(v >> 8);
+	}
+
+	void putU32(uint32_t v) {
+		putU16(v & 0xFFFF);
+		putU16(v >> 16);
+	}
+
+	void putInt16(int16_t v) { putU16((uint16_t) v); }
+
+	void putFloat(float f) {
+		uint32_t v;
+		memcpy(&v, &f, 4);
+		putU32(v);
+	}
+
+	/**
+	 * Zigzag varint: 1 byte up to +-63, 2 up to +-8191, 5 at most.
+	*/
+	void putVarint(int32_t v) {
+		uint32_t z = ((uint32_t) v << 1) ^ (uint32_t)(v >> 31);
+		while(z >= 0x80) {
+			putU8((z & 0x7F) | 0x80);
+			z >>= 7;
+		}
+		putU8(z);
+	}
+
+	/**
+	 * f * scale rounded to int16, saturated.
+	*/
+	void putScaled(float f, float scale) {
+		float s = f * scale;
+		s = s < -32767.0f ? -32767.0f : s > 32767.0f ? 32767.0f : s;
+		putInt16((int16_t)(s < 0.0f ? s - 0.5f : s + 0.5f));
+	}
+
+	/**
+	 * Length and crc, returns the size of the frame, 0 if the payload did not fit.
+	*/
+	uint8_t end() {
+		if(overflow) return 0;
+		buf[2] = n - FRAME_HEADER;
+		uint16_t crc = 0xFFFF;
+		for(uint8_t i = 2; i < n; i++) crc = frameCrc(crc, buf[i]);
+		buf[n++] = crc & 0xFF;
+		buf[n++] = crc >> 8;
+		return n;
+	}
+
+  private:
+	uint8_t * buf;
+	uint8_t size;
+	uint8_t n;
+	bool overflow;
+};
+
+/**
+ * Finds frames in a byte stream.  push() returns true when a frame is complete, which type(),
+ * seq() and payload() describe until the next push.  After a damaged frame the bytes it took
+ * are searched again, and may hold more than one frame: next() returns those still waiting
+ * without adding a byte.
+*/
+class FrameDecoder
+{
+  public:
+	uint32_t frames;		// good frames
+	uint32_t crc_errors;	// frames dropped for their crc or an impossible length
+	uint32_t skipped;		// bytes outside of good frames
+	uint32_t lost;			// frames missing in the sequence numbers of the good ones
+
+	FrameDecoder() { reset(); }
+
+	void reset() {
+		frames = crc_errors = skipped = lost = 0;
+		n = 0;
+		have_seq = false;
+	}
+
+	bool push(uint8_t c) {
+		if(n == sizeof(win)) drop(1);
+		win[n++] = c;
+		return next();
+	}
+
+	bool next() {
+		for(;;) {
+			// up to the first marker, or a sync1 ending the window
+			uint8_t i = 0;
+			while(i < n && !(win[i] == FRAME_SYNC1 && (i + 1 == n || win[i + 1] == FRAME_SYNC2))) i++;
+			drop(i);
+			if(n < FRAME_OVERHEAD) return false;
+			uint8_t len = win[2];
+			bool good = len <= FRAME_MAX_PAYLOAD;
+			if(good) {
+				if(n < len + FRAME_OVERHEAD) return false;
+				uint16_t crc = 0xFFFF;
+				for(i = 2; i < len + FRAME_HEADER; i++) crc = frameCrc(crc, win[i]);
+				good = (crc & 0xFF) == win[len + FRAME_HEADER] && (crc >> 8) == win[len + FRAME_HEADER + 1];
+			}
+			if(!good) {
+				crc_errors++;
+				drop(1);
+				continue;
+			}
+			memcpy(frame, win + 2, len + 3);
+			remove(len + FRAME_OVERHEAD);
+			if(have_seq) lost += (uint8_t)(frame[2] - last_seq - 1);
+			have_seq = true;
+			last_seq = frame[2];
+			frames++;
+			return true;
+		}
+	}
+
+	uint8_t type() const { return frame[1]; }
+	uint8_t seq() const { return frame[2]; }
+	uint8_t length() const { return frame[0]; }
+	const uint8_t * payload() const { return frame + 3; }
+
+  private:
+	uint8_t win[2 * (FRAME_MAX_PAYLOAD + FRAME_OVERHEAD)];	// bytes not yet decoded
+	uint8_t frame[3 + FRAME_MAX_PAYLOAD];					// length, type, seq, payload
+	uint8_t n;
+	uint8_t last_seq;
+	bool have_seq;
+
+	void remove(uint8_t k) {
+		memmove(win, win + k, n - k);
+		n -= k;
+	}
+
+	void drop(uint8_t k) {
+		remove(k);
+		skipped += k;
+	}
+};
+
+/**
+ * Little endian reads from the payload of a decoded frame.
+*/
+class FrameReader
+{
+  public:
+	FrameReader(const uint8_t * payload, uint8_t length) : p(payload), length(length) {}
+
+	uint8_t u8(uint8_t at) const { return p[at]; }
+	uint16_t u16(uint8_t at) const { return p[at] | (uint16_t) p[at + 1] << 8; }
+	uint32_t u32(uint8_t at) const { return u16(at) | (uint32_t) u16(at + 2) << 16; }
+	int16_t int16(uint8_t at) const { return (int16_t) u16(at); }
+
+	float float32(uint8_t at) const {
+		uint32_t v = u32(at);
+		float f;
+		memcpy(&f, &v, 4);
+		return f;
+	}
+
+	float scaled(uint8_t at, float scale) const { return int16(at) / scale; }
+
+	/**
+	 * Zigzag varint at at into v, returns its size, 0 if it runs past the payload.
+	*/
+	uint8_t varint(uint8_t at, int32_t &v) const {
+		uint32_t z = 0;
+		for(uint8_t i = 0; i < 5 && at + i < length; i++) {
+			z |= (uint32_t)(p[at + i] & 0x7F) << (7 * i);
+			if(!(p[at + i] & 0x80)) {
+				v = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+				return i + 1;
+			}
+		}
+		return 0;
+	}
+
+	uint8_t size() const { return length; }
+
+  private:
+	const uint8_t * p;
+	uint8_t length;
+};
+
+#endif // TelemetryFrame_h
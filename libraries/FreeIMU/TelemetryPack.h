@@ -0,0 +1,239 @@
+//=====================================================================================================
+// TelemetryPack.h
+//=====================================================================================================
+//
+// Packed telemetry for slow links such as the XBee of FreeIMU_serial_ARM_CPU_XBEE: the quaternion,
+// the 9 calibrated sensor values and the slow channels (temperature, pressure, altitude) of a
+// 'z' line in a FRAME_PACK_KEY or FRAME_PACK frame (TelemetryFrame.h).
+//
+//   quaternion   smallest three: the index of the largest component in 2 bits, the other three
+//                in 10 bits each (32 bits, 0.25 deg) or 15 bits each with PACK_QUAT48 (48 bits,
+//                0.01 deg), the largest one rebuilt from the unit norm and made positive (q and
+//                -q are the same rotation)
+//   sensors      int16, acc and magn times PackScale.acc/.magn, gyro in deg/s times .gyro,
+//                saturated; the scales are set per stream, fit() takes them from the range of
+//                the values (FreeIMU::calRange), and sent in the keyframes
+//   slow         hundredths (0.01 C, 0.01 mbar, cm), int32 in the keyframes and varint deltas to
+//                the last keyframe in between
+//
+// A keyframe every PackEncoder.keyframe frames:
+//
+//   FRAME_PACK_KEY  flags  scale.acc scale.gyro scale.magn (float32)  q  sensors  slow (int32)
+//   FRAME_PACK      key seq  q  sensors  slow deltas (varint)
+//
+// The deltas are to the keyframe, not to the previous frame, so that a lost FRAME_PACK costs
+// only itself; a FRAME_PACK carries the sequence number of its keyframe and is dropped by the
+// decoder if that is not the keyframe it has.  With 32 bit quaternions a FRAME_PACK is 33 bytes
+// while the slow channels stay within 0.63 of the keyframe, against 71 for the same 16 values
+// in a FRAME_VALUES.  Has no Arduino dependencies, see debug/pack_bench.cpp.
+//
+//=====================================================================================================
+
+#ifndef TelemetryPack_h
+#define TelemetryPack_h
+
+#include <math.h>
+
+#include "TelemetryFrame.h"
+
+#define PACK_QUAT48			0x01	// flags: 15 bit components
+#define PACK_SLOW			3		// temperature, pressure, altitude
+#define PACK_SLOW_SCALE		100.0f
+#define PACK_KEYFRAME		32		// default keyframe interval, frames
+#define PACK_MAX_PAYLOAD	(1 + 12 + 6 + 18 + 4 * PACK_SLOW)
+
+// default scales: +-4 g or gauss at 1/8192, +-2048 deg/s at 1/16
+#define PACK_ACC_SCALE		8192.0f
+#define PACK_GYRO_SCALE		16.0f
+#define PACK_MAGN_SCALE		8192.0f
+
+struct PackSample {
+	float q[4];
+	float sensors[9];			// acc, gyro in deg/s, magn: val[0..8] of getValues
+	float slow[PACK_SLOW];		// temperature C, pressure mbar, altitude m
+};
+
+struct PackScale {
+	float acc, gyro, magn;
+
+	PackScale() : acc(PACK_ACC_SCALE), gyro(PACK_GYRO_SCALE), magn(PACK_MAGN_SCALE) {}
+
+	float of(uint8_t sensor) const { return sensor < 3 ? acc : sensor < 6 ? gyro : magn; }
+
+	/**
+	 * Scales that take values within +-range of each sensor, the default for a range that is
+	 * not a positive number.
+	*/
+	void fit(float acc_range, float gyro_range, float magn_range) {
+		acc = fitOne(acc_range, PACK_ACC_SCALE);
+		gyro = fitOne(gyro_range, PACK_GYRO_SCALE);
+		magn = fitOne(magn_range, PACK_MAGN_SCALE);
+	}
+
+  private:
+	static float fitOne(float range, float def) { return range > 0.0f && range < 1e30f ? 32767.0f / range : def; }
+};
+
+/**
+ * Smallest three of q with bits per component, normalized and with the largest component
+ * positive.
+*/
+static inline uint64_t packQuat(const float * q, uint8_t bits) {
+	uint8_t m = 0;
+	float n = 0;
+	for(uint8_t i = 0; i < 4; i++) {
+		if(fabsf(q[i]) > fabsf(q[m])) m = i;
+		n += q[i] * q[i];
+	}
+	// components other than the largest are within +-1/sqrt(2)
+	float k = (q[m] < 0 ? -1.41421356f : 1.41421356f) / (n > 0 ? sqrtf(n) : 1.0f);
+	// -half..half around half, so that 0 is exact
+	float half = ((uint32_t) 1 << (bits - 1)) - 1;
+	uint64_t v = m;
+	for(uint8_t i = 0; i < 4; i++) {
+		if(i == m) continue;
+		float x = q[i] * k;
+		x = x < -1.0f ? -1.0f : x > 1.0f ? 1.0f : x;
+		v = v << bits | (uint32_t)((x + 1.0f) * half + 0.5f);
+	}
+	return v;
+}
+
+static inline void unpackQuat(uint64_t v, uint8_t bits, float * q) {
+	uint32_t mask = ((uint32_t) 1 << bits) - 1;
+	float half = ((uint32_t) 1 << (bits - 1)) - 1;
+	uint8_t m = (v >> (3 * bits)) & 3;
+	float s = 0;
+	for(int8_t i = 3; i >= 0; i--) {
+		if(i == m) continue;
+		q[i] = ((v & mask) / half - 1.0f) * 0.70710678f;
+		s += q[i] * q[i];
+		v >>= bits;
+	}
+	q[m] = s < 1.0f ? sqrtf(1.0f - s) : 0.0f;
+}
+
+static inline int32_t packSlow(float f) {
+	f *= PACK_SLOW_SCALE;
+	return (int32_t)(f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+
+/**
+ * Builds the FRAME_PACK_KEY and FRAME_PACK frames of a stream; the first after reset() is a
+ * keyframe, call it after a change of scale or flags.
+*/
+class PackEncoder
+{
+  public:
+	PackScale scale;
+	uint8_t flags;
+	uint8_t keyframe;			// interval, frames
+
+	PackEncoder() : flags(0), keyframe(PACK_KEYFRAME) { reset(); }
+
+	void reset() { n = 0; }
+
+	void encode(FrameEncoder &e, uint8_t seq, const PackSample &s) {
+		bool key = n == 0;
+		e.begin(key ? FRAME_PACK_KEY : FRAME_PACK, seq);
+		if(key) {
+			key_seq = seq;
+			e.putU8(flags);
+			e.putFloat(scale.acc);
+			e.putFloat(scale.gyro);
+			e.putFloat(scale.magn);
+		}
+		else e.putU8(key_seq);
+		if(flags & PACK_QUAT48) {
+			uint64_t v = packQuat(s.q, 15);
+			e.putU32(v & 0xFFFFFFFF);
+			e.putU16(v >> 32);
+		}
+		else e.putU32(packQuat(s.q, 10));
+		for(uint8_t i = 0; i < 9; i++) e.putScaled(s.sensors[i], scale.of(i));
+		for(uint8_t i = 0; i < PACK_SLOW; i++) {
+			int32_t v = packSlow(s.slow[i]);
+			if(key) {
+				ref[i] = v;
+				e.putU32(v);
+			}
+			else e.putVarint(v - ref[i]);
+		}
+		if(++n >= keyframe) n = 0;
+	}
+
+  private:
+	uint8_t n;					// frames since the keyframe
+	uint8_t key_seq;
+	int32_t ref[PACK_SLOW];		// slow channels of the keyframe
+};
+
+/**
+ * Decodes the frames of a PackEncoder.  decode() returns false for other frame types, damaged
+ * payloads and a FRAME_PACK whose keyframe it did not get, which it counts as stale.
+*/
+class PackDecoder
+{
+  public:
+	PackScale scale;
+	uint8_t flags;
+	uint32_t keyframes;
+	uint32_t stale;				// FRAME_PACK without their keyframe
+
+	PackDecoder() : flags(0), keyframes(0), stale(0), have_key(false) {}
+
+	bool decode(uint8_t type, uint8_t seq, const uint8_t * payload, uint8_t length, PackSample &s) {
+		FrameReader r(payload, length);
+		uint8_t at;
+		bool key = type == FRAME_PACK_KEY;
+		if(key) {
+			if(length < 13 || length < 13 + ((r.u8(0) & PACK_QUAT48) ? 6 : 4) + 18 + 4 * PACK_SLOW) return false;
+			flags = r.u8(0);
+			scale.acc = r.float32(1);
+			scale.gyro = r.float32(5);
+			scale.magn = r.float32(9);
+			at = 13;
+		}
+		else if(type == FRAME_PACK) {
+			if(!have_key || length < 1 || r.u8(0) != key_seq) {
+				stale++;
+				return false;
+			}
+			at = 1;
+		}
+		else return false;
+		uint8_t qsize = (flags & PACK_QUAT48) ? 6 : 4;
+		if(length < at + qsize + 18) return false;
+		if(qsize == 6) unpackQuat(r.u32(at) | (uint64_t) r.u16(at + 4) << 32, 15, s.q);
+		else unpackQuat(r.u32(at), 10, s.q);
+		at += qsize;
+		for(uint8_t i = 0; i < 9; i++, at += 2) s.sensors[i] = r.scaled(at, scale.of(i));
+		for(uint8_t i = 0; i < PACK_SLOW; i++) {
+			int32_t v;
+			if(key) {
+				v = ref[i] = (int32_t) r.u32(at);
+				at += 4;
+			}
+			else {
+				uint8_t k = r.varint(at, v);
+				if(k == 0) return false;
+				v += ref[i];
+				at += k;
+			}
+			s.slow[i] = v / PACK_SLOW_SCALE;
+		}
+		if(key) {
+			have_key = true;
+			key_seq = seq;
+			keyframes++;
+		}
+		return true;
+	}
+
+  private:
+	bool have_key;
+	uint8_t key_seq;
+	int32_t ref[PACK_SLOW];
+};
+
+#endif // TelemetryPack_h
@@ -0,0 +1,77 @@
+//=====================================================================================================
+// TelemetryStream.h
+//=====================================================================================================
+//
+// Push streaming subscription of the FreeIMU_serial sketches: the host sends once
+//
+//   's'  rate (uint16 Hz, little endian)  fields (STREAM_* mask)
+//
+// and the board sends the selected frames (TelemetryFrame.h) rate times a second from a task of
+// its LoopScheduler, until an 's' with rate or fields 0.  A FRAME_STATUS frame answers the 's'
+// and follows every STREAM_STATUS_PERIOD: rate, fields, ticks sent and ticks dropped because
+// the loop was late for them, and with STREAM_PACKED the scales of the packed frames
+// (PackScale), which the sketch fits to the calibrated range of the sensors when the
+// subscription starts.  Frames lost on the way show as gaps in the sequence numbers,
+// which the host decoder counts (FrameDecoder.lost).  STREAM_DECIMATE in fields has the
+// TelemetryWriter of the sketch skip whole ticks when the port is behind, counted as dropped,
+// instead of dropping the oldest frames.  Has no Arduino dependencies, see debug/stream_sim.cpp.
+//
+//=====================================================================================================
+
+#ifndef TelemetryStream_h
+#define TelemetryStream_h
+
+#include <inttypes.h>
+
+// fields, one frame each per tick
+#define STREAM_QUAT				0x01	// FRAME_QUAT16
+#define STREAM_VALUES			0x02	// FRAME_VALUES, the 'z' line
+#define STREAM_RAW				0x04	// FRAME_INT16, raw sensor values
+#define STREAM_ANGLES			0x08	// FRAME_ANGLES16, yaw pitch roll
+#define STREAM_GPS				0x10	// FRAME_GPS
+#define STREAM_PACKED			0x20	// FRAME_PACK_KEY or FRAME_PACK, see TelemetryPack.h
+#define STREAM_DECIMATE			0x80	// not a field: WRITER_DECIMATE, see TelemetryWriter.h
+
+#define STREAM_MAX_RATE			1000		// Hz
+#define STREAM_STATUS_PERIOD	1000000UL	// us
+
+struct TelemetryStream {
+	uint16_t rate;			// Hz, 0 when off
+	uint8_t fields;
+	uint32_t ticks;			// ticks sent since the subscription
+	uint32_t dropped;		// ticks skipped, the loop was late for them
+	uint32_t status_last;	// time of the last FRAME_STATUS
+
+	TelemetryStream() { set(0, 0, 0); }
+
+	/**
+	 * New subscription at now, rate limited to STREAM_MAX_RATE.  Returns false if it is off.
+	*/
+	bool set(uint16_t hz, uint8_t fields, uint32_t now) {
+		rate = (fields & ~STREAM_DECIMATE) ? (hz > STREAM_MAX_RATE ? STREAM_MAX_RATE : hz) : 0;
+		this->fields = rate ? fields : 0;
+		ticks = dropped = 0;
+		status_last = now;
+		return rate != 0;
+	}
+
+	uint32_t period() const { return rate ? 1000000UL / rate : 0; }
+
+	/**
+	 * Counts a tick the writer did not admit and the missed ones before it as dropped.
+	*/
+	void skip(uint32_t missed) { dropped += missed + 1; }
+
+	/**
+	 * Counts a tick and the missed ones before it, returns true if a FRAME_STATUS is due.
+	*/
+	bool tick(uint32_t missed, uint32_t now) {
+		ticks++;
+		dropped += missed;
+		if(now - status_last < STREAM_STATUS_PERIOD) return false;
+		status_last = now;
+		return true;
+	}
+};
+
+#endif // TelemetryStream_h
@@ -0,0 +1,172 @@
+//=====================================================================================================
+// TelemetryWriter.h
+//=====================================================================================================
+//
+// Non-blocking output of the binary frames (TelemetryFrame.h).  Serial.write blocks once the
+// transmit buffer of the port is full, for the time the bytes take on the wire: a 'Z' frame is
+// 14ms at 57600 baud, and the fusion task waits behind it.  With serialFrameWriter() set,
+// CommunicationUtils queues the frames in a ring of the caller instead, and flush(), called from
+// a task of its own, hands the port only what availableForWrite() says it takes without blocking.
+//
+// When the port falls behind, the ring fills and a frame that does not fit evicts the oldest
+// frames not yet started (WRITER_DROP_OLDEST), so that what gets through is the latest.  With
+// WRITER_DECIMATE the stream task asks admit() once per tick, and only every decim-th tick is
+// sent: decim doubles up to WRITER_DECIMATE_MAX while the ring is over half full and halves
+// when it drains below a quarter, so the ticks that get through are whole, with all their frames.
+// A frame is never cut: one started on the port is finished first.  Dropped frames leave gaps in
+// the sequence numbers (FrameDecoder.lost); dropped and skipped count them on the board, and
+// stall_max is the longest time the port took nothing while frames waited.  Text written to the
+// port directly must not land inside a frame: finish() sends the rest of a started frame first,
+// the frames still queued follow the text whole.
+//
+// Frames are kept as a length byte and the frame.  Ports need availableForWrite() and
+// write(buf, n), as HardwareSerial has since Arduino 1.6.  Has no Arduino dependencies, see
+// debug/writer_sim.cpp.
+//
+//=====================================================================================================
+
+#ifndef TelemetryWriter_h
+#define TelemetryWriter_h
+
+#include <inttypes.h>
+
+#define WRITER_DROP_OLDEST		0
+#define WRITER_DECIMATE			1
+#define WRITER_DECIMATE_MAX		16
+
+class TelemetryWriter
+{
+  public:
+	uint8_t policy;
+	uint32_t frames;			// frames queued
+	uint32_t dropped;			// frames evicted or refused
+	uint32_t skipped;			// ticks not admitted, WRITER_DECIMATE
+	uint32_t stall_max;			// us the port took nothing with frames waiting
+	uint16_t used_max;			// bytes
+
+	TelemetryWriter(uint8_t * buf, uint16_t size, uint8_t policy = WRITER_DROP_OLDEST)
+		: policy(policy), buf(buf), size(size), head(0), tail(0), count(0), left(0), decim(1), phase(0), last_write(0) {
+		clearStats();
+	}
+
+	void clearStats() {
+		frames = dropped = skipped = stall_max = 0;
+		used_max = count;
+	}
+
+	uint16_t used() const { return count; }
+	uint8_t decimation() const { return decim; }
+
+	/**
+	 * Whether the tick about to be built should be sent, always true with WRITER_DROP_OLDEST.
+	*/
+	bool admit() {
+		if(policy != WRITER_DECIMATE) return true;
+		if(++phase < decim) {
+			skipped++;
+			return false;
+		}
+		phase = 0;
+		if(count > size / 2 && decim < WRITER_DECIMATE_MAX) decim <<= 1;
+		else if(count < size / 4 && decim > 1) decim >>= 1;
+		return true;
+	}
+
+	/**
+	 * Queues a frame, evicting the oldest ones not started if it does not fit.  Returns false
+	 * if it was refused, larger than the ring or behind a started frame that fills it.
+	*/
+	bool push(const uint8_t * frame, uint8_t n) {
+		if(n + 1 > size) {
+			dropped++;
+			return false;
+		}
+		while(size - count < n + 1) {
+			if(!dropOldest()) {
+				dropped++;
+				return false;
+			}
+		}
+		buf[tail] = n;
+		tail = wrap(tail + 1);
+		for(uint8_t i = 0; i < n; i++) {
+			buf[tail] = frame[i];
+			tail = wrap(tail + 1);
+		}
+		count += n + 1;
+		if(count > used_max) used_max = count;
+		frames++;
+		return true;
+	}
+
+	/**
+	 * Writes what port takes now, returns the bytes written.
+	*/
+	template<class Port> uint16_t flush(Port &port, uint32_t now) {
+		uint16_t sent = 0;
+		int room = port.availableForWrite();
+		while(count > 0 && room > 0) {
+			if(left == 0) {
+				left = buf[head];
+				head = wrap(head + 1);
+				count--;
+			}
+			uint16_t k = left;
+			if(k > (uint16_t) room) k = room;
+			if(k > size - head) k = size - head;
+			port.write(buf + head, k);
+			head = wrap(head + k);
+			count -= k;
+			left -= k;
+			room -= k;
+			sent += k;
+		}
+		if(sent > 0 || count == 0) last_write = now;
+		else if(now - last_write > stall_max) stall_max = now - last_write;
+		return sent;
+	}
+
+	/**
+	 * Writes the rest of the frame started on port, for port.write to wait for the room as
+	 * Serial.write does.  To be called before writing to port other than through flush().
+	*/
+	template<class Port> void finish(Port &port) {
+		while(left > 0) {
+			uint16_t k = left;
+			if(k > size - head) k = size - head;
+			port.write(buf + head, k);
+			head = wrap(head + k);
+			count -= k;
+			left -= k;
+		}
+	}
+
+  private:
+	uint8_t * buf;
+	uint16_t size;
+	uint16_t head;				// next byte to send
+	uint16_t tail;				// next byte to queue
+	uint16_t count;				// bytes queued
+	uint8_t left;				// bytes of the started frame still to send, 0 between frames
+	uint8_t decim, phase;
+	uint32_t last_write;		// time of the last write, or of an empty ring
+
+	uint16_t wrap(uint16_t i) const { return i >= size ? i - size : i; }
+
+	// drops the oldest frame not started, moving the rest of a started one over it
+	bool dropOldest() {
+		uint16_t at = wrap(head + left);
+		if(count <= left) return false;
+		uint16_t n = buf[at] + 1;
+		for(uint16_t i = left; i > 0; i--) {
+			uint16_t from = wrap(head + i - 1);
+			buf[wrap(from + n)] = buf[from];
+		}
+		head = wrap(head + n);
+		count -= n;
+		dropped++;
+		return true;
+	}
+};
+
+#endif // TelemetryWriter_h
@@ -0,0 +1,85 @@
+//=====================================================================================================
+// TempCorrLUT.h
+//=====================================================================================================
+//
+// Temperature correction of the accel/gyro/magnetometer axes (temp_corr_on) from a table instead
+// of the c3..c0 cubics of FreeIMU.cpp.  build() evaluates the cubics at NODES temperatures from
+// x0 to x1, at() interpolates linearly between the two nodes around the temperature.  The slopes
+// of the bin last used are kept, a sample in the same bin costs a multiply-add per axis and the
+// table is only looked at again when the temperature changes bin.  Outside x0..x1 the first or
+// last bin is extrapolated.  Has no Arduino dependencies, see debug/tempcorr_bench.cpp.
+//
+// The error of the interpolation is at most |f''| h^2 / 8 over a bin of width h.  With the
+// FREEIMU_v04 cubics over 0..33.6 degC (raw -12420..-1000) the accel Z axis, the only one with a
+// c3, is the worst (tempcorr_bench):
+//
+//   nodes   RAM (9 axes)   max error (LSB)
+//     9        380            19.3
+//    17        668             5.0
+//    33       1244             1.3
+//    65       2396             0.33
+//
+// One LSB is 61ug of acceleration at +-2g, the gyro axes stay below 0.03LSB at any size.  On an
+// AVR a table worth having does not fit next to the filters in 2K of RAM, FreeIMU.h leaves it
+// off there (TEMP_CORR_LUT 0) and the cubics are evaluated when the raw temperature changes.
+//
+//=====================================================================================================
+
+#ifndef TempCorrLUT_h
+#define TempCorrLUT_h
+
+#include <inttypes.h>
+
+/**
+ * Table of AXES temperature corrections at NODES (at least 2) temperatures.
+*/
+template <uint8_t AXES, uint8_t NODES>
+class TempCorrLUT
+{
+  public:
+	TempCorrLUT() : bin(-1) {}
+
+	/**
+	 * Fills the table with c3*x^3 + c2*x^2 + c1*x + c0 of every axis at NODES
+	 * temperatures evenly spaced from x0 to x1.
+	*/
+	void build(const float * c3, const float * c2, const float * c1, const float * c0, float x0, float x1) {
+		this->x0 = x0;
+		step = (x1 - x0) / (NODES - 1);
+		inv_step = 1.0f / step;
+		for(uint8_t n = 0; n < NODES; n++) {
+			float x = x0 + n * step;
+			for(uint8_t i = 0; i < AXES; i++) {
+				node[n][i] = ((c3[i]*x + c2[i])*x + c1[i])*x + c0[i];
+			}
+		}
+		bin = -1;
+	}
+
+	/**
+	 * Corrections of all axes at temperature x into corr[0..AXES-1].
+	*/
+	void at(float x, float * corr) {
+		float f = (x - x0) * inv_step;
+		int16_t b = f < 1.0f ? 0 : f >= NODES - 2 ? NODES - 2 : (int16_t) f;
+		if(b != bin) {
+			bin = b;
+			base = x0 + b * step;
+			for(uint8_t i = 0; i < AXES; i++) {
+				slope[i] = (node[b + 1][i] - node[b][i]) * inv_step;
+			}
+		}
+		float dx = x - base;
+		for(uint8_t i = 0; i < AXES; i++) {
+			corr[i] = node[bin][i] + slope[i] * dx;
+		}
+	}
+
+  private:
+	float node[NODES][AXES];
+	float slope[AXES];		// of the bin last used
+	float x0, step, inv_step, base;
+	int16_t bin;
+};
+
+#endif // TempCorrLUT_h
@@ -0,0 +1,63 @@
+//=====================================================================================================
+// board_axes_check.cpp
+//=====================================================================================================
+//
+// The axis maps of all boards (BoardAxes.h) in one build: each must give the same board axes as
+// the sensor_order/sensor_sign arrays FreeIMU.h had for it.  That the maps are permutations with
+// signs -1, 0 or 1 is checked by the compiler.
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -o board_axes_check board_axes_check.cpp
+//   ./board_axes_check       exits with 1 if a map differs
+//
+//=====================================================================================================
+
+#include <stdio.h>
+
+#include "BoardAxes.h"
+
+// the arrays of FreeIMU.h before BoardAxes.h, the MPU-9x50 sign table had 8 entries
+struct Legacy {
+	const char * name;
+	int order[9];
+	int sign[9];
+};
+
+static const Legacy legacy[] = {
+	{ "aligned",   {0,1,2,3,4,5,6,7,8}, {1,1,1,1,1,1,1,1,1} },
+	{ "SEN_10724", {0,1,2,3,4,5,7,6,8}, {1,1,1,1,1,1,1,-1,1} },
+	{ "ARDUIMU_v3",{0,1,2,3,4,5,6,7,8}, {1,1,1,1,1,1,-1,-1,1} },
+	{ "MPU-9x50",  {0,1,2,3,4,5,7,6,8}, {1,1,1,1,1,1,1,-1} },
+	{ "APM_2_5",   {1,0,2,4,3,5,7,6,8}, {1,-1,1,1,-1,1,-1,1,1} },
+};
+
+template <class Axes>
+static bool check(const Legacy & l) {
+	float in[9], out[9], ref[9];
+	bool same = true;
+	for(int i = 0; i < 9; i++) {
+		in[i] = 1.5f * (i + 1);
+		same = same && Axes::order(i) == l.order[i] && Axes::sign(i) == l.sign[i];
+	}
+	Axes::apply(in, out);
+	for(int i = 0; i < 9; i++) {
+		ref[i] = l.sign[i] * in[l.order[i]];
+		same = same && out[i] == ref[i];
+	}
+
+	printf("  %-11s", l.name);
+	for(int i = 0; i < 9; i++) printf(" %c%d", Axes::sign(i) < 0 ? '-' : Axes::sign(i) > 0 ? '+' : '0', Axes::order(i));
+	printf("   %s\n", same ? "ok" : "DIFFERS");
+	return same;
+}
+
+int main() {
+	printf("board axis maps, board axis = sensor axis\n");
+	bool ok = true;
+	ok &= check<AlignedAxes>(legacy[0]);
+	ok &= check<SEN10724Axes>(legacy[1]);
+	ok &= check<ArduIMUv3Axes>(legacy[2]);
+	ok &= check<MPU9x50Axes>(legacy[3]);
+	ok &= check<APM25Axes>(legacy[4]);
+	return ok ? 0 : 1;
+}
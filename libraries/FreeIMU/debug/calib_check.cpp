@@ -0,0 +1,107 @@
+//=====================================================================================================
+// calib_check.cpp
+//=====================================================================================================
+//
+// The folded calibration (CalibTransform.h) against the computation it replaces, for the axis map
+// of every board (BoardAxes.h):
+//   - offsets and scales, identity matrices: the same as sign * (raw - off) / scale per axis, as
+//     FreeIMU calibrated before, with the gyro sensitivity folded in as a scale
+//   - a full 3x3 matrix: the same as A * M * (raw - off) / scale in double, A the board map
+//   - setOffset changes b only
+//   - bound(32768) is the largest output over the grid, whose corners are the extremes
+// over a grid of raw values of the full int16 range.  Errors are relative to the output range.
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -o calib_check calib_check.cpp
+//   ./calib_check            exits with 1 if an error exceeds its bound
+//
+//=====================================================================================================
+
+#include <stdio.h>
+#include <math.h>
+
+#include "BoardAxes.h"
+#include "CalibTransform.h"
+
+// float against double over sums of three products
+#define BOUND	1e-6
+
+static const float off[3] = {-45.0f, 131.0f, -305.0f};
+static const float scale[3] = {16473.2f, 16391.6f, 16711.0f};
+// misalignment of about a degree, soft iron of a few percent
+static const float mat[9] = { 1.031f, 0.012f, -0.018f,
+                              0.012f, 0.978f,  0.007f,
+                             -0.018f, 0.007f,  1.004f };
+
+struct Raw {
+	float v[3];
+};
+
+static Raw raw(int n) {
+	Raw r;
+	r.v[0] = -32768.0f + (n % 17) * 4096.0f;
+	r.v[1] = -32768.0f + ((n / 17) % 17) * 4096.0f;
+	r.v[2] = -32768.0f + (n / 289) * 4096.0f;
+	for(int i = 0; i < 3; i++) if(r.v[i] > 32767.0f) r.v[i] = 32767.0f;
+	return r;
+}
+
+template <class Axes>
+static bool check(const char * name) {
+	double err_diag = 0, err_mat = 0, err_off = 0, out_max = 0, bound_err = 0;
+	for(uint8_t first = 0; first < 9; first += 3) {
+		float M[9];
+		for(int i = 0; i < 9; i++) M[i] = (i % 4 == 0) ? 1.0f / scale[i % 3] : 0.0f;
+		CalibTransform diag;
+		diag.fold<Axes>(M, off, 1.0f, first);
+
+		for(int i = 0; i < 9; i++) M[i] = mat[i] / scale[i % 3];
+		CalibTransform full;
+		full.fold<Axes>(M, off, 1.0f, first);
+
+		// offsets changed at runtime, as zeroGyro does
+		const float off2[3] = {7.0f, -3.0f, 12.0f};
+		CalibTransform moved = full;
+		moved.setOffset(off2);
+
+		for(int n = 0; n < 17 * 17 * 17; n++) {
+			Raw r = raw(n);
+			float out[3], out_full[3], out_moved[3];
+			diag.apply(r.v, out);
+			full.apply(r.v, out_full);
+			moved.apply(r.v, out_moved);
+			for(int i = 0; i < 3; i++) out_max = fmax(out_max, fabs(out_moved[i]));
+			for(int i = 0; i < 3; i++) {
+				int o = Axes::order(first + i) - first;
+				double legacy = Axes::sign(first + i) * ((double) r.v[o] - off[o]) / scale[o];
+				err_diag = fmax(err_diag, fabs(out[i] - legacy));
+				double ref = 0, ref_moved = 0;
+				for(int j = 0; j < 3; j++) {
+					ref += (double) mat[o * 3 + j] / scale[j] * ((double) r.v[j] - off[j]);
+					ref_moved += (double) mat[o * 3 + j] / scale[j] * ((double) r.v[j] - off2[j]);
+				}
+				err_mat = fmax(err_mat, fabs(out_full[i] - Axes::sign(first + i) * ref));
+				err_off = fmax(err_off, fabs(out_moved[i] - Axes::sign(first + i) * ref_moved));
+			}
+		}
+		// the grid stops at 32767 on the positive side
+		bound_err = fmax(bound_err, fabs(moved.bound(32768.0f) - out_max));
+		out_max = 0;
+	}
+	bool pass = err_diag <= BOUND && err_mat <= BOUND && err_off <= BOUND && bound_err <= 1e-4;
+	printf("  %-11s %12.2e %12.2e %12.2e %12.2e   %s\n", name, err_diag, err_mat, err_off, bound_err,
+	       pass ? "ok" : "EXCEEDED");
+	return pass;
+}
+
+int main() {
+	printf("folded calibration, max error (output about +-2)\n");
+	printf("  %-11s %12s %12s %12s %12s\n", "board", "scales", "matrix", "setOffset", "bound");
+	bool ok = true;
+	ok &= check<AlignedAxes>("aligned");
+	ok &= check<SEN10724Axes>("SEN_10724");
+	ok &= check<ArduIMUv3Axes>("ARDUIMU_v3");
+	ok &= check<MPU9x50Axes>("MPU-9x50");
+	ok &= check<APM25Axes>("APM_2_5");
+	return ok ? 0 : 1;
+}
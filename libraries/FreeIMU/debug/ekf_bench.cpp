@@ -0,0 +1,155 @@
+//=====================================================================================================
+// ekf_bench.cpp
+//=====================================================================================================
+//
+// Host benchmark of the error-state Kalman filter engine (EKFEngine.h).  Runs it, the Mahony
+// and Madgwick engines and the DCM filter on the same samples and reports the cost per update
+// and, for the quaternion engines, the error against the true orientation and gyro bias.
+//
+// The engines are run twice: with the combined update on every sample, and split into a gyro
+// predict on every sample with the accelerometer and magnetometer corrections at ACC_RATE and
+// MAG_RATE (FUSION_ACC_RATE / FUSION_MAG_RATE in FreeIMU.h).  On the synthetic motion the EKF
+// error against the true orientation must stay within CHECK_EKF_RMS in both runs and its gyro
+// bias within CHECK_EKF_BIAS of the true one.
+//
+// Host timings only give the ratio between the filters; for cycles on the target select the
+// engine with 'e5' (or run it in shadow mode with 'h5') in FreeIMU_serial and read them with 'E'.
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -I../../DCM -I../../AP_Math_freeimu -Ihost -o ekf_bench ekf_bench.cpp ../../DCM/DCM.cpp
+//   ./ekf_bench                      synthetic motion, 1kHz, 60s, exits with 1 if a bound is exceeded
+//   ./ekf_bench log.csv [gyro_lsb]   recorded raw log, see fixed_replay.cpp (timing only)
+// add -DEKF_MAG_DISTURBANCE=1 for the 9 state filter.
+//
+//=====================================================================================================
+
+#include <time.h>
+
+#define FUSION_CYCLES() 0	// the whole run is timed, clock() per update would dominate
+
+#include "replay_data.h"
+#include "DCM.h"
+#include "FusionEngine.h"
+#include "EKFEngine.h"
+#include "AHRS.h"
+#include "MadgwickAHRS.h"
+
+#define TWO_KP	(2.0f * 0.5f)
+#define TWO_KI	(2.0f * 0.1f)
+#define BETA	0.1f
+#define PASSES	5		// timing runs per engine, the fastest one is reported
+#define ACC_RATE	200	// multi-rate correction rates in Hz
+#define MAG_RATE	50
+#define CHECK_EKF_RMS	0.1		// deg, after convergence
+#define CHECK_EKF_BIAS	0.02	// deg/s, largest axis
+
+template <class Engine>
+static double run(FusionEngine<Engine> &e, const std::vector<Sample> &data, std::vector<float> &q_out, FusionRates &rates) {
+	FusionStats st;
+	uint8_t due;
+	q_out.resize(data.size() * 4);
+	clock_t t0 = clock();
+	for(size_t i = 0; i < data.size(); i++) {
+		due = rates.advance(data[i].dt);
+		fusionTimedUpdate(e, data[i].val, data[i].dt, rates, due, st);
+		rates.done(due);
+		e.getQ(&q_out[4 * i]);
+	}
+	return (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / data.size();
+}
+
+template <class Engine>
+static double best(Engine &e, const std::vector<Sample> &data, std::vector<float> &q_out, float acc_hz = 0, float mag_hz = 0) {
+	FusionRates rates;
+	double ns = 1e30;
+	for(int p = 0; p < PASSES; p++) {
+		e.reset();
+		rates.setRates(acc_hz, mag_hz);
+		double t = run(e, data, q_out, rates);
+		if(t < ns) ns = t;
+	}
+	return ns;
+}
+
+// false if bound is given and the rms error against the truth exceeds it
+static bool report(const char * name, double ns, double ref_ns, const std::vector<Sample> &data, const std::vector<float> &q,
+                   bool synthetic, float bound = 0) {
+	bool pass = true;
+	printf("  %-10s %8.1f ns/update  %5.2f x calDCM", name, ns, ns / ref_ns);
+	if(synthetic && !q.empty()) {
+		ErrorStats st;
+		// skip the first 10s of convergence
+		for(size_t i = data.size() / 6; i < data.size(); i++) st.add(fusionQuatAngle(data[i].truth, &q[4 * i]));
+		printf("   vs truth: rms %7.3f  max %7.3f deg", st.rms(), st.max);
+		if(bound > 0) {
+			pass = st.rms() <= bound;
+			printf("  %s", pass ? "ok" : "EXCEEDED");
+		}
+	}
+	printf("\n");
+	return pass;
+}
+
+int main(int argc, char ** argv) {
+	std::vector<Sample> data;
+	std::vector<float> q, none;
+	bool synthetic = argc < 2;
+	bool ok = true;
+
+	if(synthetic) {
+		synthesize(data, 1000, 60);
+		printf("synthetic motion, %lu samples at 1kHz\n", (unsigned long) data.size());
+	} else {
+		if(!load(argv[1], argc > 2 ? atof(argv[2]) : 16.4f, data)) {
+			fprintf(stderr, "cannot read %s\n", argv[1]);
+			return 1;
+		}
+		printf("%s, %lu samples\n", argv[1], (unsigned long) data.size());
+	}
+	printf("EKF with %d states, %d covariance floats, %lu bytes of state\n",
+		EKF_STATES, EKF_P_SIZE, (unsigned long) sizeof(EKFEngine));
+
+	// DCM: setSensorVals + calDCM per update, the reference
+	DCM dcm;
+	DCMEngine dcmEngine;
+	dcm.DCM_init(1.2f, 0.0234f, 1.75f, 0.002f);
+	dcmEngine.attach(&dcm);
+	double dcm_ns = best(dcmEngine, data, q);
+	report("DCM", dcm_ns, dcm_ns, data, none, synthetic);
+
+	MahonyEngine mahony;
+	mahony.setGains(TWO_KP, TWO_KI);
+	double ns = best(mahony, data, q);
+	report("Mahony", ns, dcm_ns, data, q, synthetic);
+
+	MadgwickEngine madgwick;
+	madgwick.setGains(BETA);
+	ns = best(madgwick, data, q);
+	report("Madgwick", ns, dcm_ns, data, q, synthetic);
+
+	EKFEngine ekf;
+	ns = best(ekf, data, q);
+	ok &= report("EKF", ns, dcm_ns, data, q, synthetic, CHECK_EKF_RMS);
+	printf("  EKF gyro bias %7.3f %7.3f %7.3f deg/s", ekf.bias.x * 180 / M_PI, ekf.bias.y * 180 / M_PI, ekf.bias.z * 180 / M_PI);
+	if(synthetic) printf(" (true %.3f %.3f %.3f)", SYNTH_BIAS_X, SYNTH_BIAS_Y, SYNTH_BIAS_Z);
+	printf(", %lu rejected measurements", (unsigned long) ekf.rejected);
+	if(synthetic) {
+		float bias_err = fmax(fmax(fabs(ekf.bias.x * 180 / M_PI - SYNTH_BIAS_X), fabs(ekf.bias.y * 180 / M_PI - SYNTH_BIAS_Y)),
+		                      fabs(ekf.bias.z * 180 / M_PI - SYNTH_BIAS_Z));
+		bool pass = bias_err <= CHECK_EKF_BIAS;
+		printf(", %.4f off  %s", bias_err, pass ? "ok" : "EXCEEDED");
+		ok &= pass;
+	}
+	printf("\n");
+
+	printf("gyro predict every sample, accelerometer at %dHz, magnetometer at %dHz\n", ACC_RATE, MAG_RATE);
+	ns = best(dcmEngine, data, q, ACC_RATE, MAG_RATE);
+	report("DCM", ns, dcm_ns, data, none, synthetic);
+	ns = best(mahony, data, q, ACC_RATE, MAG_RATE);
+	report("Mahony", ns, dcm_ns, data, q, synthetic);
+	ns = best(madgwick, data, q, ACC_RATE, MAG_RATE);
+	report("Madgwick", ns, dcm_ns, data, q, synthetic);
+	ns = best(ekf, data, q, ACC_RATE, MAG_RATE);
+	ok &= report("EKF", ns, dcm_ns, data, q, synthetic, CHECK_EKF_RMS);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+//=====================================================================================================
+// fastmath_bench.cpp
+//=====================================================================================================
+//
+// Host accuracy and throughput check of the approximations in FastMath.h (AP_Math_freeimu).
+// Every function is swept over its input range and compared with double precision libm; the
+// maximum absolute error must stay within the bound documented in FastMath.h.  The cost per
+// call is then timed against the float libm function.
+//
+// Host timings only give the ratio between the two; the cost on AVR is dominated by the number
+// of soft float multiplies and divisions, which is what the approximations save.
+//
+// Build and run on a PC:
+//   g++ -O2 -I../../AP_Math_freeimu -o fastmath_bench fastmath_bench.cpp
+//   ./fastmath_bench        exits with 1 if a bound is exceeded
+//
+//=====================================================================================================
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+#include "FastMath.h"
+
+#define SWEEP	2000000		// accuracy samples per function
+#define CALLS	4000000		// timed calls per function
+
+static volatile float sink;
+
+struct Check {
+	const char * name;
+	double bound;
+	double lo, hi;			// input range, atan2 sweeps the angle of a unit vector
+	float (*fast)(float, float);
+	float (*libm)(float, float);
+	double (*ref)(double, double);
+};
+
+static float fAtan(float x, float) { return fmAtan(x); }
+static float lAtan(float x, float) { return atanf(x); }
+static double rAtan(double x, double) { return atan(x); }
+static float fAtan2(float y, float x) { return fmAtan2(y, x); }
+static float lAtan2(float y, float x) { return atan2f(y, x); }
+static double rAtan2(double y, double x) { return atan2(y, x); }
+static float fAsin(float x, float) { return fmAsin(x); }
+static float lAsin(float x, float) { return asinf(x); }
+static double rAsin(double x, double) { return asin(x); }
+static float fSin(float x, float) { return fmSin(x); }
+static float lSin(float x, float) { return sinf(x); }
+static double rSin(double x, double) { return sin(x); }
+static float fCos(float x, float) { return fmCos(x); }
+static float lCos(float x, float) { return cosf(x); }
+static double rCos(double x, double) { return cos(x); }
+static float fSinCos(float x, float) { float s, c; fmSinCos(x, &s, &c); return s + c; }
+static float lSinCos(float x, float) { return sinf(x) + cosf(x); }
+static double rSinCos(double x, double) { return sin(x) + cos(x); }
+
+static const Check checks[] = {
+	{ "atan",   1.2e-5, -100.0, 100.0, fAtan, lAtan, rAtan },
+	{ "atan2",  1.2e-5, -M_PI, M_PI, fAtan2, lAtan2, rAtan2 },
+	{ "asin",   6.8e-5, -1.0, 1.0, fAsin, lAsin, rAsin },
+	{ "sin",    4.0e-7, -1000.0, 1000.0, fSin, lSin, rSin },
+	{ "cos",    4.0e-7, -1000.0, 1000.0, fCos, lCos, rCos },
+	{ "sin+cos", 8.0e-7, -1000.0, 1000.0, fSinCos, lSinCos, rSinCos },
+};
+
+// atan2 is swept around the circle at a few radii so both branches and all quadrants are hit
+static void args(const Check &c, size_t i, size_t n, float &a, float &b) {
+	double t = c.lo + (c.hi - c.lo) * i / (n - 1);
+	if(c.fast == fAtan2) {
+		double r = 0.01 + (i % 7) * 3.0;
+		a = (float)(r * sin(t));
+		b = (float)(r * cos(t));
+	} else {
+		a = (float) t;
+		b = 0.0f;
+	}
+}
+
+static double nsPerCall(float (*f)(float, float), const std::vector<float> &a, const std::vector<float> &b) {
+	float acc = 0.0f;
+	clock_t t0 = clock();
+	for(size_t i = 0; i < a.size(); i++) acc += f(a[i], b[i]);
+	sink = acc;
+	return (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / a.size();
+}
+
+int main() {
+	bool ok = true;
+	printf("FASTMATH %d (fast* functions use %s)\n", FASTMATH, FASTMATH ? "the approximations" : "libm");
+	printf("  %-8s %12s %12s %12s   %9s %9s\n", "", "max error", "at", "bound", "ns fast", "ns libm");
+
+	for(size_t k = 0; k < sizeof(checks) / sizeof(checks[0]); k++) {
+		const Check &c = checks[k];
+		double worst = 0.0, where = 0.0;
+		float a, b;
+
+		for(size_t i = 0; i < SWEEP; i++) {
+			args(c, i, SWEEP, a, b);
+			double e = fabs(c.fast(a, b) - c.ref(a, b));
+			if(e > worst) {
+				worst = e;
+				where = c.fast == fAtan2 ? atan2((double) a, (double) b) : a;
+			}
+		}
+
+		std::vector<float> ta(CALLS), tb(CALLS);
+		for(size_t i = 0; i < CALLS; i++) args(c, (i * 7919) % CALLS, CALLS, ta[i], tb[i]);
+		double ns_fast = nsPerCall(c.fast, ta, tb);
+		double ns_libm = nsPerCall(c.libm, ta, tb);
+
+		bool pass = worst <= c.bound;
+		ok = ok && pass;
+		printf("  %-8s %12.3g %12.5g %12.3g   %9.2f %9.2f  %s\n", c.name, worst, where, c.bound, ns_fast, ns_libm, pass ? "ok" : "EXCEEDED");
+	}
+	return ok ? 0 : 1;
+}
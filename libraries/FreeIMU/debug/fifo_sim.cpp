@@ -0,0 +1,127 @@
+//=====================================================================================================
+// fifo_sim.cpp
+//=====================================================================================================
+//
+// FIFO acquisition on the simulated board (host/SimBoard.h): a sketch loop that calls getQ,
+// reads the barometer now and then and spends a varying time on other work, during which
+// the MPU60X0 keeps writing samples to its FIFO.  Built twice from the same source:
+//
+//   fifo_sim_poll   FIFO_BURST, getQ reads the FIFO
+//   fifo_sim_int    FIFO_BURST and FIFO_INT_PIN, the data-ready interrupt reads the FIFO into
+//                   fifoRing at the time the sample is written, wherever the loop is; the
+//                   interrupt is taken between bus transfers and inside delay() (Arduino.h)
+//
+// Reports the time spent in getQ and the FIFOStats counters, and checks that every sample the
+// device wrote was fused or is still buffered, that the FIFO never overflowed and that no
+// transfer was started during another one (the interrupt must wait for claimBus/releaseBus).
+// Then calls getQ twice with nothing written in between: the second call must return the
+// orientation and val of the first, and the fusion must go on from there with a finite
+// quaternion.
+//
+// Build and run on a PC:
+//   make fifo_sim_poll fifo_sim_int [BOARD=...]
+//   ./fifo_sim_int [seconds [max work ms]]
+// Exits with 1 if a check fails, make check runs both.
+//
+//=====================================================================================================
+
+#include <math.h>
+
+#include "FreeIMU.h"
+#include "SimBoard.h"
+
+static const char * script =
+	"2    0   0   0\n"
+	"5   20 -10  30\n"
+	"5  -20  10 -30\n";
+
+// the same sequence on every run
+static uint32_t work_seed = 1;
+static uint32_t workRandom(uint32_t n) {
+	work_seed = work_seed * 1103515245UL + 12345UL;
+	return (work_seed >> 16) % n;
+}
+
+int main(int argc, char ** argv) {
+	float seconds = argc > 1 ? atof(argv[1]) : 20.0f;
+	int max_work_ms = argc > 2 ? atoi(argv[2]) : 40;
+	SimScript motion;
+	motion.parse(script);
+	SimDelayed source(&motion);
+	SimBoard board(&source);
+	FreeIMU my3IMU;
+	float q[4], val[12];
+
+	Wire.begin();
+	my3IMU.init(true);
+	source.start = hostMicros();
+	my3IMU.clearFusionStats();
+	Wire.stats.clear();
+	// samples already buffered will be fused in the loop
+	FIFOStats st;
+	my3IMU.getFIFOStats(st);
+	uint32_t written0 = board.mpu->fifo_samples - st.depth - board.mpu->fifoCount() / MOTION_FRAME_SIZE;
+
+	uint32_t loops = 0, in_getq_us = 0, max_getq_us = 0;
+	uint64_t end = source.start + (uint64_t)(seconds * 1e6);
+	while(hostMicros() < end) {
+		uint64_t t0 = host_time_ns;
+		my3IMU.getQ(q, val);
+		uint32_t us = (uint32_t)((host_time_ns - t0) / 1000);
+		in_getq_us += us;
+		if(us > max_getq_us) max_getq_us = us;
+		loops++;
+
+		// the rest of the sketch: the barometer every 10th loop, then other work
+		#if HAS_PRESS()
+			if(loops % 10 == 0) my3IMU.getBaroAlt();
+		#endif
+		delay(workRandom(max_work_ms + 1));
+	}
+
+	my3IMU.getFIFOStats(st);
+	uint32_t written = board.mpu->fifo_samples - written0;
+	uint32_t fused = my3IMU.fusion_stats[my3IMU.fusion_active].updates;
+	uint32_t buffered = st.depth + board.mpu->fifoCount() / MOTION_FRAME_SIZE;
+
+	printf("FreeIMU %s, FIFO %s, %.0fs, work 0..%dms per loop\n", FREEIMU_ID,
+	       FIFO_INT_PIN >= 0 ? "read by the data-ready interrupt" : "read by getQ", seconds, max_work_ms);
+	printf("  %lu loops, getQ %.0fus mean %luus max\n", (unsigned long) loops,
+	       (double) in_getq_us / loops, (unsigned long) max_getq_us);
+	printf("  samples: %lu written, %lu fused, %lu buffered\n", (unsigned long) written,
+	       (unsigned long) fused, (unsigned long) buffered);
+	printf("  fifoRing: depth %u peak %u/%u overruns %u; FIFO overflows %u\n", st.depth, st.peak,
+	       FIFO_RING_SIZE, st.overruns, st.overflows);
+	printf("  interrupts %u, deferred %u; bus collisions %lu\n", st.interrupts, st.deferred,
+	       (unsigned long) Wire.stats.collisions);
+
+	bool ok = written == fused + buffered && st.overflows == 0 && Wire.stats.collisions == 0;
+	if(FIFO_INT_PIN >= 0) ok = ok && st.interrupts > 0;
+
+	// getQ with no new sample, val of the second call filled with NaN beforehand
+	float q2[4], val2[12];
+	bool empty = false, same = true;
+	for(int k = 0; k < 100 && !empty; k++) {
+		delay(5);
+		my3IMU.getQ(q, val);
+		my3IMU.getFIFOStats(st);
+		uint32_t samples = board.mpu->fifo_samples;
+		if(st.depth > 0 || board.mpu->fifoCount() > 0) continue;
+		for(int i = 0; i < 12; i++) val2[i] = NAN;
+		my3IMU.getQ(q2, val2);
+		if(board.mpu->fifo_samples != samples) continue;
+		empty = true;
+		same = memcmp(q, q2, sizeof(q)) == 0 && memcmp(val, val2, sizeof(val)) == 0;
+	}
+	for(int k = 0; k < 20; k++) {
+		delay(5);
+		my3IMU.getQ(q, val);
+	}
+	float n = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+	bool finite = isfinite(n) && fabsf(n - 1.0f) < 1e-3f && isfinite(val[11]);
+	printf("  getQ with no new sample: %s, q and val %s, fusion after it %s\n", empty ? "seen" : "not seen",
+	       same ? "unchanged" : "CHANGED", finite ? "finite" : "NOT FINITE");
+	ok = ok && empty && same && finite;
+	printf("  %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
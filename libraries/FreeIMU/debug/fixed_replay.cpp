@@ -0,0 +1,113 @@
+//=====================================================================================================
+// fixed_replay.cpp
+//=====================================================================================================
+//
+// Host replay harness for the fixed point fusion engines (FusionFixed.h).  Runs the float
+// Mahony and Madgwick engines and their Q1.15 and Q2.30 versions on the same samples and
+// reports the angle between the fixed point and the float orientation.
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -o fixed_replay fixed_replay.cpp
+//   ./fixed_replay                       synthetic motion, 200Hz, 120s, also reports error vs truth
+//   ./fixed_replay log.csv [gyro_lsb]    recorded raw log: ax,ay,az,gx,gy,gz,mx,my,mz,...,time_ms
+//                                        with a header line (e.g. the temperature calibration logs),
+//                                        gyro_lsb is LSB per deg/s, default 16.4 (MPU60X0 2000dps),
+//                                        gaps of more than 10 sample periods are replayed as one period
+//
+//=====================================================================================================
+
+#include <time.h>
+
+#include "replay_data.h"
+#include "FusionEngine.h"
+#include "FusionFixed.h"
+#include "AHRS.h"
+#include "MadgwickAHRS.h"
+
+#define TWO_KP	(2.0f * 0.5f)
+#define TWO_KI	(2.0f * 0.1f)
+#define BETA	0.1f
+
+template <class Engine>
+static void runAll(FusionEngine<Engine> &e, const std::vector<Sample> &data, std::vector<float> &q_out, double &ns) {
+	clock_t t0 = clock();
+	q_out.resize(data.size() * 4);
+	for(size_t i = 0; i < data.size(); i++) {
+		e.update(data[i].val, data[i].dt);
+		e.getQ(&q_out[4 * i]);
+	}
+	ns = (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / data.size();
+}
+
+static void compare(const char * name, const std::vector<float> &ref, const std::vector<float> &q, double ns, double ref_ns) {
+	ErrorStats st;
+	for(size_t i = 0; i < ref.size() / 4; i++) st.add(fusionQuatAngle(&ref[4 * i], &q[4 * i]));
+	printf("  %-18s vs float: rms %8.4f  max %8.4f  final %8.4f deg   host %6.1f ns/update (float %6.1f)\n",
+		name, st.rms(), st.max, st.last, ns, ref_ns);
+}
+
+static void truthError(const char * name, const std::vector<Sample> &data, const std::vector<float> &q) {
+	ErrorStats st;
+	// skip the first 10s of convergence
+	for(size_t i = data.size() / 12; i < data.size(); i++) st.add(fusionQuatAngle(data[i].truth, &q[4 * i]));
+	printf("  %-18s vs truth: rms %8.4f  max %8.4f deg\n", name, st.rms(), st.max);
+}
+
+int main(int argc, char ** argv) {
+	std::vector<Sample> data;
+	bool synthetic = argc < 2;
+	std::vector<float> qf, q15, q30;
+	double nf, n15, n30;
+
+	if(synthetic) {
+		synthesize(data, 200, 120);
+		printf("synthetic motion, %lu samples at 200Hz\n", (unsigned long) data.size());
+	} else {
+		if(!load(argv[1], argc > 2 ? atof(argv[2]) : 16.4f, data)) {
+			fprintf(stderr, "cannot read %s\n", argv[1]);
+			return 1;
+		}
+		printf("%s, %lu samples\n", argv[1], (unsigned long) data.size());
+	}
+
+	printf("Mahony twoKp %.3f twoKi %.3f\n", TWO_KP, TWO_KI);
+	{
+		MahonyEngine f;
+		MahonyFixedEngine<FixQ15> x15;
+		MahonyFixedEngine<FixQ30> x30;
+		f.setGains(TWO_KP, TWO_KI);
+		x15.setGains(TWO_KP, TWO_KI);
+		x30.setGains(TWO_KP, TWO_KI);
+		runAll(f, data, qf, nf);
+		runAll(x15, data, q15, n15);
+		runAll(x30, data, q30, n30);
+		compare("Q1.15", qf, q15, n15, nf);
+		compare("Q2.30", qf, q30, n30, nf);
+		if(synthetic) {
+			truthError("float", data, qf);
+			truthError("Q1.15", data, q15);
+			truthError("Q2.30", data, q30);
+		}
+	}
+
+	printf("Madgwick beta %.3f\n", BETA);
+	{
+		MadgwickEngine f;
+		MadgwickFixedEngine<FixQ15> x15;
+		MadgwickFixedEngine<FixQ30> x30;
+		f.setGains(BETA);
+		x15.setGains(BETA);
+		x30.setGains(BETA);
+		runAll(f, data, qf, nf);
+		runAll(x15, data, q15, n15);
+		runAll(x30, data, q30, n30);
+		compare("Q1.15", qf, q15, n15, nf);
+		compare("Q2.30", qf, q30, n30, nf);
+		if(synthetic) {
+			truthError("float", data, qf);
+			truthError("Q1.15", data, q15);
+			truthError("Q2.30", data, q30);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,211 @@
+//=====================================================================================================
+// frame_bench.cpp
+//=====================================================================================================
+//
+// Binary telemetry frames (TelemetryFrame.h) as CommunicationUtils sends them, the Serial output
+// of the host core captured and decoded again:
+//
+//   round trip   floats bit for bit, raw values, Q15 quaternions and angles within half a step
+//   crc          every single bit error of a 'Z' frame is caught
+//   resync       garbage between frames, a truncated frame and a damaged length: the decoder
+//                finds every good frame after them and counts the lost ones by sequence number
+//
+// and prints the size of a 'z'/'q' line and of a 'Z'/'Q' frame with the rate each allows at
+// the standard baud rates (8N1, 10 bits a byte).
+//
+// Build and run on a PC:
+//   make frame_bench
+//   ./frame_bench            exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include "CommunicationUtils.h"
+
+#define VALUES 18	// the 'z' line of FreeIMU_serial
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+// what emit() writes to Serial
+static size_t capture(void (*emit)(), uint8_t * out, size_t size) {
+	char * p;
+	size_t n;
+	fflush(stdout);
+	FILE * saved = stdout;
+	stdout = open_memstream(&p, &n);
+	emit();
+	fclose(stdout);
+	stdout = saved;
+	if(n > size) n = size;
+	memcpy(out, p, n);
+	free(p);
+	return n;
+}
+
+static float values[VALUES];
+static float quat[4];
+static float ypr[3];
+static int raw[11];
+
+static void zLine() { serialPrintFloatArr(values, VALUES); Serial.print('\n'); }
+static void qLine() { serialPrintFloatArr(quat, 4); Serial.println(""); }
+static void zFrame() { serialFrameFloatArr(FRAME_VALUES, values, VALUES); }
+static void qFrame() { serialFrameQuat16(quat); }
+static void yprFrame() { serialFrameAngles16(ypr); }
+static void rawFrame() { serialFrameIntArr(raw, 11); }
+
+static float frand(float lo, float hi) { return lo + (hi - lo) * (rand() / (float) RAND_MAX); }
+
+static void randomize() {
+	for(int i = 0; i < VALUES; i++) values[i] = frand(-2000.0f, 2000.0f);
+	float n = 0;
+	for(int i = 0; i < 4; i++) {
+		quat[i] = frand(-1.0f, 1.0f);
+		n += quat[i] * quat[i];
+	}
+	for(int i = 0; i < 4; i++) quat[i] /= sqrtf(n);
+	ypr[0] = frand(-180.0f, 180.0f);
+	ypr[1] = frand(-90.0f, 90.0f);
+	ypr[2] = frand(-180.0f, 180.0f);
+	for(int i = 0; i < 11; i++) raw[i] = (int) frand(-32768.0f, 32767.0f);
+}
+
+// decodes a stream, the sequence numbers of the good frames into seqs
+static int decodeAll(FrameDecoder &d, const uint8_t * s, size_t n, uint8_t * seqs, int max) {
+	int got = 0;
+	for(size_t i = 0; i < n; i++) {
+		if(!d.push(s[i])) continue;
+		do {
+			if(got < max) seqs[got] = d.seq();
+			got++;
+		} while(d.next());
+	}
+	return got;
+}
+
+int main() {
+	char line[100];
+	uint8_t buf[4096];
+	size_t n;
+	FrameDecoder d;
+
+	printf("round trip\n");
+	{
+		bool exact = true, seq_ok = true;
+		float q_err = 0, a_err = 0;
+		int frames = 0;
+		uint8_t last_seq = 0;
+		for(int k = 0; k < 1000; k++) {
+			randomize();
+			n = capture(zFrame, buf, sizeof(buf));
+			n += capture(qFrame, buf + n, sizeof(buf) - n);
+			n += capture(yprFrame, buf + n, sizeof(buf) - n);
+			n += capture(rawFrame, buf + n, sizeof(buf) - n);
+			for(size_t i = 0; i < n; i++) {
+				if(!d.push(buf[i])) continue;
+				FrameReader r(d.payload(), d.length());
+				if(frames > 0) seq_ok = seq_ok && d.seq() == (uint8_t)(last_seq + 1);
+				last_seq = d.seq();
+				frames++;
+				if(d.type() == FRAME_VALUES) {
+					exact = exact && r.size() == 4 * VALUES;
+					for(int j = 0; j < VALUES; j++) exact = exact && r.float32(4 * j) == values[j];
+				} else if(d.type() == FRAME_QUAT16) {
+					for(int j = 0; j < 4; j++) q_err = fmax(q_err, fabs(r.scaled(2 * j, FRAME_Q15) - quat[j]));
+				} else if(d.type() == FRAME_ANGLES16) {
+					for(int j = 0; j < 3; j++) a_err = fmax(a_err, fabs(r.scaled(2 * j, FRAME_CDEG) - ypr[j]));
+				} else if(d.type() == FRAME_INT16) {
+					for(int j = 0; j < 11; j++) exact = exact && r.int16(2 * j) == raw[j];
+				}
+			}
+		}
+		snprintf(line, sizeof(line), "%d frames, floats and raw values exact", frames);
+		check(line, frames == 4000 && exact && d.crc_errors == 0 && d.skipped == 0);
+		check("sequence numbers", seq_ok && d.lost == 0);
+		snprintf(line, sizeof(line), "quaternion Q15 error %.2e", q_err);
+		check(line, q_err <= 0.5f / FRAME_Q15 + 1e-7f);
+		snprintf(line, sizeof(line), "angles error %.4f deg", a_err);
+		check(line, a_err <= 0.5f / FRAME_CDEG + 1e-4f);
+	}
+
+	printf("crc\n");
+	{
+		randomize();
+		n = capture(zFrame, buf, sizeof(buf));
+		int caught = 0, bits = 0;
+		for(size_t i = 0; i < n; i++) {
+			for(int b = 0; b < 8; b++) {
+				FrameDecoder e;
+				buf[i] ^= 1 << b;
+				bool got = false;
+				for(size_t j = 0; j < n; j++) got = e.push(buf[j]) || got;
+				buf[i] ^= 1 << b;
+				bits++;
+				caught += !got;
+			}
+		}
+		snprintf(line, sizeof(line), "%d of %d single bit errors caught", caught, bits);
+		check(line, caught == bits);
+	}
+
+	printf("resync\n");
+	{
+		uint8_t seqs[64];
+		randomize();
+		FrameDecoder e;
+		size_t m = 0;
+		// garbage with markers in it and an impossible length, then a good frame
+		const uint8_t junk[] = {0x00, FRAME_SYNC1, 0x13, FRAME_SYNC1, FRAME_SYNC2, 0xFF, 0x42, FRAME_SYNC1};
+		memcpy(buf, junk, sizeof(junk));
+		m = sizeof(junk);
+		m += capture(qFrame, buf + m, sizeof(buf) - m);			// seq s
+		// a frame cut short by the next ones
+		size_t cut = capture(zFrame, buf + m, sizeof(buf) - m);	// s + 1, lost
+		m += cut / 2;
+		m += capture(qFrame, buf + m, sizeof(buf) - m);			// s + 2
+		m += capture(yprFrame, buf + m, sizeof(buf) - m);		// s + 3
+		// a frame whose length grew, taking the next two short frames with it
+		size_t at = m;
+		m += capture(rawFrame, buf + m, sizeof(buf) - m);		// s + 4, lost
+		buf[at + 2] = FRAME_MAX_PAYLOAD;
+		m += capture(qFrame, buf + m, sizeof(buf) - m);			// s + 5
+		m += capture(qFrame, buf + m, sizeof(buf) - m);			// s + 6
+		m += capture(yprFrame, buf + m, sizeof(buf) - m);		// s + 7
+		m += capture(zFrame, buf + m, sizeof(buf) - m);			// s + 8
+		int got = decodeAll(e, buf, m, seqs, 64);
+		uint8_t s = seqs[0];
+		bool order = got == 7;
+		const uint8_t expect[] = {0, 2, 3, 5, 6, 7, 8};
+		for(int i = 0; order && i < 7; i++) order = seqs[i] == (uint8_t)(s + expect[i]);
+		snprintf(line, sizeof(line), "%d good frames found, %lu damaged, %lu bytes skipped", got,
+		         (unsigned long) e.crc_errors, (unsigned long) e.skipped);
+		check(line, order && e.crc_errors == 3);
+		snprintf(line, sizeof(line), "%lu frames lost by sequence number", (unsigned long) e.lost);
+		check(line, e.lost == 2);
+	}
+
+	printf("size and rate at 8N1\n");
+	{
+		randomize();
+		size_t z = capture(zLine, buf, sizeof(buf));
+		size_t zf = capture(zFrame, buf, sizeof(buf));
+		size_t q = capture(qLine, buf, sizeof(buf));
+		size_t qf = capture(qFrame, buf, sizeof(buf));
+		printf("  %-8s %8s %8s %8s %8s   frames/s\n", "baud", "'z' line", "'Z'", "'q' line", "'Q'");
+		printf("  %-8s %8zu %8zu %8zu %8zu   bytes\n", "", z, zf, q, qf);
+		const long bauds[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+		for(long b : bauds) {
+			printf("  %-8ld %8.1f %8.1f %8.1f %8.1f\n", b, b / 10.0 / z, b / 10.0 / zf, b / 10.0 / q, b / 10.0 / qf);
+		}
+		snprintf(line, sizeof(line), "'Z' %.1f frames/s at 57600, 'z' %.1f lines/s", 5760.0 / zf, 5760.0 / z);
+		check(line, zf == 4 * VALUES + FRAME_OVERHEAD && 2 * zf <= z);
+		check("'Q' half a 'q' line or less", qf == 4 * 2 + FRAME_OVERHEAD && 2 * qf <= q);
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
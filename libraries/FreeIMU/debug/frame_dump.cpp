@@ -0,0 +1,75 @@
+//=====================================================================================================
+// frame_dump.cpp
+//=====================================================================================================
+//
+// Decodes a capture of binary telemetry frames (TelemetryFrame.h, 'Q' and 'Z' of the
+// FreeIMU_serial sketches) into one text line per frame:
+//
+//   seq,type,value,value,...
+//
+// floats as %g, Q15 and angle frames scaled back, raw values as integers, status frames of a
+// subscription (TelemetryStream.h) as rate,fields,ticks,dropped followed by the acc,gyro,magn
+// scales with STREAM_PACKED, packed frames (TelemetryPack.h) as the quaternion, the 9 sensor
+// values and temperature,pressure,altitude; packed frames whose keyframe was lost are counted
+// stale and not printed.  The frame, damaged frame, skipped byte and lost frame counts go to
+// stderr at the end.
+//
+// Build and run on a PC:
+//   make frame_dump
+//   ./frame_dump capture.bin > capture.csv
+//   stty -F /dev/ttyUSB0 57600 raw && ./frame_dump < /dev/ttyUSB0
+//
+//=====================================================================================================
+
+#include <stdio.h>
+
+#include "TelemetryPack.h"
+
+int main(int argc, char ** argv) {
+	FILE * in = stdin;
+	if(argc > 1 && !(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	FrameDecoder d;
+	PackDecoder pack;
+	PackSample s;
+	int c;
+	while((c = fgetc(in)) != EOF) {
+		if(!d.push(c)) continue;
+		do {
+			FrameReader r(d.payload(), d.length());
+			if((d.type() == FRAME_PACK_KEY || d.type() == FRAME_PACK)
+			   && !pack.decode(d.type(), d.seq(), d.payload(), d.length(), s)) continue;
+			printf("%u,%u", d.seq(), d.type());
+			switch(d.type()) {
+			case FRAME_INT16:
+				for(uint8_t i = 0; i + 1 < r.size(); i += 2) printf(",%d", r.int16(i));
+				break;
+			case FRAME_QUAT16:
+				for(uint8_t i = 0; i + 1 < r.size(); i += 2) printf(",%.5f", r.scaled(i, FRAME_Q15));
+				break;
+			case FRAME_ANGLES16:
+				for(uint8_t i = 0; i + 1 < r.size(); i += 2) printf(",%.2f", r.scaled(i, FRAME_CDEG));
+				break;
+			case FRAME_STATUS:
+				printf(",%u,%u,%lu,%lu", r.u16(0), r.u8(2), (unsigned long) r.u32(3), (unsigned long) r.u32(7));
+				if(r.size() >= 23) printf(",%g,%g,%g", r.float32(11), r.float32(15), r.float32(19));
+				break;
+			case FRAME_PACK_KEY:
+			case FRAME_PACK:
+				for(uint8_t i = 0; i < 4; i++) printf(",%.5f", s.q[i]);
+				for(uint8_t i = 0; i < 9; i++) printf(",%g", s.sensors[i]);
+				for(uint8_t i = 0; i < PACK_SLOW; i++) printf(",%.2f", s.slow[i]);
+				break;
+			default:	// FRAME_FLOATS, FRAME_VALUES, FRAME_GPS
+				for(uint8_t i = 0; i + 3 < r.size(); i += 4) printf(",%g", r.float32(i));
+				break;
+			}
+			printf("\n");
+		} while(d.next());
+	}
+	fprintf(stderr, "%lu frames, %lu damaged, %lu bytes skipped, %lu lost, %lu stale\n", (unsigned long) d.frames,
+	        (unsigned long) d.crc_errors, (unsigned long) d.skipped, (unsigned long) d.lost, (unsigned long) pack.stale);
+	return 0;
+}
@@ -0,0 +1,256 @@
+//=====================================================================================================
+// freeimu_sim.cpp
+//=====================================================================================================
+//
+// Runs the FreeIMU library unmodified on the host against simulated sensors (host/Wire.h and
+// host/SimSensors.h): FreeIMU::init, then getQ in a loop, like the FreeIMU_serial sketches.
+// The board is selected at build time (BOARD= in the Makefile) and gets the sensors its
+// HAS_*() macros ask for: MPU-6050 or MPU-9250, HMC5883L or AK8963 behind the bypass
+// switch, MS5611.  The sensor offsets and scales are set from calibration.h, so the
+// calibrated values the library computes are the simulated physical ones.
+//
+// The board rests during init and then follows the script, which starts at rest for the
+// background gyro bias estimation (GYRO_BIAS_BACKGROUND, initGyros in init otherwise); the error
+// between getQ and the true orientation is reported once a second of virtual time.
+//
+// Build and run on a PC:
+//   make freeimu_sim [BOARD=FREEIMU_v04|MPU9250_5611|GEN_MPU9250|GEN_MPU6050]
+//   ./freeimu_sim [-q] [script.txt [seconds]]   motion script, see SimScript, default built in
+//   ./freeimu_sim [-q] -r log.csv [gyro_lsb]    recorded raw log, see replay_data.h (no truth)
+// -q prints the summary only.  Exits with 1 if the tilt error after convergence (angle
+// between the true and the estimated gravity vector) exceeds CHECK_TILT, make check runs it.
+// The heading error is reported but not checked: the engines differ in their heading
+// reference (DCM includes MAG_DEC) and convention.  calRange, which the packed telemetry takes
+// its scales from, is checked against the full scale range and the values of the run.
+//
+//=====================================================================================================
+
+#include <time.h>
+
+#include "FreeIMU.h"
+#include "SimBoard.h"
+
+#define CHECK_TILT		2.0		// deg rms
+
+// rests, tilts about x and y and back, turns a full circle, climbs 10m, wobbles and rests.  The
+// tilt stays within 60 degrees: DCM's quaternion output is undefined upside down (q0 = 0).
+static const char * default_script =
+	"# seconds  wx wy wz (deg/s)  climb (m/s)\n"
+	"5    0   0   0\n"
+	"3   20   0   0\n"
+	"3  -20   0   0\n"
+	"3    0 -15   0\n"
+	"3    0  15   0\n"
+	"8    0   0  45\n"
+	"5    0   0   0   2\n"
+	"4   10   8 -30\n"
+	"4  -10  -8  30\n"
+	"10   0   0   0\n";
+
+// gravity in the sensor frame
+static void toGravity(const float * q, float * g) {
+	g[0] = 2 * (q[1]*q[3] - q[0]*q[2]);
+	g[1] = 2 * (q[0]*q[1] + q[2]*q[3]);
+	g[2] = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+}
+
+static float tiltError(const float * q, const float * truth) {
+	float g[3], t[3];
+	toGravity(q, g);
+	toGravity(truth, t);
+	float c = (g[0]*t[0] + g[1]*t[1] + g[2]*t[2]) / sqrt((g[0]*g[0] + g[1]*g[1] + g[2]*g[2]) * (t[0]*t[0] + t[1]*t[1] + t[2]*t[2]));
+	return acos(constrain(c, -1.0f, 1.0f)) * 180 / M_PI;
+}
+
+static float wrap180(float a) {
+	return remainder(a, 360.0f);
+}
+
+int main(int argc, char ** argv) {
+	bool quiet = false;
+	SimScript script;
+	SimRecording recording;
+	SimSource * motion = &script;
+	float seconds = 0;
+
+	if(argc > 1 && strcmp(argv[1], "-q") == 0) {
+		quiet = true;
+		argc--;
+		argv++;
+	}
+	if(argc > 2 && strcmp(argv[1], "-r") == 0) {
+		if(!recording.load(argv[2], argc > 3 ? atof(argv[3]) : 16.4f)) {
+			fprintf(stderr, "cannot read %s\n", argv[2]);
+			return 2;
+		}
+		motion = &recording;
+	} else if(argc > 1) {
+		if(!script.load(argv[1])) {
+			fprintf(stderr, "cannot read %s\n", argv[1]);
+			return 2;
+		}
+		if(argc > 2) seconds = atof(argv[2]);
+	} else {
+		script.parse(default_script);
+	}
+
+	SimDelayed source(motion);
+	SimBoard board(&source);
+	FreeIMU my3IMU;
+	float q[4], val[12], truth_ypr[3], ypr[3];
+	clock_t c0 = clock();
+
+	Wire.begin();
+	my3IMU.init(true);
+	source.start = hostMicros();
+	if(seconds <= 0) seconds = motion->duration();
+
+	printf("FreeIMU %s on the simulated bus: init %.2fs, %lu transactions, %lu register reads from the shadow\n",
+	       FREEIMU_ID, source.start * 1e-6, (unsigned long)(Wire.stats.writes + Wire.stats.reads),
+	       (unsigned long) I2Cdev::shadowStats.hits);
+	Wire.stats.clear();
+	if(!quiet) printf("%8s %8s %8s %8s   %8s %8s %8s %8s\n", "t", "yaw", "pitch", "roll",
+	                  "err yaw", "pitch", "roll", "alt");
+
+	ErrorStats tilt, heading;
+	float val_max[3] = {0, 0, 0};
+	unsigned long samples = 0;
+	uint64_t next_print = source.start + 1000000;
+	bool truth = motion->hasTruth();
+
+	while(hostMicros() < source.start + (uint64_t)(seconds * 1e6)) {
+		SimState s;
+		my3IMU.getQ(q, val);
+		samples++;
+		for(int k = 0; k < 9; k++) val_max[k / 3] = fmax(val_max[k / 3], fabs(val[k]));
+		source.at(hostMicros(), s);
+		toYawPitchRoll(q, ypr);
+		toYawPitchRoll(s.q, truth_ypr);
+
+		float e[3];
+		for(int k = 0; k < 3; k++) e[k] = wrap180(ypr[k] - truth_ypr[k]);
+		// after half of the run the filter has converged
+		if(truth && hostMicros() > source.start + (uint64_t)(seconds * 0.5e6)) {
+			tilt.add(tiltError(q, s.q));
+			heading.add(fabs(e[0]));
+		}
+
+		if(!quiet && hostMicros() >= next_print) {
+			printf("%8.2f %8.2f %8.2f %8.2f   ", (hostMicros() - source.start) * 1e-6, ypr[0], ypr[1], ypr[2]);
+			if(truth) printf("%8.2f %8.2f %8.2f", e[0], e[1], e[2]);
+			else printf("%8s %8s %8s", "-", "-", "-");
+		#if HAS_PRESS()
+			printf(" %8.2f", my3IMU.getBaroAlt() - s.altitude);
+		#endif
+			printf("\n");
+			next_print += 1000000;
+		}
+	}
+
+	double host_s = (double)(clock() - c0) / CLOCKS_PER_SEC;
+	printf("%lu getQ in %.1fs virtual time (%.0fHz), %.2fs host time (%.0f getQ/s)\n", samples, seconds,
+	       samples / seconds, host_s, samples / host_s);
+	printf("bus: %.1f transactions, %.1f bytes per getQ\n",
+	       (double)(Wire.stats.writes + Wire.stats.reads) / samples, (double) Wire.stats.bytes / samples);
+
+	// updateBatch on the last sample: an empty batch, then repeated timestamps, with a shadow engine;
+	// the magnetic field turned by 90 degrees, the heading of getYawPitchRoll180 is the batch's
+	bool batch_ok = true;
+	{
+		const uint16_t n = 50;
+		float a[3][n], g[3][n], m[3][n];
+		uint32_t t[n];
+		for(uint16_t i = 0; i < n; i++) {
+			for(int k = 0; k < 3; k++) {
+				a[k][i] = val[k];
+				g[k][i] = val[3 + k];
+				m[k][i] = val[6 + k];
+			}
+			m[0][i] = -val[7];
+			m[1][i] = val[6];
+			t[i] = my3IMU.getSampleTime() + 2000 * ((i + 1) / 2);
+		}
+		FusionBatch batch = {0, a[0], a[1], a[2], g[0], g[1], g[2], m[0], m[1], m[2], t, 0.0f};
+		uint8_t shadow = FUSION_NONE;
+		for(uint8_t e = 0; e < FUSION_SLOTS && shadow == FUSION_NONE; e++) {
+			if(e != my3IMU.fusion_active && my3IMU.setShadowEngine(e)) shadow = e;
+		}
+		float freq = my3IMU.sampleFreq;
+		my3IMU.updateBatch(batch, q);
+		batch_ok = my3IMU.sampleFreq == freq;
+		batch.n = n;
+		uint32_t active0 = my3IMU.fusion_stats[my3IMU.fusion_active].updates;
+		uint32_t shadow0 = shadow != FUSION_NONE ? my3IMU.fusion_stats[shadow].updates : 0;
+		my3IMU.updateBatch(batch, q);
+		float norm = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+		batch_ok = batch_ok && fabs(my3IMU.sampleFreq - 500.0f) < 0.5f && isfinite(norm) && fabs(norm - 1.0f) < 1e-3f
+		           && my3IMU.fusion_stats[my3IMU.fusion_active].updates == active0 + n;
+		if(shadow != FUSION_NONE) {
+			batch_ok = batch_ok && my3IMU.fusion_stats[shadow].updates == shadow0 + n && isfinite(my3IMU.fusion_shadow_diff);
+		}
+		printf("updateBatch: empty and repeated timestamps, sampleFreq %.0fHz, %s shadow  %s\n", my3IMU.sampleFreq,
+		       shadow != FUSION_NONE ? "with" : "no", batch_ok ? "ok" : "FAILED");
+	#if IS_9DOM()
+		iCompass compass(MAG_DEC, WINDOW_SIZE, 500);
+		float want = compass.iheading(1, 0, 0, a[0][n - 1], a[1][n - 1], a[2][n - 1], m[0][n - 1], m[1][n - 1], m[2][n - 1]);
+		float ypr[3];
+		my3IMU.getYawPitchRoll180(ypr);
+		float yaw = ypr[0] * 57.2957795f, off = fmod(fabs(yaw - want), 360.0f);
+		if(off > 180.0f) off = 360.0f - off;
+		printf("updateBatch heading %.2f, last sample %.2f, getQ %.2f  %s\n", yaw, want, val[9],
+		       off < 0.1f ? "ok" : "FAILED");
+		batch_ok = batch_ok && off < 0.1f;
+	#endif
+	}
+
+	// replayQ on a repeated timestamp, as a log with millisecond resolution has them
+	{
+		float v[12], freq = my3IMU.sampleFreq;
+		memcpy(v, val, sizeof(v));
+		my3IMU.replayQ(q, v, my3IMU.getSampleTime());
+		bool same = my3IMU.sampleFreq == freq;
+		printf("replayQ on a repeated timestamp: sampleFreq %.0fHz  %s\n", my3IMU.sampleFreq, same ? "ok" : "FAILED");
+		batch_ok = batch_ok && same;
+	}
+
+	// the engines start from the orientation they are given, DCM included: getQ_simple seeds the
+	// active one, setFusionEngine hands it on to each of the others and back, an empty
+	// updateBatch reads it
+	{
+		float v[12] = {0.3f, -0.4f, 0.87f, 0, 0, 0, 0, 0, 0, 40.0f};
+		float qs[4], qe[4], diff = 0;
+		uint8_t active = my3IMU.fusion_active;
+		FusionBatch empty = {0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0.0f};
+		my3IMU.setShadowEngine(FUSION_NONE);
+		my3IMU.getQ_simple(qs, v);
+		for(uint8_t e = 0; e <= FUSION_SLOTS; e++) {
+			uint8_t next = e < FUSION_SLOTS ? e : active;
+			if(!my3IMU.setFusionEngine(next)) continue;
+			my3IMU.updateBatch(empty, qe);
+			diff = fmax(diff, fusionQuatAngle(qs, qe));
+		}
+		bool seeded = diff < 0.01f;
+		printf("engines started from a given orientation: %.4f deg off max  %s\n", diff, seeded ? "ok" : "FAILED");
+		batch_ok = batch_ok && seeded;
+	}
+
+	// about +-2g and +-2000 deg/s, the ranges init sets, and above every value of the run
+	{
+		float range[3];
+		bool in = true;
+		for(int k = 0; k < 3; k++) {
+			range[k] = my3IMU.calRange(k);
+			in = in && val_max[k] <= range[k];
+		}
+		in = in && range[0] > 1.9f && range[0] < 2.3f && range[1] > 1900.0f && range[1] < 2100.0f;
+		printf("calRange: acc %.2f gyro %.0f magn %.2f, values up to %.2f %.1f %.2f  %s\n", range[0], range[1],
+		       range[2], val_max[0], val_max[1], val_max[2], in ? "ok" : "FAILED");
+		batch_ok = batch_ok && in;
+	}
+	if(!truth) return batch_ok ? 0 : 1;
+
+	bool ok = batch_ok && tilt.rms() <= CHECK_TILT;
+	printf("error after convergence: tilt %.2f rms %.2f max, heading %.2f rms %.2f max (deg)  %s\n",
+	       tilt.rms(), tilt.max, heading.rms(), heading.max, ok ? "ok" : "EXCEEDED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+//=====================================================================================================
+// gyro_bias_sim.cpp
+//=====================================================================================================
+//
+// Background gyro bias estimation (GYRO_BIAS_BACKGROUND, GyroBias.h) on the simulated board,
+// with the bias stored in the host EEPROM (GYRO_BIAS_STORE).  Boots the board several times:
+//
+//   cold       erased EEPROM, at rest: init takes no gyro samples, getQ converges on the bias
+//              and stores it
+//   turning    erased EEPROM, turning about x for the first seconds: nothing converges while
+//              the board turns, the bias is found once it rests
+//   warm       the stored bias at the same temperature: converged from the first sample
+//   warmer     10 degC warmer: the stored bias is only the start, getQ converges again
+//
+// and checks that setTempCalib(0) returns at once.  The bias found must be within CHECK_BIAS
+// of the simulated one.
+//
+// Build and run on a PC:
+//   make gyro_bias_sim [BOARD=...]
+//   ./gyro_bias_sim          exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include "FreeIMU.h"
+#include "SimBoard.h"
+
+#define CHECK_BIAS		0.05f	// deg/s
+#define GYRO_LSB		16.4f	// counts per deg/s at +-2000 deg/s
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+// largest difference between the gyro offsets and the simulated bias, deg/s
+static float biasError(FreeIMU & imu, SimBoard & board) {
+	const float off[3] = {imu.gyro_off_x, imu.gyro_off_y, imu.gyro_off_z};
+	float e = 0;
+	for(int k = 0; k < 3; k++) e = fmax(e, fabs(off[k] / GYRO_LSB - board.mpu->gyro_bias[k]));
+	return e;
+}
+
+// the record in the EEPROM: bias and temperature
+static bool stored(float * rec) {
+	if(EEPROM.read(FREEIMU_EEPROM_GYRO_BASE) != FREEIMU_EEPROM_SIGNATURE_GYRO) return false;
+	for(int i = 0; i < 4; i++) EEPROM.get(FREEIMU_EEPROM_GYRO_BASE + 1 + 4 * i, rec[i]);
+	return true;
+}
+
+struct Boot {
+	SimScript motion;
+	SimDelayed source;
+	SimBoard board;
+	FreeIMU imu;
+	unsigned long init_transactions;
+
+	Boot(const char * script, float temperature) : motion(0.0f, temperature), source(&motion), board(&source) {
+		motion.parse(script);
+		Wire.stats.clear();
+		imu.init(true);
+		source.start = hostMicros();
+		init_transactions = Wire.stats.writes + Wire.stats.reads;
+	}
+
+	// getQ until the bias converged or seconds passed, returns the time taken
+	float converge(float seconds) {
+		float q[4], val[12];
+		uint64_t t0 = hostMicros();
+		while(!imu.gyroBiasConverged() && hostMicros() < t0 + (uint64_t)(seconds * 1e6)) imu.getQ(q, val);
+		return (hostMicros() - t0) * 1e-6f;
+	}
+
+	void run(float seconds) {
+		float q[4], val[12];
+		uint64_t t0 = hostMicros();
+		while(hostMicros() < t0 + (uint64_t)(seconds * 1e6)) imu.getQ(q, val);
+	}
+};
+
+int main() {
+	char line[100];
+	float rec[4];
+	Wire.begin();
+
+	printf("cold start, erased EEPROM, at rest\n");
+	{
+		Boot b("10 0 0 0\n", 25.0f);
+		// initGyros read the gyro 75 times per round, for at least two rounds
+		snprintf(line, sizeof(line), "init %lu transactions, no gyro averaging", b.init_transactions);
+		check(line, b.init_transactions < 2 * nsamples && !b.imu.gyroBiasConverged());
+		float t = b.converge(2.0f);
+		snprintf(line, sizeof(line), "converged after %.3fs at rest", t);
+		check(line, b.imu.gyroBiasConverged());
+		snprintf(line, sizeof(line), "bias error %.4f deg/s", biasError(b.imu, b.board));
+		check(line, biasError(b.imu, b.board) <= CHECK_BIAS);
+		b.run(0.1f);
+		check("stored in the EEPROM", stored(rec));
+		uint64_t t0 = hostMicros();
+		b.imu.setTempCalib(0);
+		snprintf(line, sizeof(line), "setTempCalib(0) returns after %.1fms", (hostMicros() - t0) * 1e-3);
+		check(line, hostMicros() - t0 < 1000 && !b.imu.gyroBiasConverged());
+		b.converge(2.0f);
+		snprintf(line, sizeof(line), "converged again, bias error %.4f deg/s", biasError(b.imu, b.board));
+		check(line, b.imu.gyroBiasConverged() && biasError(b.imu, b.board) <= CHECK_BIAS);
+	}
+
+	printf("cold start, erased EEPROM, turning about x for 3s\n");
+	{
+		memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+		Boot b("3 20 0 0\n1.5 -20 0 0\n5 0 0 0\n", 25.0f);
+		b.converge(4.5f);
+		check("not converged while turning", !b.imu.gyroBiasConverged() && !stored(rec));
+		float t = b.converge(2.0f);
+		snprintf(line, sizeof(line), "converged %.3fs after the turn, bias error %.4f deg/s", t, biasError(b.imu, b.board));
+		check(line, b.imu.gyroBiasConverged() && biasError(b.imu, b.board) <= CHECK_BIAS);
+		b.run(0.1f);
+		check("stored in the EEPROM", stored(rec));
+	}
+
+	printf("warm start, bias stored at 25 degC\n");
+	{
+		float q[4], val[12];
+		float start[4];
+		stored(start);
+		Boot b("5 0 0 0\n", 25.0f);
+		b.imu.getQ(q, val);
+		snprintf(line, sizeof(line), "converged at the first sample, bias error %.4f deg/s", biasError(b.imu, b.board));
+		check(line, b.imu.gyroBiasConverged() && b.imu.gyro_off_x == start[0] && biasError(b.imu, b.board) <= CHECK_BIAS);
+	}
+
+	printf("warm start at 35 degC\n");
+	{
+		float q[4], val[12];
+		float start[4];
+		stored(start);
+		Boot b("5 0 0 0\n", 35.0f);
+		b.imu.getQ(q, val);
+		check("starts from the stored bias, not converged",
+		      !b.imu.gyroBiasConverged() && b.imu.gyro_off_x == start[0] && b.imu.gyro_off_z == start[2]);
+		b.converge(2.0f);
+		b.run(0.1f);
+		snprintf(line, sizeof(line), "converged, bias error %.4f deg/s", biasError(b.imu, b.board));
+		check(line, b.imu.gyroBiasConverged() && biasError(b.imu, b.board) <= CHECK_BIAS);
+		check("stored again with the new temperature", stored(rec) && rec[3] - start[3] > GYRO_BIAS_WARM_TEMP);
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+//=====================================================================================================
+// Arduino.h
+//=====================================================================================================
+//
+// Host (Linux) stand-in for the Arduino core, used by the host harnesses in debug/ and by the
+// host build of the libraries (debug/Makefile).  Add -Ihost to the compiler flags.
+//
+// Time is virtual: it only advances with delay()/delayMicroseconds(), with traffic on the
+// simulated I2C bus (Wire.h) and by 1us on every micros()/millis() call, so that polling loops
+// terminate.  A sketch therefore runs at full host speed and always sees the same timing.
+//
+// External interrupts are emulated on the virtual clock: a simulated device (HostTimed) is
+// ticked whenever time advances and raises an edge with hostInterrupt(); the handler
+// attached with attachInterrupt() then runs at that point of the sketch, e.g. between two
+// bus transfers or inside a delay(), unless noInterrupts() is in effect.  As on AVR the
+// handler runs with interrupts off, a pending edge is a flag, not a count, and a handler
+// that calls interrupts() can be interrupted itself.
+//
+// Serial writes to stdout and never has input.
+//
+//=====================================================================================================
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// nominal clock of the emulated board, FUSION_CYCLES() counts virtual microseconds with it
+#ifndef F_CPU
+	#define F_CPU 16000000L
+#endif
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) ((p) >= 0 && (p) < HOST_INTERRUPTS ? (p) : NOT_AN_INTERRUPT)
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#ifndef PI
+	#define PI 3.1415926535897932384626433832795
+#endif
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+// float literals as in AP_Math_freeimu.h, which defines them again
+#define DEG_TO_RAD 0.017453292519943295769236907684886f
+#define RAD_TO_DEG 57.295779513082320876798154814105f
+
+// binary.h constants used by the libraries
+#define B110 6
+#define B11000000 192
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define abs(x) ((x)>0?(x):-(x))
+#define radians(deg) ((deg)*DEG_TO_RAD)
+#define degrees(rad) ((rad)*RAD_TO_DEG)
+#define sq(x) ((x)*(x))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bit(b) (1UL << (b))
+
+// min/max as templates rather than macros so <algorithm> and friends still compile
+template<class T, class U> static inline T min(T a, U b) { return a < (T) b ? a : (T) b; }
+template<class T, class U> static inline T max(T a, U b) { return a > (T) b ? a : (T) b; }
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_float(addr) (*(const float *)(addr))
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+//-----------------------------------------------------------------------------------------------------
+// Virtual time and interrupts
+
+#define HOST_INTERRUPTS 8		// interrupt numbers = pin numbers 0..7
+
+// a simulated device that changes state with time rather than on bus access
+class HostTimed {
+  public:
+	virtual ~HostTimed() {}
+	virtual void tick(uint64_t now_ns) = 0;
+};
+
+inline uint64_t host_time_ns = 0;
+inline HostTimed * host_timed[8];
+inline uint8_t host_timed_count = 0;
+inline void (*host_isr[HOST_INTERRUPTS])(void);
+inline bool host_int_flag[HOST_INTERRUPTS];
+inline bool host_int_enabled = true;	// global interrupt enable, the AVR I flag
+inline uint32_t host_int_taken = 0;
+
+static inline void hostAddTimed(HostTimed * d) { if(host_timed_count < 8) host_timed[host_timed_count++] = d; }
+
+// runs the handlers of the pending interrupts, lowest number first
+static inline void hostDispatch() {
+	for(uint8_t n = 0; n < HOST_INTERRUPTS && host_int_enabled; n++) {
+		if(!host_int_flag[n]) continue;
+		host_int_flag[n] = false;
+		host_int_enabled = false;
+		host_int_taken++;
+		host_isr[n]();
+		host_int_enabled = true;
+	}
+}
+
+// an edge on interrupt n, ignored if no handler is attached
+static inline void hostInterrupt(uint8_t n) {
+	if(n < HOST_INTERRUPTS && host_isr[n]) host_int_flag[n] = true;
+}
+
+// advance the virtual clock, e.g. for the time a simulated transfer takes
+static inline void hostAdvance(uint64_t ns) {
+	host_time_ns += ns;
+	for(uint8_t i = 0; i < host_timed_count; i++) host_timed[i]->tick(host_time_ns);
+	hostDispatch();
+}
+static inline uint64_t hostMicros() { return host_time_ns / 1000; }
+
+static inline unsigned long micros() { hostAdvance(1000); return (unsigned long) hostMicros(); }
+static inline unsigned long millis() { hostAdvance(1000); return (unsigned long)(host_time_ns / 1000000); }
+// in 1ms steps so that interrupts are taken during the delay
+static inline void delay(unsigned long ms) { while(ms--) hostAdvance(1000000); }
+static inline void delayMicroseconds(unsigned int us) { hostAdvance((uint64_t) us * 1000); }
+
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+static inline int digitalRead(uint8_t) { return LOW; }
+static inline int analogRead(uint8_t) { return 0; }
+static inline void interrupts() { host_int_enabled = true; hostDispatch(); }
+static inline void noInterrupts() { host_int_enabled = false; }
+
+static inline void attachInterrupt(int n, void (*isr)(void), int) {
+	if(n < 0 || n >= HOST_INTERRUPTS) return;
+	host_isr[n] = isr;
+	host_int_flag[n] = false;
+}
+static inline void detachInterrupt(int n) {
+	if(n < 0 || n >= HOST_INTERRUPTS) return;
+	host_isr[n] = NULL;
+	host_int_flag[n] = false;
+}
+
+//-----------------------------------------------------------------------------------------------------
+// Serial
+
+class HostSerial {
+  public:
+	void begin(unsigned long) {}
+	void end() {}
+	int available() { return 0; }
+	int read() { return -1; }
+	int peek() { return -1; }
+	void flush() { fflush(stdout); }
+	operator bool() { return true; }
+
+	size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+	size_t write(const uint8_t * buf, size_t n) { return fwrite(buf, 1, n, stdout); }
+
+	size_t print(const char * s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+	size_t print(const __FlashStringHelper * s) { return print(reinterpret_cast<const char *>(s)); }
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(unsigned char n, int base = DEC) { return print((unsigned long) n, base); }
+	size_t print(int n, int base = DEC) { return print((long) n, base); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+	size_t print(long n, int base = DEC) {
+		if(base == DEC) return printf("%ld", n);
+		return print((unsigned long) n, base);
+	}
+	size_t print(unsigned long n, int base = DEC) {
+		char buf[8 * sizeof(long) + 1], *p = buf + sizeof(buf) - 1;
+		if(base < 2) base = DEC;
+		*p = 0;
+		do {
+			int d = n % base;
+			*--p = d < 10 ? '0' + d : 'A' + d - 10;
+			n /= base;
+		} while(n);
+		return print(p);
+	}
+	size_t print(double x, int digits = 2) { return printf("%.*f", digits, x); }
+
+	size_t println() { return print("\r\n"); }
+	template<class T> size_t println(T x) { size_t n = print(x); return n + println(); }
+	template<class T> size_t println(T x, int f) { size_t n = print(x, f); return n + println(); }
+};
+
+inline HostSerial Serial;
+
+#endif // Arduino_h
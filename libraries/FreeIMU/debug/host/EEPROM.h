@@ -0,0 +1,51 @@
+//=====================================================================================================
+// EEPROM.h
+//=====================================================================================================
+//
+// Host stand-in for the Arduino EEPROM library: 4kB of RAM, erased (0xFF) at start up.
+// EEPROM.load()/save() copy it from/to a file so calibration data can persist between runs.
+//
+//=====================================================================================================
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE 4096
+
+class HostEEPROM {
+  public:
+	uint8_t data[HOST_EEPROM_SIZE];
+
+	HostEEPROM() { memset(data, 0xFF, sizeof(data)); }
+
+	uint8_t read(int address) { return data[address % HOST_EEPROM_SIZE]; }
+	void write(int address, uint8_t value) { data[address % HOST_EEPROM_SIZE] = value; }
+	void update(int address, uint8_t value) { write(address, value); }
+	uint8_t & operator[](int address) { return data[address % HOST_EEPROM_SIZE]; }
+	uint16_t length() { return HOST_EEPROM_SIZE; }
+
+	template<class T> T & get(int address, T & t) { memcpy(&t, data + address, sizeof(T)); return t; }
+	template<class T> const T & put(int address, const T & t) { memcpy(data + address, &t, sizeof(T)); return t; }
+
+	bool load(const char * path) {
+		FILE * f = fopen(path, "rb");
+		if(f == NULL) return false;
+		size_t n = fread(data, 1, sizeof(data), f);
+		fclose(f);
+		return n == sizeof(data);
+	}
+
+	bool save(const char * path) {
+		FILE * f = fopen(path, "wb");
+		if(f == NULL) return false;
+		size_t n = fwrite(data, 1, sizeof(data), f);
+		fclose(f);
+		return n == sizeof(data);
+	}
+};
+
+inline HostEEPROM EEPROM;
+
+#endif // EEPROM_h
@@ -0,0 +1,43 @@
+//=====================================================================================================
+// SPI.h
+//=====================================================================================================
+//
+// Host stand-in for the Arduino SPI library.  Only the I2C bus is simulated (Wire.h), so
+// transfers return 0; boards with SPI sensors (APM 2.5, ArduIMU v3) build but read nothing.
+//
+//=====================================================================================================
+
+#ifndef SPI_h
+#define SPI_h
+
+#include "Arduino.h"
+
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV32 0x06
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+class HostSPI {
+  public:
+	void begin() {}
+	void end() {}
+	void setBitOrder(uint8_t) {}
+	void setDataMode(uint8_t) {}
+	void setClockDivider(uint8_t) {}
+	uint8_t transfer(uint8_t) { hostAdvance(1000); return 0; }
+};
+
+inline HostSPI SPI;
+
+#endif // SPI_h
@@ -0,0 +1,71 @@
+//=====================================================================================================
+// SimBoard.h
+//=====================================================================================================
+//
+// The simulated sensors of the board selected in FreeIMU.h (BOARD= in the Makefile), attached
+// to the simulated I2C bus with the imperfections of calibration.h.  Include after FreeIMU.h.
+//
+//=====================================================================================================
+
+#ifndef SimBoard_h
+#define SimBoard_h
+
+#include "SimSensors.h"
+
+struct SimBoard {
+	SimMPU60X0 * mpu;
+	I2CSlave * mag;
+	SimMS5611 * baro;
+
+	SimBoard(SimSource * source) : mpu(NULL), mag(NULL), baro(NULL) {
+	#if HAS_MPU6050() || HAS_MPU9150() || HAS_MPU9250()
+	#if HAS_MPU9250()
+		mpu = new SimMPU60X0(source, true);
+	#else
+		mpu = new SimMPU60X0(source, false);
+	#endif
+		for(int k = 0; k < 3; k++) {
+			const int acc_off[3] = {acc_off_x, acc_off_y, acc_off_z};
+			const float acc_scale[3] = {acc_scale_x, acc_scale_y, acc_scale_z};
+			mpu->acc_off[k] = acc_off[k];
+			mpu->acc_scale[k] = acc_scale[k];
+		}
+		mpu->gyro_bias[0] = SYNTH_BIAS_X;
+		mpu->gyro_bias[1] = SYNTH_BIAS_Y;
+		mpu->gyro_bias[2] = SYNTH_BIAS_Z;
+		mpu->acc_noise = 0.005f;
+		mpu->gyro_noise = 0.1f;
+		mpu->int_pin = FIFO_INT_PIN;
+		Wire.attach(FIMU_ACCGYRO_ADDR, mpu);
+	#endif
+	#if HAS_HMC5883L()
+		SimHMC5883L * hmc = new SimHMC5883L(source, mpu);
+		hmc->noise_amp = 0.002f;
+		mag = hmc;
+		Wire.attach(0x1E, hmc);
+	#elif HAS_MPU9150() || HAS_MPU9250()
+		SimAK8963 * ak = new SimAK8963(source, mpu);
+		ak->noise_amp = 0.002f;
+		mag = ak;
+		Wire.attach(0x0C, ak);
+		mpu->aux = ak;
+		mpu->aux_address = 0x0C;
+	#endif
+	#if HAS_MS5611()
+		baro = new SimMS5611(source);
+		baro->noise_amp = 0.01f;
+		Wire.attach(FIMU_BARO_ADDR, baro);
+	#endif
+	}
+};
+
+static inline void toYawPitchRoll(const float * q, float * ypr) {
+	float gx = 2 * (q[1]*q[3] - q[0]*q[2]);
+	float gy = 2 * (q[0]*q[1] + q[2]*q[3]);
+	float gz = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+	ypr[0] = atan2(2 * q[1] * q[2] - 2 * q[0] * q[3], 2 * q[0]*q[0] + 2 * q[1] * q[1] - 1) * 180 / M_PI;
+	ypr[1] = atan(gx / sqrt(gy*gy + gz*gz)) * 180 / M_PI;
+	ypr[2] = atan(gy / sqrt(gx*gx + gz*gz)) * 180 / M_PI;
+}
+
+#endif // SimBoard_h
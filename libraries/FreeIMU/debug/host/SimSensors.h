@@ -0,0 +1,858 @@
+//=====================================================================================================
+// SimSensors.h
+//=====================================================================================================
+//
+// Register level models of the FreeIMU sensors for the simulated I2C bus (Wire.h):
+//
+//   SimMPU60X0    MPU-6050 / MPU-9250 accelerometer and gyro: WHO_AM_I, PWR_MGMT_1 reset and
+//                 sleep, SMPLRT_DIV and DLPF sample rate, FS_SEL/AFS_SEL ranges, data and
+//                 temperature registers, INT_STATUS, the FIFO (FIFO_EN, USER_CTRL, FIFO_COUNT,
+//                 FIFO_R_W with overflow), the INT_PIN_CFG bypass switch to the aux bus, the
+//                 I2C master (slaves 0-3, I2C_MST_DLY, EXT_SENS_DATA, SLV0 in the FIFO) for
+//                 one aux device and the data-ready pulse on the INT pin (see Arduino.h)
+//   SimAK8963     AK8963 magnetometer of the MPU-9250: single, continuous 8/100Hz and self
+//                 test modes, 14/16 bit output, DRDY/DOR/HOFL, fuse ROM (ASA) access
+//   SimHMC5883L   HMC5883L magnetometer: ID, gain, data rate, single/continuous mode, the
+//                 positive/negative self test bias and the X, Z, Y register order
+//   SimMS5611     MS5611 barometer: reset, PROM with CRC, D1/D2 conversions with the OSR
+//                 dependent conversion time and the ADC read (0 if not ready)
+//
+// The devices sample a SimSource, the physical state of the board at a given time: a script
+// of constant rate segments (SimScript) or a recorded log (SimRecording).  Each device adds
+// its own imperfections (offsets, scale, noise), which can be set to the values in
+// calibration.h so that the calibrated output of the library matches the source.
+//
+// Conversions and output data rates follow the virtual clock of Arduino.h; nothing here
+// depends on the host's own time.
+//
+//=====================================================================================================
+
+#ifndef SimSensors_h
+#define SimSensors_h
+
+#include <algorithm>
+#include <vector>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "../replay_data.h"
+
+#define SIM_FIELD_X		0.22f		// earth field in gauss, north and (negative) down
+#define SIM_FIELD_Z		-0.40f
+#define SIM_SEA_LEVEL	1013.25f	// mbar
+
+// Physical state of the board at one instant, in the sensor frame of the filters
+struct SimState {
+	float q[4];				// true orientation
+	float gyro[3];			// deg/s
+	float acc[3];			// g
+	float mag[3];			// gauss
+	float altitude;			// m
+	float pressure;			// mbar
+	float temperature;		// deg C
+};
+
+class SimSource {
+  public:
+	virtual ~SimSource() {}
+	// state at t_us (virtual time), any order of t_us
+	virtual void at(uint64_t t_us, SimState &s) = 0;
+	// false if the source has no true orientation (recorded data)
+	virtual bool hasTruth() { return true; }
+	virtual float duration() = 0;
+};
+
+// Another source delayed by start (us), held at its initial state before that.  Lets a
+// script begin once the library has finished its start up calibration.
+class SimDelayed : public SimSource {
+  public:
+	uint64_t start;
+
+	SimDelayed(SimSource * source) : start(0), source(source) {}
+
+	void at(uint64_t t_us, SimState &s) { source->at(t_us > start ? t_us - start : 0, s); }
+	bool hasTruth() { return source->hasTruth(); }
+	float duration() { return start * 1e-6f + source->duration(); }
+
+  private:
+	SimSource * source;
+};
+
+// gravity and earth field in the sensor frame for orientation q
+static void simVectors(SimState &s) {
+	const float * q = s.q;
+	float q0q0 = q[0]*q[0], q0q1 = q[0]*q[1], q0q2 = q[0]*q[2], q0q3 = q[0]*q[3];
+	float q1q1 = q[1]*q[1], q1q2 = q[1]*q[2], q1q3 = q[1]*q[3];
+	float q2q2 = q[2]*q[2], q2q3 = q[2]*q[3], q3q3 = q[3]*q[3];
+	const float bx = SIM_FIELD_X, bz = SIM_FIELD_Z;
+
+	s.acc[0] = 2 * (q1q3 - q0q2);
+	s.acc[1] = 2 * (q0q1 + q2q3);
+	s.acc[2] = q0q0 - q1q1 - q2q2 + q3q3;
+	s.mag[0] = 2 * bx * (0.5f - q2q2 - q3q3) + 2 * bz * (q1q3 - q0q2);
+	s.mag[1] = 2 * bx * (q1q2 - q0q3) + 2 * bz * (q0q1 + q2q3);
+	s.mag[2] = 2 * bx * (q0q2 + q1q3) + 2 * bz * (0.5f - q1q1 - q2q2);
+}
+
+static float simPressure(float altitude) {
+	return SIM_SEA_LEVEL * pow(1.0f - altitude / 44330.0f, 5.255f);
+}
+
+/**
+ * Motion script: segments of constant body rates, climb rate and temperature change.  The
+ * orientation inside a segment is computed in closed form, so the devices can sample it at
+ * any time.  After the last segment the board stays at rest.
+ *
+ * Text format, one segment per line, '#' starts a comment:
+ *   seconds  wx wy wz (deg/s)  [climb (m/s)  [temperature rate (deg C/s)]]
+*/
+class SimScript : public SimSource {
+  public:
+	SimScript(float altitude = 0.0f, float temperature = 25.0f) {
+		Segment s = {0, {0, 0, 0}, 0, 0, 0, {1, 0, 0, 0}, altitude, temperature};
+		segments.push_back(s);
+	}
+
+	void add(float seconds, float wx, float wy, float wz, float climb = 0.0f, float temp_rate = 0.0f) {
+		Segment &last = segments.back();
+		Segment s;
+		end(last, last.duration, s);
+		s.duration = seconds;
+		s.rate[0] = wx;
+		s.rate[1] = wy;
+		s.rate[2] = wz;
+		s.climb = climb;
+		s.temp_rate = temp_rate;
+		s.t0 = last.t0 + last.duration;
+		segments.push_back(s);
+	}
+
+	bool parse(const char * text) {
+		while(*text) {
+			float v[6] = {0, 0, 0, 0, 0, 0};
+			int n = 0;
+			const char * eol = strchr(text, '\n');
+			if(eol == NULL) eol = text + strlen(text);
+			while(n < 6 && text < eol && *text != '#') {
+				char * end;
+				v[n] = strtof(text, &end);
+				if(end == text) break;
+				n++;
+				text = end;
+			}
+			if(n >= 4) add(v[0], v[1], v[2], v[3], v[4], v[5]);
+			else if(n > 0) return false;
+			text = *eol ? eol + 1 : eol;
+		}
+		return true;
+	}
+
+	bool load(const char * path) {
+		FILE * f = fopen(path, "r");
+		std::vector<char> text;
+		int c;
+		if(f == NULL) return false;
+		while((c = fgetc(f)) != EOF) text.push_back((char) c);
+		text.push_back(0);
+		fclose(f);
+		return parse(&text[0]);
+	}
+
+	float duration() {
+		return segments.back().t0 + segments.back().duration;
+	}
+
+	void at(uint64_t t_us, SimState &st) {
+		double t = t_us * 1e-6;
+		size_t i = segments.size() - 1;
+		while(i > 0 && segments[i].t0 > t) i--;
+		const Segment &s = segments[i];
+		float dt = (float) std::min(t - s.t0, (double) s.duration);
+		Segment e;
+		end(s, dt, e);
+
+		memcpy(st.q, e.q0, sizeof(st.q));
+		for(int k = 0; k < 3; k++) st.gyro[k] = t - s.t0 < s.duration ? s.rate[k] : 0.0f;
+		st.altitude = e.alt0;
+		st.pressure = simPressure(e.alt0);
+		st.temperature = e.temp0;
+		simVectors(st);
+	}
+
+  private:
+	struct Segment {
+		float duration;
+		float rate[3];
+		float climb, temp_rate;
+		double t0;
+		float q0[4];			// state at t0
+		float alt0, temp0;
+	};
+	std::vector<Segment> segments;
+
+	// state dt seconds into segment s
+	static void end(const Segment &s, float dt, Segment &e) {
+		const float d2r = M_PI / 180;
+		float w = sqrt(s.rate[0]*s.rate[0] + s.rate[1]*s.rate[1] + s.rate[2]*s.rate[2]) * d2r;
+		float c = cos(0.5f * w * dt), k = w > 0 ? sin(0.5f * w * dt) / w * d2r : 0.0f;
+		float r[4] = {c, s.rate[0] * k, s.rate[1] * k, s.rate[2] * k};
+		const float * q = s.q0;
+
+		// q0 * r, body rates
+		e.q0[0] = q[0]*r[0] - q[1]*r[1] - q[2]*r[2] - q[3]*r[3];
+		e.q0[1] = q[0]*r[1] + q[1]*r[0] + q[2]*r[3] - q[3]*r[2];
+		e.q0[2] = q[0]*r[2] - q[1]*r[3] + q[2]*r[0] + q[3]*r[1];
+		e.q0[3] = q[0]*r[3] + q[1]*r[2] - q[2]*r[1] + q[3]*r[0];
+		e.alt0 = s.alt0 + s.climb * dt;
+		e.temp0 = s.temp0 + s.temp_rate * dt;
+	}
+};
+
+/**
+ * Recorded raw log (see load() in replay_data.h), replayed at its own time stamps with
+ * the values held between samples.  acc_lsb and mag_lsb convert the logged counts back to
+ * g and gauss, the devices then scale them to their own ranges again.
+*/
+class SimRecording : public SimSource {
+  public:
+	bool load(const char * path, float gyro_lsb = 16.4f, float acc_lsb = 16384.0f, float mag_lsb = 1090.0f) {
+		double t = 0;
+		if(!::load(path, gyro_lsb, samples)) return false;
+		times.clear();
+		for(size_t i = 0; i < samples.size(); i++) {
+			times.push_back((uint64_t)(t * 1e6));
+			t += samples[i].dt;
+			for(int k = 0; k < 3; k++) {
+				samples[i].val[k] /= acc_lsb;
+				samples[i].val[6 + k] /= mag_lsb;
+			}
+		}
+		return !samples.empty();
+	}
+
+	bool hasTruth() { return false; }
+
+	float duration() {
+		return samples.empty() ? 0.0f : times.back() * 1e-6f + samples.back().dt;
+	}
+
+	void at(uint64_t t_us, SimState &s) {
+		size_t i = std::upper_bound(times.begin(), times.end(), t_us) - times.begin();
+		const float * val = samples[i ? i - 1 : 0].val;
+		s.q[0] = 1.0f;
+		s.q[1] = s.q[2] = s.q[3] = 0.0f;
+		for(int k = 0; k < 3; k++) {
+			s.acc[k] = val[k];
+			s.gyro[k] = val[3 + k];
+			s.mag[k] = val[6 + k];
+		}
+		s.altitude = 0.0f;
+		s.pressure = SIM_SEA_LEVEL;
+		s.temperature = 25.0f;
+	}
+
+  private:
+	std::vector<Sample> samples;
+	std::vector<uint64_t> times;
+};
+
+static int16_t simCounts(float v) {
+	v = v < 0 ? v - 0.5f : v + 0.5f;
+	if(v > 32767.0f) return 32767;
+	if(v < -32768.0f) return -32768;
+	return (int16_t) v;
+}
+
+//-----------------------------------------------------------------------------------------------------
+// MPU-6050 / MPU-9250
+
+#define SIM_MPU_SMPLRT_DIV		0x19
+#define SIM_MPU_CONFIG			0x1A
+#define SIM_MPU_GYRO_CONFIG		0x1B
+#define SIM_MPU_ACCEL_CONFIG	0x1C
+#define SIM_MPU_FIFO_EN			0x23
+#define SIM_MPU_I2C_SLV0_ADDR	0x25
+#define SIM_MPU_I2C_SLV4_CTRL	0x34
+#define SIM_MPU_INT_PIN_CFG		0x37
+#define SIM_MPU_INT_ENABLE		0x38
+#define SIM_MPU_INT_STATUS		0x3A
+#define SIM_MPU_ACCEL_XOUT_H	0x3B
+#define SIM_MPU_TEMP_OUT_H		0x41
+#define SIM_MPU_GYRO_XOUT_H		0x43
+#define SIM_MPU_EXT_SENS_DATA	0x49
+#define SIM_MPU_I2C_SLV0_DO		0x63
+#define SIM_MPU_I2C_MST_DELAY	0x67
+#define SIM_MPU_USER_CTRL		0x6A
+#define SIM_MPU_PWR_MGMT_1		0x6B
+#define SIM_MPU_FIFO_COUNTH		0x72
+#define SIM_MPU_FIFO_COUNTL		0x73
+#define SIM_MPU_FIFO_R_W		0x74
+#define SIM_MPU_WHO_AM_I		0x75
+#define SIM_MPU_FIFO_SIZE		1024
+
+class SimMPU60X0 : public I2CSlave, public HostTimed {
+  public:
+	// imperfections, accelerometer offset and scale in LSB and LSB/g at +-2g as in calibration.h
+	float gyro_bias[3];			// deg/s
+	float acc_off[3];
+	float acc_scale[3];
+	float acc_noise;			// g, peak
+	float gyro_noise;			// deg/s, peak
+
+	uint32_t fifo_overflows;
+	uint32_t fifo_samples;		// samples written to the FIFO
+	int8_t int_pin;				// interrupt the INT pin is wired to, -1 = not connected
+	I2CSlave * aux;				// device on the auxiliary bus, reached by the I2C master
+	uint8_t aux_address;
+	uint32_t aux_reads;			// reads of the I2C master slaves 0-3
+
+	SimMPU60X0(SimSource * source, bool mpu9250 = false) : source(source), mpu9250(mpu9250) {
+		for(int k = 0; k < 3; k++) {
+			gyro_bias[k] = 0.0f;
+			acc_off[k] = 0.0f;
+			acc_scale[k] = 16384.0f;
+		}
+		acc_noise = 0.0f;
+		gyro_noise = 0.0f;
+		fifo_overflows = 0;
+		fifo_samples = 0;
+		int_pin = -1;
+		aux = NULL;
+		aux_address = 0;
+		aux_reads = 0;
+		reset();
+		hostAddTimed(this);
+	}
+
+	// aux bus devices are reachable in bypass mode with the I2C master off
+	bool bypass() {
+		return (reg[SIM_MPU_INT_PIN_CFG] & 0x02) && !(reg[SIM_MPU_USER_CTRL] & 0x20);
+	}
+
+	// internal sample period: 1kHz with the DLPF on, 8kHz without, divided by 1 + SMPLRT_DIV
+	uint64_t periodNs() {
+		uint8_t dlpf = reg[SIM_MPU_CONFIG] & 0x07;
+		uint64_t base = (dlpf == 0 || dlpf == 7) ? 125000 : 1000000;
+		return base * (1 + reg[SIM_MPU_SMPLRT_DIV]);
+	}
+
+	uint16_t fifoCount() { return fifo_count; }
+
+	// INT pin, active high: a pulse for every new sample when DATA_RDY_EN is set
+	void tick(uint64_t now_ns) {
+		if(int_pin < 0 || !(reg[SIM_MPU_INT_ENABLE] & 0x01) || next_sample > now_ns) return;
+		if(reg[SIM_MPU_PWR_MGMT_1] & 0x40) return;
+		update();
+		hostInterrupt(int_pin);
+	}
+
+	void write(const uint8_t * data, uint8_t length) {
+		update();
+		ptr = data[0] & 0x7F;
+		for(uint8_t i = 1; i < length; i++) {
+			writeReg(ptr, data[i]);
+			if(ptr != SIM_MPU_FIFO_R_W) ptr = (ptr + 1) & 0x7F;
+		}
+	}
+
+	void read(uint8_t * data, uint8_t length) {
+		update();
+		uint16_t count = fifo_count;	// latched for FIFO_COUNTH/L
+		for(uint8_t i = 0; i < length; i++) {
+			if(ptr == SIM_MPU_FIFO_R_W) {
+				data[i] = fifoPop();
+				continue;
+			}
+			if(ptr == SIM_MPU_FIFO_COUNTH) data[i] = count >> 8;
+			else if(ptr == SIM_MPU_FIFO_COUNTL) data[i] = count & 0xFF;
+			else data[i] = reg[ptr];
+			if(ptr == SIM_MPU_INT_STATUS) reg[ptr] = 0;
+			ptr = (ptr + 1) & 0x7F;
+		}
+	}
+
+  private:
+	SimSource * source;
+	bool mpu9250;
+	uint8_t reg[128];
+	uint8_t ptr;
+	uint8_t fifo[SIM_MPU_FIFO_SIZE];
+	uint16_t fifo_head, fifo_count;
+	uint64_t next_sample;			// ns
+	uint32_t sample_count;			// samples since power up, for the I2C master delay
+
+	void reset() {
+		memset(reg, 0, sizeof(reg));
+		reg[SIM_MPU_PWR_MGMT_1] = 0x40;		// sleep
+		reg[SIM_MPU_WHO_AM_I] = mpu9250 ? 0x71 : 0x68;
+		ptr = 0;
+		fifo_head = fifo_count = 0;
+		next_sample = host_time_ns;
+		sample_count = 0;
+	}
+
+	void writeReg(uint8_t r, uint8_t v) {
+		switch(r) {
+			case SIM_MPU_PWR_MGMT_1:
+				if(v & 0x80) reset();
+				else reg[r] = v;
+				break;
+			case SIM_MPU_USER_CTRL:
+				if(v & 0x04) fifo_head = fifo_count = 0;
+				reg[r] = v & ~0x07;				// reset bits clear themselves
+				break;
+			case SIM_MPU_FIFO_R_W:
+				fifoPush(v);
+				break;
+			case SIM_MPU_INT_STATUS:
+			case SIM_MPU_FIFO_COUNTH:
+			case SIM_MPU_FIFO_COUNTL:
+			case SIM_MPU_WHO_AM_I:
+				break;							// read only
+			default:
+				if(r >= SIM_MPU_ACCEL_XOUT_H && r < SIM_MPU_EXT_SENS_DATA + 24) break;
+				reg[r] = v;
+		}
+	}
+
+	void fifoPush(uint8_t b) {
+		if(fifo_count == SIM_MPU_FIFO_SIZE) {
+			// full: the oldest byte is overwritten
+			fifo_head = (fifo_head + 1) % SIM_MPU_FIFO_SIZE;
+			fifo_count--;
+			if(!(reg[SIM_MPU_INT_STATUS] & 0x10)) fifo_overflows++;
+			reg[SIM_MPU_INT_STATUS] |= 0x10;
+		}
+		fifo[(fifo_head + fifo_count) % SIM_MPU_FIFO_SIZE] = b;
+		fifo_count++;
+	}
+
+	uint8_t fifoPop() {
+		if(fifo_count == 0) return 0;
+		uint8_t b = fifo[fifo_head];
+		fifo_head = (fifo_head + 1) % SIM_MPU_FIFO_SIZE;
+		fifo_count--;
+		return b;
+	}
+
+	// latch all samples due by now, only the FIFO needs the ones in between
+	void update() {
+		if(reg[SIM_MPU_PWR_MGMT_1] & 0x40) {
+			next_sample = host_time_ns;
+			return;
+		}
+		uint64_t period = periodNs();
+		bool fifo_on = (reg[SIM_MPU_USER_CTRL] & 0x40) && reg[SIM_MPU_FIFO_EN];
+		if(next_sample > host_time_ns) return;
+		if(!fifo_on) {
+			uint64_t skip = (host_time_ns - next_sample) / period;
+			next_sample += skip * period;
+			sample_count += skip;
+		}
+		while(next_sample <= host_time_ns) {
+			sample(next_sample, fifo_on);
+			next_sample += period;
+		}
+	}
+
+	void put16(uint8_t r, int16_t v) {
+		reg[r] = (uint16_t) v >> 8;
+		reg[r + 1] = v & 0xFF;
+	}
+
+	void sample(uint64_t t_ns, bool fifo_on) {
+		SimState s;
+		source->at(t_ns / 1000, s);
+
+		float afs = 1 << ((reg[SIM_MPU_ACCEL_CONFIG] >> 3) & 3);
+		float gyro_lsb = 131.0f / (1 << ((reg[SIM_MPU_GYRO_CONFIG] >> 3) & 3));
+		for(int k = 0; k < 3; k++) {
+			float a = (s.acc[k] + noise(acc_noise)) * acc_scale[k] + acc_off[k];
+			float g = (s.gyro[k] + gyro_bias[k] + noise(gyro_noise)) * gyro_lsb;
+			put16(SIM_MPU_ACCEL_XOUT_H + 2 * k, simCounts(a / afs));
+			put16(SIM_MPU_GYRO_XOUT_H + 2 * k, simCounts(g));
+		}
+		if(mpu9250) put16(SIM_MPU_TEMP_OUT_H, simCounts((s.temperature - 21.0f) * 333.87f));
+		else put16(SIM_MPU_TEMP_OUT_H, simCounts((s.temperature - 36.53f) * 340.0f));
+		reg[SIM_MPU_INT_STATUS] |= 0x01;
+		master(t_ns);
+		sample_count++;
+
+		if(fifo_on) {
+			uint8_t en = reg[SIM_MPU_FIFO_EN];
+			fifo_samples++;
+			for(uint8_t r = SIM_MPU_ACCEL_XOUT_H; r < SIM_MPU_GYRO_XOUT_H + 6; r++) {
+				bool on = r < SIM_MPU_TEMP_OUT_H ? (en & 0x08) :
+				          r < SIM_MPU_GYRO_XOUT_H ? (en & 0x80) :
+				          (en & (0x40 >> ((r - SIM_MPU_GYRO_XOUT_H) / 2)));
+				if(on) fifoPush(reg[r]);
+			}
+			if(en & 0x01) {
+				uint8_t n = reg[SIM_MPU_I2C_SLV0_ADDR + 2] & 0x0F;
+				for(uint8_t i = 0; i < n; i++) fifoPush(reg[SIM_MPU_EXT_SENS_DATA + i]);
+			}
+		}
+	}
+
+	// I2C master, slaves 0-3 in order after every sample, the ones with their I2C_MST_DELAY_CTRL
+	// bit set every 1 + I2C_MST_DLY samples.  Reads fill EXT_SENS_DATA in slave order.  The
+	// transfers take no bus time but the aux device sees the time of the sample.
+	void master(uint64_t t_ns) {
+		if(!(reg[SIM_MPU_USER_CTRL] & 0x20) || aux == NULL) return;
+		bool delayed_due = sample_count % (1 + (reg[SIM_MPU_I2C_SLV4_CTRL] & 0x1F)) == 0;
+		uint8_t ext = SIM_MPU_EXT_SENS_DATA;
+		uint64_t now = host_time_ns;
+		host_time_ns = t_ns;
+		for(uint8_t n = 0; n < 4; n++) {
+			uint8_t addr = reg[SIM_MPU_I2C_SLV0_ADDR + 3 * n];
+			uint8_t sreg = reg[SIM_MPU_I2C_SLV0_ADDR + 3 * n + 1];
+			uint8_t ctrl = reg[SIM_MPU_I2C_SLV0_ADDR + 3 * n + 2];
+			uint8_t len = ctrl & 0x0F;
+			if(!(ctrl & 0x80)) continue;
+			bool read = addr & 0x80;
+			if(read) ext += len;		// the data registers stay assigned while skipped
+			if((reg[SIM_MPU_I2C_MST_DELAY] & (1 << n)) && !delayed_due) continue;
+			if((addr & 0x7F) != aux_address) continue;
+			if(read) {
+				aux->write(&sreg, 1);
+				aux->read(&reg[ext - len], len);
+				aux_reads++;
+			} else {
+				uint8_t data[2] = {sreg, reg[SIM_MPU_I2C_SLV0_DO + n]};
+				aux->write(data, 2);
+			}
+		}
+		host_time_ns = now;
+	}
+};
+
+//-----------------------------------------------------------------------------------------------------
+// AK8963, behind the MPU-9250 bypass switch or read by its I2C master
+
+#define SIM_AK_WIA		0x00
+#define SIM_AK_ST1		0x02
+#define SIM_AK_HXL		0x03
+#define SIM_AK_ST2		0x09
+#define SIM_AK_CNTL1	0x0A
+#define SIM_AK_CNTL2	0x0B
+#define SIM_AK_ASTC		0x0C
+#define SIM_AK_ASAX		0x10
+
+class SimAK8963 : public I2CSlave {
+  public:
+	uint8_t asa[3];				// sensitivity adjustment in the fuse ROM
+	float off[3];				// offset, LSB at 16 bit
+	float scale[3];				// sensitivity error, 1 = nominal
+	float noise_amp;			// gauss, peak
+
+	SimAK8963(SimSource * source, SimMPU60X0 * host = NULL) : source(source), host(host) {
+		asa[0] = 176;
+		asa[1] = 177;
+		asa[2] = 165;
+		for(int k = 0; k < 3; k++) {
+			off[k] = 0.0f;
+			scale[k] = 1.0f;
+		}
+		noise_amp = 0.0f;
+		reset();
+	}
+
+	bool present() { return host == NULL || host->bypass(); }
+
+	void write(const uint8_t * data, uint8_t length) {
+		update();
+		ptr = data[0];
+		for(uint8_t i = 1; i < length; i++, ptr++) {
+			if(ptr == SIM_AK_CNTL1) {
+				reg[ptr] = data[i];
+				// first measurement one period (7.2ms in single/self test mode) from now
+				next_meas = host_time_ns + periodNs();
+			} else if(ptr == SIM_AK_CNTL2) {
+				if(data[i] & 0x01) reset();
+			} else if(ptr == SIM_AK_ASTC || ptr == 0x0F) {
+				reg[ptr] = data[i];
+			}
+		}
+	}
+
+	void read(uint8_t * data, uint8_t length) {
+		update();
+		for(uint8_t i = 0; i < length; i++, ptr++) {
+			if(ptr > SIM_AK_ASAX + 2) ptr = 0;
+			if(ptr >= SIM_AK_ASAX) {
+				data[i] = mode() == 0x0F ? asa[ptr - SIM_AK_ASAX] : 0;
+			} else {
+				data[i] = reg[ptr];
+			}
+			// reading ST2 ends the data read
+			if(ptr == SIM_AK_ST2) reg[SIM_AK_ST1] = 0;
+		}
+	}
+
+  private:
+	SimSource * source;
+	SimMPU60X0 * host;
+	uint8_t reg[0x13];
+	uint8_t ptr;
+	uint64_t next_meas;
+
+	uint8_t mode() { return reg[SIM_AK_CNTL1] & 0x0F; }
+
+	uint64_t periodNs() {
+		switch(mode()) {
+			case 0x02: return 125000000;		// continuous 1, 8Hz
+			case 0x06: return 10000000;			// continuous 2, 100Hz
+			case 0x01:
+			case 0x04:
+			case 0x08: return 7200000;			// single, external trigger, self test
+			default: return 0;
+		}
+	}
+
+	void reset() {
+		memset(reg, 0, sizeof(reg));
+		reg[SIM_AK_WIA] = 0x48;
+		reg[0x01] = 0x9A;						// INFO
+		ptr = 0;
+		next_meas = 0;
+	}
+
+	void update() {
+		uint8_t m = mode();
+		if(m == 0x01 || m == 0x08) {
+			if(host_time_ns >= next_meas) {
+				measure(m == 0x08);
+				reg[SIM_AK_CNTL1] &= 0xF0;		// back to power down
+			}
+		} else if(m == 0x02 || m == 0x06) {
+			uint64_t period = periodNs();
+			if(host_time_ns >= next_meas) {
+				next_meas += (host_time_ns - next_meas) / period * period + period;
+				measure(false);
+			}
+		}
+	}
+
+	void measure(bool self_test) {
+		SimState s;
+		source->at(host_time_ns / 1000, s);
+		bool bits16 = reg[SIM_AK_CNTL1] & 0x10;
+		float lsb = bits16 ? 666.67f : 166.67f;			// LSB per gauss, 0.15 / 0.6 uT
+		float h[3];
+		bool overflow = false;
+
+		// chip axes: x = board y, y = board x, z = -board z
+		h[0] = s.mag[1];
+		h[1] = s.mag[0];
+		h[2] = -s.mag[2];
+		for(int k = 0; k < 3; k++) {
+			float adj = (asa[k] - 128) / 256.0f + 1.0f;
+			float v = (h[k] + noise(noise_amp)) * scale[k] * lsb / adj + off[k] * (bits16 ? 1.0f : 0.25f);
+			if(self_test) v = (k == 2 ? -1600.0f : 0.0f) / adj * (bits16 ? 1.0f : 0.25f);
+			if(fabs(v / lsb) > 49.12f) overflow = true;		// 4912 uT
+			int16_t c = simCounts(v);
+			reg[SIM_AK_HXL + 2 * k] = c & 0xFF;
+			reg[SIM_AK_HXL + 2 * k + 1] = (uint16_t) c >> 8;
+		}
+		reg[SIM_AK_ST1] = (reg[SIM_AK_ST1] & 0x01) ? 0x03 : 0x01;	// DRDY, DOR if not read
+		reg[SIM_AK_ST2] = (bits16 ? 0x10 : 0) | (overflow ? 0x08 : 0);
+	}
+};
+
+//-----------------------------------------------------------------------------------------------------
+// HMC5883L, behind the MPU-6050 bypass switch on the FreeIMU v0.4
+
+#define SIM_HMC_CRA		0
+#define SIM_HMC_CRB		1
+#define SIM_HMC_MODE	2
+#define SIM_HMC_XM		3
+#define SIM_HMC_SR		9
+
+class SimHMC5883L : public I2CSlave {
+  public:
+	float off[3];				// offset in LSB
+	float scale[3];				// sensitivity error, 1 = nominal
+	float noise_amp;			// gauss, peak
+
+	SimHMC5883L(SimSource * source, SimMPU60X0 * host = NULL) : source(source), host(host) {
+		for(int k = 0; k < 3; k++) {
+			off[k] = 0.0f;
+			scale[k] = 1.0f;
+		}
+		noise_amp = 0.0f;
+		memset(reg, 0, sizeof(reg));
+		reg[SIM_HMC_CRA] = 0x10;
+		reg[SIM_HMC_CRB] = 0x20;
+		reg[SIM_HMC_MODE] = 0x01;
+		reg[10] = 'H';
+		reg[11] = '4';
+		reg[12] = '3';
+		gain = 1;
+		ptr = 0;
+		next_meas = 0;
+	}
+
+	bool present() { return host == NULL || host->bypass(); }
+
+	void write(const uint8_t * data, uint8_t length) {
+		update();
+		ptr = data[0];
+		for(uint8_t i = 1; i < length; i++, ptr++) {
+			if(ptr > SIM_HMC_MODE) continue;
+			reg[ptr] = data[i];
+			if(ptr == SIM_HMC_MODE) {
+				// single: one measurement in 6ms, continuous: the first one after a period
+				next_meas = host_time_ns + ((data[i] & 0x03) == 1 ? 6000000 : periodNs());
+			}
+		}
+	}
+
+	void read(uint8_t * data, uint8_t length) {
+		update();
+		for(uint8_t i = 0; i < length; i++) {
+			data[i] = reg[ptr];
+			// reading the last data register releases the lock and clears RDY
+			if(ptr == SIM_HMC_XM + 5) reg[SIM_HMC_SR] = 0;
+			if(ptr == SIM_HMC_XM + 5) ptr = SIM_HMC_XM;
+			else ptr = ptr >= 12 ? 0 : ptr + 1;
+		}
+	}
+
+  private:
+	SimSource * source;
+	SimMPU60X0 * host;
+	uint8_t reg[13];
+	uint8_t ptr;
+	uint8_t gain;				// gain of the next measurement, changes take one measurement
+	uint64_t next_meas;
+
+	uint64_t periodNs() {
+		static const uint32_t dor_us[8] = {1333333, 666667, 333333, 133333, 66667, 33333, 13333, 13333};
+		return (uint64_t) dor_us[(reg[SIM_HMC_CRA] >> 2) & 7] * 1000;
+	}
+
+	void update() {
+		uint8_t m = reg[SIM_HMC_MODE] & 0x03;
+		if(m == 1) {
+			if(host_time_ns >= next_meas) {
+				measure();
+				reg[SIM_HMC_MODE] |= 0x03;				// idle
+			}
+		} else if(m == 0) {
+			uint64_t period = periodNs();
+			if(host_time_ns >= next_meas) {
+				next_meas += (host_time_ns - next_meas) / period * period + period;
+				measure();
+			}
+		}
+	}
+
+	void measure() {
+		static const float lsb[8] = {1370, 1090, 820, 660, 440, 390, 330, 230};	// LSB per gauss
+		static const float bias[3] = {1.16f, 1.16f, 1.08f};						// self test field
+		SimState s;
+		source->at(host_time_ns / 1000, s);
+		uint8_t ms = reg[SIM_HMC_CRA] & 0x03;
+		int16_t c[3];
+
+		for(int k = 0; k < 3; k++) {
+			float h = s.mag[k] + noise(noise_amp);
+			if(ms == 1) h += bias[k];
+			if(ms == 2) h -= bias[k];
+			float v = h * scale[k] * lsb[gain] + off[k];
+			c[k] = (v < -2048.0f || v > 2047.0f) ? -4096 : simCounts(v);
+		}
+		// X, Z, Y
+		const int order[3] = {0, 2, 1};
+		for(int k = 0; k < 3; k++) {
+			reg[SIM_HMC_XM + 2 * k] = (uint16_t) c[order[k]] >> 8;
+			reg[SIM_HMC_XM + 2 * k + 1] = c[order[k]] & 0xFF;
+		}
+		reg[SIM_HMC_SR] = 0x01;
+		gain = reg[SIM_HMC_CRB] >> 5;
+	}
+};
+
+//-----------------------------------------------------------------------------------------------------
+// MS5611
+
+class SimMS5611 : public I2CSlave {
+  public:
+	float noise_amp;			// mbar, peak
+
+	SimMS5611(SimSource * source) : source(source) {
+		// typical coefficients from the datasheet
+		const uint16_t c[8] = {0, 40127, 36924, 23317, 23282, 33464, 28312, 0};
+		memcpy(prom, c, sizeof(prom));
+		prom[7] = crc4(prom);
+		noise_amp = 0.0f;
+		cmd = 0;
+		adc = 0;
+		done_at = 0;
+		converting = 0;
+	}
+
+	void write(const uint8_t * data, uint8_t length) {
+		cmd = data[0];
+		if((cmd & 0xF0) == 0x40 || (cmd & 0xF0) == 0x50) {
+			static const uint32_t conv_us[5] = {600, 1170, 2280, 4540, 9040};
+			uint8_t osr = ((cmd & 0x0F) >> 1) % 5;
+			converting = cmd & 0xF0;
+			done_at = host_time_ns + (uint64_t) conv_us[osr] * 1000;
+		}
+	}
+
+	void read(uint8_t * data, uint8_t length) {
+		memset(data, 0, length);
+		if(cmd == 0x00) {
+			// ADC read: 0 if no conversion has finished since the last read
+			if(converting && host_time_ns >= done_at) {
+				adc = convert(converting == 0x40);
+				converting = 0;
+			} else {
+				adc = 0;
+			}
+			for(uint8_t i = 0; i < length && i < 3; i++) data[i] = (adc >> (16 - 8 * i)) & 0xFF;
+			adc = 0;
+		} else if(cmd >= 0xA0 && cmd <= 0xAE) {
+			uint16_t w = prom[(cmd - 0xA0) >> 1];
+			if(length > 0) data[0] = w >> 8;
+			if(length > 1) data[1] = w & 0xFF;
+		}
+	}
+
+  private:
+	SimSource * source;
+	uint16_t prom[8];
+	uint8_t cmd, converting;
+	uint32_t adc;
+	uint64_t done_at;
+
+	// raw D1 (pressure) or D2 (temperature), first order inverse of the datasheet formulas
+	uint32_t convert(bool pressure) {
+		SimState s;
+		source->at(done_at / 1000, s);
+		double temp = s.temperature * 100;
+		double d2 = prom[5] * 256.0 + (temp - 2000) * 8388608.0 / prom[6];
+		if(!pressure) return (uint32_t)(d2 + 0.5);
+		double dt = d2 - prom[5] * 256.0;
+		double off = prom[2] * 65536.0 + prom[4] * dt / 128;
+		double sens = prom[1] * 32768.0 + prom[3] * dt / 256;
+		double p = (s.pressure + noise(noise_amp)) * 100;
+		return (uint32_t)((p * 32768 + off) * 2097152.0 / sens + 0.5);
+	}
+
+	// AN520
+	static uint16_t crc4(const uint16_t * n_prom) {
+		uint16_t p[8], rem = 0;
+		memcpy(p, n_prom, sizeof(p));
+		p[7] &= 0xFF00;
+		for(int cnt = 0; cnt < 16; cnt++) {
+			rem ^= (cnt & 1) ? (p[cnt >> 1] & 0x00FF) : (p[cnt >> 1] >> 8);
+			for(int b = 8; b > 0; b--) rem = (rem & 0x8000) ? (rem << 1) ^ 0x3000 : (rem << 1);
+		}
+		return (rem >> 12) & 0x000F;
+	}
+};
+
+#endif // SimSensors_h
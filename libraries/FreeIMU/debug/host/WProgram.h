@@ -0,0 +1,2 @@
+// Pre-1.0 Arduino core header, see Arduino.h
+#include "Arduino.h"
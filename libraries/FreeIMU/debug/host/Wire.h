@@ -0,0 +1,144 @@
+//=====================================================================================================
+// Wire.h
+//=====================================================================================================
+//
+// Host stand-in for the Arduino Wire library: a simulated I2C bus.  Devices derive from
+// I2CSlave and are attached to an address; a write transaction (beginTransmission, write,
+// endTransmission) is handed to the device as a whole, a read (requestFrom) asks it for the
+// requested number of bytes.  Register level models of the sensors are in SimSensors.h.
+//
+// Every transfer advances the virtual clock (Arduino.h) by its duration at the bus clock,
+// 9 bits per byte plus the address byte, so a sketch sees the same sample rates as on the
+// target.  stats counts the transactions and bytes, e.g. to compare driver changes.
+//
+// A transfer started while another one is on the bus, i.e. by an interrupt handler taken
+// during a transfer of the sketch, is counted in stats.collisions; on the target it would
+// corrupt both.
+//
+// endTransmission() without data is a no-op (I2Cdev calls it after every read) and returns
+// 0; to an absent or disconnected device it returns 2 (address NACK) and requestFrom()
+// returns 0 bytes.
+//
+//=====================================================================================================
+
+#ifndef Wire_h
+#define Wire_h
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class I2CSlave {
+  public:
+	virtual ~I2CSlave() {}
+	// false while the device can not be reached, e.g. behind a disabled bypass switch
+	virtual bool present() { return true; }
+	// master write, data[0] is usually the register address
+	virtual void write(const uint8_t * data, uint8_t length) = 0;
+	// master read of length bytes
+	virtual void read(uint8_t * data, uint8_t length) = 0;
+};
+
+struct I2CStats {
+	uint32_t writes, reads;		// transactions
+	uint32_t bytes;				// data bytes both ways
+	uint32_t nacks;				// transactions to absent devices
+	uint32_t collisions;		// transfers started during another one
+
+	void clear() { writes = reads = bytes = nacks = collisions = 0; }
+};
+
+class TwoWire {
+  public:
+	I2CStats stats;
+
+	TwoWire() : clock(400000UL), busy(false), txAddress(0), txLength(0), rxIndex(0), rxLength(0) {
+		memset(slaves, 0, sizeof(slaves));
+		stats.clear();
+	}
+
+	void attach(uint8_t address, I2CSlave * slave) { slaves[address & 0x7F] = slave; }
+	void detach(uint8_t address) { slaves[address & 0x7F] = NULL; }
+
+	void begin() {}
+	void setClock(uint32_t hz) { clock = hz; }
+
+	void beginTransmission(uint8_t address) {
+		if(busy) stats.collisions++;
+		txAddress = address;
+		txLength = 0;
+	}
+	void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+
+	size_t write(uint8_t data) {
+		if(txLength >= BUFFER_LENGTH) return 0;
+		txBuffer[txLength++] = data;
+		return 1;
+	}
+	size_t write(const uint8_t * data, size_t n) {
+		size_t i = 0;
+		while(i < n && write(data[i])) i++;
+		return i;
+	}
+	size_t write(int data) { return write((uint8_t) data); }
+	void send(uint8_t data) { write(data); }
+
+	uint8_t endTransmission(bool = true) {
+		if(txLength == 0) return 0;
+		uint8_t length = txLength;
+		I2CSlave * slave = find(txAddress);
+		txLength = 0;
+		transfer(length);
+		if(slave == NULL) return 2;
+		stats.writes++;
+		stats.bytes += length;
+		slave->write(txBuffer, length);
+		return 0;
+	}
+
+	uint8_t requestFrom(int address, int quantity, int = 1) {
+		if(busy) stats.collisions++;
+		I2CSlave * slave = find((uint8_t) address);
+		if(quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+		rxIndex = rxLength = 0;
+		transfer(slave ? quantity : 0);
+		if(slave == NULL || quantity <= 0) return 0;
+		slave->read(rxBuffer, (uint8_t) quantity);
+		rxLength = (uint8_t) quantity;
+		stats.reads++;
+		stats.bytes += rxLength;
+		return rxLength;
+	}
+
+	int available() { return rxLength - rxIndex; }
+	int read() { return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1; }
+	int peek() { return rxIndex < rxLength ? rxBuffer[rxIndex] : -1; }
+	uint8_t receive() { return (uint8_t) read(); }
+
+  private:
+	I2CSlave * slaves[128];
+	uint32_t clock;
+	bool busy;
+	uint8_t txAddress, txBuffer[BUFFER_LENGTH], txLength;
+	uint8_t rxBuffer[BUFFER_LENGTH], rxIndex, rxLength;
+
+	I2CSlave * find(uint8_t address) {
+		I2CSlave * slave = slaves[address & 0x7F];
+		if(slave == NULL || !slave->present()) {
+			stats.nacks++;
+			return NULL;
+		}
+		return slave;
+	}
+
+	// start, address byte, n data bytes and stop, 9 clocks each
+	void transfer(int n) {
+		busy = true;
+		hostAdvance((uint64_t)(n + 1) * 9 * 1000000000ULL / clock + 2 * 1000000000ULL / clock);
+		busy = false;
+	}
+};
+
+inline TwoWire Wire;
+
+#endif // Wire_h
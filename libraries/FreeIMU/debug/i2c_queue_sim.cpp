@@ -0,0 +1,347 @@
+//=====================================================================================================
+// i2c_queue_sim.cpp
+//=====================================================================================================
+//
+// The I2Cdev transaction queue (submitRead/submitWrite, poll) on the simulated bus (host/Wire.h),
+// with the sensors of host/SimSensors.h side by side on it: MPU-6050, HMC5883L, AK8963 and
+// MS5611, the board at rest and without noise.
+//
+//   ordering     transactions complete in submit order, one per poll() unless chained; a
+//                chain stops at a failed transfer (absent device) and its rest completes with
+//                -1 without bus traffic; a full queue rejects; a callback may submit
+//   drivers      requestMotion6/9, requestRaw, requestHeading and the queued MS5611
+//                measurement return the same values as the blocking calls
+//   throughput   a sensor loop of blocking reads against the same reads queued and chained:
+//                bus transactions and bus time per loop, host time per loop
+//   shadow       the MPU60X0 configuration registers held by the I2Cdev shadow: a setter is one
+//                write once its register is known, the device holds what the shadow holds,
+//                the FIFO_RESET strobe of USER_CTRL is not written again by a later setter,
+//                reset() forgets the shadow
+//
+// Build and run on a PC:
+//   make i2c_queue_sim
+//   ./i2c_queue_sim [loops]
+// Exits with 1 if a check fails, make check runs it.
+//
+//=====================================================================================================
+
+#include <time.h>
+
+#include "I2Cdev.h"
+#include "MPU60X0.h"
+#include "HMC58X3.h"
+#include "AK8963.h"
+#include "MS561101BA.h"
+#include "SimSensors.h"
+
+#define MPU_ADDR		0x68
+#define AK_ADDR			0x0C
+#define BARO_ADDR		0x77
+#define ABSENT_ADDR		0x50
+
+static bool ok = true;
+
+static void check(bool c, const char * what) {
+	printf("  %-64s %s\n", what, c ? "ok" : "FAILED");
+	if(!c) ok = false;
+}
+
+// completion log of the ordering tests, ctx is the tag of the transaction
+static int8_t done_tag[64], done_count[64];
+static uint8_t completed;
+
+static void logDone(void * ctx, int8_t count) {
+	if(completed >= sizeof(done_tag)) return;
+	done_tag[completed] = (int8_t)(intptr_t) ctx;
+	done_count[completed++] = count;
+}
+
+static uint8_t follower[6];
+static void submitFollower(void * ctx, int8_t count) {
+	logDone(ctx, count);
+	I2Cdev::submitRead(false, HMC58X3_ADDR, HMC58X3_R_XM, sizeof(follower), follower, logDone, (void *) 9, I2CDEV_CHAIN);
+}
+
+static const struct { uint8_t addr, reg, length; } xfer[4] = {
+	{MPU_ADDR, 0x3B, 14},		// ACCEL_XOUT_H..GYRO_ZOUT_L
+	{HMC58X3_ADDR, 3, 6},		// data registers
+	{AK_ADDR, 0x02, 8},			// ST1..ST2
+	{BARO_ADDR, 0x00, 3}		// ADC
+};
+static uint8_t xfer_buf[4][14];
+
+static int16_t submitXfer(int i, uint8_t flags = 0) {
+	return I2Cdev::submitRead(false, xfer[i].addr, xfer[i].reg, xfer[i].length, xfer_buf[i], logDone, (void *)(intptr_t) i, flags);
+}
+
+static bool tagsAre(const int8_t * tags, uint8_t n) {
+	if(completed != n) return false;
+	for(uint8_t i = 0; i < n; i++) if(done_tag[i] != tags[i]) return false;
+	return true;
+}
+
+static void testOrdering() {
+	printf("ordering\n");
+
+	completed = 0;
+	Wire.stats.clear();
+	for(int i = 0; i < 4; i++) submitXfer(i);
+	submitXfer(0);
+	bool one_per_poll = true;
+	for(uint8_t n = 1; n <= 5; n++) {
+		I2Cdev::poll();
+		one_per_poll = one_per_poll && completed == n && Wire.stats.reads == n;
+	}
+	const int8_t fifo[5] = {0, 1, 2, 3, 0};
+	check(one_per_poll, "one transaction per poll()");
+	check(tagsAre(fifo, 5) && done_count[2] == 8 && done_count[4] == 14, "completion in submit order, count = length");
+
+	completed = 0;
+	submitXfer(0);
+	submitXfer(1, I2CDEV_CHAIN);
+	submitXfer(2, I2CDEV_CHAIN);
+	submitXfer(3);
+	bool more = I2Cdev::poll();
+	check(more && completed == 3 && I2Cdev::pending() == 1, "a chain runs in one poll()");
+	I2Cdev::poll();
+	check(completed == 4 && I2Cdev::pending() == 0 && !I2Cdev::poll(), "the next one in the next poll()");
+
+	completed = 0;
+	Wire.stats.clear();
+	static uint8_t absent_buf[6];
+	I2Cdev::submitRead(false, ABSENT_ADDR, 0, 6, absent_buf, logDone, (void *) 8);
+	submitXfer(1, I2CDEV_CHAIN);
+	submitXfer(2, I2CDEV_CHAIN);
+	submitXfer(3);
+	I2Cdev::poll();
+	const int8_t skipped[3] = {8, 1, 2};
+	check(tagsAre(skipped, 3) && done_count[0] == 0 && done_count[1] == -1 && done_count[2] == -1,
+	      "a chain stops at a failed read, the rest completes with -1");
+	check(Wire.stats.reads == 0, "no bus traffic for the skipped transactions");
+	I2Cdev::poll();
+	check(completed == 4 && done_count[3] == 3, "the next chain runs");
+
+	completed = 0;
+	int16_t first = submitXfer(0), last = first;
+	int accepted = 1;
+	for(int16_t t; (t = submitXfer(accepted % 4)) >= 0; accepted++) last = t;
+	check(accepted == I2CDEV_QUEUE_LENGTH && I2Cdev::pending() == I2CDEV_QUEUE_LENGTH, "a full queue rejects");
+	check(!I2Cdev::isDone(first) && !I2Cdev::isDone(last), "isDone false while queued");
+	I2Cdev::poll();
+	check(I2Cdev::isDone(first) && !I2Cdev::isDone(last), "isDone in queue order");
+	I2Cdev::flush();
+	check(I2Cdev::isDone(last) && I2Cdev::pending() == 0 && completed == I2CDEV_QUEUE_LENGTH, "flush runs all");
+
+	completed = 0;
+	I2Cdev::submitRead(false, MPU_ADDR, 0x3B, 14, xfer_buf[0], submitFollower, (void *) 7);
+	I2Cdev::poll();
+	const int8_t followed[2] = {7, 9};
+	check(tagsAre(followed, 2) && I2Cdev::pending() == 0, "a chained submit of a callback runs in the same poll()");
+
+	uint8_t cra = 0;
+	I2Cdev::submitWriteByte(false, HMC58X3_ADDR, HMC58X3_R_CONFA, 0x14);
+	I2Cdev::submitRead(false, HMC58X3_ADDR, HMC58X3_R_CONFA, 1, &cra, 0, 0, I2CDEV_CHAIN);
+	I2Cdev::submitWriteByte(false, HMC58X3_ADDR, HMC58X3_R_CONFA, 0x70);
+	I2Cdev::flush();
+	check(cra == 0x14, "write and read of one device in order");
+}
+
+static bool same(const int16_t * a, const int16_t * b, int n) {
+	for(int i = 0; i < n; i++) if(a[i] != b[i]) return false;
+	return true;
+}
+
+static float measure(MS561101BA & baro, bool queued) {
+	baro.setQueued(queued);
+	baro.startMeasurement(MS561101BA_OSR_4096);
+	for(int i = 0; i < 100; i++) {
+		I2Cdev::poll();
+		if(baro.pollMeasurement()) return baro.getMeasuredPressure();
+		delay(1);
+	}
+	return 0;
+}
+
+static void testDrivers(MPU60X0 & mpu, HMC58X3 & hmc, AK8963 & ak, MS561101BA & baro) {
+	int16_t a[10], b[10];
+	printf("drivers\n");
+
+	mpu.getMotion6(&a[0], &a[1], &a[2], &a[3], &a[4], &a[5]);
+	check(mpu.requestMotion6() && !mpu.requestMotion6(), "MPU60X0 requestMotion6, refused while pending");
+	check(!mpu.pollMotion6(&b[0], &b[1], &b[2], &b[3], &b[4], &b[5]), "pollMotion6 false before poll()");
+	I2Cdev::poll();
+	check(mpu.pollMotion6(&b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) && same(a, b, 6), "pollMotion6 = getMotion6");
+	check(!mpu.pollMotion6(&b[0], &b[1], &b[2], &b[3], &b[4], &b[5]), "pollMotion6 true once per read");
+
+	uint8_t s = mpu.getMotion9(&a[0], &a[1], &a[2], &a[3], &a[4], &a[5], &a[6], &a[7], &a[8], &a[9]);
+	mpu.requestMotion9();
+	I2Cdev::poll();
+	uint8_t r = mpu.pollMotion9(&b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &b[6], &b[7], &b[8], &b[9]);
+	check(r == (MPU60X0_MOTION_READY | s) && same(a, b, 10), "pollMotion9 = getMotion9");
+
+	int ia[3], ib[3];
+	hmc.getRaw(&ia[0], &ia[1], &ia[2]);
+	hmc.requestRaw();
+	I2Cdev::poll();
+	check(hmc.pollRaw(&ib[0], &ib[1], &ib[2]) && ia[0] == ib[0] && ia[1] == ib[1] && ia[2] == ib[2], "HMC58X3 pollRaw = getRaw");
+
+	// both need a new measurement (DRDY), 100Hz
+	for(int k = 0; k < 3; k++) a[k] = b[k] = INT16_MIN;
+	delay(20);
+	ak.getHeading(&a[0], &a[1], &a[2]);
+	delay(20);
+	ak.requestHeading();
+	I2Cdev::poll();
+	check(ak.pollHeading(&b[0], &b[1], &b[2]) && a[0] != INT16_MIN && same(a, b, 3), "AK8963 pollHeading = getHeading");
+
+	float p_blocking = measure(baro, false);
+	uint32_t writes = Wire.stats.writes;
+	float p_queued = measure(baro, true);
+	check(p_blocking > 900 && p_queued == p_blocking && Wire.stats.writes - writes == 4,
+	      "MS561101BA queued measurement = blocking, 4 writes");
+}
+
+static void testThroughput(MPU60X0 & mpu, HMC58X3 & hmc, AK8963 & ak, MS561101BA & baro, unsigned long loops) {
+	int16_t m[6], h[3];
+	int xyz[3];
+	unsigned long motion[2] = {0, 0}, baro_samples[2] = {0, 0};
+	double bus_us[2], transactions[2], host_us[2];
+	printf("throughput, %lu loops of MPU, HMC5883L and AK8963 reads and the barometer\n", loops);
+
+	for(int queued = 0; queued < 2; queued++) {
+		baro.setQueued(queued);
+		baro.startMeasurement(MS561101BA_OSR_4096);
+		Wire.stats.clear();
+		uint64_t t0 = host_time_ns;
+		clock_t c0 = clock();
+		for(unsigned long i = 0; i < loops; i++) {
+			if(!queued) {
+				mpu.getMotion6(&m[0], &m[1], &m[2], &m[3], &m[4], &m[5]);
+				hmc.getRaw(&xyz[0], &xyz[1], &xyz[2]);
+				ak.getHeading(&h[0], &h[1], &h[2]);
+				motion[0]++;
+			} else {
+				mpu.requestMotion6();
+				hmc.requestRaw(I2CDEV_CHAIN);
+				ak.requestHeading(I2CDEV_CHAIN);
+				I2Cdev::flush();
+				if(mpu.pollMotion6(&m[0], &m[1], &m[2], &m[3], &m[4], &m[5])) motion[1]++;
+				hmc.pollRaw(&xyz[0], &xyz[1], &xyz[2]);
+				ak.pollHeading(&h[0], &h[1], &h[2]);
+			}
+			if(baro.pollMeasurement()) {
+				baro_samples[queued]++;
+				baro.startMeasurement(MS561101BA_OSR_4096);
+			}
+			I2Cdev::flush();
+		}
+		host_us[queued] = (double)(clock() - c0) / CLOCKS_PER_SEC * 1e6 / loops;
+		bus_us[queued] = (host_time_ns - t0) * 1e-3 / loops;
+		transactions[queued] = (double)(Wire.stats.writes + Wire.stats.reads) / loops;
+		// finish the measurement in progress, setQueued needs the barometer idle
+		while(!baro.pollMeasurement()) {
+			I2Cdev::flush();
+			delay(1);
+		}
+		printf("  %-9s %6.2f transactions %7.1fus bus per loop, %lu motion and %lu baro samples, %.2fus host per loop\n",
+		       queued ? "queued" : "blocking", transactions[queued], bus_us[queued], motion[queued],
+		       baro_samples[queued], host_us[queued]);
+	}
+	check(motion[1] == loops, "every queued motion read completed");
+	// the same transfers, readBytes spends a virtual 1us per byte in millis()
+	check(transactions[1] < transactions[0] * 1.01 && bus_us[1] < bus_us[0] * 1.05, "as many transactions and as much bus time queued");
+	check(baro_samples[1] + 1 >= baro_samples[0], "as many barometer samples queued");
+}
+
+// the configuration a sensor loop changes at runtime, k selects the values
+static void reconfigure(MPU60X0 & mpu, uint8_t k) {
+	mpu.setRate(k);
+	mpu.setDLPFMode(k % 7);
+	mpu.setFullScaleGyroRange(k & 3);
+	mpu.setFullScaleAccelRange(k & 3);
+	mpu.setI2CBypassEnabled(k & 1);
+	mpu.setAccelFIFOEnabled(true);
+}
+
+// a register as the device holds it, past I2Cdev
+static uint8_t deviceRegister(uint8_t reg) {
+	Wire.beginTransmission(MPU_ADDR);
+	Wire.write(reg);
+	Wire.endTransmission();
+	Wire.requestFrom((uint8_t)MPU_ADDR, (uint8_t)1);
+	return Wire.read();
+}
+
+static void testShadow(MPU60X0 & mpu) {
+	static const uint8_t config[] = { MPU60X0_RA_SMPLRT_DIV, MPU60X0_RA_CONFIG, MPU60X0_RA_GYRO_CONFIG,
+	                                  MPU60X0_RA_ACCEL_CONFIG, MPU60X0_RA_INT_PIN_CFG, MPU60X0_RA_FIFO_EN };
+	printf("shadow registers, %d slots\n", I2CDEV_SHADOW_SLOTS);
+	I2Cdev::shadowStats.clear();
+	Wire.stats.clear();
+	reconfigure(mpu, 1);
+	unsigned long first = Wire.stats.writes + Wire.stats.reads;
+	Wire.stats.clear();
+	uint64_t t0 = host_time_ns;
+	for(uint8_t k = 2; k < 12; k++) reconfigure(mpu, k);
+	double bus_us = (host_time_ns - t0) * 1e-3 / 10;
+	printf("  6 setters: %lu transactions the first time, then %.1f and %.1fus bus, %lu hits\n",
+	       first, (double)(Wire.stats.writes + Wire.stats.reads) / 10, bus_us, (unsigned long)I2Cdev::shadowStats.hits);
+	check(Wire.stats.reads == 0 && Wire.stats.writes == 60, "a setter is one write once its register is known");
+
+	bool same = true;
+	for(uint8_t i = 0; i < sizeof(config); i++) {
+		uint8_t value = 0;
+		I2Cdev::readByte(false, MPU_ADDR, config[i], &value);
+		same = same && value == deviceRegister(config[i]);
+	}
+	check(same && mpu.getDLPFMode() == 11 % 7 && mpu.getFullScaleGyroRange() == 3, "the device holds what the shadow holds");
+
+	// FIFO_RESET is a strobe, a setter of another USER_CTRL bit must not write it again
+	mpu.setFIFOEnabled(true);
+	mpu.resetFIFO();
+	delay(20);
+	uint16_t count = mpu.getFIFOCount();
+	mpu.setI2CMasterModeEnabled(false);
+	check(count > 0 && mpu.getFIFOCount() >= count, "FIFO not reset by a later USER_CTRL setter");
+
+	uint32_t misses = I2Cdev::shadowStats.misses;
+	mpu.reset();
+	delay(50);
+	check(mpu.getFullScaleGyroRange() == 0 && I2Cdev::shadowStats.misses > misses, "reset() forgets the shadow");
+	mpu.initialize();
+}
+
+int main(int argc, char ** argv) {
+	unsigned long loops = argc > 1 ? atol(argv[1]) : 5000;
+	SimScript motion;
+	motion.parse("1000 0 0 0\n");
+	SimMPU60X0 sim_mpu(&motion);
+	SimHMC5883L sim_hmc(&motion);
+	SimAK8963 sim_ak(&motion);
+	SimMS5611 sim_baro(&motion);
+	Wire.attach(MPU_ADDR, &sim_mpu);
+	Wire.attach(HMC58X3_ADDR, &sim_hmc);
+	Wire.attach(AK_ADDR, &sim_ak);
+	Wire.attach(BARO_ADDR, &sim_baro);
+
+	MPU60X0 mpu(false, MPU_ADDR);
+	HMC58X3 hmc;
+	AK8963 ak(false, AK_ADDR);
+	MS561101BA baro;
+	Wire.begin();
+	mpu.initialize();
+	hmc.init(false);
+	ak.setModeRes(AK8963_MODE_CONT2, 1);
+	baro.init(BARO_ADDR);
+	delay(100);
+
+	printf("I2Cdev transaction queue on the simulated bus, %d entries\n", I2CDEV_QUEUE_LENGTH);
+	testOrdering();
+	testDrivers(mpu, hmc, ak, baro);
+	testThroughput(mpu, hmc, ak, baro, loops);
+#if I2CDEV_SHADOW_DEVICES > 0
+	testShadow(mpu);
+#endif
+	printf("%s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
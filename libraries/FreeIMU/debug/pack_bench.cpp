@@ -0,0 +1,340 @@
+//=====================================================================================================
+// pack_bench.cpp
+//=====================================================================================================
+//
+// Packed telemetry (TelemetryPack.h) against the frames and lines it replaces:
+//
+//   quaternion   smallest three in 32 and 48 bits, the largest rotation error over random
+//                quaternions, q and -q packed the same
+//   varint       round trip and size of the deltas at the edges of each byte count
+//   flight       60s of a simulated flight at 50 Hz (rotation, sensor noise, climb, temperature
+//                drift) encoded and decoded through FrameDecoder: every value within half a step
+//                of its scale, and the bytes a frame against a FRAME_VALUES of the same 16 values
+//                and a 'z' line, with the rate each allows at 57600 baud
+//   loss         the same with 20% of the frames lost, keyframes too: the frames whose keyframe
+//                got through decode as well, the others are counted stale and none is wrong
+//   saturation   sensor values beyond the scale saturate instead of wrapping
+//   fitted       scales fitted to uncalibrated raw counts carry them within half a step where
+//                the defaults saturate, and a range that is not a number keeps the default
+//
+// Build and run on a PC:
+//   make pack_bench
+//   ./pack_bench             exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "TelemetryPack.h"
+
+#define RATE		50			// Hz
+#define SECONDS		60
+#define FRAMES		(RATE * SECONDS)
+#define BAUD		57600
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+static double frand(double lo, double hi) { return lo + (hi - lo) * (rand() / (double) RAND_MAX); }
+
+static double gauss() {
+	double u = frand(1e-12, 1.0), v = frand(0.0, 1.0);
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+// rotation between two quaternions, degrees
+static double quatError(const float * a, const float * b) {
+	double d = 0, na = 0, nb = 0;
+	for(int i = 0; i < 4; i++) {
+		d += (double) a[i] * b[i];
+		na += (double) a[i] * a[i];
+		nb += (double) b[i] * b[i];
+	}
+	d = fabs(d) / sqrt(na * nb);
+	return 2.0 * acos(d > 1.0 ? 1.0 : d) * 180.0 / M_PI;
+}
+
+// the simulated flight: a slow tumble, gravity and a field in the body frame, a climb
+static void flight(int k, PackSample &s) {
+	double t = k / (double) RATE;
+	double yaw = 0.7 * t, pitch = 0.4 * sin(0.5 * t), roll = 0.6 * sin(0.9 * t + 1.0);
+	double cy = cos(yaw / 2), sy = sin(yaw / 2), cp = cos(pitch / 2), sp = sin(pitch / 2);
+	double cr = cos(roll / 2), sr = sin(roll / 2);
+	s.q[0] = cr * cp * cy + sr * sp * sy;
+	s.q[1] = sr * cp * cy - cr * sp * sy;
+	s.q[2] = cr * sp * cy + sr * cp * sy;
+	s.q[3] = cr * cp * sy - sr * sp * cy;
+	s.sensors[0] = -sin(pitch) + 0.01 * gauss();
+	s.sensors[1] = sin(roll) * cos(pitch) + 0.01 * gauss();
+	s.sensors[2] = cos(roll) * cos(pitch) + 0.01 * gauss();
+	s.sensors[3] = 30.0 * cos(0.9 * t) + 0.5 * gauss();
+	s.sensors[4] = 12.0 * cos(0.5 * t) + 0.5 * gauss();
+	s.sensors[5] = 40.0 + 0.5 * gauss();
+	s.sensors[6] = 0.45 * cos(yaw) + 0.005 * gauss();
+	s.sensors[7] = -0.45 * sin(yaw) + 0.005 * gauss();
+	s.sensors[8] = 0.3 + 0.005 * gauss();
+	double alt = 120.0 + 2.0 * t + 0.1 * gauss();
+	s.slow[0] = 24.0 - 0.0065 * 2.0 * t + 0.02 * gauss();
+	s.slow[1] = 1013.25 * pow(1.0 - alt / 44330.0, 5.255) + 0.012 * gauss();
+	s.slow[2] = alt;
+}
+
+struct Errors {
+	double q;					// degrees
+	double sensors[9];
+	double slow[PACK_SLOW];
+
+	Errors() {
+		q = 0;
+		for(int i = 0; i < 9; i++) sensors[i] = 0;
+		for(int i = 0; i < PACK_SLOW; i++) slow[i] = 0;
+	}
+
+	void add(const PackSample &a, const PackSample &b) {
+		q = fmax(q, quatError(a.q, b.q));
+		for(int i = 0; i < 9; i++) sensors[i] = fmax(sensors[i], fabs(a.sensors[i] - b.sensors[i]));
+		for(int i = 0; i < PACK_SLOW; i++) slow[i] = fmax(slow[i], fabs(a.slow[i] - b.slow[i]));
+	}
+
+	// within half a step, with the rounding of a float
+	bool inScale(const PackScale &scale) const {
+		bool in = true;
+		for(int i = 0; i < 9; i++) in = in && sensors[i] <= 0.5 / scale.of(i) * 1.001;
+		for(int i = 0; i < PACK_SLOW; i++) in = in && slow[i] <= 0.5 / PACK_SLOW_SCALE + 1e-4;
+		return in;
+	}
+};
+
+struct Run {
+	uint8_t stream[FRAMES * (PACK_MAX_PAYLOAD + FRAME_OVERHEAD)];
+	size_t bytes, key_bytes, delta_bytes;
+	int keys;
+};
+
+static Run run;
+static PackSample sent[FRAMES];
+
+// the flight encoded, frames lost with the probability loss
+static void encodeFlight(uint8_t flags, double loss, bool * delivered) {
+	PackEncoder pack;
+	pack.flags = flags;
+	srand(7);
+	run.bytes = run.key_bytes = run.delta_bytes = 0;
+	run.keys = 0;
+	for(int k = 0; k < FRAMES; k++) {
+		uint8_t buf[PACK_MAX_PAYLOAD + FRAME_OVERHEAD];
+		FrameEncoder e(buf, sizeof(buf));
+		flight(k, sent[k]);
+		pack.encode(e, k, sent[k]);
+		uint8_t n = e.end();
+		if(buf[3] == FRAME_PACK_KEY) {
+			run.keys++;
+			run.key_bytes = n;
+		}
+		else run.delta_bytes = n;
+		delivered[k] = frand(0.0, 1.0) >= loss;
+		if(!delivered[k]) continue;
+		memcpy(run.stream + run.bytes, buf, n);
+		run.bytes += n;
+	}
+}
+
+int main() {
+	char line[100];
+
+	printf("quaternion\n");
+	{
+		double e32 = 0, e48 = 0;
+		bool same = true;
+		srand(1);
+		for(int k = 0; k < 100000; k++) {
+			float q[4], nq[4], r[4];
+			double n = 0;
+			for(int i = 0; i < 4; i++) {
+				q[i] = gauss();
+				n += q[i] * q[i];
+			}
+			for(int i = 0; i < 4; i++) {
+				q[i] /= sqrt(n);
+				nq[i] = -q[i];
+			}
+			unpackQuat(packQuat(q, 10), 10, r);
+			e32 = fmax(e32, quatError(q, r));
+			unpackQuat(packQuat(q, 15), 15, r);
+			e48 = fmax(e48, quatError(q, r));
+			same = same && packQuat(q, 10) == packQuat(nq, 10) && packQuat(q, 15) == packQuat(nq, 15);
+		}
+		snprintf(line, sizeof(line), "32 bits, error max %.3f deg", e32);
+		check(line, e32 < 0.25);
+		snprintf(line, sizeof(line), "48 bits, error max %.4f deg", e48);
+		check(line, e48 < 0.01);
+		check("q and -q the same", same);
+	}
+
+	printf("varint\n");
+	{
+		const int32_t v[] = {0, 1, -1, 63, -64, 64, -65, 8191, -8192, 8192, -8193, 1048575, -1048576,
+		                     1048576, 2147483647, -2147483647 - 1};
+		const uint8_t size[] = {1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 5, 5};
+		bool exact = true;
+		for(unsigned i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+			uint8_t buf[16];
+			FrameEncoder e(buf, sizeof(buf));
+			e.begin(FRAME_PACK, 0);
+			e.putVarint(v[i]);
+			uint8_t n = e.end() - FRAME_OVERHEAD;
+			FrameReader r(buf + FRAME_HEADER, n);
+			int32_t w = 0;
+			exact = exact && n == size[i] && r.varint(0, w) == n && w == v[i];
+			// cut short, the reader must not run past the payload
+			FrameReader s(buf + FRAME_HEADER, n - 1);
+			exact = exact && s.varint(0, w) == 0;
+		}
+		check("round trip, 1 byte to +-63, 5 bytes at most", exact);
+	}
+
+	static bool delivered[FRAMES];
+
+	for(uint8_t flags = 0; flags <= PACK_QUAT48; flags++) {
+		printf("flight, %d frames at %d Hz, %d bit quaternion\n", FRAMES, RATE, flags ? 48 : 32);
+		encodeFlight(flags, 0.0, delivered);
+		FrameDecoder d;
+		PackDecoder p;
+		Errors err;
+		int good = 0;
+		for(size_t i = 0; i < run.bytes; i++) {
+			if(!d.push(run.stream[i])) continue;
+			do {
+				PackSample s;
+				if(p.decode(d.type(), d.seq(), d.payload(), d.length(), s)) err.add(sent[good], s);
+				good++;
+			} while(d.next());
+		}
+		snprintf(line, sizeof(line), "%d frames decoded, %lu keyframes", good, (unsigned long) p.keyframes);
+		check(line, good == FRAMES && (int) p.keyframes == run.keys && p.stale == 0 && d.crc_errors == 0);
+		snprintf(line, sizeof(line), "quaternion error max %.4f deg", err.q);
+		check(line, err.q < (flags ? 0.01 : 0.25));
+		snprintf(line, sizeof(line), "acc %.1e gyro %.1e magn %.1e, half a step",
+		         fmax(fmax(err.sensors[0], err.sensors[1]), err.sensors[2]),
+		         fmax(fmax(err.sensors[3], err.sensors[4]), err.sensors[5]),
+		         fmax(fmax(err.sensors[6], err.sensors[7]), err.sensors[8]));
+		check(line, err.inScale(p.scale));
+		snprintf(line, sizeof(line), "temp %.4f C, press %.4f mbar, alt %.4f m",
+		         err.slow[0], err.slow[1], err.slow[2]);
+		check(line, err.inScale(p.scale));
+
+		// the same 16 values as floats, and the 'z' line of 19 floats in hex with their commas
+		size_t values = 16 * 4 + FRAME_OVERHEAD, zline = 19 * 9 + 1;
+		double avg = run.bytes / (double) FRAMES;
+		printf("  %-20s %8s %8s\n", "", "bytes", "Hz at 57600");
+		printf("  %-20s %8zu %8.1f\n", "'z' line", zline, BAUD / 10.0 / zline);
+		printf("  %-20s %8zu %8.1f\n", "FRAME_VALUES", values, BAUD / 10.0 / values);
+		printf("  %-20s %8zu\n", "FRAME_PACK_KEY", run.key_bytes);
+		printf("  %-20s %8zu\n", "FRAME_PACK", run.delta_bytes);
+		printf("  %-20s %8.1f %8.1f\n", "packed, average", avg, BAUD / 10.0 / avg);
+		snprintf(line, sizeof(line), "%.1f bytes a frame, %.0f%% of FRAME_VALUES", avg, 100.0 * avg / values);
+		check(line, run.delta_bytes <= (flags ? 38u : 36u) && avg < 0.55 * values);
+	}
+
+	printf("20%% of the frames lost\n");
+	{
+		encodeFlight(0, 0.2, delivered);
+		// the frames whose keyframe got through, by the sender
+		int expect = 0, expect_stale = 0, lost = 0, gaps = 0;
+		bool key_ok = false;
+		for(int k = 0; k < FRAMES; k++) {
+			if(k % PACK_KEYFRAME == 0) key_ok = delivered[k];
+			if(!delivered[k]) lost++;
+			else if(key_ok) expect++;
+			else expect_stale++;
+			// between the first and the last frame received, which the decoder sees
+			if(delivered[k]) gaps = lost;
+		}
+		for(int k = 0; k < FRAMES && !delivered[k]; k++) gaps--;
+		FrameDecoder d;
+		PackDecoder p;
+		Errors err;
+		int good = 0, wrong = 0, k = -1;
+		for(size_t i = 0; i < run.bytes; i++) {
+			if(!d.push(run.stream[i])) continue;
+			do {
+				// the next frame that got through
+				while(!delivered[++k]);
+				PackSample s;
+				if(!p.decode(d.type(), d.seq(), d.payload(), d.length(), s)) continue;
+				Errors e;
+				e.add(sent[k], s);
+				if(!e.inScale(p.scale) || e.q >= 0.25) wrong++;
+				err.add(sent[k], s);
+				good++;
+			} while(d.next());
+		}
+		snprintf(line, sizeof(line), "%d lost (%lu), %d decoded, %lu stale (expected %d, %d)", lost,
+		         (unsigned long) d.lost, good, (unsigned long) p.stale, expect, expect_stale);
+		check(line, good == expect && (int) p.stale == expect_stale && (int) d.lost == gaps);
+		snprintf(line, sizeof(line), "%d decoded wrong", wrong);
+		check(line, wrong == 0);
+	}
+
+	printf("saturation\n");
+	{
+		PackEncoder pack;
+		PackDecoder p;
+		PackSample s, r;
+		flight(0, s);
+		s.sensors[0] = 10.0f;		// g, beyond the +-4 of PACK_ACC_SCALE
+		s.sensors[3] = -5000.0f;	// deg/s
+		uint8_t buf[PACK_MAX_PAYLOAD + FRAME_OVERHEAD];
+		FrameEncoder e(buf, sizeof(buf));
+		pack.encode(e, 0, s);
+		uint8_t n = e.end();
+		bool got = p.decode(buf[3], buf[4], buf + FRAME_HEADER, n - FRAME_OVERHEAD, r);
+		snprintf(line, sizeof(line), "acc 10 -> %.3f, gyro -5000 -> %.1f", r.sensors[0], r.sensors[3]);
+		check(line, got && fabs(r.sensors[0] - 32767 / PACK_ACC_SCALE) < 1e-6 && fabs(r.sensors[3] + 32767 / PACK_GYRO_SCALE) < 1e-3);
+	}
+
+	printf("fitted scales\n");
+	{
+		// uncalibrated: acc and magn in raw counts, +-32768 and +-4096 with an offset
+		PackEncoder pack;
+		PackDecoder p;
+		PackSample s, r;
+		flight(0, s);
+		for(int i = 0; i < 3; i++) {
+			s.sensors[i] *= 16384.0f;
+			s.sensors[6 + i] = s.sensors[6 + i] * 500.0f + 120.0f;
+		}
+		pack.scale.fit(32768.0f + 400.0f, 2000.0f, 4096.0f + 120.0f);
+		uint8_t buf[PACK_MAX_PAYLOAD + FRAME_OVERHEAD];
+		FrameEncoder e(buf, sizeof(buf));
+		pack.encode(e, 0, s);
+		uint8_t n = e.end();
+		bool got = p.decode(buf[3], buf[4], buf + FRAME_HEADER, n - FRAME_OVERHEAD, r);
+		Errors err;
+		err.add(s, r);
+		snprintf(line, sizeof(line), "acc %.0f -> %.1f, magn %.0f -> %.2f", s.sensors[2], r.sensors[2], s.sensors[6],
+		         r.sensors[6]);
+		check(line, got && err.inScale(p.scale) && p.scale.acc == pack.scale.acc && p.scale.magn == pack.scale.magn);
+		// the same with the defaults
+		PackEncoder def;
+		FrameEncoder d(buf, sizeof(buf));
+		def.encode(d, 1, s);
+		n = d.end();
+		p.decode(buf[3], buf[4], buf + FRAME_HEADER, n - FRAME_OVERHEAD, r);
+		snprintf(line, sizeof(line), "default scales: acc -> %.1f, magn -> %.2f", r.sensors[2], r.sensors[6]);
+		check(line, fabs(r.sensors[2] - 32767 / PACK_ACC_SCALE) < 1e-3 && fabs(r.sensors[6] - 32767 / PACK_MAGN_SCALE) < 1e-3);
+		PackScale none;
+		none.fit(0.0f, NAN, INFINITY);
+		check("range 0, NaN, inf: default scales", none.acc == PACK_ACC_SCALE && none.gyro == PACK_GYRO_SCALE
+		      && none.magn == PACK_MAGN_SCALE);
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
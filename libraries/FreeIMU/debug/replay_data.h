@@ -0,0 +1,144 @@
+//=====================================================================================================
+// replay_data.h
+//=====================================================================================================
+//
+// Sample sources shared by the host harnesses in this directory: a synthetic trajectory with
+// known orientation and gyro bias, and recorded raw logs.
+//
+//=====================================================================================================
+
+#ifndef replay_data_h
+#define replay_data_h
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+
+// gyro bias of the synthetic data in deg/s
+#define SYNTH_BIAS_X	0.3f
+#define SYNTH_BIAS_Y	-0.2f
+#define SYNTH_BIAS_Z	0.1f
+
+struct Sample {
+	float val[10];		// FusionEngine layout, gyro in deg/s
+	float dt;
+	float truth[4];		// only for synthetic data
+};
+
+struct ErrorStats {
+	double sum2, max, last;
+	unsigned long n;
+
+	ErrorStats() : sum2(0), max(0), last(0), n(0) {}
+
+	void add(double deg) {
+		sum2 += deg * deg;
+		if(deg > max) max = deg;
+		last = deg;
+		n++;
+	}
+
+	double rms() const { return n ? sqrt(sum2 / n) : 0; }
+};
+
+static uint32_t rnd_state = 12345;
+
+static float noise(float amp) {
+	rnd_state = rnd_state * 1664525UL + 1013904223UL;
+	return amp * ((rnd_state >> 8) / 8388608.0f - 1.0f);
+}
+
+/**
+ * Smooth rotation about all three axes with a gyro bias and sensor noise.  Gravity
+ * and magnetic field are rotated into the sensor frame with the same convention
+ * as the filters.
+*/
+static inline void synthesize(std::vector<Sample> &out, float rate, float seconds) {
+	float q[4] = {1, 0, 0, 0};
+	const float dt = 1.0f / rate;
+	const float bx = 0.5f, bz = -0.85f;
+	const float d2r = M_PI / 180;
+
+	for(unsigned long i = 0; i < (unsigned long)(rate * seconds); i++) {
+		float t = i * dt;
+		float w[3] = {60 * sin(0.3f * t), 45 * sin(0.17f * t + 1), 90 * sin(0.11f * t + 2)};	// deg/s
+		Sample s;
+
+		// integrate the true orientation
+		float hx = 0.5f * dt * w[0] * d2r, hy = 0.5f * dt * w[1] * d2r, hz = 0.5f * dt * w[2] * d2r;
+		float n0 = q[0] - q[1] * hx - q[2] * hy - q[3] * hz;
+		float n1 = q[1] + q[0] * hx + q[2] * hz - q[3] * hy;
+		float n2 = q[2] + q[0] * hy - q[1] * hz + q[3] * hx;
+		float n3 = q[3] + q[0] * hz + q[1] * hy - q[2] * hx;
+		float r = 1.0f / sqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+		q[0] = n0 * r; q[1] = n1 * r; q[2] = n2 * r; q[3] = n3 * r;
+
+		float q0q0 = q[0]*q[0], q0q1 = q[0]*q[1], q0q2 = q[0]*q[2], q0q3 = q[0]*q[3];
+		float q1q1 = q[1]*q[1], q1q2 = q[1]*q[2], q1q3 = q[1]*q[3];
+		float q2q2 = q[2]*q[2], q2q3 = q[2]*q[3], q3q3 = q[3]*q[3];
+
+		s.val[0] = 2 * (q1q3 - q0q2) + noise(0.01f);
+		s.val[1] = 2 * (q0q1 + q2q3) + noise(0.01f);
+		s.val[2] = q0q0 - q1q1 - q2q2 + q3q3 + noise(0.01f);
+		s.val[3] = w[0] + SYNTH_BIAS_X + noise(0.2f);
+		s.val[4] = w[1] + SYNTH_BIAS_Y + noise(0.2f);
+		s.val[5] = w[2] + SYNTH_BIAS_Z + noise(0.2f);
+		s.val[6] = 2 * bx * (0.5f - q2q2 - q3q3) + 2 * bz * (q1q3 - q0q2) + noise(0.01f);
+		s.val[7] = 2 * bx * (q1q2 - q0q3) + 2 * bz * (q0q1 + q2q3) + noise(0.01f);
+		s.val[8] = 2 * bx * (q0q2 + q1q3) + 2 * bz * (0.5f - q1q1 - q2q2) + noise(0.01f);
+		s.val[9] = 0;
+		s.dt = dt;
+		memcpy(s.truth, q, sizeof(q));
+		out.push_back(s);
+	}
+}
+
+static bool load(const char * path, float gyro_lsb, std::vector<Sample> &out) {
+	FILE * f = fopen(path, "r");
+	char line[512];
+	double last_t = -1;
+	float dt = 0.01f;
+
+	if(f == NULL) return false;
+	if(fgets(line, sizeof(line), f) == NULL) { fclose(f); return false; }	// header
+
+	while(fgets(line, sizeof(line), f) != NULL) {
+		double col[32];
+		int n = 0;
+		char * p = line;
+		while(n < 32) {
+			char * end;
+			col[n] = strtod(p, &end);
+			if(end == p) break;
+			n++;
+			p = end;
+			while(*p == ',' || *p == ' ' || *p == '\t') p++;
+		}
+		if(n < 10) continue;
+
+		Sample s;
+		for(int i = 0; i < 3; i++) {
+			s.val[i] = col[i];
+			s.val[3 + i] = col[3 + i] / gyro_lsb;
+			s.val[6 + i] = col[6 + i];
+		}
+		s.val[9] = 0;
+		// logging pauses are not motion, replace them with the previous step
+		double t = col[n - 1] / 1000.0;
+		if(last_t < 0 || t <= last_t || t - last_t > 10 * dt) {
+			s.dt = dt;
+		} else {
+			s.dt = dt = (float)(t - last_t);
+		}
+		last_t = t;
+		memset(s.truth, 0, sizeof(s.truth));
+		out.push_back(s);
+	}
+	fclose(f);
+	return true;
+}
+
+#endif // replay_data_h
@@ -0,0 +1,206 @@
+//=====================================================================================================
+// scheduler_sim.cpp
+//=====================================================================================================
+//
+// LoopScheduler (LoopScheduler.h) on a simulated microsecond clock, with the tasks of the
+// FreeIMU_serial sketches modelled by the time they take:
+//
+//   FUSION_COST    getQ
+//   TELEM_COST     one 'z' line of 18 floats in hex, on a USB serial port
+//   GPS_COST       parsing what the GPS sent since the last run
+//   CMD_COST       looking for a command
+//
+// The loop the sketches had before, getQ, the line and smartDelay(20) one after the other while
+// streaming, is modelled the same way.  Checks the fusion rate of both while streaming, that
+// missed releases are counted and skipped rather than run in a burst, that a task keeps its
+// phase after a stall, that background tasks only fill the slack, the run time statistics
+// against the modelled costs, and the scheduler across the wraparound of micros.
+//
+// A line written to a 57600 baud port blocks in Serial.print for most of 30ms: the scheduler
+// cannot split a task, fusion then misses the releases the line covers (see the stall test).
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -o scheduler_sim scheduler_sim.cpp
+//   ./scheduler_sim          exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "LoopScheduler.h"
+
+#define FUSION_PERIOD	2500
+#define TELEM_PERIOD	20000
+#define FUSION_COST		1200
+#define TELEM_COST		1000
+#define GPS_COST		150
+#define CMD_COST		40
+#define SMART_DELAY		20000
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+static uint32_t now_us;
+static uint32_t simClock() { return now_us; }
+
+// the tasks, each takes its time off the clock
+static bool streaming;
+static uint32_t stall_us;				// added once to the next telemetry run
+static uint32_t fusion_jitter;			// fusion takes FUSION_COST + 0..fusion_jitter
+static uint32_t fusion_time_max, fusion_time_sum;
+static uint32_t phase_err_max;			// largest distance of a fusion start from its grid
+static uint32_t grid0;
+static bool background_late;			// a background task ran while a periodic one was due
+static uint32_t fusion_next, telem_next;
+
+static void fusionTask() {
+	uint32_t off = (now_us - grid0) % FUSION_PERIOD;
+	if(off > phase_err_max) phase_err_max = off;
+	uint32_t t = FUSION_COST + (fusion_jitter ? rand() % (fusion_jitter + 1) : 0);
+	if(t > fusion_time_max) fusion_time_max = t;
+	fusion_time_sum += t;
+	fusion_next = grid0 + ((now_us - grid0) / FUSION_PERIOD + 1) * FUSION_PERIOD;
+	now_us += t;
+}
+
+static void telemetryTask() {
+	telem_next = now_us - (now_us - grid0) % TELEM_PERIOD + TELEM_PERIOD;
+	if(streaming) now_us += TELEM_COST;
+	now_us += stall_us;
+	stall_us = 0;
+}
+
+static void backgroundCheck() {
+	if((int32_t)(now_us - fusion_next) >= 0 || (int32_t)(now_us - telem_next) >= 0) background_late = true;
+}
+
+static void gpsTask() {
+	backgroundCheck();
+	now_us += GPS_COST;
+}
+
+static void commandTask() {
+	backgroundCheck();
+	now_us += CMD_COST;
+}
+
+struct Sketch {
+	LoopScheduler<4> sched;
+	int8_t fusion, telemetry, gps, command;
+
+	Sketch(uint32_t start) : sched(simClock) {
+		now_us = grid0 = start;
+		fusion_next = telem_next = start;
+		streaming = false;
+		stall_us = fusion_jitter = fusion_time_max = fusion_time_sum = phase_err_max = 0;
+		background_late = false;
+		fusion = sched.add(fusionTask, FUSION_PERIOD, "fusion");
+		telemetry = sched.add(telemetryTask, TELEM_PERIOD, "telemetry");
+		gps = sched.add(gpsTask, 0, "gps");
+		command = sched.add(commandTask, 0, "command");
+	}
+
+	void run(uint32_t us) {
+		uint32_t t0 = now_us;
+		while(now_us - t0 < us) sched.run();
+	}
+
+	const TaskStats & stats(int8_t i) { return sched.stats(i); }
+};
+
+int main() {
+	char line[100];
+
+	printf("streaming 'z' for 1s\n");
+	{
+		// the old loop: getQ, the line, smartDelay(20)
+		uint32_t t = 0, fusions = 0;
+		while(t < 1000000) {
+			t += FUSION_COST + TELEM_COST + SMART_DELAY;
+			fusions++;
+		}
+		Sketch s(0);
+		streaming = true;
+		s.run(1000000);
+		const TaskStats &f = s.stats(s.fusion);
+		const TaskStats &tl = s.stats(s.telemetry);
+		snprintf(line, sizeof(line), "fusion %lu Hz, inline loop %lu Hz", (unsigned long) f.runs, (unsigned long) fusions);
+		check(line, f.runs >= 5 * fusions);
+		snprintf(line, sizeof(line), "telemetry %lu lines, %lu releases missed",
+		         (unsigned long) tl.runs, (unsigned long) tl.misses);
+		check(line, tl.runs >= 1000000 / TELEM_PERIOD && tl.misses == 0);
+		// every release up to now either ran or was counted as missed
+		uint32_t releases = (now_us - grid0 + FUSION_PERIOD - 1) / FUSION_PERIOD;
+		snprintf(line, sizeof(line), "fusion runs + misses %lu of %lu releases",
+		         (unsigned long)(f.runs + f.misses), (unsigned long) releases);
+		check(line, f.runs + f.misses <= releases && f.runs + f.misses >= releases - 1);
+		snprintf(line, sizeof(line), "fusion late max %luus, at most one line", (unsigned long) f.late_max);
+		check(line, f.late_max <= TELEM_COST + GPS_COST && f.misses == 0);
+	}
+
+	printf("idle for 1s\n");
+	{
+		Sketch s(0);
+		fusion_jitter = 600;
+		s.run(1000000);
+		const TaskStats &f = s.stats(s.fusion);
+		snprintf(line, sizeof(line), "fusion %lu Hz, no misses", (unsigned long) f.runs);
+		check(line, f.runs >= 1000000 / FUSION_PERIOD && f.misses == 0);
+		snprintf(line, sizeof(line), "fusion late max %luus, one background task", (unsigned long) f.late_max);
+		check(line, f.late_max <= GPS_COST);
+		check("background tasks only when no task is due", !background_late);
+		const TaskStats &g = s.stats(s.gps);
+		const TaskStats &c = s.stats(s.command);
+		snprintf(line, sizeof(line), "gps %lu and command %lu runs take turns", (unsigned long) g.runs, (unsigned long) c.runs);
+		check(line, g.runs > 1000 && (g.runs > c.runs ? g.runs - c.runs : c.runs - g.runs) <= 1);
+		snprintf(line, sizeof(line), "fusion time max %lu avg %lu us (modelled %lu, %lu)",
+		         (unsigned long) f.time_max, (unsigned long) f.time_avg(),
+		         (unsigned long) fusion_time_max, (unsigned long)(fusion_time_sum / f.runs));
+		check(line, f.time_max == fusion_time_max && f.time_last >= FUSION_COST
+		      && abs((int)(f.time_avg() - fusion_time_sum / f.runs)) <= 30);
+		check("gps time max and avg", g.time_max == GPS_COST && g.time_avg() == GPS_COST);
+		s.sched.clearStats();
+		check("cleared", s.stats(s.fusion).runs == 0 && s.stats(s.fusion).time_max == 0);
+	}
+
+	printf("telemetry stalls for 12ms once\n");
+	{
+		Sketch s(0);
+		s.run(100000);
+		stall_us = 12000;
+		s.run(100000);
+		const TaskStats &f = s.stats(s.fusion);
+		// released every 2.5ms, the stall hides four releases and delays a fifth
+		snprintf(line, sizeof(line), "fusion missed %lu releases, late max %luus",
+		         (unsigned long) f.misses, (unsigned long) f.late_max);
+		check(line, f.misses == 4 && f.late_max >= 10000 && f.late_max < 12000 + GPS_COST);
+		snprintf(line, sizeof(line), "fusion %lu runs in 200ms, no burst", (unsigned long) f.runs);
+		check(line, f.runs + f.misses >= 200000 / FUSION_PERIOD && f.runs + f.misses <= 200000 / FUSION_PERIOD + 1);
+		phase_err_max = 0;
+		s.run(100000);
+		snprintf(line, sizeof(line), "phase kept, starts within %luus of the grid", (unsigned long) phase_err_max);
+		check(line, phase_err_max <= GPS_COST);
+	}
+
+	printf("micros wraps around after 50ms\n");
+	{
+		Sketch s(0xFFFFFFFFu - 50000);
+		streaming = true;
+		s.run(1000000);
+		const TaskStats &f = s.stats(s.fusion);
+		uint32_t releases = (now_us - grid0 + FUSION_PERIOD - 1) / FUSION_PERIOD;
+		snprintf(line, sizeof(line), "fusion runs + misses %lu of %lu releases",
+		         (unsigned long)(f.runs + f.misses), (unsigned long) releases);
+		check(line, now_us < grid0 && f.runs + f.misses <= releases && f.runs + f.misses >= releases - 1);
+		snprintf(line, sizeof(line), "fusion late max %luus", (unsigned long) f.late_max);
+		check(line, f.late_max <= TELEM_COST + GPS_COST);
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
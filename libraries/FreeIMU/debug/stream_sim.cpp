@@ -0,0 +1,314 @@
+//=====================================================================================================
+// stream_sim.cpp
+//=====================================================================================================
+//
+// The push streaming subscription of the FreeIMU_serial sketches (TelemetryStream.h) on a
+// simulated microsecond clock: LoopScheduler with the fusion, telemetry, stream and command
+// tasks of the sketches, the frames CommunicationUtils writes to Serial taking the time of their
+// bytes at BAUD, and a host that decodes them as they arrive.  Checks
+//
+//   subscription   one 's' gives rate frames a second in consecutive sequence numbers, its
+//                  answer and a FRAME_STATUS every second
+//   stall          ticks the loop was late for are counted as dropped, in the status frame and
+//                  as the misses of the task, and do not show as lost frames
+//   stop           an 's' with rate 0 is answered and ends the frames
+//   packed         with STREAM_PACKED the status frames carry the scales of the packed frames,
+//                  without it they do not
+//   polled         the same frames polled with 'Z' and a count of 64, the host sending the next
+//                  command HOST_RTT after the last frame of a burst: fewer frames, a gap per
+//                  burst and a command per burst, where the subscription needs one
+//
+// Build and run on a PC:
+//   make stream_sim
+//   ./stream_sim             exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include <new>
+
+#include "CommunicationUtils.h"
+#include "LoopScheduler.h"
+
+#define FUSION_PERIOD	2500
+#define TELEM_PERIOD	5000		// FreeIMU_serial_ARM_CPU
+#define FUSION_COST		1200
+#define CMD_COST		40			// looking for a command
+#define BAUD			921600.0
+#define HOST_RTT		20000		// USB latency timer and host, from the last frame to the next command
+#define VALUES			19
+#define RATE			200
+#define FIELDS			(STREAM_QUAT | STREAM_ANGLES | STREAM_VALUES)
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+static uint32_t now_us;
+static uint32_t simClock() { return now_us; }
+static uint32_t clock_us() { return now_us; }
+
+// Serial, captured while a test runs
+static FILE * saved;
+static char * cap_p;
+static size_t cap_n, cap_read;
+
+static void captureStart() {
+	fflush(stdout);
+	saved = stdout;
+	stdout = open_memstream(&cap_p, &cap_n);
+	cap_read = 0;
+}
+
+static void captureEnd() {
+	fclose(stdout);
+	stdout = saved;
+	free(cap_p);
+}
+
+// the time the bytes written since sent take at BAUD, 8N1
+static void wire(size_t before) {
+	fflush(stdout);
+	now_us += (uint32_t)((cap_n - before) * 10 * 1000000.0 / BAUD);
+}
+
+// the sketch
+static LoopScheduler<4> * sched;
+static int8_t fusion_task, telemetry_task, subscription_task, command_task;
+static TelemetryStream subscription;
+static char stream_cmd;
+static uint8_t stream_count;
+static float q[4] = {1, 0, 0, 0};
+static float ypr[3] = {10, -20, 30};
+static float val_array[VALUES];
+static PackScale pack_scale;
+static uint32_t stall_us;			// added once to the next fusion run
+
+static void fusionTask() {
+	now_us += FUSION_COST + stall_us;
+	stall_us = 0;
+}
+
+static void telemetryTask() {
+	if(stream_count == 0) return;
+	size_t before = cap_n;
+	serialFrameFloatArr(FRAME_VALUES, val_array, VALUES);
+	stream_count--;
+	wire(before);
+}
+
+static void streamTask() {
+	size_t before = cap_n;
+	if(subscription.tick(sched->missed(), clock_us())) serialFrameStatus(subscription, &pack_scale);
+	if(subscription.fields & STREAM_QUAT) serialFrameQuat16(q);
+	if(subscription.fields & STREAM_ANGLES) serialFrameAngles16(ypr);
+	if(subscription.fields & STREAM_VALUES) serialFrameFloatArr(FRAME_VALUES, val_array, VALUES);
+	wire(before);
+}
+
+// the command the host sent, arrived at cmd_at
+static char cmd;
+static uint16_t cmd_rate;
+static uint8_t cmd_fields;
+static uint32_t cmd_at, commands;
+
+static void commandTask() {
+	now_us += CMD_COST;
+	if(!cmd || (int32_t)(now_us - cmd_at) < 0) return;
+	size_t before = cap_n;
+	if(cmd == 's') {
+		if(subscription.set(cmd_rate, cmd_fields, clock_us())) sched->setPeriod(subscription_task, subscription.period());
+		sched->enable(subscription_task, subscription.rate != 0);
+		serialFrameStatus(subscription, &pack_scale);
+	}
+	else {
+		stream_cmd = cmd;
+		stream_count = 64;
+	}
+	cmd = 0;
+	wire(before);
+}
+
+// the host
+static FrameDecoder host;
+static uint8_t tick_type;			// the frame counted as a tick
+static uint32_t tick_frames, tick_last, gap_max;
+static uint32_t status_frames;
+static uint16_t status_rate;
+static uint8_t status_fields;
+static uint32_t status_ticks, status_dropped;
+static uint8_t status_length;
+static PackScale status_scale;
+
+static void send(char c, uint16_t rate, uint8_t fields, uint32_t delay) {
+	cmd = c;
+	cmd_rate = rate;
+	cmd_fields = fields;
+	cmd_at = now_us + delay;
+	commands++;
+}
+
+static void hostFrame() {
+	FrameReader r(host.payload(), host.length());
+	if(host.type() == FRAME_STATUS) {
+		status_frames++;
+		status_rate = r.u16(0);
+		status_fields = r.u8(2);
+		status_ticks = r.u32(3);
+		status_dropped = r.u32(7);
+		status_length = host.length();
+		if(status_length >= 23) {
+			status_scale.acc = r.float32(11);
+			status_scale.gyro = r.float32(15);
+			status_scale.magn = r.float32(19);
+		}
+	}
+	if(host.type() != tick_type) return;
+	if(tick_frames > 0 && now_us - tick_last > gap_max) gap_max = now_us - tick_last;
+	tick_last = now_us;
+	tick_frames++;
+	// polling, the next burst once this one is in
+	if(stream_cmd == 'Z' && tick_frames % 64 == 0) send('Z', 0, 0, HOST_RTT);
+}
+
+static void hostRead() {
+	fflush(stdout);
+	for(; cap_read < cap_n; cap_read++) {
+		if(!host.push(cap_p[cap_read])) continue;
+		do hostFrame(); while(host.next());
+	}
+}
+
+static void hostClear(uint8_t type) {
+	tick_type = type;
+	tick_frames = gap_max = status_frames = commands = 0;
+}
+
+static void run(uint32_t us) {
+	uint32_t t0 = now_us;
+	while(now_us - t0 < us) {
+		sched->run();
+		hostRead();
+	}
+}
+
+static void sketch() {
+	static uint8_t mem[sizeof(LoopScheduler<4>)];
+	now_us = 0;
+	sched = new(mem) LoopScheduler<4>(simClock);
+	fusion_task = sched->add(fusionTask, FUSION_PERIOD, "fusion");
+	telemetry_task = sched->add(telemetryTask, TELEM_PERIOD, "telemetry");
+	subscription_task = sched->add(streamTask, TELEM_PERIOD, "stream");
+	sched->enable(subscription_task, false);
+	command_task = sched->add(commandTask, 0, "command");
+	subscription.set(0, 0, 0);
+	stream_cmd = cmd = 0;
+	stream_count = 0;
+	stall_us = 0;
+	for(int i = 0; i < VALUES; i++) val_array[i] = i * 1.5f;
+	pack_scale.fit(2.1f, 2010.0f, 8.3f);
+	status_length = 0;
+	host.reset();
+	hostClear(FRAME_QUAT16);
+}
+
+int main() {
+	char line[100];
+	uint32_t push_frames, push_gap;
+
+	printf("subscription at %d Hz for 3s\n", RATE);
+	{
+		sketch();
+		captureStart();
+		send('s', RATE, FIELDS, 0);
+		run(3000000);
+		uint32_t st = status_frames, sr = status_rate, sf = status_fields;
+		captureEnd();
+		push_frames = tick_frames;
+		push_gap = gap_max;
+		snprintf(line, sizeof(line), "%lu quaternion frames, ticks %lu", (unsigned long) tick_frames,
+		         (unsigned long) subscription.ticks);
+		check(line, tick_frames == subscription.ticks && tick_frames >= 3 * RATE - 1 && tick_frames <= 3 * RATE + 1);
+		snprintf(line, sizeof(line), "%lu frames, none damaged or lost", (unsigned long) host.frames);
+		check(line, host.crc_errors == 0 && host.skipped == 0 && host.lost == 0);
+		snprintf(line, sizeof(line), "%lu status frames, rate %lu fields 0x%02lx", (unsigned long) st,
+		         (unsigned long) sr, (unsigned long) sf);
+		check(line, st >= 3 && st <= 4 && sr == RATE && sf == FIELDS);
+		snprintf(line, sizeof(line), "gap max %luus, period %dus", (unsigned long) gap_max, 1000000 / RATE);
+		check(line, gap_max <= 1000000 / RATE + FUSION_COST + 500);
+		check("one command", commands == 1 && subscription.dropped == 0);
+	}
+
+	printf("fusion stalls 50ms once\n");
+	{
+		sketch();
+		captureStart();
+		send('s', RATE, FIELDS, 0);
+		run(500000);
+		stall_us = 50000;
+		run(1000000);
+		const TaskStats &s = sched->stats(subscription_task);
+		captureEnd();
+		// released every 5ms, the stall hides nine releases and delays a tenth
+		snprintf(line, sizeof(line), "%lu ticks dropped, %lu misses of the task", (unsigned long) subscription.dropped,
+		         (unsigned long) s.misses);
+		check(line, subscription.dropped == s.misses && subscription.dropped >= 9 && subscription.dropped <= 10);
+		snprintf(line, sizeof(line), "status frame ticks %lu dropped %lu", (unsigned long) status_ticks,
+		         (unsigned long) status_dropped);
+		check(line, status_dropped == subscription.dropped && status_ticks <= subscription.ticks);
+		check("no frame lost, the sequence numbers go on", host.lost == 0 && host.crc_errors == 0);
+	}
+
+	printf("stop\n");
+	{
+		sketch();
+		captureStart();
+		send('s', RATE, FIELDS, 0);
+		run(100000);
+		send('s', 0, FIELDS, 0);
+		run(10000);
+		uint32_t sr = status_rate;
+		hostClear(FRAME_QUAT16);
+		run(1000000);
+		captureEnd();
+		snprintf(line, sizeof(line), "answered with rate %lu, %lu frames after", (unsigned long) sr, (unsigned long) tick_frames);
+		check(line, sr == 0 && tick_frames == 0 && status_frames == 0);
+	}
+
+	printf("packed\n");
+	{
+		sketch();
+		captureStart();
+		send('s', RATE, FIELDS, 0);
+		run(10000);
+		uint8_t plain = status_length;
+		send('s', RATE, FIELDS | STREAM_PACKED, 0);
+		run(10000);
+		captureEnd();
+		snprintf(line, sizeof(line), "status %u bytes, packed %u, scales %g %g %g", plain, status_length,
+		         status_scale.acc, status_scale.gyro, status_scale.magn);
+		check(line, plain == 11 && status_length == 23 && status_scale.acc == pack_scale.acc
+		      && status_scale.gyro == pack_scale.gyro && status_scale.magn == pack_scale.magn);
+	}
+
+	printf("polled 'Z' with a count of 64 for 3s\n");
+	{
+		sketch();
+		hostClear(FRAME_VALUES);
+		captureStart();
+		send('Z', 0, 0, 0);
+		run(3000000);
+		captureEnd();
+		snprintf(line, sizeof(line), "%lu frames, subscription %lu", (unsigned long) tick_frames, (unsigned long) push_frames);
+		check(line, tick_frames < push_frames);
+		snprintf(line, sizeof(line), "gap max %luus, subscription %luus", (unsigned long) gap_max, (unsigned long) push_gap);
+		check(line, gap_max >= HOST_RTT && push_gap < gap_max);
+		snprintf(line, sizeof(line), "%lu commands, subscription 1", (unsigned long) commands);
+		check(line, commands >= 3000000 / (64 * TELEM_PERIOD + HOST_RTT));
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
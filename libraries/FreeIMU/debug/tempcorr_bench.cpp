@@ -0,0 +1,110 @@
+//=====================================================================================================
+// tempcorr_bench.cpp
+//=====================================================================================================
+//
+// Host accuracy and cost check of the temperature correction table (TempCorrLUT.h) against the
+// c3..c0 cubics it replaces, with the FREEIMU_v04 coefficients of FreeIMU.cpp over the range
+// FreeIMU builds the table for (TEMP_CORR_MIN..temp_break, raw MPU60X0 temperature).  For every
+// table size the largest error over the range, per axis group, must stay within the
+// interpolation bound |f''| h^2 / 8 of the worst axis; the RAM the table takes is printed with it.
+// The cost per sample is timed on a slowly drifting noisy temperature, as getValues sees it.
+//
+// Build and run on a PC:
+//   g++ -O2 -I.. -o tempcorr_bench tempcorr_bench.cpp
+//   ./tempcorr_bench        exits with 1 if a bound is exceeded
+//
+//=====================================================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "TempCorrLUT.h"
+
+#define X0		-12420.0f	// TEMP_CORR_MIN, 0 degC on the MPU-6050
+#define X1		-1000.0f	// temp_break
+#define SAMPLES	4000000
+
+// FREEIMU_v04 (MPU-6050) coefficients from FreeIMU.cpp
+static const float c3[9] = {           0.,            0., -1.618180e-09,            0.,          0.,          0.,     0., 0.,  0.};
+static const float c2[9] = {4.798083e-07 ,-7.104300e-08 , -1.899410e-05, -4.387634e-08, -1.779335e-08,  4.216745e-09, 0., 0., 0. };
+static const float c1[9] = {1.801522e-02 ,-5.200081e-03 , -1.462879e-01, -5.878346e-04,  1.172002e-03, -6.897733e-05, 0., 0., 0. };
+static const float c0[9] = {      -45.61 ,	     -45.24,       -305.58,  6.699801e+00,  8.341212e+00,	-2.171155e+01, 0., 0., 0. };
+
+static volatile float sink;
+static int16_t temps[SAMPLES];
+
+static double cubic(int i, double x) {
+	return ((c3[i]*x + c2[i])*x + c1[i])*x + c0[i];
+}
+
+// max |f''| of any axis over x0..x1, f'' = 6 c3 x + 2 c2 is linear so an end is the max
+static double maxSecond() {
+	double m = 0;
+	for(int i = 0; i < 9; i++) {
+		m = fmax(m, fabs(6.0 * c3[i] * X0 + 2.0 * c2[i]));
+		m = fmax(m, fabs(6.0 * c3[i] * X1 + 2.0 * c2[i]));
+	}
+	return m;
+}
+
+static double timePoly() {
+	float corr[9];
+	clock_t t0 = clock();
+	for(int n = 0; n < SAMPLES; n++) {
+		float t = temps[n];
+		for(int i = 0; i < 9; i++) corr[i] = ((c3[i]*t + c2[i])*t + c1[i])*t + c0[i];
+		sink = corr[n % 9];
+	}
+	return (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / SAMPLES;
+}
+
+template <uint8_t NODES>
+static bool run() {
+	static TempCorrLUT<9, NODES> lut;
+	lut.build(c3, c2, c1, c0, X0, X1);
+	double err_acc = 0, err_gyro = 0;
+	float corr[9];
+	for(int32_t x = (int32_t) X0; x <= (int32_t) X1; x++) {
+		lut.at(x, corr);
+		for(int i = 0; i < 6; i++) {
+			double e = fabs(corr[i] - cubic(i, x));
+			if(i < 3) err_acc = fmax(err_acc, e);
+			else err_gyro = fmax(err_gyro, e);
+		}
+	}
+	double h = (X1 - X0) / (NODES - 1);
+	// plus float rounding of the values around 300 LSB
+	double bound = maxSecond() * h * h / 8 + 1e-3;
+
+	clock_t t0 = clock();
+	for(int n = 0; n < SAMPLES; n++) {
+		lut.at(temps[n], corr);
+		sink = corr[n % 9];
+	}
+	double ns = (double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / SAMPLES;
+
+	bool pass = err_acc <= bound && err_gyro <= bound;
+	printf("  %5d %7u %14.3f %14.4f %10.3f %10.2f  %s\n", NODES, (unsigned) sizeof(lut),
+	       err_acc, err_gyro, bound, ns, pass ? "ok" : "EXCEEDED");
+	return pass;
+}
+
+int main() {
+	// a drift of 20 degC over the run with +-2 LSB of noise
+	srand(1);
+	for(int n = 0; n < SAMPLES; n++) {
+		float drift = X0 + 340.0f * 20.0f * n / SAMPLES;
+		temps[n] = (int16_t)(drift + rand() % 5 - 2);
+	}
+	printf("temperature correction table, %.0f..%.0f raw\n", X0, X1);
+	printf("  %5s %7s %14s %14s %10s %10s\n", "nodes", "bytes", "accel err LSB", "gyro err LSB", "bound", "ns/sample");
+	bool ok = true;
+	ok &= run<9>();
+	ok &= run<17>();
+	ok &= run<33>();
+	ok &= run<65>();
+	printf("  cubics %42s %10.2f\n", "", timePoly());
+	return ok ? 0 : 1;
+}
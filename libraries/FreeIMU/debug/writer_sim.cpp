@@ -0,0 +1,332 @@
+//=====================================================================================================
+// writer_sim.cpp
+//=====================================================================================================
+//
+// TelemetryWriter (TelemetryWriter.h) against the blocking Serial.write, on a simulated
+// microsecond clock: the fusion, stream and writer tasks of FreeIMU_serial_ARM_CPU on a
+// LoopScheduler, a UART with the 64 byte transmit buffer of HardwareSerial draining at its baud
+// rate, and a host decoding what comes out of it.  The stream sends a 'Q' and a 'Z' frame a tick.
+//
+//   overload     100 ticks a second at 57600 baud, 1.7 times what the port carries: blocking,
+//                fusion waits behind the port; with the writer it keeps its rate, dropping the
+//                oldest frames or decimating whole ticks, every drop counted and seen by the host
+//                as lost
+//   stall        the port takes nothing for 200ms (the host stops reading): the writer reports
+//                the stall, fusion does not see it
+//   capacity     100 ticks a second at 921600 baud: nothing dropped or skipped
+//   text         a text line to the port directly every TEXT_PERIOD, as the command replies and
+//                text streams of the sketches: after finish() the host finds every frame whole
+//                and the text between them, without it text lands inside frames
+//
+// Build and run on a PC:
+//   make writer_sim
+//   ./writer_sim             exits with 1 if a check fails, make check runs it
+//
+//=====================================================================================================
+
+#include "CommunicationUtils.h"
+#include "LoopScheduler.h"
+
+#include <new>
+
+#define FUSION_PERIOD	2500
+#define FUSION_COST		1200
+#define FRAME_COST		100			// building the frames of a tick
+#define WRITER_COST		20			// a flush
+#define UART_BUFFER		64			// SERIAL_TX_BUFFER_SIZE
+#define WRITER_SIZE		1024
+#define VALUES			19
+#define TEXT_PERIOD		20000
+
+static bool ok = true;
+
+static void check(const char * what, bool pass) {
+	printf("  %-60s %s\n", what, pass ? "ok" : "FAILED");
+	ok = ok && pass;
+}
+
+static uint32_t now_us;
+static uint32_t simClock() { return now_us; }
+
+// the host: decodes what leaves the UART, counts the ticks that arrive whole
+static FrameDecoder host;
+static uint32_t ticks_whole, ticks_broken;
+static bool quat_waiting;
+static uint8_t quat_seq;
+
+static void hostByte(uint8_t c) {
+	if(!host.push(c)) return;
+	do {
+		if(host.type() == FRAME_QUAT16) {
+			if(quat_waiting) ticks_broken++;
+			quat_waiting = true;
+			quat_seq = host.seq();
+		}
+		else if(host.type() == FRAME_VALUES) {
+			if(quat_waiting && host.seq() == (uint8_t)(quat_seq + 1)) ticks_whole++;
+			else ticks_broken++;
+			quat_waiting = false;
+		}
+	} while(host.next());
+}
+
+// UART transmit buffer draining at baud, 8N1
+struct Uart {
+	double baud;
+	uint8_t fifo[UART_BUFFER];
+	uint8_t head, fill;
+	uint32_t t;					// time drained up to
+	double credit;				// bytes of wire time not used yet
+	uint32_t paused_until;		// nothing leaves before
+
+	void reset(double b) {
+		baud = b;
+		head = fill = 0;
+		t = now_us;
+		credit = 0;
+		paused_until = 0;
+	}
+
+	void update() {
+		if((int32_t)(now_us - paused_until) < 0) {
+			t = now_us;
+			return;
+		}
+		credit += (now_us - t) * baud / 10.0 / 1e6;
+		t = now_us;
+		while(fill > 0 && credit >= 1.0) {
+			hostByte(fifo[head]);
+			head = (head + 1) % UART_BUFFER;
+			fill--;
+			credit -= 1.0;
+		}
+		if(fill == 0) credit = 0;
+	}
+
+	int availableForWrite() {
+		update();
+		return UART_BUFFER - fill;
+	}
+
+	size_t write(const uint8_t * buf, size_t n) {
+		for(size_t i = 0; i < n && fill < UART_BUFFER; i++) fifo[(head + fill++) % UART_BUFFER] = buf[i];
+		return n;
+	}
+
+	// Serial.write: waits for room
+	void writeBlocking(const uint8_t * buf, size_t n) {
+		for(size_t i = 0; i < n; i++) {
+			while(availableForWrite() == 0) now_us++;
+			write(buf + i, 1);
+		}
+	}
+};
+
+static Uart uart;
+
+// the sketch
+static LoopScheduler<4> * sched;
+static int8_t fusion_task, stream_task, writer_task, text_task;
+static uint8_t writer_buf[WRITER_SIZE];
+static TelemetryWriter writer(writer_buf, sizeof(writer_buf));
+static bool blocking;
+static uint32_t ticks;
+static float q[4] = {1, 0, 0, 0};
+static float val_array[VALUES];
+
+// Serial of the host core, captured and sent through the UART by writeBlocking
+static char * cap_p;
+static size_t cap_n, cap_sent;
+
+static void fusionTask() {
+	now_us += FUSION_COST;
+}
+
+static void streamTask() {
+	if(!writer.admit()) return;
+	ticks++;
+	now_us += FRAME_COST;
+	serialFrameQuat16(q);
+	serialFrameFloatArr(FRAME_VALUES, val_array, VALUES);
+	if(blocking) {
+		fflush(stdout);
+		uart.writeBlocking((uint8_t *) cap_p + cap_sent, cap_n - cap_sent);
+		cap_sent = cap_n;
+	}
+}
+
+static void writerTask() {
+	writer.flush(uart, now_us);
+	now_us += WRITER_COST;
+}
+
+// Serial.write, waiting for room
+struct BlockingPort {
+	void write(const uint8_t * buf, size_t n) { uart.writeBlocking(buf, n); }
+};
+
+static const char text_line[] = "fusion: period us 2500, runs 400, misses 0\n";
+static bool text_finish;
+static uint32_t text_bytes;
+
+static void textTask() {
+	BlockingPort port;
+	if(text_finish) writer.finish(port);
+	port.write((const uint8_t *) text_line, sizeof(text_line) - 1);
+	text_bytes += sizeof(text_line) - 1;
+}
+
+static void sketch(double baud, uint16_t rate, bool block, uint8_t policy) {
+	static uint8_t mem[sizeof(LoopScheduler<4>)];
+	now_us = 0;
+	sched = new(mem) LoopScheduler<4>(simClock);
+	fusion_task = sched->add(fusionTask, FUSION_PERIOD, "fusion");
+	stream_task = sched->add(streamTask, 1000000UL / rate, "stream");
+	writer_task = sched->add(writerTask, 0, "writer");
+	text_task = sched->add(textTask, TEXT_PERIOD, "text");
+	sched->enable(text_task, false);
+	text_bytes = 0;
+	new(&writer) TelemetryWriter(writer_buf, sizeof(writer_buf), policy);
+	blocking = block;
+	serialFrameWriter(block ? NULL : &writer);
+	uart.reset(baud);
+	host.reset();
+	ticks = ticks_whole = ticks_broken = 0;
+	quat_waiting = false;
+	for(int i = 0; i < VALUES; i++) val_array[i] = i * 1.5f;
+	fflush(stdout);
+	stdout = open_memstream(&cap_p, &cap_n);
+	cap_sent = 0;
+}
+
+// stops the stream and lets the port drain
+static void drain() {
+	sched->enable(stream_task, false);
+	sched->enable(text_task, false);
+	uint32_t t0 = now_us;
+	while(now_us - t0 < 1000000) {
+		sched->run();
+		uart.update();
+		now_us++;
+	}
+}
+
+static void run(uint32_t us) {
+	uint32_t t0 = now_us;
+	while(now_us - t0 < us) {
+		if(sched->run() < 0) now_us++;
+		uart.update();
+	}
+}
+
+static void end(FILE * out) {
+	fclose(stdout);
+	stdout = out;
+	free(cap_p);
+}
+
+int main() {
+	char line[100];
+	FILE * out = stdout;
+	const char * policies[] = {"drop oldest", "decimate"};
+
+	printf("overload: 100 ticks/s of 'Q' and 'Z' at 57600 baud for 5s\n");
+	{
+		sketch(57600, 100, true, WRITER_DROP_OLDEST);
+		run(5000000);
+		TaskStats f = sched->stats(fusion_task);
+		end(out);
+		snprintf(line, sizeof(line), "blocking: fusion %lu runs, %lu missed, late max %luus", (unsigned long) f.runs,
+		         (unsigned long) f.misses, (unsigned long) f.late_max);
+		check(line, f.misses > 0);
+		uint32_t blocked_runs = f.runs;
+
+		for(uint8_t policy = WRITER_DROP_OLDEST; policy <= WRITER_DECIMATE; policy++) {
+			sketch(57600, 100, false, policy);
+			run(5000000);
+			TaskStats f = sched->stats(fusion_task);
+			drain();
+			end(out);
+			snprintf(line, sizeof(line), "%s: fusion %lu runs, %lu missed, late max %luus", policies[policy],
+			         (unsigned long) f.runs, (unsigned long) f.misses, (unsigned long) f.late_max);
+			check(line, f.misses == 0 && f.runs >= 5000000 / FUSION_PERIOD && f.runs > blocked_runs
+			      && f.late_max <= FRAME_COST + WRITER_COST + 2 * 15 + 100);
+			snprintf(line, sizeof(line), "%s: %lu frames, %lu dropped, %lu lost at the host", policies[policy],
+			         (unsigned long) writer.frames, (unsigned long) writer.dropped, (unsigned long) host.lost);
+			check(line, host.lost == writer.dropped && host.crc_errors == 0 && host.skipped == 0);
+			snprintf(line, sizeof(line), "%s: %lu ticks whole, %lu broken, %lu skipped", policies[policy],
+			         (unsigned long) ticks_whole, (unsigned long) ticks_broken, (unsigned long) writer.skipped);
+			if(policy == WRITER_DECIMATE) {
+				// the port carries 5760 bytes/s, 98 a tick
+				check(line, ticks_broken == 0 && writer.dropped == 0 && ticks_whole == ticks
+				      && ticks_whole >= 5 * 5760 / 98 / 2 && ticks_whole <= 5 * 5760 / 98 + 10);
+			}
+			else check(line, writer.dropped > 0 && writer.skipped == 0 && ticks_whole > 5 * 5760 / 98 / 2);
+			snprintf(line, sizeof(line), "%s: ring used max %u of %d", policies[policy], writer.used_max, WRITER_SIZE);
+			check(line, writer.used_max <= WRITER_SIZE);
+		}
+	}
+
+	printf("stall: 20 ticks/s at 57600 baud, the port stops for 200ms\n");
+	{
+		for(int block = 1; block >= 0; block--) {
+			sketch(57600, 20, block, WRITER_DROP_OLDEST);
+			run(500000);
+			uart.paused_until = now_us + 200000;
+			run(1000000);
+			TaskStats f = sched->stats(fusion_task);
+			drain();
+			end(out);
+			if(block) {
+				snprintf(line, sizeof(line), "blocking: fusion %lu missed, late max %luus", (unsigned long) f.misses,
+				         (unsigned long) f.late_max);
+				check(line, f.misses >= 150000 / FUSION_PERIOD);
+			}
+			else {
+				snprintf(line, sizeof(line), "writer: fusion %lu missed, late max %luus", (unsigned long) f.misses,
+				         (unsigned long) f.late_max);
+				check(line, f.misses == 0 && f.late_max <= FRAME_COST + WRITER_COST + 2 * 15 + 100);
+				snprintf(line, sizeof(line), "writer: stall max %luus, %lu dropped", (unsigned long) writer.stall_max,
+				         (unsigned long) writer.dropped);
+				// from the last byte the port took, up to a tick before the pause
+				check(line, writer.stall_max >= 140000 && writer.stall_max <= 201000 && writer.dropped == 0
+				      && ticks_whole == ticks && host.lost == 0);
+			}
+		}
+	}
+
+	printf("capacity: 100 ticks/s at 921600 baud for 5s\n");
+	{
+		sketch(921600, 100, false, WRITER_DECIMATE);
+		run(5000000);
+		TaskStats f = sched->stats(fusion_task);
+		drain();
+		end(out);
+		snprintf(line, sizeof(line), "%lu ticks whole, %lu dropped, %lu skipped, stall max %luus", (unsigned long) ticks_whole,
+		         (unsigned long) writer.dropped, (unsigned long) writer.skipped, (unsigned long) writer.stall_max);
+		check(line, ticks_whole == ticks && ticks >= 499 && writer.dropped == 0 && writer.skipped == 0
+		      && host.lost == 0 && writer.stall_max < 1000);
+		snprintf(line, sizeof(line), "fusion %lu missed, ring used max %u", (unsigned long) f.misses, writer.used_max);
+		check(line, f.misses == 0 && writer.used_max < 256);
+	}
+
+	printf("text: a line every %dms to the port, 100 ticks/s at 57600 baud for 2s\n", TEXT_PERIOD / 1000);
+	{
+		for(int fin = 0; fin <= 1; fin++) {
+			sketch(57600, 100, false, WRITER_DROP_OLDEST);
+			text_finish = fin;
+			sched->enable(text_task, true);
+			run(2000000);
+			drain();
+			end(out);
+			snprintf(line, sizeof(line), "%s: %lu text bytes, host skipped %lu, %lu damaged",
+			         fin ? "finish" : "no finish", (unsigned long) text_bytes, (unsigned long) host.skipped,
+			         (unsigned long) host.crc_errors);
+			if(fin) check(line, host.skipped == text_bytes && host.crc_errors == 0 && host.lost == writer.dropped);
+			else check(line, host.crc_errors > 0);
+		}
+	}
+
+	printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -33,6 +33,7 @@
 #include "DebugUtils.h"
 #include "CommunicationUtils.h"
 #include "FreeIMU.h"
+#include "LoopScheduler.h"
 #include "DCM.h"
 #include "FilteringScheme.h"
 #include "RunningAverage.h"
@@ -42,6 +43,13 @@
 static const unsigned long GPSBaud = 57600;
 #define gpsSerial Serial1
 
+// task periods in us, 'S' shows whether the board keeps up with them
+#define IMU_PERIOD      2500    // getQ
+#define ACQUIRE_PERIOD  1000    // FIFO reads between two getQ, FIFO_BURST only
+#define BARO_PERIOD    10000
+#define TELEM_PERIOD    5000    // one line or frame of a 'r', 'b', 'q', 'z', 'a', 'Q' or 'Z' stream
+#define WRITER_SIZE     1024    // bytes of frames queued for writerTask
+
 KalmanFilter kFilters[4];
 int k_index = 3;
 
@@ -67,6 +75,203 @@ FreeIMU my3IMU = FreeIMU();
 
 //The command from the PC
 char cmd, tempCorr;
+char stream_cmd;        // stream sent by telemetryTask
+uint8_t stream_count;   // lines of it still to send
+
+static uint32_t clock_us() {
+  return micros();
+}
+
+LoopScheduler<9> sched(clock_us);
+TelemetryStream subscription;   // set by 's'
+int8_t subscription_task;
+PackEncoder pack;               // STREAM_PACKED
+uint8_t writer_buf[WRITER_SIZE];
+TelemetryWriter writer(writer_buf, sizeof(writer_buf));  // the frames, see TelemetryWriter.h
+
+void imuTask() {
+  my3IMU.getQ(q, val);
+}
+
+#if HAS_MPU_FIFO()
+void acquireTask() {
+  my3IMU.acquire();
+}
+#endif
+
+#if HAS_BARO()
+void baroTask() {
+  my3IMU.pollBaro();
+}
+#endif
+
+#if HAS_GPS
+void gpsTask() {
+  while (gpsSerial.available())
+    gps.encode(gpsSerial.read());
+}
+#endif
+
+// the 'z' line: quaternion, acc, gyro, magn, temperatures, pressure...
+void fillValues(bool kalman) {
+  val_array[15] = my3IMU.sampleFreq;
+  val_array[7] = (val[3] * M_PI/180);
+  val_array[8] = (val[4] * M_PI/180);
+  val_array[9] = (val[5] * M_PI/180);
+  val_array[4] = (val[0]);
+  val_array[5] = (val[1]);
+  val_array[6] = (val[2]);
+  val_array[10] = (val[6]);
+  val_array[11] = (val[7]);
+  val_array[12] = (val[8]);
+  for(uint8_t i = 0; i < 4; i++) {
+    val_array[i] = kalman ? kFilters[i].measureRSSI(q[i]) : q[i];
+  }
+  val_array[16] = val[9];
+  val_array[18] = val[11];
+  
+  #if HAS_PRESS()
+     // with baro
+     val_array[17] = val[10];
+     val_array[13] = (my3IMU.getBaroTemperature());
+     val_array[14] = (my3IMU.getBaroPressure());
+  #elif HAS_MPU6050()
+     val_array[13] = (my3IMU.DTemp/340.) + 35.;
+  #elif HAS_MPU9150()  || HAS_MPU9250()
+     val_array[13] = ((float) my3IMU.DTemp) / 333.87 + 21.0;
+  #elif HAS_ITG3200()
+     val_array[13] = my3IMU.rt;
+  #endif
+}
+
+#if HAS_GPS
+void fillGps() {
+  val_array[0] = (float) gps.hdop.value();
+  val_array[1] = (float) gps.hdop.isValid();
+  val_array[2] = (float) gps.location.lat();
+  val_array[3] = (float) gps.location.lng();
+  val_array[4] = (float) gps.location.isValid();
+  val_array[5] = (float) gps.altitude.meters();
+  val_array[6] = (float) gps.altitude.isValid();
+  val_array[7] = (float) gps.course.deg();
+  val_array[8] = (float) gps.course.isValid();
+  val_array[9] = (float) gps.speed.kmph();
+  val_array[10] = (float) gps.speed.isValid();
+  val_array[11] = (float) gps.charsProcessed();
+}
+#endif
+
+// one line of the stream started by 'r', 'b', 'q', 'z' or 'a', or frames for 'Q' and 'Z'
+void telemetryTask() {
+  if(stream_count == 0) return;
+  stream_count--;
+  if(stream_cmd != 'Q' && stream_cmd != 'Z') serialText();  // not inside a frame of the writer
+  if(stream_cmd == 'r') {
+    //my3IMU.getUnfilteredRawValues(raw_values);
+    my3IMU.getRawValues(raw_values);
+    sprintf(str, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,", raw_values[0], raw_values[1], raw_values[2], raw_values[3], raw_values[4], raw_values[5], raw_values[6], raw_values[7], raw_values[8], raw_values[9]);
+    Serial.print(str);
+    #if (HAS_MS5611() || HAS_BMP085() || HAS_LPS331())
+      Serial.print(my3IMU.getBaroTemperature()); Serial.print(",");
+      Serial.print(my3IMU.getBaroPressure()); Serial.print(",");
+    #endif
+    Serial.print(millis()); Serial.print(",");
+    Serial.println("\r\n");
+  }
+  else if(stream_cmd == 'b') {
+    #if HAS_ITG3200()
+      my3IMU.acc.readAccel(&raw_values[0], &raw_values[1], &raw_values[2]);
+      my3IMU.gyro.readGyroRaw(&raw_values[3], &raw_values[4], &raw_values[5]);
+      writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_MPU9150()  || HAS_MPU9250()
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_MPU6050() || HAS_MPU6000()   // MPU6050
+      //my3IMU.accgyro.getMotion6(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5]);
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_ALTIMU10()
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag of Altimu 10        
+    #endif
+    //writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    
+    #if IS_9DOM() && (!HAS_MPU9150()  && !HAS_MPU9250() && !HAS_ALTIMU10())
+      my3IMU.magn.getValues(&raw_values[0], &raw_values[1], &raw_values[2]);
+      writeArr(raw_values, 3, sizeof(int));
+    #endif
+    Serial.println();
+  }
+  else if(stream_cmd == 'q') {
+    serialPrintFloatArr(q, 4);
+    Serial.println("");
+  }
+  else if(stream_cmd == 'Q') { // binary, Q15
+    serialFrameQuat16(q);
+  }
+  else { // 'z', 'Z' in binary frames, or 'a' with the quaternion through the Kalman filters
+    fillValues(stream_cmd == 'a');
+    if(stream_cmd == 'Z') serialFrameFloatArr(FRAME_VALUES, val_array, 19);
+    else serialPrintFloatArr(val_array, 19);
+    
+    #if HAS_GPS
+      fillGps();
+      if(stream_cmd == 'Z') serialFrameFloatArr(FRAME_GPS, val_array, 12);
+      else serialPrintFloatArr(val_array,12);
+    #endif
+    if(stream_cmd != 'Z') Serial.print('\n');
+  }
+}
+
+// the frames queued by CommunicationUtils, as much as Serial takes without blocking
+void writerTask() {
+  writer.flush(Serial, clock_us());
+}
+
+// scales of the packed frames for the calibrated range of the sensors, from a keyframe on
+void packScale() {
+  pack.scale.fit(my3IMU.calRange(0), my3IMU.calRange(1), my3IMU.calRange(2));
+  pack.reset();
+}
+
+// the frames of the subscription, see TelemetryStream.h
+void streamTask() {
+  if(!writer.admit()) {  // decimated, the port is behind
+    subscription.skip(sched.missed());
+    return;
+  }
+  if(subscription.tick(sched.missed(), clock_us())) serialFrameStatus(subscription, &pack.scale);
+  if(subscription.fields & STREAM_QUAT) serialFrameQuat16(q);
+  if(subscription.fields & STREAM_ANGLES) {
+    my3IMU.getYawPitchRollRadAHRS(ypr, q);
+    for(uint8_t i = 0; i < 3; i++) ypr[i] *= 180 / M_PI;
+    serialFrameAngles16(ypr);
+  }
+  if(subscription.fields & STREAM_VALUES) {
+    fillValues(false);
+    serialFrameFloatArr(FRAME_VALUES, val_array, 19);
+  }
+  if(subscription.fields & STREAM_RAW) {
+    my3IMU.getRawValues(raw_values);
+    serialFrameIntArr(raw_values, 11);
+  }
+  if(subscription.fields & STREAM_PACKED) {
+    PackSample s;
+    fillValues(false);
+    for(uint8_t i = 0; i < 4; i++) s.q[i] = q[i];
+    for(uint8_t i = 0; i < 9; i++) s.sensors[i] = val[i];
+    s.slow[0] = val_array[13];  // temperature, pressure, altitude
+    s.slow[1] = val_array[14];
+    s.slow[2] = val_array[17];
+    serialFramePacked(pack, s);
+  }
+  #if HAS_GPS
+    if(subscription.fields & STREAM_GPS) {
+      fillGps();
+      serialFrameFloatArr(FRAME_GPS, val_array, 12);
+    }
+  #endif
+}
 
 void setup() {
   Serial.begin(BaudRate);
@@ -103,11 +308,33 @@ void setup() {
   
   // LED
   pinMode(13, OUTPUT);
+  
+  #if HAS_MPU_FIFO()
+    sched.add(acquireTask, ACQUIRE_PERIOD, "acquire");
+  #endif
+  sched.add(imuTask, IMU_PERIOD, "fusion");
+  #if HAS_BARO()
+    sched.add(baroTask, BARO_PERIOD, "baro");
+  #endif
+  sched.add(telemetryTask, TELEM_PERIOD, "telemetry");
+  subscription_task = sched.add(streamTask, TELEM_PERIOD, "stream");
+  sched.enable(subscription_task, false);
+  #if HAS_GPS
+    sched.add(gpsTask, 0, "gps");
+  #endif
+  sched.add(writerTask, 0, "writer");
+  sched.add(commandTask, 0, "command");
+  serialFrameWriter(&writer);
 }
 
 void loop() {
+  sched.run();
+}
+
+void commandTask() {
   if(Serial.available()) {
     cmd = Serial.read();
+    serialText();  // the replies are text, not inside a frame of the writer
     if(cmd=='v') {
       sprintf(str, "FreeIMU library by %s, FREQ:%s, LIB_VERSION: %s, IMU: %s", FREEIMU_DEVELOPER, FREEIMU_FREQ, FREEIMU_LIB_VERSION, FREEIMU_ID);
       Serial.print(str);
@@ -138,177 +365,11 @@ void loop() {
       my3IMU.setSeaPress(sea_press/100.0);
       //Serial.println(sea_press);
     }	
-    else if(cmd=='r') {
-      uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        //my3IMU.getUnfilteredRawValues(raw_values);
-        my3IMU.getRawValues(raw_values);
-        sprintf(str, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,", raw_values[0], raw_values[1], raw_values[2], raw_values[3], raw_values[4], raw_values[5], raw_values[6], raw_values[7], raw_values[8], raw_values[9]);
-        Serial.print(str);
-        #if (HAS_MS5611() || HAS_BMP085() || HAS_LPS331())
-          Serial.print(my3IMU.getBaroTemperature()); Serial.print(",");
-          Serial.print(my3IMU.getBaroPressure()); Serial.print(",");
-        #endif
-        Serial.print(millis()); Serial.print(",");
-        Serial.println("\r\n");
-     }
-    }
-    else if(cmd=='b') {
-      uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        #if HAS_ITG3200()
-          my3IMU.acc.readAccel(&raw_values[0], &raw_values[1], &raw_values[2]);
-          my3IMU.gyro.readGyroRaw(&raw_values[3], &raw_values[4], &raw_values[5]);
-          writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_MPU9150()  || HAS_MPU9250()
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_MPU6050() || HAS_MPU6000()   // MPU6050
-          //my3IMU.accgyro.getMotion6(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5]);
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_ALTIMU10()
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag of Altimu 10        
-        #endif
-        //writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        
-        #if IS_9DOM() && (!HAS_MPU9150()  && !HAS_MPU9250() && !HAS_ALTIMU10())
-          my3IMU.magn.getValues(&raw_values[0], &raw_values[1], &raw_values[2]);
-          writeArr(raw_values, 3, sizeof(int));
-        #endif
-        Serial.println();
-      }
-    }
-    else if(cmd == 'q') {
-      uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        my3IMU.getQ(q, val);
-        serialPrintFloatArr(q, 4);
-        Serial.println("");
-      }
+    else if(cmd=='r' || cmd=='b' || cmd=='q' || cmd=='z' || cmd=='a' || cmd=='Q' || cmd=='Z') {
+      // number of lines, sent one per TELEM_PERIOD by telemetryTask
+      stream_count = serial_busy_wait();
+      stream_cmd = cmd;
     }
-    else if(cmd == 'z') {
-      float val_array[19] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-      uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        my3IMU.getQ(q, val);
-	val_array[15] = my3IMU.sampleFreq;        
-        //my3IMU.getValues(val);       
-        val_array[7] = (val[3] * M_PI/180);
-        val_array[8] = (val[4] * M_PI/180);
-        val_array[9] = (val[5] * M_PI/180);
-        val_array[4] = (val[0]);
-        val_array[5] = (val[1]);
-        val_array[6] = (val[2]);
-        val_array[10] = (val[6]);
-        val_array[11] = (val[7]);
-        val_array[12] = (val[8]);
-        val_array[0] = (q[0]);
-        val_array[1] = (q[1]);
-        val_array[2] = (q[2]);
-        val_array[3] = (q[3]);
-        //val_array[15] = millis();
-        val_array[16] = val[9];
-        val_array[18] = val[11];
-        
-        #if HAS_PRESS()
-           // with baro
-           val_array[17] = val[10];
-           val_array[13] = (my3IMU.getBaroTemperature());
-           val_array[14] = (my3IMU.getBaroPressure());
-        #elif HAS_MPU6050()
-           val_array[13] = (my3IMU.DTemp/340.) + 35.;
-		#elif HAS_MPU9150()  || HAS_MPU9250()
-           val_array[13] = ((float) my3IMU.DTemp) / 333.87 + 21.0;
-        #elif HAS_ITG3200()
-           val_array[13] = my3IMU.rt;
-        #endif
-
-        serialPrintFloatArr(val_array,19);
-        //Serial.print('\n');
-        
-        #if HAS_GPS
-          val_array[0] = (float) gps.hdop.value();
-          val_array[1] = (float) gps.hdop.isValid();
-          val_array[2] = (float) gps.location.lat();
-          val_array[3] = (float) gps.location.lng();
-          val_array[4] = (float) gps.location.isValid();
-          val_array[5] = (float) gps.altitude.meters();
-          val_array[6] = (float) gps.altitude.isValid();
-          val_array[7] = (float) gps.course.deg();
-          val_array[8] = (float) gps.course.isValid();
-          val_array[9] = (float) gps.speed.kmph();
-          val_array[10] = (float) gps.speed.isValid();
-          val_array[11] = (float) gps.charsProcessed();
-          serialPrintFloatArr(val_array,12);
-          Serial.print('\n');
-          smartDelay(20);
-        #else
-          Serial.print('\n');
-        #endif        
-      }
-    } 
-    else if(cmd == 'a') {
-      float val_array[19] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-      uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        my3IMU.getQ(q, val);
-        val_array[15] = my3IMU.sampleFreq;
-        //my3IMU.getValues(val);        
-		val_array[7] = (val[3] * M_PI/180);
-		val_array[8] = (val[4] * M_PI/180);
-		val_array[9] = (val[5] * M_PI/180);
-		val_array[4] = (val[0]);
-		val_array[5] = (val[1]);
-		val_array[6] = (val[2]);
-		val_array[10] = (val[6]);
-		val_array[11] = (val[7]);
-		val_array[12] = (val[8]);
-		val_array[0] = kFilters[0].measureRSSI(q[0]);
-		val_array[1] = kFilters[1].measureRSSI(q[1]);
-		val_array[2] = kFilters[2].measureRSSI(q[2]);
-		val_array[3] = kFilters[3].measureRSSI(q[3]);
-		//val_array[15] = millis();
-		val_array[16] = val[9];
-        val_array[18] = val[11];
-                
-        #if HAS_PRESS() 
-           // with baro
-           val_array[17] = val[10];
-           val_array[13] = (my3IMU.getBaroTemperature());
-           val_array[14] = (my3IMU.getBaroPressure());
-        #elif HAS_MPU6050()
-           val_array[13] = (my3IMU.DTemp/340.) + 35.;
-		#elif HAS_MPU9150()  || HAS_MPU9250()
-           val_array[13] = ((float) my3IMU.DTemp) / 333.87 + 21.0;
-        #elif HAS_ITG3200()
-           val_array[13] = my3IMU.rt;
-        #endif
-        serialPrintFloatArr(val_array, 19);
-        //Serial.print('\n');
-        
-        #if HAS_GPS
-          val_array[0] = (float) gps.hdop.value();
-          val_array[1] = (float) gps.hdop.isValid();
-          val_array[2] = (float) gps.location.lat();
-          val_array[3] = (float) gps.location.lng();
-          val_array[4] = (float) gps.location.isValid();
-          val_array[5] = (float) gps.altitude.meters();
-          val_array[6] = (float) gps.altitude.isValid();
-          val_array[7] = (float) gps.course.deg();
-          val_array[8] = (float) gps.course.isValid();
-          val_array[9] = (float) gps.speed.kmph();
-          val_array[10] = (float) gps.speed.isValid();
-          val_array[11] = (float) gps.charsProcessed();
-          serialPrintFloatArr(val_array,12);
-          Serial.print('\n');
-          smartDelay(20);
-        #else
-          Serial.print('\n');
-        #endif 
-       }
-     }
 
     #ifdef __AVR__
       #ifndef CALIBRATION_H
@@ -320,14 +381,28 @@ void loop() {
 				EEPROM.write(FREEIMU_EEPROM_BASE + i, (char) Serial.read());
 			}
         my3IMU.calLoad(); // reload calibration
+        packScale();
         // toggle LED after calibration store.
         digitalWrite(13, HIGH);
         delay(1000);
         digitalWrite(13, LOW);
 		}
+		else if(cmd == 'm') { // offsets and 3x3 matrices, see FreeIMU::calStore
+			uint8_t cal[FREEIMU_EEPROM_MAT_SIZE];
+			for(uint8_t i = 0; i < FREEIMU_EEPROM_MAT_SIZE; i++) { // more than the serial buffer holds
+				while(Serial.available() == 0) ;
+				cal[i] = Serial.read();
+			}
+			my3IMU.calStore(cal);
+			packScale();
+			digitalWrite(13, HIGH);
+			delay(1000);
+			digitalWrite(13, LOW);
+		}
 		else if(cmd == 'x') {
 		EEPROM.write(FREEIMU_EEPROM_BASE, 0); // reset signature
 		my3IMU.calLoad(); // reload calibration
+		packScale();
 		}
 		#endif
     #endif
@@ -364,6 +439,34 @@ void loop() {
       Serial.print(my3IMU.magn_scale_z);
       Serial.print("\n");
     }
+    else if(cmd == 'e') { // select fusion engine: 0 Mahony, 1 Madgwick, 3 MARG, 4 DCM, 5 EKF
+      uint8_t engine = serial_busy_wait() - '0';
+      if(!my3IMU.setFusionEngine(engine)) Serial.println("engine not available");
+    }
+    else if(cmd == 'h') { // shadow engine, same ids as 'e', 'n' turns it off
+      char c = serial_busy_wait();
+      uint8_t engine = (c == 'n') ? FUSION_NONE : c - '0';
+      if(!my3IMU.setShadowEngine(engine)) Serial.println("engine not available");
+    }
+    else if(cmd == 'E') { // fusion engine statistics
+      printFusionStats();
+    }
+    else if(cmd == 'J') { // getQ timestamp jitter histogram, cleared after printing
+      printJitter();
+    }
+    else if(cmd == 's') { // subscription: rate in Hz (2 bytes, little endian), STREAM_* fields
+      uint16_t rate = (uint8_t) serial_busy_wait();
+      rate |= (uint16_t)(uint8_t) serial_busy_wait() << 8;
+      uint8_t fields = serial_busy_wait();
+      packScale();
+      writer.policy = (fields & STREAM_DECIMATE) ? WRITER_DECIMATE : WRITER_DROP_OLDEST;
+      if(subscription.set(rate, fields, clock_us())) sched.setPeriod(subscription_task, subscription.period());
+      sched.enable(subscription_task, subscription.rate != 0);
+      serialFrameStatus(subscription, &pack.scale);
+    }
+    else if(cmd == 'S') { // scheduler task statistics, cleared after printing
+      printTaskStats();
+    }
     else if(cmd == 'd') { // debugging outputs
       while(1) {
         my3IMU.getRawValues(raw_values);
@@ -386,6 +489,95 @@ void loop() {
   }
 }
 
+void printFusionStats() {
+  for(uint8_t i = 0; i < FUSION_SLOTS; i++) {
+    if(!my3IMU.hasFusionEngine(i)) continue;
+    Serial.print("engine ");
+    Serial.print(i);
+    if(i == my3IMU.fusion_active) Serial.print(" (active)");
+    else if(i == my3IMU.fusion_shadow) Serial.print(" (shadow)");
+    Serial.print(": updates ");
+    Serial.print(my3IMU.fusion_stats[i].updates);
+    Serial.print(", cycles last ");
+    Serial.print(my3IMU.fusion_stats[i].cycles_last);
+    Serial.print(" max ");
+    Serial.print(my3IMU.fusion_stats[i].cycles_max);
+    Serial.print(" avg ");
+    Serial.print(my3IMU.fusion_stats[i].cycles_avg());
+    Serial.print("\n");
+  }
+  if(my3IMU.fusion_shadow != FUSION_NONE) {
+    Serial.print("shadow diff (deg): ");
+    Serial.print(my3IMU.fusion_shadow_diff);
+    Serial.print("\n");
+  }
+}
+
+void printJitter() {
+  Serial.print("period us min ");
+  Serial.print(my3IMU.dt_jitter.period_min);
+  Serial.print(" max ");
+  Serial.print(my3IMU.dt_jitter.period_max);
+  Serial.print(" last ");
+  Serial.print(my3IMU.dt_jitter.period_last);
+  Serial.print("\n");
+  for(uint8_t i = 0; i < FUSION_JITTER_BINS; i++) {
+    if(i < FUSION_JITTER_BINS - 1) {
+      Serial.print("change < ");
+      Serial.print(my3IMU.dt_jitter.binLimit(i));
+    }
+    else {
+      Serial.print("larger");
+    }
+    Serial.print(": ");
+    Serial.print(my3IMU.dt_jitter.bins[i]);
+    Serial.print("\n");
+  }
+  my3IMU.dt_jitter.clear();
+}
+
+void printTaskStats() {
+  for(uint8_t i = 0; i < sched.size(); i++) {
+    const TaskStats &st = sched.stats(i);
+    Serial.print(sched.name(i));
+    Serial.print(": period us ");
+    Serial.print(sched.period(i));
+    Serial.print(", runs ");
+    Serial.print(st.runs);
+    Serial.print(", misses ");
+    Serial.print(st.misses);
+    Serial.print(", late max ");
+    Serial.print(st.late_max);
+    Serial.print(", time max ");
+    Serial.print(st.time_max);
+    Serial.print(" avg ");
+    Serial.print(st.time_avg());
+    Serial.print("\n");
+  }
+  if(subscription.rate) {
+    Serial.print("subscription: rate ");
+    Serial.print(subscription.rate);
+    Serial.print(", ticks ");
+    Serial.print(subscription.ticks);
+    Serial.print(", dropped ");
+    Serial.print(subscription.dropped);
+    Serial.print("\n");
+  }
+  Serial.print("writer: frames ");
+  Serial.print(writer.frames);
+  Serial.print(", dropped ");
+  Serial.print(writer.dropped);
+  Serial.print(", skipped ");
+  Serial.print(writer.skipped);
+  Serial.print(", stall max ");
+  Serial.print(writer.stall_max);
+  Serial.print(", used max ");
+  Serial.print(writer.used_max);
+  Serial.print("\n");
+  sched.clearStats();
+  writer.clearStats();
+}
+
 char serial_busy_wait() {
   while(!Serial.available()) {
     ; // do nothing until ready
@@ -415,20 +607,6 @@ void eeprom_serial_dump_column() {
 }
 #endif
 
-// This custom version of delay() ensures that the gps object
-// is being "fed".
-static void smartDelay(unsigned long ms)
-{
-  #if HAS_GPS
-  unsigned long start = millis();
-  do 
-  {
-    while (gpsSerial.available())
-      gps.encode(gpsSerial.read());
-  } while (millis() - start < ms);
-  #endif
-}
-
 #if HAS_GPS
 
 	void configureUblox(byte *settingsArrayPointer) {
@@ -17,6 +17,7 @@
 #include "DebugUtils.h"
 #include "CommunicationUtils.h"
 #include "FreeIMU.h"
+#include "LoopScheduler.h"
 #include "DCM.h"
 #include "FilteringScheme.h"
 #include "RunningAverage.h"
@@ -34,6 +35,12 @@ static const unsigned long GPSBaud = 57600;
 #define telemSerial Serial2  //xbee on serial2 for my xbee setup
 #define telemBaud 57600
 
+// task periods in us, 'S' shows whether the board keeps up with them
+#define IMU_PERIOD      2500    // getQ
+#define ACQUIRE_PERIOD  1000    // FIFO reads between two getQ, FIFO_BURST only
+#define BARO_PERIOD    10000
+#define TELEM_PERIOD   10000    // one line of a 'r', 'b' or 'z' stream, or a frame of 'c'
+
 uint8_t count = 64;
 float q[4];
 int raw_values[11];
@@ -74,7 +81,174 @@ FreeIMU my3IMU = FreeIMU();
 char tempCorr;
 char cmd1[9];
 String cmd, Payload;
+char stream_cmd;        // stream sent by telemetryTask
+uint8_t stream_count;   // lines of it still to send
+PackEncoder pack;       // 'c', packed frames, see TelemetryPack.h
+uint8_t pack_seq;       // sequence number of the next one over the XBee
+
+static uint32_t clock_us() {
+  return micros();
+}
+
+LoopScheduler<6> sched(clock_us);
+
+void imuTask() {
+  my3IMU.getQ(q, val);
+}
+
+#if HAS_MPU_FIFO()
+void acquireTask() {
+  my3IMU.acquire();
+}
+#endif
+
+#if HAS_BARO()
+void baroTask() {
+  my3IMU.pollBaro();
+}
+#endif
+
+#if HAS_GPS
+void gpsTask() {
+  while (gpsSerial.available())
+    gps.encode(gpsSerial.read());
+}
+#endif
+
+// the 'z' line: quaternion, acc, gyro, magn, temperatures, pressure...
+void fillValues() {
+  val_array[15] = my3IMU.sampleFreq;
+  val_array[7] = (val[3] * M_PI/180);
+  val_array[8] = (val[4] * M_PI/180);
+  val_array[9] = (val[5] * M_PI/180);
+  val_array[4] = (val[0]);
+  val_array[5] = (val[1]);
+  val_array[6] = (val[2]);
+  val_array[10] = (val[6]);
+  val_array[11] = (val[7]);
+  val_array[12] = (val[8]);
+  val_array[0] = (q[0]);
+  val_array[1] = (q[1]);
+  val_array[2] = (q[2]);
+  val_array[3] = (q[3]);
+  val_array[16] = val[9];
+  val_array[18] = val[11];
+  #if HAS_PRESS()
+     // with baro
+     val_array[17] = val[10];
+     val_array[13] = (my3IMU.getBaroTemperature());
+     val_array[14] = (my3IMU.getBaroPressure());
+  #elif HAS_MPU6050()
+     val_array[13] = (my3IMU.DTemp/340.) + 35.;
+  #elif HAS_MPU9150()  || HAS_MPU9250()
+     val_array[13] = ((float) my3IMU.DTemp) / 333.87 + 21.0;
+  #elif HAS_ITG3200()
+     val_array[13] = my3IMU.rt;
+  #endif
+}
+
+// scales of the packed frames for the calibrated range of the sensors, from a keyframe on
+void packScale() {
+  pack.scale.fit(my3IMU.calRange(0), my3IMU.calRange(1), my3IMU.calRange(2));
+  pack.reset();
+}
 
+// one line of the stream started by 'r', 'b' or 'z', or a packed frame of 'c'
+void telemetryTask() {
+  if(stream_count == 0) return;
+  stream_count--;
+  if(stream_cmd == 'r') {
+    //my3IMU.getUnfilteredRawValues(raw_values);
+    my3IMU.getRawValues(raw_values);
+    sprintf(str, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,", raw_values[0], raw_values[1], raw_values[2], raw_values[3], raw_values[4], raw_values[5], raw_values[6], raw_values[7], raw_values[8], raw_values[9]);
+    Serial.print(str);
+    #if (HAS_MS5611() || HAS_BMP085() || HAS_LPS331())
+      Serial.print(my3IMU.getBaroTemperature()); Serial.print(",");
+      Serial.print(my3IMU.getBaroPressure()); Serial.print(",");
+    #endif
+    Serial.print(millis()); Serial.print(",");
+    Serial.println("\r\n");
+  }
+  else if(stream_cmd == 'b') {
+    #if HAS_ITG3200()
+      my3IMU.acc.readAccel(&raw_values[0], &raw_values[1], &raw_values[2]);
+      my3IMU.gyro.readGyroRaw(&raw_values[3], &raw_values[4], &raw_values[5]);
+      writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_MPU9150()  || HAS_MPU9250()
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_MPU6050() || HAS_MPU6000()   // MPU6050
+      //my3IMU.accgyro.getMotion6(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5]);
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    #elif HAS_ALTIMU10()
+      my3IMU.getRawValues(raw_values);
+      writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag of Altimu 10        
+    #endif
+    //writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
+    
+    #if IS_9DOM() && (!HAS_MPU9150()  && !HAS_MPU9250() && !HAS_ALTIMU10())
+      my3IMU.magn.getValues(&raw_values[0], &raw_values[1], &raw_values[2]);
+      writeArr(raw_values, 3, sizeof(int));
+    #endif
+    Serial.println();
+  }
+  else if(stream_cmd == 'z') {
+    fillValues();
+    #if HAS_telem
+      Message[0] = '\0';
+      XBeeSerialPrintFloatArr(val_array,19);
+    #else
+      serialPrintFloatArr(val_array,19);
+    #endif
+    
+    #if HAS_GPS
+      val_array[0] = (float) gps.hdop.value();
+      val_array[1] = (float) gps.location.lat();
+      val_array[2] = (float) gps.location.lng();
+      val_array[3] = (float) gps.altitude.meters();
+      val_array[4] = (float) gps.course.deg();
+      val_array[5] = (float) gps.speed.kmph();
+      
+      #if HAS_telem
+        XBeeSerialPrintFloatArr(val_array,6);
+      #else
+        serialPrintFloatArr(val_array,6);
+        Serial.print('\n');
+      #endif
+    #else
+      #if HAS_telem
+        strcat(Message, "\n");
+      #else
+        Serial.print('\n');
+      #endif
+    #endif
+    
+    #if HAS_telem
+      sendPayload();
+      Serial.print(Message);
+    #endif
+  }
+  else if(stream_cmd == 'c') {
+    PackSample s;
+    fillValues();
+    for(uint8_t i = 0; i < 4; i++) s.q[i] = q[i];
+    for(uint8_t i = 0; i < 9; i++) s.sensors[i] = val[i];
+    s.slow[0] = val_array[13];  // temperature, pressure, altitude
+    s.slow[1] = val_array[14];
+    s.slow[2] = val_array[17];
+    #if HAS_telem
+      // one frame per XBee packet, debug/pack_bench.cpp has the sizes
+      uint8_t buf[PACK_MAX_PAYLOAD + FRAME_OVERHEAD];
+      FrameEncoder e(buf, sizeof(buf));
+      pack.encode(e, pack_seq++, s);
+      ZBTxRequest zbtx = ZBTxRequest(Broadcast, buf, e.end());
+      xbee.send(zbtx);
+    #else
+      serialFramePacked(pack, s);
+    #endif
+  }
+}
 
 void setup() {
   Serial.begin(BaudRate);
@@ -107,9 +281,26 @@ void setup() {
 
   // LED
   pinMode(13, OUTPUT);
+  
+  #if HAS_MPU_FIFO()
+    sched.add(acquireTask, ACQUIRE_PERIOD, "acquire");
+  #endif
+  sched.add(imuTask, IMU_PERIOD, "fusion");
+  #if HAS_BARO()
+    sched.add(baroTask, BARO_PERIOD, "baro");
+  #endif
+  sched.add(telemetryTask, TELEM_PERIOD, "telemetry");
+  #if HAS_GPS
+    sched.add(gpsTask, 0, "gps");
+  #endif
+  sched.add(commandTask, 0, "command");
 }
 
 void loop() {
+  sched.run();
+}
+
+void commandTask() {
   #if HAS_telem
     xbee.readPacket();
     if (xbee.getResponse().isAvailable()) {
@@ -161,126 +352,40 @@ void loop() {
       my3IMU.setSeaPress(sea_press/100.0);
       //Serial.println(sea_press);
     }	
-    else if(cmd1[0]=='r') {
-      //uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        //my3IMU.getUnfilteredRawValues(raw_values);
-        my3IMU.getRawValues(raw_values);
-        sprintf(str, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,", raw_values[0], raw_values[1], raw_values[2], raw_values[3], raw_values[4], raw_values[5], raw_values[6], raw_values[7], raw_values[8], raw_values[9]);
-        Serial.print(str);
-        #if (HAS_MS5611() || HAS_BMP085() || HAS_LPS331())
-          Serial.print(my3IMU.getBaroTemperature()); Serial.print(",");
-          Serial.print(my3IMU.getBaroPressure()); Serial.print(",");
-        #endif
-        Serial.print(millis()); Serial.print(",");
-        Serial.println("\r\n");
-     }
+    else if(cmd1[0]=='r' || cmd1[0]=='b' || cmd1[0]=='z' || cmd1[0]=='c') {
+      // count lines, sent one per TELEM_PERIOD by telemetryTask; 'c' starts on a keyframe,
+      // which carries the scales
+      if(cmd1[0]=='c') packScale();
+      stream_count = count;
+      stream_cmd = cmd1[0];
     }
-    else if(cmd1[0]=='b') {
-      //uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        #if HAS_ITG3200()
-          my3IMU.acc.readAccel(&raw_values[0], &raw_values[1], &raw_values[2]);
-          my3IMU.gyro.readGyroRaw(&raw_values[3], &raw_values[4], &raw_values[5]);
-          writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_MPU9150()  || HAS_MPU9250()
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_MPU6050() || HAS_MPU6000()   // MPU6050
-          //my3IMU.accgyro.getMotion6(&raw_values[0], &raw_values[1], &raw_values[2], &raw_values[3], &raw_values[4], &raw_values[5]);
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        #elif HAS_ALTIMU10()
-          my3IMU.getRawValues(raw_values);
-          writeArr(raw_values, 9, sizeof(int)); // writes accelerometer, gyro values & mag of Altimu 10        
-        #endif
-        //writeArr(raw_values, 6, sizeof(int)); // writes accelerometer, gyro values & mag if 9150
-        
-        #if IS_9DOM() && (!HAS_MPU9150()  && !HAS_MPU9250() && !HAS_ALTIMU10())
-          my3IMU.magn.getValues(&raw_values[0], &raw_values[1], &raw_values[2]);
-          writeArr(raw_values, 3, sizeof(int));
-        #endif
-        Serial.println();
-      }
+    else if(cmd1[0] == 'S') { // scheduler task statistics, cleared after printing
+      printTaskStats();
     }
-    else if(cmd1[0] == 'z') {
-      float val_array[19] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-      //uint8_t count = serial_busy_wait();
-      for(uint8_t i=0; i<count; i++) {
-        my3IMU.getQ(q, val);
-		val_array[15] = my3IMU.sampleFreq;        
-        //my3IMU.getValues(val);       
-        val_array[7] = (val[3] * M_PI/180);
-        val_array[8] = (val[4] * M_PI/180);
-        val_array[9] = (val[5] * M_PI/180);
-        val_array[4] = (val[0]);
-        val_array[5] = (val[1]);
-        val_array[6] = (val[2]);
-        val_array[10] = (val[6]);
-        val_array[11] = (val[7]);
-        val_array[12] = (val[8]);
-        val_array[0] = (q[0]);
-        val_array[1] = (q[1]);
-        val_array[2] = (q[2]);
-        val_array[3] = (q[3]);
-        //val_array[15] = millis();
-        val_array[16] = val[9];
-        val_array[18] = val[11];
-	
-        #if HAS_PRESS()
-           // with baro
-           val_array[17] = val[10];
-           val_array[13] = (my3IMU.getBaroTemperature());
-           val_array[14] = (my3IMU.getBaroPressure());
-        #elif HAS_MPU6050()
-           val_array[13] = (my3IMU.DTemp/340.) + 35.;
-		#elif HAS_MPU9150()  || HAS_MPU9250()
-           val_array[13] = ((float) my3IMU.DTemp) / 333.87 + 21.0;
-        #elif HAS_ITG3200()
-           val_array[13] = my3IMU.rt;
-        #endif
-		
-        #if HAS_telem
-          //serialPrintFloatArr(val_array,19);
-          //Serial.println('\n');
-          Message[0] = '\0';
-          XBeeSerialPrintFloatArr(val_array,19);
-        #else
-          serialPrintFloatArr(val_array,19);
-        #endif
-        
-        #if HAS_GPS
-          val_array[0] = (float) gps.hdop.value();
-          val_array[1] = (float) gps.location.lat();
-          val_array[2] = (float) gps.location.lng();
-          val_array[3] = (float) gps.altitude.meters();
-          val_array[4] = (float) gps.course.deg();
-          val_array[5] = (float) gps.speed.kmph();
-		  
-          #if HAS_telem
-	    XBeeSerialPrintFloatArr(val_array,6);
-          #else
-	    serialPrintFloatArr(val_array,6);
-	    Serial.print('\n');			
-          #endif
-          smartDelay(20);
-        #else
-          #if HAS_telem
-	    strcat(Message, "\n");
-	  #else
-            Serial.print('\n');
-	  #endif
-        #endif
-		
-        #if HAS_telem
-	  sendPayload();
-          Serial.print(Message);
-        #endif
-      }
-    }    
   cmd1[0] = '\0';
 }
 
+void printTaskStats() {
+  for(uint8_t i = 0; i < sched.size(); i++) {
+    const TaskStats &st = sched.stats(i);
+    Serial.print(sched.name(i));
+    Serial.print(": period us ");
+    Serial.print(sched.period(i));
+    Serial.print(", runs ");
+    Serial.print(st.runs);
+    Serial.print(", misses ");
+    Serial.print(st.misses);
+    Serial.print(", late max ");
+    Serial.print(st.late_max);
+    Serial.print(", time max ");
+    Serial.print(st.time_max);
+    Serial.print(" avg ");
+    Serial.print(st.time_avg());
+    Serial.print("\n");
+  }
+  sched.clearStats();
+}
+
 char serial_busy_wait() {
   #if !HAS_telem
     while(!Serial.available()) {
@@ -292,21 +397,6 @@ char serial_busy_wait() {
   #endif
 }
 
-
-// This custom version of delay() ensures that the gps object
-// is being "fed".
-static void smartDelay(unsigned long ms)
-{
-  #if HAS_GPS
-  unsigned long start = millis();
-  do 
-  {
-    while (gpsSerial.available())
-      gps.encode(gpsSerial.read());
-  } while (millis() - start < ms);
-  #endif
-}
-
 #if HAS_GPS
 
   void configureUblox(byte *settingsArrayPointer) {
@@ -249,6 +249,17 @@ void loop() {
       delay(1000);
       digitalWrite(13, LOW);
     }
+    else if(cmd == 'm') { // offsets and 3x3 matrices, see FreeIMU::calStore
+      uint8_t cal[FREEIMU_EEPROM_MAT_SIZE];
+      for(uint8_t i = 0; i < FREEIMU_EEPROM_MAT_SIZE; i++) { // more than the serial buffer holds
+        while(Serial.available() == 0) ;
+        cal[i] = Serial.read();
+      }
+      my3IMU.calStore(cal);
+      digitalWrite(13, HIGH);
+      delay(1000);
+      digitalWrite(13, LOW);
+    }
     else if(cmd == 'x') {
       EEPROM.write(FREEIMU_EEPROM_BASE, 0); // reset signature
       my3IMU.calLoad(); // reload calibration
@@ -1,3 +1,4 @@
+#include <AP_Math_freeimu.h>
 #include <ADXL345.h>
 #include <bma180.h>
 #include <HMC58X3.h>
@@ -30,6 +30,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#define DEBUG (1)
 
 #include <HMC58X3.h>
+#include <I2Cdev.h>
 //#include <DebugUtils.h>
 #define DEBUG_PRINT
 
@@ -68,6 +69,7 @@ HMC58X3::HMC58X3() {
   x_scale=1.0F;
   y_scale=1.0F;
   z_scale=1.0F;
+  asyncCount=0;
 }
 
 
@@ -328,6 +330,60 @@ void HMC58X3::getValues(float *xyz) {
   getValues(&xyz[0], &xyz[1], &xyz[2]);
 }
 
+
+/*!
+    \brief Queue a read of the data registers (I2Cdev::submitRead), it runs in I2Cdev::poll().
+    Does nothing while a queued read is pending.
+
+    \param flags I2CDEV_CHAIN to run in the same poll as the transaction queued before.
+    \return true if the read was queued.
+*/
+bool HMC58X3::requestRaw(uint8_t flags) {
+  if(asyncCount == I2CDEV_PENDING) return false;
+  asyncCount = I2CDEV_PENDING;
+  if(I2Cdev::submitRead(false, HMC58X3_ADDR, HMC58X3_R_XM, 6, asyncBuffer, I2Cdev::storeCount, &asyncCount, flags) < 0) {
+    asyncCount = 0;
+    return false;
+  }
+  return true;
+}
+
+
+/*!
+    \brief Values of the read queued by requestRaw(), as getRaw().
+
+    \return true once, when the read has completed; x, y and z are set only then.
+*/
+bool HMC58X3::pollRaw(int *x,int *y,int *z) {
+  if(asyncCount != 6) return false;
+  asyncCount = 0;
+  *x = (int16_t)((asyncBuffer[0] << 8) | asyncBuffer[1]);
+  #ifdef ISHMC5843
+    *y = (int16_t)((asyncBuffer[2] << 8) | asyncBuffer[3]);
+    *z = (int16_t)((asyncBuffer[4] << 8) | asyncBuffer[5]);
+  #else // the Z registers comes before the Y registers in the HMC5883L
+    *z = (int16_t)((asyncBuffer[2] << 8) | asyncBuffer[3]);
+    *y = (int16_t)((asyncBuffer[4] << 8) | asyncBuffer[5]);
+  #endif
+  return true;
+}
+
+
+/*!
+    \brief Scaled values of the read queued by requestRaw(), as getValues().
+
+    \return true once, when the read has completed.
+*/
+bool HMC58X3::pollValues(float *xyz) {
+  int xr,yr,zr;
+  
+  if(!pollRaw(&xr, &yr, &zr)) return false;
+  xyz[0] = ((float) xr) / x_scale;
+  xyz[1] = ((float) yr) / y_scale;
+  xyz[2] = ((float) zr) / z_scale;
+  return true;
+}
+
 /*! 
     \brief Retrieve the value of the three ID registers.    
 
@@ -90,6 +90,9 @@ class HMC58X3
     void getValues(float *xyz);
     void getRaw(int *x,int *y,int *z);
     void getRaw(int *xyz);
+    bool requestRaw(uint8_t flags = 0);
+    bool pollRaw(int *x,int *y,int *z);
+    bool pollValues(float *xyz);
     void calibrate(unsigned char gain);     // Original calibrate with a few weaknesses.
     bool calibrate(unsigned char gain,unsigned int n_samples);
     void setMode(unsigned char mode);
@@ -99,6 +102,8 @@ class HMC58X3
   private:
     void writeReg(unsigned char reg, unsigned char val);
     float x_scale,y_scale,z_scale,x_max,y_max,z_max;
+    uint8_t asyncBuffer[6]; // data registers of requestRaw, filled by I2Cdev::poll
+    int8_t asyncCount;
 };
 
 #endif // HMC58X3_h
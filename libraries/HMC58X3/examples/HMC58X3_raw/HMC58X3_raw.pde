@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Uncomment the following line if you are using the HMC5843
 
 #include <Wire.h>
+#include <I2Cdev.h>
 #include <HMC58X3.h>
 
 HMC58X3 magn;
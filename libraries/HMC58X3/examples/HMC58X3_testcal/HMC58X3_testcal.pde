@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <Wire.h>
+#include <I2Cdev.h>
 #include <HMC58X3.h>
 
 int x, y, z;
@@ -102,13 +102,10 @@ int8_t I2Cdev::readBits(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t b
     //    xxx   args: bitStart=4, length=3
     //    010   masked
     //   -> 010 shifted
-    uint8_t count, b, r = 0;
+    uint8_t count, b;
     if ((count = readByte(useSPI, devAddr, regAddr, &b, timeout)) != 0) {
-        for (uint8_t i = bitStart; i > bitStart - length; i--) {
-            r |= (b & (1 << i));
-        }
-        r >>= (bitStart - length + 1);
-        *data = r;
+        // a mask rather than a loop down to bit 0, which never ended for bitStart - length == -1
+        *data = (b >> (bitStart - length + 1)) & ((1 << length) - 1);
     }
     return count;
 }
@@ -130,13 +127,9 @@ int8_t I2Cdev::readBitsW(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t
     //    010           masked
     //           -> 010 shifted
     uint8_t count;
-    uint16_t w, r = 0;
+    uint16_t w;
     if ((count = readWord(useSPI, devAddr, regAddr, &w, timeout)) != 0) {
-        for (uint8_t i = bitStart; i > bitStart - length; i--) {
-            r |= (w & (1 << i));
-        }
-        r >>= (bitStart - length + 1);
-        *data = r;
+        *data = (w >> (bitStart - length + 1)) & ((1UL << length) - 1);
     }
     return count;
 }
@@ -175,6 +168,10 @@ int8_t I2Cdev::readWord(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint16_t
  * @return Number of bytes read (0 indicates failure)
  */
 int8_t I2Cdev::readBytes(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+    #if I2CDEV_SHADOW_DEVICES > 0
+        Shadow *shadow = findShadow(useSPI, devAddr);
+        if (shadow && length == 1 && shadowRead(shadow, regAddr, data)) return 1;
+    #endif
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.print(useSPI ? "SPI (0x" : "I2C 0x");
         Serial.print(devAddr, HEX);
@@ -221,6 +218,9 @@ int8_t I2Cdev::readBytes(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t
 		}
 		digitalWrite(devAddr, HIGH);
 	}
+    #if I2CDEV_SHADOW_DEVICES > 0
+        if (shadow && count > 0) shadowStore(shadow, regAddr, count, data);
+    #endif
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.print(". Done (");
         Serial.print(count, DEC);
@@ -495,6 +495,10 @@ bool I2Cdev::writeBytes(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t l
 		}
 		digitalWrite(devAddr, HIGH);
 	}
+    #if I2CDEV_SHADOW_DEVICES > 0
+        Shadow *shadow = findShadow(useSPI, devAddr);
+        if (shadow) shadowStore(shadow, regAddr, length, data);
+    #endif
 	
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.println(". Done.");
@@ -557,6 +561,10 @@ bool I2Cdev::writeWords(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t l
 		}
 		digitalWrite(devAddr, HIGH);	
 	}
+    #if I2CDEV_SHADOW_DEVICES > 0
+        Shadow *shadow = findShadow(useSPI, devAddr);
+        if (shadow) shadowForget(shadow, regAddr, length * 2);
+    #endif
     #ifdef I2CDEV_SERIAL_DEBUG
         Serial.println(". Done.");
     #endif
@@ -568,6 +576,249 @@ bool I2Cdev::writeWords(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t l
  */
 uint16_t I2Cdev::readTimeout = I2CDEV_DEFAULT_READ_TIMEOUT;
 
+// Transaction queue
+//
+// A transaction is submitted and the caller goes on; poll() runs the one at the
+// head of the queue and those chained to it, back to back, and calls their
+// completion callbacks. The transfers use the blocking calls above, so the wait
+// moves to wherever the sketch calls poll() (e.g. once per loop, after the
+// fusion step) and the reads of several devices go out in one burst of bus
+// activity. A transport that completes in the background (interrupt or DMA
+// driven TWI) replaces the body of poll() only, not the drivers.
+//
+// Submit and poll from the sketch, not from an interrupt handler. A callback may
+// submit (a chained submit then still runs in the same poll()) but not poll.
+
+#define I2CDEV_XFER_WRITE       0x02    // write, otherwise read
+#define I2CDEV_XFER_VALUE       0x04    // write of Transaction::value (submitWriteByte)
+
+I2Cdev::Transaction I2Cdev::queue[I2CDEV_QUEUE_LENGTH];
+uint8_t I2Cdev::queueHead = 0;
+uint8_t I2Cdev::queueTail = 0;
+
+int16_t I2Cdev::submit(uint8_t flags, bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done, void *ctx) {
+    if ((uint8_t)(queueTail - queueHead) >= I2CDEV_QUEUE_LENGTH) return -1;
+    Transaction *t = &queue[queueTail & (I2CDEV_QUEUE_LENGTH - 1)];
+    t->flags = flags;
+    t->useSPI = useSPI;
+    t->devAddr = devAddr;
+    t->regAddr = regAddr;
+    t->length = length;
+    t->data = data;
+    t->done = done;
+    t->ctx = ctx;
+    return queueTail++;
+}
+
+/** Queue a read of multiple bytes, see readBytes().
+ * @param useSPI  true : use SPI
+ * @param devAddr I2C slave device address or Slave Select pin if SPI
+ * @param regAddr First register regAddr to read from
+ * @param length Number of bytes to read
+ * @param data Buffer to store read data in, must stay valid until completion
+ * @param done Optional completion callback, called by poll() with ctx and the number of bytes read
+ * @param ctx Argument of the callback
+ * @param flags I2CDEV_CHAIN to run right after the transaction submitted before
+ * @return Ticket for isDone(), -1 if the queue is full
+ */
+int16_t I2Cdev::submitRead(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done, void *ctx, uint8_t flags) {
+    return submit(flags & I2CDEV_CHAIN, useSPI, devAddr, regAddr, length, data, done, ctx);
+}
+
+/** Queue a write of multiple bytes, see writeBytes(). A length of 0 writes the
+ * register address only, i.e. a command byte.
+ * @param data Buffer to copy new data from, must stay valid until completion
+ * @return Ticket for isDone(), -1 if the queue is full
+ * @see submitRead()
+ */
+int16_t I2Cdev::submitWrite(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done, void *ctx, uint8_t flags) {
+    return submit((flags & I2CDEV_CHAIN) | I2CDEV_XFER_WRITE, useSPI, devAddr, regAddr, length, data, done, ctx);
+}
+
+/** Queue a write of a single byte, the value is kept in the queue.
+ * @return Ticket for isDone(), -1 if the queue is full
+ * @see submitRead()
+ */
+int16_t I2Cdev::submitWriteByte(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t data, I2Cdev_callback done, void *ctx, uint8_t flags) {
+    int16_t ticket = submit((flags & I2CDEV_CHAIN) | I2CDEV_XFER_WRITE | I2CDEV_XFER_VALUE, useSPI, devAddr, regAddr, 1, 0, done, ctx);
+    if (ticket >= 0) queue[ticket & (I2CDEV_QUEUE_LENGTH - 1)].value = data;
+    return ticket;
+}
+
+/** Run the transaction at the head of the queue and the ones chained to it.
+ * A transaction chained to one that failed (fewer bytes than requested) is
+ * skipped and completes with -1.
+ * @return true if transactions remain queued
+ */
+bool I2Cdev::poll() {
+    bool first = true, failed = false;
+    while (queueHead != queueTail) {
+        Transaction t = queue[queueHead & (I2CDEV_QUEUE_LENGTH - 1)];
+        if (!first && !(t.flags & I2CDEV_CHAIN)) break;
+        int8_t count = -1;
+        if (!failed) {
+            if (!(t.flags & I2CDEV_XFER_WRITE)) {
+                count = readBytes(t.useSPI, t.devAddr, t.regAddr, t.length, t.data);
+            } else if (writeBytes(t.useSPI, t.devAddr, t.regAddr, t.length, (t.flags & I2CDEV_XFER_VALUE) ? &t.value : t.data)) {
+                count = t.length;
+            }
+            failed = count != t.length;
+        }
+        // the slot is free before the callback runs, so that it can submit
+        queueHead++;
+        first = false;
+        if (t.done) t.done(t.ctx, count);
+    }
+    return queueHead != queueTail;
+}
+
+/** Run all queued transactions, including those submitted by their callbacks.
+ */
+void I2Cdev::flush() {
+    while (poll());
+}
+
+/** Number of transactions in the queue.
+ */
+uint8_t I2Cdev::pending() {
+    return queueTail - queueHead;
+}
+
+/** Check whether a submitted transaction has completed. Transactions complete
+ * in queue order; a ticket is valid until 127 further transactions completed.
+ * @param ticket Return value of submitRead/submitWrite/submitWriteByte
+ * @return true once the transaction completed (and for the -1 of a rejected submit)
+ */
+bool I2Cdev::isDone(int16_t ticket) {
+    if (ticket < 0) return true;
+    return (int8_t)(queueHead - (uint8_t) ticket) > 0;
+}
+
+/** Completion callback that stores the count in the int8_t ctx points to. A
+ * driver sets that to I2CDEV_PENDING on submit and checks it in its poll.
+ */
+void I2Cdev::storeCount(void *ctx, int8_t count) {
+    *(int8_t *) ctx = count;
+}
+
+// Shadow register files
+//
+// A device with a shadow keeps the last value read from or written to its
+// cacheable registers (configuration, not data or status) in a few slots. A
+// single register read of a cached register, and so the read half of
+// writeBit/writeBits, is served from the slot instead of the bus: a setter
+// costs one bus write instead of a write, a read and a write. Every write goes
+// to the device and updates the slot (write-through); bits the device clears
+// by itself once they took effect (resets) are not kept. The driver invalidates
+// the shadow when it resets the device.
+
+I2Cdev_ShadowStats I2Cdev::shadowStats;
+
+#if I2CDEV_SHADOW_DEVICES > 0
+
+I2Cdev::Shadow I2Cdev::shadows[I2CDEV_SHADOW_DEVICES];
+uint8_t I2Cdev::shadowCount = 0;
+
+/** Keep a shadow of the cacheable registers of a device. Calling it again for
+ * the same device invalidates the shadow.
+ * @param useSPI  true : use SPI
+ * @param devAddr I2C slave device address or Slave Select pin if SPI
+ * @param cacheable Bitmap of the cacheable registers 0-127 in PROGMEM, 16 bytes, register r is bit (r & 7) of byte r >> 3
+ * @param transient Optional PROGMEM list of register, mask pairs ending with a 0 mask: bits the device clears by itself
+ * @return false if all I2CDEV_SHADOW_DEVICES shadows are in use
+ */
+bool I2Cdev::enableShadow(bool useSPI, uint8_t devAddr, const uint8_t *cacheable, const uint8_t *transient) {
+    Shadow *s = findShadow(useSPI, devAddr);
+    if (s == 0) {
+        if (shadowCount >= I2CDEV_SHADOW_DEVICES) return false;
+        s = &shadows[shadowCount++];
+        s->useSPI = useSPI;
+        s->devAddr = devAddr;
+    }
+    s->cacheable = cacheable;
+    s->transient = transient;
+    s->used = 0;
+    s->victim = 0;
+    return true;
+}
+
+/** Forget the cached registers of a device, e.g. after a device reset.
+ * @param useSPI  true : use SPI
+ * @param devAddr I2C slave device address or Slave Select pin if SPI
+ */
+void I2Cdev::invalidateShadow(bool useSPI, uint8_t devAddr) {
+    Shadow *s = findShadow(useSPI, devAddr);
+    if (s) s->used = 0;
+}
+
+I2Cdev::Shadow *I2Cdev::findShadow(bool useSPI, uint8_t devAddr) {
+    for (uint8_t i = 0; i < shadowCount; i++) {
+        if (shadows[i].devAddr == devAddr && shadows[i].useSPI == useSPI) return &shadows[i];
+    }
+    return 0;
+}
+
+bool I2Cdev::shadowRead(Shadow *s, uint8_t regAddr, uint8_t *data) {
+    for (uint8_t i = 0; i < s->used; i++) {
+        if (s->reg[i] == regAddr) {
+            *data = s->value[i];
+            shadowStats.hits++;
+            return true;
+        }
+    }
+    if (regAddr < 128 && (pgm_read_byte(&s->cacheable[regAddr >> 3]) & (1 << (regAddr & 7)))) shadowStats.misses++;
+    return false;
+}
+
+void I2Cdev::shadowStore(Shadow *s, uint8_t regAddr, uint8_t length, const uint8_t *data) {
+    for (uint8_t k = 0; k < length; k++) {
+        uint8_t r = regAddr + k;
+        if (r >= 128 || !(pgm_read_byte(&s->cacheable[r >> 3]) & (1 << (r & 7)))) continue;
+        uint8_t v = data[k];
+        if (s->transient) {
+            for (const uint8_t *t = s->transient; pgm_read_byte(&t[1]); t += 2) {
+                if (pgm_read_byte(&t[0]) == r) v &= ~pgm_read_byte(&t[1]);
+            }
+        }
+        uint8_t i = 0;
+        while (i < s->used && s->reg[i] != r) i++;
+        if (i == s->used) {
+            if (s->used < I2CDEV_SHADOW_SLOTS) {
+                s->used++;
+            } else {
+                i = s->victim;
+                s->victim = (s->victim + 1) % I2CDEV_SHADOW_SLOTS;
+                shadowStats.evictions++;
+            }
+            s->reg[i] = r;
+        }
+        s->value[i] = v;
+    }
+}
+
+void I2Cdev::shadowForget(Shadow *s, uint8_t regAddr, uint8_t length) {
+    for (uint8_t i = 0; i < s->used; ) {
+        if ((uint8_t)(s->reg[i] - regAddr) < length) {
+            s->used--;
+            s->reg[i] = s->reg[s->used];
+            s->value[i] = s->value[s->used];
+        } else {
+            i++;
+        }
+    }
+}
+
+#else
+
+bool I2Cdev::enableShadow(bool useSPI, uint8_t devAddr, const uint8_t *cacheable, const uint8_t *transient) {
+    return false;
+}
+
+void I2Cdev::invalidateShadow(bool useSPI, uint8_t devAddr) {
+}
+
+#endif
+
 #if I2CDEV_IMPLEMENTATION == I2CDEV_BUILTIN_NBWIRE
     // NBWire implementation based heavily on code by Gene Knight <Gene@Telobot.com>
     // Originally posted on the Arduino forum at http://arduino.cc/forum/index.php/topic,70705.0.html
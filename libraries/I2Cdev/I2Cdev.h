@@ -3,6 +3,8 @@
 // 11/1/2011 by Jeff Rowberg <jeff@rowberg.net>
 //
 // Changelog:
+//     2026-10-16 - added shadow register files: enableShadow, invalidateShadow, shadowStats
+//     2026-10-16 - added the transaction queue: submitRead/submitWrite, poll, completion callbacks
 //     2012-10-11 - add bit and bytes SPI R/W functions
 //     2011-11-01 - fix write*Bits mask calculation (thanks sasquatch @ Arduino forums)
 //     2011-10-03 - added automatic Arduino version detection for ease of use
@@ -77,6 +79,40 @@ THE SOFTWARE.
 // 1000ms default read timeout (modify with "I2Cdev::readTimeout = [ms];")
 #define I2CDEV_DEFAULT_READ_TIMEOUT     1000
 
+// -----------------------------------------------------------------------------
+// Transaction queue (submitRead/submitWrite, run by poll)
+// -----------------------------------------------------------------------------
+#ifndef I2CDEV_QUEUE_LENGTH
+    #define I2CDEV_QUEUE_LENGTH         8       // transactions, a power of 2 up to 64
+#endif
+#if (I2CDEV_QUEUE_LENGTH & (I2CDEV_QUEUE_LENGTH - 1)) || I2CDEV_QUEUE_LENGTH > 64
+    #error "I2CDEV_QUEUE_LENGTH must be a power of 2 up to 64"
+#endif
+#define I2CDEV_CHAIN                    0x01    // submit flag: run in the same poll() as the transaction submitted before, skipped if that one failed
+#define I2CDEV_PENDING                  -128    // count set by a driver on submit, replaced by I2Cdev::storeCount on completion
+
+// -----------------------------------------------------------------------------
+// Shadow register files (enableShadow)
+// -----------------------------------------------------------------------------
+#ifndef I2CDEV_SHADOW_DEVICES
+    #define I2CDEV_SHADOW_DEVICES       1       // devices with a shadow register file, 0 to leave it out
+#endif
+#ifndef I2CDEV_SHADOW_SLOTS
+    #define I2CDEV_SHADOW_SLOTS         16      // registers cached per device
+#endif
+
+// counters of all shadow register files, I2Cdev::shadowStats
+struct I2Cdev_ShadowStats {
+    uint32_t hits;          // single register reads served from a shadow, each saves a bus write and a read
+    uint32_t misses;        // single reads of a cacheable register that went to the bus
+    uint32_t evictions;     // cached registers replaced for lack of slots
+    void clear() { hits = misses = evictions = 0; }
+};
+
+// completion callback: count is the number of bytes read or written, -1 on timeout
+// or when the transaction was skipped (chained to a failed one)
+typedef void (*I2Cdev_callback)(void *ctx, int8_t count);
+
 class I2Cdev {
     public:
         I2Cdev();
@@ -100,6 +136,50 @@ class I2Cdev {
         static bool writeWords(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t *data);
 
         static uint16_t readTimeout;
+
+        static int16_t submitRead(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done=0, void *ctx=0, uint8_t flags=0);
+        static int16_t submitWrite(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done=0, void *ctx=0, uint8_t flags=0);
+        static int16_t submitWriteByte(bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t data, I2Cdev_callback done=0, void *ctx=0, uint8_t flags=0);
+        static bool poll();
+        static void flush();
+        static uint8_t pending();
+        static bool isDone(int16_t ticket);
+        static void storeCount(void *ctx, int8_t count);
+
+        static bool enableShadow(bool useSPI, uint8_t devAddr, const uint8_t *cacheable, const uint8_t *transient=0);
+        static void invalidateShadow(bool useSPI, uint8_t devAddr);
+        static I2Cdev_ShadowStats shadowStats;
+
+    private:
+        struct Transaction {
+            uint8_t flags;          // I2CDEV_CHAIN and the I2CDEV_XFER_* bits of I2Cdev.cpp
+            bool useSPI;
+            uint8_t devAddr, regAddr, length;
+            uint8_t value;          // data of submitWriteByte
+            uint8_t *data;
+            I2Cdev_callback done;
+            void *ctx;
+        };
+        static Transaction queue[I2CDEV_QUEUE_LENGTH];
+        static uint8_t queueHead, queueTail;    // free running, the ticket of a transaction is its queueTail
+        static int16_t submit(uint8_t flags, bool useSPI, uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, I2Cdev_callback done, void *ctx);
+
+        #if I2CDEV_SHADOW_DEVICES > 0
+            struct Shadow {
+                bool useSPI;
+                uint8_t devAddr;
+                const uint8_t *cacheable;   // PROGMEM bitmap of the registers 0-127, bit (r & 7) of byte r >> 3
+                const uint8_t *transient;   // PROGMEM register, self-clearing bits pairs, ends with a 0 mask
+                uint8_t used, victim;
+                uint8_t reg[I2CDEV_SHADOW_SLOTS], value[I2CDEV_SHADOW_SLOTS];
+            };
+            static Shadow shadows[I2CDEV_SHADOW_DEVICES];
+            static uint8_t shadowCount;
+            static Shadow *findShadow(bool useSPI, uint8_t devAddr);
+            static bool shadowRead(Shadow *s, uint8_t regAddr, uint8_t *data);
+            static void shadowStore(Shadow *s, uint8_t regAddr, uint8_t length, const uint8_t *data);
+            static void shadowForget(Shadow *s, uint8_t regAddr, uint8_t length);
+        #endif
 };
 
 #if I2CDEV_IMPLEMENTATION == I2CDEV_BUILTIN_NBWIRE
@@ -16,6 +16,8 @@ LPS331::LPS331(void)
   // Pololu board pulls SA0 high, so default assumption is that it is
   // high
   address = LPS331AP_ADDRESS_SA0_HIGH;
+  measPress = 0;
+  measTemp = 0;
 }
 
 // Public Methods ////////////////////////////////////////////////////
@@ -139,6 +141,35 @@ int16_t LPS331::readTemperatureRaw(void)
   return (int16_t)th << 8 | tl;
 }
 
+// starts a one-shot conversion if the output data rate is set to one-shot
+void LPS331::startMeasurement(void)
+{
+  if (!(readReg(LPS331_CTRL_REG1) & 0x70)) writeReg(LPS331_CTRL_REG2, 0x01);
+}
+
+// checks STATUS_REG without waiting; once pressure and temperature are both
+// available reads them in one transfer and returns true
+bool LPS331::pollMeasurement(void)
+{
+  if ((readReg(LPS331_STATUS_REG) & 0x03) != 0x03) return false;
+
+  Wire.beginTransmission(address);
+  // assert MSB to enable register address auto-increment
+  Wire.write(LPS331_PRESS_OUT_XL | (1 << 7));
+  Wire.endTransmission();
+  if (Wire.requestFrom(address, (byte)5) != 5) return false;
+
+  uint8_t pxl = Wire.read();
+  uint8_t pl = Wire.read();
+  uint8_t ph = Wire.read();
+  uint8_t tl = Wire.read();
+  uint8_t th = Wire.read();
+
+  measPress = (float)((int32_t)(int8_t)ph << 16 | (uint16_t)pl << 8 | pxl) / 4096;
+  measTemp = 42.5 + (float)(int16_t)((uint16_t)th << 8 | tl) / 480.;
+  return true;
+}
+
 // converts pressure in mbar to altitude in meters, using 1976 US
 // Standard Atmosphere model (note that this formula only applies to a
 // height of 11 km, or about 36000 ft)
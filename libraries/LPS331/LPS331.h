@@ -64,11 +64,19 @@ class LPS331
     float readTemperatureF(void);
     int16_t readTemperatureRaw(void);
 
+    // non-blocking measurement: in one-shot mode startMeasurement triggers a
+    // conversion, in continuous mode (enableDefault) it does nothing
+    void startMeasurement(void);
+    bool pollMeasurement(void);
+    float getMeasuredPressure(void) { return measPress; }
+    float getMeasuredTemperature(void) { return measTemp; }
+
     static float pressureToAltitudeMeters(float pressure_mbar, float altimeter_setting_mbar = 1013.25);
     static float pressureToAltitudeFeet(float pressure_inHg, float altimeter_setting_inHg = 29.9213);
 
   private:
     byte address;
+    float measPress, measTemp;
 
     bool autoDetectAddress(void);
     bool testWhoAmI(void);
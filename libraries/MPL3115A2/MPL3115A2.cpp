@@ -38,6 +38,8 @@
 MPL3115A2::MPL3115A2()
 {
   //Set initial values for private vars
+  measPress = 0;
+  measTemp = 0;
 }
 
 //Begin
@@ -253,6 +255,35 @@ void MPL3115A2::enableEventFlags()
   IIC_Write(PT_DATA_CFG, 0x07); // Enable all three pressure and temp event flags 
 }
 
+//Starts a one shot conversion, the oversample rate sets how long it takes (6ms at 1 sample
+//to 512ms at 128). pollMeasurement tells when it is done.
+void MPL3115A2::startMeasurement()
+{
+  toggleOneShot();
+}
+
+//Checks PDR and TDR without waiting, reads pressure and temperature in one go once both are set
+bool MPL3115A2::pollMeasurement()
+{
+  if((IIC_Read(STATUS) & 0x06) != 0x06) return false;
+
+  Wire.beginTransmission(MPL3115A2_ADDRESS);
+  Wire.write(OUT_P_MSB);  // Address of data to get
+  Wire.endTransmission(false); // Repeated start, see IIC_Read
+  if (Wire.requestFrom(MPL3115A2_ADDRESS, 5) != 5) return false;
+
+  byte p_msb = Wire.read();
+  byte p_csb = Wire.read();
+  byte p_lsb = Wire.read();
+  byte t_msb = Wire.read();
+  byte t_lsb = Wire.read();
+
+  // pressure: unsigned 18.2 fixed point Pa in the top 20 bits, temperature: signed 8.4 C
+  measPress = (((long)p_msb<<16 | (long)p_csb<<8 | (long)p_lsb) >> 4) / 4.0;
+  measTemp = (int16_t)((word)t_msb<<8 | t_lsb) / 256.0;
+  return true;
+}
+
 //Clears then sets the OST bit which causes the sensor to immediately take another reading
 //Needed to sample faster than 1Hz
 void MPL3115A2::toggleOneShot(void)
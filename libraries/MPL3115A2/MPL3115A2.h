@@ -88,6 +88,12 @@ public:
   void setOversampleRate(byte); // Sets the # of samples from 1 to 128. See datasheet.
   void enableEventFlags(); // Sets the fundamental event flags. Required during setup.
 
+  // non-blocking measurement in barometer mode, no delay and no polling loop
+  void startMeasurement(); // Starts a one shot conversion (OST), returns at once.
+  bool pollMeasurement(); // True once pressure and temperature are ready, reads them.
+  float getMeasuredPressure() { return measPress; } // Pa of the last measurement
+  float getMeasuredTemperature() { return measTemp; } // Celsius of the last measurement
+
   // added by https://github.com/mariocannistra
   // to declare the functions by Michael Lange on mbed.org
   int8_t offsetAltitude();
@@ -113,6 +119,7 @@ private:
   void IIC_Write(byte regAddr, byte value);
 
   //Private Variables
+  float measPress, measTemp;
 
 };
 
@@ -42,6 +42,7 @@ THE SOFTWARE.
  */
 MPU60X0::MPU60X0() {
   devAddr = MPU60X0_DEFAULT_ADDRESS;
+  asyncCount = 0;
 }
 
 /** Specific address constructor.
@@ -54,7 +55,22 @@ MPU60X0::MPU60X0() {
 MPU60X0::MPU60X0(bool useSPI, uint8_t address) {
   bSPI = useSPI;
   devAddr = address;
-}
+  asyncCount = 0;
+}
+
+// registers kept in the I2Cdev shadow: SMPLRT_DIV..I2C_SLV4_CTRL, INT_PIN_CFG,
+// INT_ENABLE, I2C_SLV0_DO..I2C_MST_DELAY_CTRL, MOT_DETECT_CTRL..PWR_MGMT_2
+static const uint8_t shadowCacheable[16] PROGMEM = {
+    0x00, 0x00, 0x00, 0xFE, 0xFF, 0xFF, 0x9F, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0xF8, 0x1E, 0x00, 0x00
+};
+// bits the device clears by itself: I2C_SLV4_EN, the USER_CTRL resets, DEVICE_RESET
+static const uint8_t shadowTransient[] PROGMEM = {
+    MPU60X0_RA_I2C_SLV4_CTRL, 0x80,
+    MPU60X0_RA_USER_CTRL, 0x0F,
+    MPU60X0_RA_PWR_MGMT_1, 0x80,
+    0, 0
+};
 
 /** Power on and prepare for general usage.
  * This will activate the device and take it out of sleep mode (which must be done
@@ -64,6 +80,7 @@ MPU60X0::MPU60X0(bool useSPI, uint8_t address) {
  * the default internal clock source.
  */
 void MPU60X0::initialize() {
+    I2Cdev::enableShadow(bSPI, devAddr, shadowCacheable, shadowTransient);
     // SPI Configuration
 	if (bSPI) {
       SPI.begin();
@@ -91,7 +108,7 @@ void MPU60X0::initialize() {
  * 
  */
 void MPU60X0::initialize9250() {
-	uint8_t data;
+    I2Cdev::enableShadow(bSPI, devAddr, shadowCacheable, shadowTransient);
     // SPI Configuration
 	if (bSPI) {
       SPI.begin();
@@ -1751,7 +1768,14 @@ bool MPU60X0::getIntDataReadyStatus() {
 // ACCEL_*OUT_* registers
 
 /** Get raw 9-axis motion sensor readings (accel/gyro/compass).
- * FUNCTION NOT FULLY IMPLEMENTED YET.
+ * Reads accel, temperature, gyro and the magnetometer data the auxiliary I2C
+ * master left in EXT_SENS_DATA_00..07 in one burst, so the magnetometer costs
+ * no transaction and no conversion wait of its own. Requires
+ * setAuxMagnetometer(); without it the magnetometer values are meaningless.
+ * The magnetometer values are those of the last aux read; the return value
+ * tells whether it found a new measurement. A measurement is reported fresh
+ * until the next aux read, i.e. twice if the sensors are read faster than the
+ * magnetometer rate.
  * @param ax 16-bit signed integer container for accelerometer X-axis value
  * @param ay 16-bit signed integer container for accelerometer Y-axis value
  * @param az 16-bit signed integer container for accelerometer Z-axis value
@@ -1761,14 +1785,18 @@ bool MPU60X0::getIntDataReadyStatus() {
  * @param mx 16-bit signed integer container for magnetometer X-axis value
  * @param my 16-bit signed integer container for magnetometer Y-axis value
  * @param mz 16-bit signed integer container for magnetometer Z-axis value
+ * @param t 16-bit signed integer container for the raw temperature, may be 0
+ * @return MPU60X0_MAG_FRESH and MPU60X0_MAG_OVERFLOW flags
  * @see getMotion6()
- * @see getAcceleration()
- * @see getRotation()
+ * @see setAuxMagnetometer()
  * @see MPU60X0_RA_ACCEL_XOUT_H
  */
-void MPU60X0::getMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz) {
-    getMotion6(ax, ay, az, gx, gy, gz);
-    // TODO: magnetometer integration
+uint8_t MPU60X0::getMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz, int16_t* t) {
+    // ACCEL_XOUT_H..GYRO_ZOUT_L are followed by EXT_SENS_DATA_00
+    uint8_t data[14 + MPU60X0_AUX_MAG_LENGTH];
+    I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_ACCEL_XOUT_H, sizeof(data), data);
+    decodeMotion(data, ax, ay, az, gx, gy, gz, t);
+    return decodeAuxMagnetometer(&data[14], mx, my, mz);
 }
 /** Get raw 6-axis motion sensor readings (accel/gyro).
  * Retrieves all currently available motion sensor values.
@@ -1783,13 +1811,74 @@ void MPU60X0::getMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int
  * @see MPU60X0_RA_ACCEL_XOUT_H
  */
 void MPU60X0::getMotion6(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz) {
-   I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_ACCEL_XOUT_H, 14, buffer);
-    *ax = (((int16_t)buffer[0]) << 8) | buffer[1];
-    *ay = (((int16_t)buffer[2]) << 8) | buffer[3];
-    *az = (((int16_t)buffer[4]) << 8) | buffer[5];
-    *gx = (((int16_t)buffer[8]) << 8) | buffer[9];
-    *gy = (((int16_t)buffer[10]) << 8) | buffer[11];
-    *gz = (((int16_t)buffer[12]) << 8) | buffer[13];
+    I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_ACCEL_XOUT_H, 14, buffer);
+    decodeMotion(buffer, ax, ay, az, gx, gy, gz, 0);
+}
+/** Get raw 6-axis motion sensor readings and the raw temperature.
+ * TEMP_OUT_H/L lie between the accel and gyro registers, so the burst read of
+ * getMotion6() already holds them: this saves the transaction of a
+ * getTemperature() after getMotion6().
+ * @param t 16-bit signed integer container for the raw temperature, see getTemperature()
+ * @see getMotion6()
+ * @see getTemperature()
+ */
+void MPU60X0::getMotion7(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t) {
+    I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_ACCEL_XOUT_H, 14, buffer);
+    decodeMotion(buffer, ax, ay, az, gx, gy, gz, t);
+}
+/** Queue a read of the 6-axis motion sensor registers (I2Cdev::submitRead).
+ * The read runs in I2Cdev::poll(), pollMotion6() returns its values. Does
+ * nothing while a queued read of this device is pending.
+ * @param flags I2CDEV_CHAIN to run in the same poll as the transaction queued before
+ * @return true if the read was queued
+ * @see getMotion6()
+ */
+bool MPU60X0::requestMotion6(uint8_t flags) {
+    return requestMotion(14, flags);
+}
+/** Queue a read of the 6-axis motion sensor registers and of the magnetometer
+ * read by the auxiliary I2C master, see getMotion9() and requestMotion6().
+ * @return true if the read was queued
+ */
+bool MPU60X0::requestMotion9(uint8_t flags) {
+    return requestMotion(sizeof(asyncBuffer), flags);
+}
+bool MPU60X0::requestMotion(uint8_t length, uint8_t flags) {
+    if (asyncCount == I2CDEV_PENDING) return false;
+    asyncCount = I2CDEV_PENDING;
+    if (I2Cdev::submitRead(bSPI, devAddr, MPU60X0_RA_ACCEL_XOUT_H, length, asyncBuffer, I2Cdev::storeCount, &asyncCount, flags) < 0) {
+        asyncCount = 0;
+        return false;
+    }
+    return true;
+}
+/** Get the values of the read queued by requestMotion6() or requestMotion9().
+ * @return true once, when the read has completed
+ */
+bool MPU60X0::pollMotion6(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t) {
+    if (asyncCount < 14) return false;
+    asyncCount = 0;
+    decodeMotion(asyncBuffer, ax, ay, az, gx, gy, gz, t);
+    return true;
+}
+/** Get the values of the read queued by requestMotion9().
+ * @return 0 while the read is pending (or failed), MPU60X0_MOTION_READY once
+ * it completed, or'ed with the MPU60X0_MAG_* flags of getMotion9()
+ */
+uint8_t MPU60X0::pollMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz, int16_t* t) {
+    if (asyncCount != (int8_t) sizeof(asyncBuffer)) return 0;
+    asyncCount = 0;
+    decodeMotion(asyncBuffer, ax, ay, az, gx, gy, gz, t);
+    return MPU60X0_MOTION_READY | decodeAuxMagnetometer(&asyncBuffer[14], mx, my, mz);
+}
+void MPU60X0::decodeMotion(const uint8_t *data, int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t) {
+    *ax = (((int16_t)data[0]) << 8) | data[1];
+    *ay = (((int16_t)data[2]) << 8) | data[3];
+    *az = (((int16_t)data[4]) << 8) | data[5];
+    if (t) *t = (((int16_t)data[6]) << 8) | data[7];
+    *gx = (((int16_t)data[8]) << 8) | data[9];
+    *gy = (((int16_t)data[10]) << 8) | data[11];
+    *gz = (((int16_t)data[12]) << 8) | data[13];
 }
 /** Get 3-axis accelerometer readings.
  * These registers store the most recent accelerometer measurements.
@@ -2409,6 +2498,7 @@ void MPU60X0::resetSensors() {
  */
 void MPU60X0::reset() {
     I2Cdev::writeBit(bSPI, devAddr, MPU60X0_RA_PWR_MGMT_1, MPU60X0_PWR1_DEVICE_RESET_BIT, true);
+    I2Cdev::invalidateShadow(bSPI, devAddr); // all registers are back to their defaults
 	delay(50);
 }
 /** Get sleep mode status.
@@ -2749,6 +2839,107 @@ void MPU60X0::setFIFOByte(uint8_t data) {
     I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_FIFO_R_W, data);
 }
 
+// FIFO burst acquisition
+
+/** Configure the FIFO for burst acquisition of accel, temperature and gyro.
+ * Every sample is pushed into the FIFO as a 14 byte MOTION7 frame in register
+ * order (ACCEL_XOUT_H through GYRO_ZOUT_L), which is the same layout returned
+ * by a getMotion6() burst read. The FIFO is flushed so the first byte read
+ * afterwards is always the start of a frame.
+ * @param enabled True to start filling the FIFO, false to stop and flush it
+ * @see getFIFOFrames()
+ * @see MPU60X0_FIFO_EN_MOTION7
+ */
+void MPU60X0::setFIFOBurstEnabled(bool enabled) {
+    setFIFOEnabled(false);
+    I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_FIFO_EN, enabled ? MPU60X0_FIFO_EN_MOTION7 : 0);
+    resetFIFO();
+    if (enabled) setFIFOEnabled(true);
+}
+
+/** Read whole MOTION7 frames out of the FIFO.
+ * Reads at most maxFrames frames, split into transactions no longer than
+ * MPU60X0_FIFO_CHUNK_SIZE bytes. Frames that do not fit stay in the FIFO for
+ * the next call. Once the FIFO has filled up the device keeps overwriting the
+ * oldest bytes and frame alignment is lost, so in that case the FIFO is reset
+ * and -1 returned.
+ * @param data Buffer of at least maxFrames * MPU60X0_FIFO_FRAME_SIZE bytes
+ * @param maxFrames Maximum number of frames to read
+ * @return Number of frames read, or -1 if the FIFO overflowed and was reset
+ * @see setFIFOBurstEnabled()
+ */
+int16_t MPU60X0::getFIFOFrames(uint8_t *data, uint8_t maxFrames) {
+    uint16_t count = getFIFOCount();
+    if (count >= MPU60X0_FIFO_SIZE) {
+        resetFIFO();
+        return -1;
+    }
+    uint8_t frames = count / MPU60X0_FIFO_FRAME_SIZE;
+    if (frames > maxFrames) frames = maxFrames;
+    uint16_t length = (uint16_t)frames * MPU60X0_FIFO_FRAME_SIZE;
+    for (uint16_t i = 0; i < length; i += MPU60X0_FIFO_CHUNK_SIZE) {
+        uint8_t chunk = (length - i < MPU60X0_FIFO_CHUNK_SIZE) ? length - i : MPU60X0_FIFO_CHUNK_SIZE;
+        I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_FIFO_R_W, chunk, data + i);
+    }
+    return frames;
+}
+
+// Auxiliary magnetometer
+
+/** Read an AK8975/AK8963 on the auxiliary bus with the internal I2C master.
+ * SLV0 reads ST1 through ST2 into EXT_SENS_DATA_00..07 every divider samples,
+ * from where getMotion9() picks them up with the accel and gyro data. With
+ * trigger set SLV1 then writes CNTL to start the next single measurement
+ * (AK8975); an AK8963 in continuous mode needs no trigger. The magnetometer has
+ * to be set up through the bypass switch first, this turns the bypass off.
+ * @param address I2C address of the magnetometer
+ * @param trigger True to start a single measurement after every read
+ * @param divider Samples per magnetometer read, 1 to 32, e.g. 10 for 100Hz at
+ *        a 1kHz sample rate (AK8975 single measurements take 7.3ms)
+ * @see getMotion9()
+ * @see getAuxMagnetometer()
+ */
+void MPU60X0::setAuxMagnetometer(uint8_t address, bool trigger, uint8_t divider) {
+    if (divider < 1) divider = 1;
+    if (divider > 32) divider = 32;
+    setI2CMasterModeEnabled(false);
+    setI2CBypassEnabled(false);
+    setMasterClockSpeed(13);                // 400kHz
+    I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV0_ADDR, 0x80 | address);
+    I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV0_REG, MPU60X0_AUX_MAG_REG);
+    I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV0_CTRL, 0x80 | MPU60X0_AUX_MAG_LENGTH);
+    if (trigger) {
+        I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV1_ADDR, address);
+        I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV1_REG, MPU60X0_AUX_MAG_CNTL);
+        I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV1_DO, MPU60X0_AUX_MAG_SINGLE);
+        I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV1_CTRL, 0x81);
+    } else {
+        I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_SLV1_CTRL, 0);
+    }
+    setSlave4MasterDelay(divider - 1);
+    I2Cdev::writeByte(bSPI, devAddr, MPU60X0_RA_I2C_MST_DELAY_CTRL, divider > 1 ? 0x03 : 0);
+    setI2CMasterModeEnabled(true);
+}
+
+/** Read the magnetometer data of the last aux read on its own.
+ * For when accel and gyro come from the FIFO, see getMotion9().
+ * @return MPU60X0_MAG_FRESH and MPU60X0_MAG_OVERFLOW flags
+ * @see setAuxMagnetometer()
+ */
+uint8_t MPU60X0::getAuxMagnetometer(int16_t* mx, int16_t* my, int16_t* mz) {
+    uint8_t data[MPU60X0_AUX_MAG_LENGTH];
+    I2Cdev::readBytes(bSPI, devAddr, MPU60X0_RA_EXT_SENS_DATA_00, sizeof(data), data);
+    return decodeAuxMagnetometer(data, mx, my, mz);
+}
+
+uint8_t MPU60X0::decodeAuxMagnetometer(const uint8_t *ext, int16_t* mx, int16_t* my, int16_t* mz) {
+    // ST1, HXL, HXH, HYL, HYH, HZL, HZH, ST2: little endian
+    *mx = (((int16_t)ext[2]) << 8) | ext[1];
+    *my = (((int16_t)ext[4]) << 8) | ext[3];
+    *mz = (((int16_t)ext[6]) << 8) | ext[5];
+    return ((ext[0] & 0x01) ? MPU60X0_MAG_FRESH : 0) | ((ext[7] & 0x08) ? MPU60X0_MAG_OVERFLOW : 0);
+}
+
 // WHO_AM_I register
 
 /** Get Device ID.
@@ -172,6 +172,26 @@ THE SOFTWARE.
 #define MPU60X0_RA_FIFO_R_W         0x74
 #define MPU60X0_RA_WHO_AM_I         0x75
 
+#define MPU60X0_FIFO_SIZE           1024    // FIFO capacity in bytes
+#define MPU60X0_FIFO_EN_MOTION7     0xF8    // FIFO_EN value for TEMP, XG, YG, ZG and ACCEL
+#define MPU60X0_FIFO_FRAME_SIZE     14      // bytes per MOTION7 frame, same layout as ACCEL_XOUT_H..GYRO_ZOUT_L
+
+// largest whole number of FIFO frames that fits in one Wire transaction
+#ifdef BUFFER_LENGTH
+    #define MPU60X0_FIFO_CHUNK_SIZE ((BUFFER_LENGTH / MPU60X0_FIFO_FRAME_SIZE) * MPU60X0_FIFO_FRAME_SIZE)
+#else
+    #define MPU60X0_FIFO_CHUNK_SIZE (2 * MPU60X0_FIFO_FRAME_SIZE)
+#endif
+
+// AK8975/AK8963 magnetometer read by the auxiliary I2C master (setAuxMagnetometer)
+#define MPU60X0_AUX_MAG_REG         0x02    // ST1, first register of the read
+#define MPU60X0_AUX_MAG_LENGTH      8       // ST1, HXL..HZH, ST2 in EXT_SENS_DATA_00..07
+#define MPU60X0_AUX_MAG_CNTL        0x0A    // CNTL, written by SLV1 to start a single measurement
+#define MPU60X0_AUX_MAG_SINGLE      0x01
+#define MPU60X0_MAG_FRESH           0x01    // getMotion9: the last aux read found a new measurement (ST1 DRDY)
+#define MPU60X0_MAG_OVERFLOW        0x02    // getMotion9: magnetic sensor overflow (ST2 HOFL), values invalid
+#define MPU60X0_MOTION_READY        0x80    // pollMotion9: the queued read completed, values set
+
 #define MPU60X0_TC_PWR_MODE_BIT     7
 #define MPU60X0_TC_OFFSET_BIT       6
 #define MPU60X0_TC_OFFSET_LENGTH    6
@@ -601,8 +621,13 @@ class MPU60X0 {
         bool getIntDataReadyStatus();
 
         // ACCEL_*OUT_* registers
-        void getMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz);
+        uint8_t getMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz, int16_t* t = 0);
         void getMotion6(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz);
+        void getMotion7(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t);
+        bool requestMotion6(uint8_t flags = 0);
+        bool requestMotion9(uint8_t flags = 0);
+        bool pollMotion6(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t = 0);
+        uint8_t pollMotion9(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* mx, int16_t* my, int16_t* mz, int16_t* t = 0);
         void getAcceleration(int16_t* x, int16_t* y, int16_t* z);
         int16_t getAccelerationX();
         int16_t getAccelerationY();
@@ -700,6 +725,14 @@ class MPU60X0 {
 		
         void setFIFOByte(uint8_t data);
 
+        // FIFO burst acquisition (MOTION7 frames)
+        void setFIFOBurstEnabled(bool enabled);
+        int16_t getFIFOFrames(uint8_t *data, uint8_t maxFrames);
+
+        // Auxiliary magnetometer (AK8975/AK8963 through the I2C master)
+        void setAuxMagnetometer(uint8_t address, bool trigger, uint8_t divider);
+        uint8_t getAuxMagnetometer(int16_t* mx, int16_t* my, int16_t* mz);
+
         // WHO_AM_I register
         uint8_t getDeviceID();
         void setDeviceID(uint8_t id);
@@ -914,7 +947,12 @@ class MPU60X0 {
 		bool	bSPI;
         uint8_t devAddr;
         uint8_t buffer[14];
+        uint8_t asyncBuffer[14 + MPU60X0_AUX_MAG_LENGTH];   // requestMotion6/9, filled by I2Cdev::poll
+        int8_t asyncCount;
 
+        bool requestMotion(uint8_t length, uint8_t flags);
+        static void decodeMotion(const uint8_t *data, int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* t);
+        static uint8_t decodeAuxMagnetometer(const uint8_t *ext, int16_t* mx, int16_t* my, int16_t* mz);
 };
 
 
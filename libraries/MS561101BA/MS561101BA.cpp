@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "MS561101BA.h"
+#include <I2Cdev.h>
 #define CONVERSION_TIME 10000l // conversion time in microseconds
 
 /*
@@ -41,7 +42,11 @@ void printLongLong(uint64_t n, uint8_t base) {
 
 
 MS561101BA::MS561101BA() {
-  ;
+  measState = MS561101BA_IDLE;
+  measQueued = false;
+  measCount = 0;
+  measPress = 0;
+  measTemp = 0;
 }
 
 void MS561101BA::init(uint8_t address) {  
@@ -139,6 +144,123 @@ uint32_t MS561101BA::rawTemperature(uint8_t OSR) {
 }
 
 
+/**
+ * Starts a measurement: a temperature (D2) and then a pressure (D1) conversion.
+ * Returns at once, pollMeasurement() moves on to the next step when a
+ * conversion is done. Does nothing while a measurement is in progress.
+*/
+void MS561101BA::startMeasurement(uint8_t OSR) {
+  if(measState != MS561101BA_IDLE) return;
+  measOSR = OSR;
+  if(measQueued) {
+    if(submitConversion(MS561101BA_D2 + OSR, 0)) measState = MS561101BA_CONV_TEMP;
+    return;
+  }
+  startConversion(MS561101BA_D2 + OSR);
+  measStart = micros();
+  measState = MS561101BA_CONV_TEMP;
+}
+
+/**
+ * Advances the measurement started by startMeasurement() without waiting:
+ * reads the ADC once the running conversion has had its maximum conversion
+ * time (0.6ms at OSR 256 to 9.04ms at OSR 4096) and starts the next one.
+ *
+ * @return true once the measurement is complete, its results are then
+ * returned by getMeasuredPressure() and getMeasuredTemperature()
+*/
+static const uint16_t conv_us[5] = {600, 1170, 2280, 4540, 9040};
+
+bool MS561101BA::pollMeasurement() {
+  if(measState == MS561101BA_IDLE) return false;
+  if(measQueued) return pollQueued();
+  if(micros() - measStart < conv_us[measOSR >> 1]) return false;
+  
+  if(measState == MS561101BA_CONV_TEMP) {
+    measD2 = getConversion(MS561101BA_D2 + measOSR);
+    startConversion(MS561101BA_D1 + measOSR);
+    measStart = micros();
+    measState = MS561101BA_CONV_PRESS;
+    return false;
+  }
+  
+  compensate(getConversion(MS561101BA_D1 + measOSR));
+  measState = MS561101BA_IDLE;
+  return true;
+}
+
+/**
+ * Runs the bus transfers of startMeasurement() and pollMeasurement() through
+ * the I2Cdev transaction queue: the ADC reads and conversion commands are
+ * submitted and done in I2Cdev::poll(), e.g. chained to the other sensor reads
+ * of a loop. Set while no measurement is in progress.
+*/
+void MS561101BA::setQueued(bool queued) {
+  if(measState == MS561101BA_IDLE) measQueued = queued;
+}
+
+// the conversion time counts from the completion of the command
+void MS561101BA::conversionStarted(void *ctx, int8_t count) {
+  MS561101BA *baro = (MS561101BA *) ctx;
+  baro->measStart = micros();
+  baro->measCount = count;
+}
+
+bool MS561101BA::submitConversion(uint8_t command, uint8_t flags) {
+  measCount = I2CDEV_PENDING;
+  if(I2Cdev::submitWrite(false, _addr, command, 0, 0, conversionStarted, this, flags) < 0) {
+    measCount = 0;
+    return false;
+  }
+  return true;
+}
+
+// pollMeasurement with the queue: measCount is I2CDEV_PENDING until the queued
+// transfers of the state are done, negative if one failed
+bool MS561101BA::pollQueued() {
+  if(measCount == I2CDEV_PENDING) return false;
+  if(measCount < 0) { // start over
+    measState = MS561101BA_IDLE;
+    startMeasurement(measOSR);
+    return false;
+  }
+  
+  switch(measState) {
+    case MS561101BA_CONV_TEMP:
+    case MS561101BA_CONV_PRESS:
+      if(micros() - measStart < conv_us[measOSR >> 1]) return false;
+      // the D2 read and the D1 command go together
+      if(I2Cdev::pending() + (measState == MS561101BA_CONV_TEMP ? 2 : 1) > I2CDEV_QUEUE_LENGTH) return false;
+      measCount = I2CDEV_PENDING;
+      I2Cdev::submitRead(false, _addr, 0, MS561101BA_D1D2_SIZE, measRaw, I2Cdev::storeCount, &measCount);
+      if(measState == MS561101BA_CONV_TEMP) {
+        submitConversion(MS561101BA_D1 + measOSR, I2CDEV_CHAIN);
+        measState = MS561101BA_READ_TEMP;
+      }
+      else {
+        measState = MS561101BA_READ_PRESS;
+      }
+      return false;
+    case MS561101BA_READ_TEMP:
+      measD2 = (uint32_t)measRaw[0] << 16 | (uint32_t)measRaw[1] << 8 | measRaw[2];
+      measState = MS561101BA_CONV_PRESS;
+      return false;
+    default:
+      compensate((uint32_t)measRaw[0] << 16 | (uint32_t)measRaw[1] << 8 | measRaw[2]);
+      measState = MS561101BA_IDLE;
+      return true;
+  }
+}
+
+// see datasheet page 7 for formulas, as getPressure and getTemperature
+void MS561101BA::compensate(uint32_t d1) {
+  int64_t dT = (int32_t)(measD2 - ((uint32_t)_Cal[4] << 8));
+  int64_t off  = ((uint32_t)_Cal[1] <<16) + ((dT * _Cal[3]) >> 7);
+  int64_t sens = ((uint32_t)_Cal[0] <<15) + ((dT * _Cal[2]) >> 8);
+  measTemp = (2000 + ((dT * _Cal[5]) >> 23)) / 100.0;
+  measPress = ((( (d1 * sens ) >> 21) - off) >> 15) / 100.0;
+}
+
 // see page 11 of the datasheet
 void MS561101BA::startConversion(uint8_t command) {
   // initialize pressure conversion
@@ -61,6 +61,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MS561101BA_PROM_REG_COUNT 6 // number of registers in the PROM
 #define MS561101BA_PROM_REG_SIZE 2 // size in bytes of a prom registry.
 
+// states of the non-blocking measurement (startMeasurement/pollMeasurement)
+#define MS561101BA_IDLE 0
+#define MS561101BA_CONV_TEMP 1  // D2 conversion running
+#define MS561101BA_CONV_PRESS 2 // D1 conversion running
+#define MS561101BA_READ_TEMP 3  // queued: D2 ADC read and D1 command queued
+#define MS561101BA_READ_PRESS 4 // queued: D1 ADC read queued
+
 
 
 class MS561101BA {
@@ -75,9 +82,26 @@ class MS561101BA {
     int readPROM();
     void reset();
     uint32_t lastPresConv, lastTempConv;
+    
+    // non-blocking measurement, not to be mixed with the getters above
+    void startMeasurement(uint8_t OSR);
+    bool pollMeasurement();
+    float getMeasuredPressure() { return measPress; }
+    float getMeasuredTemperature() { return measTemp; }
+    void setQueued(bool queued);
   private:
     void startConversion(uint8_t command);
     uint32_t getConversion(uint8_t command);
+    bool submitConversion(uint8_t command, uint8_t flags);
+    bool pollQueued();
+    void compensate(uint32_t d1);
+    static void conversionStarted(void *ctx, int8_t count);
+    bool measQueued;
+    int8_t measCount;
+    uint8_t measRaw[MS561101BA_D1D2_SIZE];
+    uint8_t measState, measOSR;
+    uint32_t measStart, measD2;
+    float measPress, measTemp;
     uint8_t _addr;
     uint16_t _Cal[MS561101BA_PROM_REG_COUNT];
     uint32_t pressCache, tempCache;
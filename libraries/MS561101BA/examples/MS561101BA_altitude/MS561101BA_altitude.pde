@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //#define DEBUG_V
 
 #include <Wire.h>
+#include <I2Cdev.h>
 //#include <DebugUtils.h>
 #include <MS561101BA.h>
 
@@ -41,7 +41,8 @@ BMP085::BMP085() {
   _Pa_Offset = 0;               // 1hPa = 100Pa = 1mbar
   
   oldEMA = 0;
-
+  _measState = BMP085_IDLE;
+  _measPressure = 0;
 }
 
 void BMP085::init() {  
@@ -119,13 +120,18 @@ void BMP085::getTemperature(int32_t *_Temperature) {
 }
 
 void BMP085::calcTrueTemperature(){
-  long ut,x1,x2;
+  long ut;
 
   //read Raw Temperature
   writemem(CONTROL, READ_TEMPERATURE);
   delay(5);                                         // min. 4.5ms read Temp delay
   readmem(CONTROL_OUTPUT, 2, _buff); 
   ut = ((long)_buff[0] << 8 | ((long)_buff[1]));    // uncompensated temperature value
+  calcB5(ut);
+}
+
+void BMP085::calcB5(long ut) {
+  long x1,x2;
   
   // calculate temperature
   x1 = ((long)ut - ac6) * ac5 >> 15;
@@ -134,9 +140,7 @@ void BMP085::calcTrueTemperature(){
 }
 
 void BMP085::calcTruePressure(long *_TruePressure) {
-  long up,x1,x2,x3,b3,b6,p;
-  unsigned long b4,b7;
-  int32_t tmp; 
+  long up;
 
   #if AUTO_UPDATE_TEMPERATURE
   calcTrueTemperature();        // b5 update 
@@ -147,6 +151,13 @@ void BMP085::calcTruePressure(long *_TruePressure) {
   delay(_pressure_waittime[_oss]);    
   readmem(CONTROL_OUTPUT, 3, _buff);  
   up = ((((long)_buff[0] <<16) | ((long)_buff[1] <<8) | ((long)_buff[2])) >> (8-_oss)); // uncompensated pressure value
+  *_TruePressure = calcPressure(up);
+}
+
+long BMP085::calcPressure(long up) {
+  long x1,x2,x3,b3,b6,p;
+  unsigned long b4,b7;
+  int32_t tmp; 
   
   // calculate true pressure
   b6 = b5 - 4000;             // b5 is updated by calcTrueTemperature().
@@ -165,7 +176,44 @@ void BMP085::calcTruePressure(long *_TruePressure) {
   x1 = (p >> 8) * (p >> 8);
   x1 = (x1 * 3038) >> 16;
   x2 = (-7357 * p) >> 16;
-  *_TruePressure = p + ((x1 + x2 + 3791) >> 4);
+  return p + ((x1 + x2 + 3791) >> 4);
+}
+
+// Starts a measurement, temperature first.  Returns at once, pollMeasurement()
+// reads each result once its maximum conversion time has passed.  Does nothing
+// while a measurement is in progress.
+void BMP085::startMeasurement() {
+  if(_measState != BMP085_IDLE) return;
+  writemem(CONTROL, READ_TEMPERATURE);
+  _measStart = micros();
+  _measState = BMP085_CONV_TEMP;
+}
+
+// Advances the measurement without waiting, true once it is complete.
+bool BMP085::pollMeasurement() {
+  if(_measState == BMP085_IDLE) return false;
+  if(_measState == BMP085_CONV_TEMP) {
+    if(micros() - _measStart < 5000UL) return false;         // min. 4.5ms read Temp delay
+    readmem(CONTROL_OUTPUT, 2, _buff);
+    calcB5((long)_buff[0] << 8 | ((long)_buff[1]));
+    writemem(CONTROL, READ_PRESSURE+(_oss << 6));
+    _measStart = micros();
+    _measState = BMP085_CONV_PRESS;
+    return false;
+  }
+  if(micros() - _measStart < _pressure_waittime[_oss] * 1000UL) return false;
+  readmem(CONTROL_OUTPUT, 3, _buff);
+  _measPressure = calcPressure((((long)_buff[0] <<16) | ((long)_buff[1] <<8) | ((long)_buff[2])) >> (8-_oss));
+  _measState = BMP085_IDLE;
+  return true;
+}
+
+float BMP085::getMeasuredPressure() {
+  return (_measPressure / pow((1 - (float)_param_centimeters / 4433000), 5.255) + _Pa_Offset) * 0.01;
+}
+
+float BMP085::getMeasuredTemperature() {
+  return ((b5 + 8) >> 4) * 0.1;
 }
 
 void BMP085::dumpCalData() {
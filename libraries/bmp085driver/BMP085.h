@@ -85,6 +85,10 @@
 #define READ_PRESSURE           0x34 
 //Other
 #define MSLP                    101325          // Mean Sea Level Pressure = 1013.25 hPA (1hPa = 100Pa = 1mbar)
+// states of the non-blocking measurement (startMeasurement/pollMeasurement)
+#define BMP085_IDLE             0
+#define BMP085_CONV_TEMP        1               // temperature conversion running
+#define BMP085_CONV_PRESS       2               // pressure conversion running
 
 
 
@@ -114,6 +118,11 @@ public:
   void getTemperature(int32_t *_Temperature);    // temperature in C   
   void calcTrueTemperature();                    // calc temperature data b5 (only needed if AUTO_UPDATE_TEMPERATURE is false)  
   void calcTruePressure(long *_TruePressure);    // calc Pressure in Pa     
+  // non-blocking measurement: temperature and pressure, the delays become polls
+  void startMeasurement();                       // start the temperature conversion
+  bool pollMeasurement();                        // true once the pressure is read
+  float getMeasuredPressure();                   // hPa of the last measurement, + offset as getPressure
+  float getMeasuredTemperature();                // C of the last measurement
   // dummy stuff
    void dumpCalData();                           // debug only
 
@@ -134,7 +143,13 @@ public:
   int32_t _cm_Offset, _Pa_Offset;
   int32_t _param_datum, _param_centimeters;
 
+  byte _measState;
+  unsigned long _measStart;
+  long _measPressure;
+  
   void getCalData();        
+  void calcB5(long ut);                         // b5 from the uncompensated temperature
+  long calcPressure(long up);                   // Pa from the uncompensated pressure and b5
   
 
 };
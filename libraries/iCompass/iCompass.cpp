@@ -1,14 +1,15 @@
 #include <iCompass.h>
 #include <math.h>
+#include "FastMath.h"
 
 // Defines ////////////////////////////////////////////////////////////////
 
 // Constructors ////////////////////////////////////////////////////////////////
 
-iCompass::iCompass(void) : myRA(1) { declinationAngle = 0; maxSamples = 500; float test = 1.0f; samples = 0; myRA.clear(); }
-iCompass::iCompass(float dAngle) : myRA(1) { declinationAngle = dAngle; maxSamples = 500; float test = 1.0f; samples = 0; myRA.clear(); }
-iCompass::iCompass(float dAngle, unsigned int windSize) : myRA(windSize) { declinationAngle = dAngle; maxSamples = 500; float test = 1.0f; samples = 0; myRA.clear(); }
-iCompass::iCompass(float dAngle, unsigned int windSize, unsigned int maxS) : myRA(windSize) { declinationAngle = dAngle; maxSamples = maxS; float test = 1.0f; samples = 0; myRA.clear(); }
+iCompass::iCompass(void) : myRA(1) { declinationAngle = 0; maxSamples = 500; samples = 0; oldHeading = 0; myRA.clear(); }
+iCompass::iCompass(float dAngle) : myRA(1) { declinationAngle = dAngle; maxSamples = 500; samples = 0; oldHeading = 0; myRA.clear(); }
+iCompass::iCompass(float dAngle, unsigned int windSize) : myRA(windSize) { declinationAngle = dAngle; maxSamples = 500; samples = 0; oldHeading = 0; myRA.clear(); }
+iCompass::iCompass(float dAngle, unsigned int windSize, unsigned int maxS) : myRA(windSize) { declinationAngle = dAngle; maxSamples = maxS; samples = 0; oldHeading = 0; myRA.clear(); }
 
 
 /*
@@ -60,7 +61,7 @@ float iCompass::iheading(int ix, int iy, int iz, float ax, float ay, float az, f
     vector_normalize(&N);
 
     // compute heading
-    float heading = atan2(vector_dot(&E, &from), vector_dot(&N, &from)) * 180 / M_PI;
+    float heading = fastAtan2(vector_dot(&E, &from), vector_dot(&N, &from)) * 180 / M_PI;
     if (heading < 0) heading += 360;
     
     if(heading < -9990) {